@@ -1,51 +1,149 @@
 #include "ism43362.h"
+#include "ism43362_encode.h"
+#include "ism43362_parser.h"
+#include "ism43362_pool.h"
 
 #include <stdbool.h>
-#include <stdio.h>
 #include <string.h>
 
 #include "../Inc/main.h"
 
-volatile int data_ready = 0;
+static volatile int data_ready = 0;
 void ism43362_drdy_exti_callback() { data_ready = 1; }
 
+// socket selected with P0, -1 if unknown
+static int selected_socket = -1;
+
+// settings of a socket, in the order of the shadow values
+typedef enum {
+    PARAM_PROTOCOL,
+    PARAM_LOCAL_PORT,
+    PARAM_REMOTE_IP,
+    PARAM_REMOTE_PORT,
+    PARAM_READ_PACKET_SIZE,
+    PARAM_READ_TIMEOUT,
+    PARAM_WRITE_TIMEOUT,
+    PARAM_LISTEN_BACKLOGS,
+    PARAM_COUNT
+} SocketParam;
+
+static const char *const param_cmds[PARAM_COUNT] = {"P1", "P2", "P3", "P4", "R1", "R2", "S2", "P8"};
+static const char *const select_cmds[4] = {"P0=0\r\n", "P0=1\r\n", "P0=2\r\n", "P0=3\r\n"};
+
+// what the driver knows of the module state, used to skip the commands that wouldn't change it
+typedef struct {
+    uint32_t values[PARAM_COUNT];
+    uint16_t valid; // bit per known value
+    bool open; // client connected or server started
+    bool tcp_server;
+    // the read timeout was lowered by ism43362_poll(), read_timeout is put back before the next read
+    bool polled;
+    uint32_t read_timeout;
+} SocketShadow;
+
+static SocketShadow shadow[4] = {0};
+
+// last configuration applied to the module or read from it
+static JoinWifiConfig module_wifi;
+static bool module_wifi_valid = false;
+
+// what doesn't fit the caller's buffer is kept here and returned by the next read on the same socket, the data is
+// a payload buffer borrowed from the pool while there is something in it
+typedef struct {
+    uint8_t *data;
+    size_t off;
+    size_t len;
+} RxStash;
+
+static RxStash rx_stash[4];
+
+static void release_stash(RxStash *stash) {
+    if (stash != NULL && stash->len == 0 && stash->data != NULL) {
+        ism43362_pool_return(ISM_POOL_PAYLOAD, stash->data);
+        stash->data = NULL;
+    }
+}
+
+void ism43362_forget_socket(Socket s) {
+    SocketShadow zero = {0};
+    shadow[s] = zero;
+}
+
+void ism43362_forget_state() {
+    SocketShadow zero = {0};
+    for (size_t i = 0; i < 4; i++) {
+        shadow[i] = zero;
+    }
+    selected_socket = -1;
+    module_wifi_valid = false;
+    // the data can't be told apart from what a reset module would send
+    for (size_t i = 0; i < 4; i++) {
+        rx_stash[i].len = 0;
+        release_stash(&rx_stash[i]);
+    }
+}
+
 #define ISM_DATA_RDY() (HAL_GPIO_ReadPin(ISM43362_DRDY_EXTI1_GPIO_Port, ISM43362_DRDY_EXTI1_Pin) == GPIO_PIN_SET)
 #define ISM_ENABLE_CSN() HAL_GPIO_WritePin(ISM43362_SPI3_CSN_GPIO_Port, ISM43362_SPI3_CSN_Pin, GPIO_PIN_RESET)
 #define ISM_DISABLE_CSN() HAL_GPIO_WritePin(ISM43362_SPI3_CSN_GPIO_Port, ISM43362_SPI3_CSN_Pin, GPIO_PIN_SET)
-#define OK_MSG "\r\nOK\r\n"
+#define R0_TRAILER "\r\nOK\r\n> "
+#define R0_TRAILER_LEN 8
 #define RET_IF_NOT_OK(ret)                                                                                             \
     if (ret != Ok) {                                                                                                   \
         return ret;                                                                                                    \
     }
+#define ISM_SPI_PAD 0x15
+// ~1.6 us per word with the configuration in the README, plus margin
+#define ISM_SPI_TIMEOUT_MS(words) (2 + (words) / 512)
 // #define USART1_LOG
+// #define ISM43362_SPI_DMA
+#ifndef ISM43362_SPI_RX_CHUNK_WORDS
+#define ISM43362_SPI_RX_CHUNK_WORDS 64
+#endif
 
 extern SPI_HandleTypeDef hspi3;
 #ifdef USART1_LOG
+// snprintf is only used by the log
+#include <stdio.h>
+
 extern UART_HandleTypeDef huart1;
 #endif
 
 void ism43362_ret_to_str(ISM43362_RET ret, char *s, size_t len) {
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, s, len);
     switch (ret) {
         case Ok:
-            snprintf(s, len, "OK\r\n");
+            ism43362_enc_str(&e, "OK\r\n");
             break;
         case Error:
-            snprintf(s, len, "Generic error\r\n");
+            ism43362_enc_str(&e, "Generic error\r\n");
             break;
         case RespBufferTooSmall:
-            snprintf(s, len, "Response buffer is too small\r\n");
+            ism43362_enc_str(&e, "Response buffer is too small\r\n");
             break;
         case BadResponse:
-            snprintf(s, len, "Response didn't contain OK string or badly formatted\r\n");
+            ism43362_enc_str(&e, "Response didn't contain OK string or badly formatted\r\n");
             break;
         case WrongInitMsg:
-            snprintf(s, len, "Didn't get initial cursor\r\n");
+            ism43362_enc_str(&e, "Didn't get initial cursor\r\n");
             break;
         case PacketBufferTooSmall:
-            snprintf(s, len, "Packet received too large for buffer\r\n");
+            ism43362_enc_str(&e, "Packet received too large for buffer\r\n");
+            break;
+        case Timeout:
+            ism43362_enc_str(&e, "Module didn't answer in time\r\n");
+            break;
+        case NotConnected:
+            ism43362_enc_str(&e, "Not connected to the network\r\n");
+            break;
+        case NoBuffer:
+            ism43362_enc_str(&e, "No free buffer in the pool\r\n");
             break;
         default:
-            snprintf(s, len, "Unrecognized value %d\r\n", ret);
+            ism43362_enc_str(&e, "Unrecognized value ");
+            ism43362_enc_u32(&e, ret);
+            ism43362_enc_str(&e, "\r\n");
     }
 }
 
@@ -70,6 +168,7 @@ ISM43362_RET ism43362_reset_module() {
     ISM_DISABLE_CSN();
 
     data_ready = 0;
+    ism43362_forget_state();
     if (init_cursor[0] != 0x15 || init_cursor[1] != 0x15 || init_cursor[2] != '\r' || init_cursor[3] != '\n' ||
         init_cursor[4] != '>' || init_cursor[5] != ' ' || read_too_much) {
         return WrongInitMsg;
@@ -77,64 +176,285 @@ ISM43362_RET ism43362_reset_module() {
     return Ok;
 }
 
-static void wait_data_ready() {
-    while (data_ready == 0) {
+#define ISM_DEFAULT_TIMEOUTS {.ready_ms = 1000, .cmd_ms = 2000, .connect_ms = 20000, .data_margin_ms = 1000}
+
+ISM43362Timeouts ism43362_get_default_timeouts() {
+    ISM43362Timeouts t = ISM_DEFAULT_TIMEOUTS;
+    return t;
+}
+
+static ISM43362Timeouts timeouts = ISM_DEFAULT_TIMEOUTS;
+static ISM43362IdleHook idle_hook = NULL;
+
+ISM43362Timeouts ism43362_get_timeouts() { return timeouts; }
+
+void ism43362_set_timeouts(const ISM43362Timeouts *t) {
+    timeouts = *t;
+}
+
+void ism43362_set_idle_hook(ISM43362IdleHook hook) { idle_hook = hook; }
+
+static void idle() {
+    if (idle_hook != NULL) {
+        idle_hook();
+    } else {
         __NOP();
     }
+}
+
+// the module raises DRDY when it can accept a new command
+static ISM43362_RET wait_module_ready() {
+    uint32_t start = HAL_GetTick();
+    while (!ISM_DATA_RDY()) {
+        if (HAL_GetTick() - start >= timeouts.ready_ms) {
+            return Timeout;
+        }
+        idle();
+    }
+    return Ok;
+}
+
+// the rising edge of DRDY after a command signals that the response is ready
+static ISM43362_RET wait_data_ready(uint32_t timeout_ms) {
+    uint32_t start = HAL_GetTick();
+    while (data_ready == 0) {
+        if (HAL_GetTick() - start >= timeout_ms) {
+            return Timeout;
+        }
+        idle();
+    }
     data_ready = 0;
+    return Ok;
 }
 
-ISM43362_RET ism43362_transmit_buffer(const uint8_t *tr_buffer, size_t tr_size, uint8_t *resp, size_t resp_buff_len,
-                                      size_t *resp_len) {
-    size_t cmd_len = tr_size;
-    size_t words_len = cmd_len / 2;
-    const uint8_t padding[2] = {'\n', tr_buffer[cmd_len - 1]};
-    *resp = 0;
+static ISM43362Stats stats = {0};
 
-#ifdef USART1_LOG
-    HAL_UART_Transmit(&huart1, tr_buffer, cmd_len, 1000);
+ISM43362Stats ism43362_get_stats() { return stats; }
+
+void ism43362_reset_stats() {
+    ISM43362Stats zero = {0};
+    stats = zero;
+}
+
+// result of the SPI transfers of the current frame
+static ISM43362_RET spi_ret = Ok;
+
+#ifdef ISM43362_SPI_DMA
+// the response length isn't known in advance, so it's read in chunks until the module lowers DRDY, the words
+// clocked after the end of the response are filled with 0x15 and trimmed
+#define ISM_SPI_RX_CHUNK ISM43362_SPI_RX_CHUNK_WORDS
+// DMA transfers of 16 bits words need aligned buffers, the others go through the blocking functions
+#define DMA_ALIGNED(p) ((((uintptr_t) (p)) & 1) == 0)
+
+// a transfer that doesn't complete is aborted, the rest of the frame is skipped and the command fails with
+// Timeout, like the blocking functions would give up after the same time. The idle hook isn't called, the transfer
+// takes a few us and the hook of the RTOS sleeps until the next interrupt.
+static void spi_wait_dma(size_t words) {
+    uint32_t start = HAL_GetTick();
+    while (HAL_SPI_GetState(&hspi3) != HAL_SPI_STATE_READY) {
+        if (HAL_GetTick() - start >= ISM_SPI_TIMEOUT_MS(words)) {
+            HAL_SPI_Abort(&hspi3);
+            spi_ret = Timeout;
+            return;
+        }
+        __NOP();
+    }
+}
+#else
+#define ISM_SPI_RX_CHUNK 1
 #endif
 
-    ISM_ENABLE_CSN();
-    if (words_len > 0) {
-        HAL_SPI_Transmit(&hspi3, tr_buffer, words_len, 1);
+static void spi_transmit(const uint8_t *data, size_t words) {
+    if (spi_ret != Ok) {
+        return;
     }
-    if (cmd_len % 2 == 1) {
-        HAL_SPI_Transmit(&hspi3, padding, 1, 1);
+#ifdef ISM43362_SPI_DMA
+    if (DMA_ALIGNED(data)) {
+        HAL_SPI_Transmit_DMA(&hspi3, data, words);
+        spi_wait_dma(words);
+    } else {
+        HAL_SPI_Transmit(&hspi3, data, words, ISM_SPI_TIMEOUT_MS(words));
     }
-    data_ready = 0;
-    ISM_DISABLE_CSN();
+#else
+    HAL_SPI_Transmit(&hspi3, data, words, ISM_SPI_TIMEOUT_MS(words));
+#endif
+    stats.spi_calls++;
+    stats.bytes_sent += words * 2;
+}
 
-    wait_data_ready();
+static void spi_receive(uint8_t *data, size_t words) {
+    if (spi_ret != Ok) {
+        return;
+    }
+#ifdef ISM43362_SPI_DMA
+    if (DMA_ALIGNED(data)) {
+        HAL_SPI_Receive_DMA(&hspi3, data, words);
+        spi_wait_dma(words);
+    } else {
+        HAL_SPI_Receive(&hspi3, data, words, ISM_SPI_TIMEOUT_MS(words));
+    }
+#else
+    HAL_SPI_Receive(&hspi3, data, words, ISM_SPI_TIMEOUT_MS(words));
+#endif
+    stats.spi_calls++;
+    stats.bytes_received += words * 2;
+}
 
+// reads while the module has data ready, returns the number of bytes written in resp, which is not terminated,
+// every chunk is passed to the parser as soon as it's read
+static size_t spi_receive_frame(uint8_t *resp, size_t resp_buff_len, bool *resp_buff_full, ISM43362Parser *parser) {
     size_t b_read = 0;
-    bool resp_buff_full = false;
-    ISM_ENABLE_CSN();
-    while (ISM_DATA_RDY()) {
-        if (b_read >= resp_buff_len - 1) {
-            resp_buff_full = true;
+    *resp_buff_full = false;
+    while (ISM_DATA_RDY() && spi_ret == Ok) {
+        size_t words = (resp_buff_len - b_read) / 2;
+        if (words == 0) {
+            *resp_buff_full = true;
             break;
         }
-        HAL_SPI_Receive(&hspi3, resp + b_read, 1, 1);
-        b_read += 2;
+        if (words > ISM_SPI_RX_CHUNK) {
+            words = ISM_SPI_RX_CHUNK;
+        }
+        spi_receive(resp + b_read, words);
+        ism43362_parser_feed(parser, resp + b_read, words * 2);
+        b_read += words * 2;
     }
+    while (b_read > 0 && resp[b_read - 1] == ISM_SPI_PAD) {
+        b_read--;
+    }
+    return b_read;
+}
+
+// the module reads 16 bits words, a segment with odd length is completed with the first byte of the next one,
+// only the last word is padded
+static void spi_transmit_segments(const ISM43362Segment *segs, size_t count) {
+    uint8_t pair[2];
+    bool carry = false;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *data = segs[i].data;
+        size_t len = segs[i].len;
+#ifdef USART1_LOG
+        HAL_UART_Transmit(&huart1, data, len, 1000);
+#endif
+        if (len == 0) {
+            continue;
+        }
+        if (carry) {
+            pair[1] = data[0];
+            spi_transmit(pair, 1);
+            data++;
+            len--;
+            carry = false;
+        }
+        if (len >= 2) {
+            spi_transmit(data, len / 2);
+        }
+        if (len % 2 == 1) {
+            pair[0] = data[len - 1];
+            carry = true;
+        }
+    }
+    if (carry) {
+        const uint8_t padding[2] = {'\n', pair[0]};
+        spi_transmit(padding, 1);
+    }
+}
+
+bool ism43362_module_ready() { return ISM_DATA_RDY(); }
+
+bool ism43362_response_ready() { return data_ready != 0; }
+
+// socket selected by the command being executed, applied if it succeeds
+static int pending_socket = -1;
+// the last command went out on the SPI, if not the module got nothing and it can be sent again
+static bool cmd_transmitted = false;
+
+ISM43362_RET ism43362_start_segments(const ISM43362Segment *segs, size_t count) {
+    const uint8_t *first = segs[0].data;
+    bool select = segs[0].len >= 4 && first[0] == 'P' && first[1] == '0' && first[2] == '=';
+    pending_socket = select ? first[3] - '0' : -1;
+    cmd_transmitted = true;
+
+    spi_ret = Ok;
+    ISM_ENABLE_CSN();
+    spi_transmit_segments(segs, count);
+    data_ready = 0;
+    ISM_DISABLE_CSN();
+    return spi_ret;
+}
+
+ISM43362_RET ism43362_receive_response(uint8_t *resp, size_t resp_buff_len, size_t *resp_len) {
+    data_ready = 0;
+    bool resp_buff_full;
+    ISM43362Parser parser;
+    ism43362_parser_init(&parser, NULL, 0, NULL);
+    spi_ret = Ok;
+    ISM_ENABLE_CSN();
+    // one byte is kept for the terminator
+    size_t b_read = spi_receive_frame(resp, resp_buff_len - 1, &resp_buff_full, &parser);
     ISM_DISABLE_CSN();
     *resp_len = b_read;
     resp[b_read] = 0;
+    stats.frames++;
 #ifdef USART1_LOG
     HAL_UART_Transmit(&huart1, (const uint8_t *) resp, *resp_len, 1000);
 #endif
 
-    HAL_Delay(1);
-
+    if (spi_ret != Ok) {
+        ism43362_forget_state();
+        return spi_ret;
+    }
     if (resp_buff_full) {
         return RespBufferTooSmall;
     }
-
-    if (strstr((char *) resp, OK_MSG) == NULL) {
+    if (parser.status != ISM_PARSE_OK) {
         return BadResponse;
     }
+    if (pending_socket >= 0 && pending_socket < 4) {
+        selected_socket = pending_socket;
+    }
+    return Ok;
+}
+
+// sends the command and waits for the module to have the response ready
+static ISM43362_RET send_command(const ISM43362Segment *segs, size_t count) {
+    cmd_transmitted = false;
+    ISM43362_RET ret = wait_module_ready();
+    if (ret == Ok) {
+        ret = ism43362_start_segments(segs, count);
+    }
+    if (ret == Ok) {
+        ret = wait_data_ready(ism43362_cmd_timeout_ms((const char *) segs[0].data, segs[0].len));
+    }
+    // the module might have been reset, nothing is known of its state anymore
+    if (ret == Timeout) {
+        ism43362_forget_state();
+    }
+    return ret;
+}
+
+ISM43362_RET ism43362_transmit_buffer(const uint8_t *tr_buffer, size_t tr_size, uint8_t *resp, size_t resp_buff_len,
+                                      size_t *resp_len) {
+    ISM43362Segment seg = {.data = tr_buffer, .len = tr_size};
+    return ism43362_transmit_segments(&seg, 1, resp, resp_buff_len, resp_len);
+}
+
+ISM43362_RET ism43362_transmit_segments(const ISM43362Segment *segs, size_t count, uint8_t *resp,
+                                        size_t resp_buff_len, size_t *resp_len) {
+    *resp = 0;
+    *resp_len = 0;
+    ISM43362_RET ret = send_command(segs, count);
+    RET_IF_NOT_OK(ret);
+    return ism43362_receive_response(resp, resp_buff_len, resp_len);
+}
 
+ISM43362_RET ism43362_strip_r0(uint8_t *resp, size_t resp_len, size_t *payload_len) {
+    *payload_len = 0;
+    if (resp_len < R0_TRAILER_LEN + 2 || resp[0] != '\r' || resp[1] != '\n' ||
+        memcmp(resp + resp_len - R0_TRAILER_LEN, R0_TRAILER, R0_TRAILER_LEN) != 0) {
+        return BadResponse;
+    }
+    *payload_len = resp_len - R0_TRAILER_LEN - 2;
+    memmove(resp, resp + 2, *payload_len);
     return Ok;
 }
 
@@ -142,18 +462,66 @@ ISM43362_RET ism43362_execute_cmd(const char *cmd, uint8_t *resp, size_t resp_bu
     return ism43362_transmit_buffer((const uint8_t *) cmd, strlen(cmd), resp, resp_buff_len, resp_len);
 }
 
-ISM43362_RET ism43362_enter_cmd_mode() {
-    uint8_t resp[100] = {0};
-    size_t resp_size = 0;
-    return ism43362_execute_cmd("$$$\r\n", resp, sizeof(resp), &resp_size);
+// the response is passed to the parser a chunk at a time, without storing it
+static ISM43362_RET receive_streamed(ISM43362Parser *parser) {
+    data_ready = 0;
+    uint16_t chunk[ISM_SPI_RX_CHUNK];
+    spi_ret = Ok;
+    ISM_ENABLE_CSN();
+    while (ISM_DATA_RDY() && spi_ret == Ok) {
+        spi_receive((uint8_t *) chunk, ISM_SPI_RX_CHUNK);
+        ism43362_parser_feed(parser, (const uint8_t *) chunk, sizeof(chunk));
+#ifdef USART1_LOG
+        HAL_UART_Transmit(&huart1, (const uint8_t *) chunk, sizeof(chunk), 1000);
+#endif
+    }
+    ISM_DISABLE_CSN();
+    stats.frames++;
+
+    if (spi_ret != Ok) {
+        ism43362_forget_state();
+        return spi_ret;
+    }
+    if (parser->status != ISM_PARSE_OK) {
+        return BadResponse;
+    }
+    if (pending_socket >= 0 && pending_socket < 4) {
+        selected_socket = pending_socket;
+    }
+    return Ok;
+}
+
+ISM43362_RET ism43362_receive_checked() {
+    ISM43362Parser parser;
+    ism43362_parser_init(&parser, NULL, 0, NULL);
+    return receive_streamed(&parser);
+}
+
+static ISM43362_RET execute_streamed(const ISM43362Segment *segs, size_t count, ISM43362Parser *parser) {
+    ISM43362_RET ret = send_command(segs, count);
+    RET_IF_NOT_OK(ret);
+    return receive_streamed(parser);
+}
+
+ISM43362_RET ism43362_execute_parsed(const char *cmd, ISM43362Parser *parser) {
+    const ISM43362Segment seg = {.data = (const uint8_t *) cmd, .len = strlen(cmd)};
+    return execute_streamed(&seg, 1, parser);
 }
 
-ISM43362_RET ism43362_enter_machine_mode() {
-    uint8_t resp[100] = {0};
-    size_t resp_size = 0;
-    return ism43362_execute_cmd("---\r\n", resp, sizeof(resp), &resp_size);
+// for the commands whose response is only checked for OK
+static ISM43362_RET execute_line(const char *cmd, size_t len) {
+    const ISM43362Segment seg = {.data = (const uint8_t *) cmd, .len = len};
+    ISM43362Parser parser;
+    ism43362_parser_init(&parser, NULL, 0, NULL);
+    return execute_streamed(&seg, 1, &parser);
 }
 
+static ISM43362_RET execute_checked(const char *cmd) { return execute_line(cmd, strlen(cmd)); }
+
+ISM43362_RET ism43362_enter_cmd_mode() { return execute_checked("$$$\r\n"); }
+
+ISM43362_RET ism43362_enter_machine_mode() { return execute_checked("---\r\n"); }
+
 JoinWifiConfig ism43362_get_default_wifi_config() {
     JoinWifiConfig conf = {.ssid = {0},
                            .password = {0},
@@ -171,98 +539,150 @@ JoinWifiConfig ism43362_get_default_wifi_config() {
     return conf;
 }
 
-ISM43362_RET ism43362_join_network(const JoinWifiConfig *conf) {
-    if (conf == NULL || strlen(conf->ssid) == 0) {
-        return Error;
-    }
-
-    ISM43362_RET ret;
-    uint8_t buff[500] = {0};
-    size_t buff_size = sizeof(buff);
-    size_t resp_len = 0;
-    char cmd[100] = {0};
-    size_t cmd_size = sizeof(cmd);
+static const char *const country_cmds[] = {
+    [US_0] = "CN=US/0\r\n", [CA_0] = "CN=CA/0\r\n", [FR_0] = "CN=FR/0\r\n", [JP_0] = "CN=JP/0\r\n"};
 
+bool ism43362_join_script(const JoinWifiConfig *conf, const JoinWifiConfig *curr, char *script, size_t size,
+                          size_t *len) {
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, script, size);
 
-    snprintf(cmd, cmd_size, "C1=%s\r\n", conf->ssid);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
-    RET_IF_NOT_OK(ret);
-
-    if (strlen(conf->password) > 0) {
-        snprintf(cmd, cmd_size, "C2=%s\r\n", conf->password);
-        ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
-        RET_IF_NOT_OK(ret);
+    if (curr == NULL || strcmp(curr->ssid, conf->ssid) != 0) {
+        ism43362_enc_param_str(&e, "C1", conf->ssid);
+    }
+    if (strlen(conf->password) > 0 && (curr == NULL || strcmp(curr->password, conf->password) != 0)) {
+        ism43362_enc_param_str(&e, "C2", conf->password);
+    }
+    if (curr == NULL || curr->security != conf->security) {
+        ism43362_enc_param(&e, "C3", conf->security);
+    }
+    if (curr == NULL || curr->dhcp != conf->dhcp) {
+        ism43362_enc_param(&e, "C4", conf->dhcp ? 1 : 0);
+    }
+    if (!conf->dhcp) {
+        if (curr == NULL || memcmp(curr->ip, conf->ip, 4) != 0) {
+            ism43362_enc_param_ip(&e, "C6", conf->ip);
+        }
+        if (curr == NULL || memcmp(curr->netmask, conf->netmask, 4) != 0) {
+            ism43362_enc_param_ip(&e, "C7", conf->netmask);
+        }
+    }
+    if (curr == NULL || memcmp(curr->gateway, conf->gateway, 4) != 0) {
+        ism43362_enc_param_ip(&e, "C8", conf->gateway);
+    }
+    if (curr == NULL || memcmp(curr->primary_dns, conf->primary_dns, 4) != 0) {
+        ism43362_enc_param_ip(&e, "C9", conf->primary_dns);
+    }
+    if (curr == NULL || memcmp(curr->secondary_dns, conf->secondary_dns, 4) != 0) {
+        ism43362_enc_param_ip(&e, "CA", conf->secondary_dns);
+    }
+    if (curr == NULL || curr->join_retry_count != conf->join_retry_count) {
+        ism43362_enc_param(&e, "CB", conf->join_retry_count);
+    }
+    if (conf->security == WEP && (curr == NULL || curr->wep_auth != conf->wep_auth)) {
+        ism43362_enc_param(&e, "CE", conf->wep_auth);
+    }
+    if (curr == NULL || curr->country_code != conf->country_code) {
+        if ((size_t) conf->country_code >= sizeof(country_cmds) / sizeof(country_cmds[0])) {
+            return false;
+        }
+        ism43362_enc_str(&e, country_cmds[conf->country_code]);
     }
 
-    snprintf(cmd, cmd_size, "C3=%d\r\n", conf->security);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
-    RET_IF_NOT_OK(ret);
+    *len = e.len;
+    return !e.overflow;
+}
 
-    snprintf(cmd, cmd_size, "C4=%d\r\n", conf->dhcp ? 1 : 0);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
-    RET_IF_NOT_OK(ret);
+bool ism43362_is_connect_cmd(const char *cmd) {
+    return (cmd[0] == 'C' && cmd[1] == '0') || (cmd[0] == 'P' && cmd[1] == '6' && cmd[2] == '=' && cmd[3] == '1');
+}
 
-    if (!conf->dhcp) {
-        snprintf(cmd, cmd_size, "C6=%d.%d.%d.%d\r\n", conf->ip[0], conf->ip[1], conf->ip[2], conf->ip[3]);
-        ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
-        RET_IF_NOT_OK(ret);
+// R0 and S3 wait for the read or write timeout of the selected socket
+static uint32_t data_timeout_ms(SocketParam param) {
+    uint32_t t = ISM43362_MAX_SOCKET_TIMEOUT_MS;
+    if (selected_socket >= 0 && (shadow[selected_socket].valid & (1 << param))) {
+        t = shadow[selected_socket].values[param];
+    }
+    return t + timeouts.data_margin_ms;
+}
 
-        snprintf(cmd, cmd_size, "C7=%d.%d.%d.%d\r\n", conf->netmask[0], conf->netmask[1], conf->netmask[2],
-                 conf->netmask[3]);
-        ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
+uint32_t ism43362_cmd_timeout_ms(const char *cmd, size_t len) {
+    if (len >= 4 && ism43362_is_connect_cmd(cmd)) {
+        return timeouts.connect_ms;
+    }
+    if (len >= 2 && cmd[0] == 'R' && cmd[1] == '0') {
+        return data_timeout_ms(PARAM_READ_TIMEOUT);
+    }
+    if (len >= 2 && cmd[0] == 'S' && cmd[1] == '3') {
+        return data_timeout_ms(PARAM_WRITE_TIMEOUT);
+    }
+    return timeouts.cmd_ms;
+}
+
+// executes the commands of the script one after the other, stopping at the first error
+static ISM43362_RET execute_script(const char *script, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        const char *cmd = script + pos;
+        size_t cmd_len = 0;
+        while (pos < len) {
+            cmd_len++;
+            if (script[pos++] == '\n') {
+                break;
+            }
+        }
+        ISM43362_RET ret = execute_line(cmd, cmd_len);
         RET_IF_NOT_OK(ret);
     }
+    return Ok;
+}
 
+// sends the settings that differ from curr, all of them if curr is NULL, then joins
+static ISM43362_RET join(const JoinWifiConfig *conf, const JoinWifiConfig *curr) {
+    char *script = (char *) ism43362_pool_borrow(ISM_POOL_CMD);
+    if (script == NULL) {
+        return NoBuffer;
+    }
+    size_t len;
+    if (!ism43362_join_script(conf, curr, script, ism43362_pool_size(ISM_POOL_CMD), &len)) {
+        ism43362_pool_return(ISM_POOL_CMD, (uint8_t *) script);
+        return Error;
+    }
 
-    snprintf(cmd, cmd_size, "C8=%d.%d.%d.%d\r\n", conf->gateway[0], conf->gateway[1], conf->gateway[2],
-             conf->gateway[3]);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
+    // the cached copy is stale until every setting is applied
+    module_wifi_valid = false;
+    ISM43362_RET ret = execute_script(script, len);
+    ism43362_pool_return(ISM_POOL_CMD, (uint8_t *) script);
     RET_IF_NOT_OK(ret);
+    module_wifi = *conf;
+    module_wifi_valid = true;
 
-    snprintf(cmd, cmd_size, "C9=%d.%d.%d.%d\r\n", conf->primary_dns[0], conf->primary_dns[1], conf->primary_dns[2],
-             conf->primary_dns[3]);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
-    RET_IF_NOT_OK(ret);
+    return execute_checked("C0\r\n");
+}
 
-    snprintf(cmd, cmd_size, "CA=%d.%d.%d.%d\r\n", conf->secondary_dns[0], conf->secondary_dns[1],
-             conf->secondary_dns[2], conf->secondary_dns[3]);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
-    RET_IF_NOT_OK(ret);
+ISM43362_RET ism43362_join_network(const JoinWifiConfig *conf) {
+    if (conf == NULL || strlen(conf->ssid) == 0) {
+        return Error;
+    }
 
-    snprintf(cmd, cmd_size, "CB=%d\r\n", conf->join_retry_count);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
-    RET_IF_NOT_OK(ret);
+    uint32_t frames = stats.frames;
+    ISM43362_RET ret = join(conf, NULL);
+    stats.join_cmds = stats.frames - frames;
+    return ret;
+}
 
-    if (conf->security == WEP) {
-        snprintf(cmd, cmd_size, "CE=%d\r\n", conf->wep_auth);
-        ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
-        RET_IF_NOT_OK(ret);
+ISM43362_RET ism43362_fast_join_network(const JoinWifiConfig *conf) {
+    if (conf == NULL || strlen(conf->ssid) == 0) {
+        return Error;
     }
 
-    switch (conf->country_code) {
-        case US_0:
-            snprintf(cmd, cmd_size, "CN=US/0\r\n");
-            break;
-        case CA_0:
-            snprintf(cmd, cmd_size, "CN=CA/0\r\n");
-            break;
-        case FR_0:
-            snprintf(cmd, cmd_size, "CN=FR/0\r\n");
-            break;
-        case JP_0:
-            snprintf(cmd, cmd_size, "CN=JP/0\r\n");
-            break;
-        default:
-            return Error;
+    uint32_t frames = stats.frames;
+    if (!module_wifi_valid && ism43362_read_wifi_config(&module_wifi) == Ok) {
+        module_wifi_valid = true;
     }
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
-    RET_IF_NOT_OK(ret);
-
-    return ism43362_execute_cmd("C0\r\n", buff, buff_size, &resp_len);
-}
-
-static void parse_ip_str(const char *str, uint8_t *ip_arr) {
-    sscanf(str, "%d.%d.%d.%d", ip_arr, ip_arr + 1, ip_arr + 2, ip_arr + 3);
+    ISM43362_RET ret = join(conf, module_wifi_valid ? &module_wifi : NULL);
+    stats.join_cmds = stats.frames - frames;
+    return ret;
 }
 
 ISM43362_RET ism43362_read_wifi_config(JoinWifiConfig *conf) {
@@ -270,32 +690,39 @@ ISM43362_RET ism43362_read_wifi_config(JoinWifiConfig *conf) {
         return Error;
     }
 
-    uint8_t buff[500] = {0};
-    size_t buff_size = sizeof(buff);
-    size_t resp_len = 0;
-    ISM43362_RET ret = ism43362_execute_cmd("C?\r\n", buff, buff_size, &resp_len);
+    uint8_t security;
+    uint8_t ip_v;
+    uint8_t auto_conn;
+    uint8_t wep_auth;
+    char cc[4];
+    // ssid,password,security,dhcp,ip version,ip,netmask,gateway,dns1,dns2,retries,auto connect,wep auth,country,status
+    const ISM43362Field fields[] = {
+        {.type = ISM_FIELD_STR, .dst = conf->ssid, .size = sizeof(conf->ssid)},
+        {.type = ISM_FIELD_STR, .dst = conf->password, .size = sizeof(conf->password)},
+        {.type = ISM_FIELD_U8, .dst = &security},
+        {.type = ISM_FIELD_BOOL, .dst = &conf->dhcp},
+        {.type = ISM_FIELD_U8, .dst = &ip_v},
+        {.type = ISM_FIELD_IP, .dst = conf->ip},
+        {.type = ISM_FIELD_IP, .dst = conf->netmask},
+        {.type = ISM_FIELD_IP, .dst = conf->gateway},
+        {.type = ISM_FIELD_IP, .dst = conf->primary_dns},
+        {.type = ISM_FIELD_IP, .dst = conf->secondary_dns},
+        {.type = ISM_FIELD_U8, .dst = &conf->join_retry_count},
+        {.type = ISM_FIELD_U8, .dst = &auto_conn},
+        {.type = ISM_FIELD_U8, .dst = &wep_auth},
+        {.type = ISM_FIELD_STR, .dst = cc, .size = sizeof(cc)},
+        {.type = ISM_FIELD_BOOL, .dst = &conf->is_connected},
+    };
+    ISM43362Parser parser;
+    ism43362_parser_init(&parser, fields, sizeof(fields) / sizeof(fields[0]), NULL);
+    ISM43362_RET ret = ism43362_execute_parsed("C?\r\n", &parser);
     RET_IF_NOT_OK(ret);
+    if (!parser.matched) {
+        return BadResponse;
+    }
 
-    int dhcp;
-    int ip_v;
-    char ip_addr[50];
-    char mask[50];
-    char gw[50];
-    char dns1[50];
-    char dns2[50];
-    int auto_conn;
-    char cc[10];
-    int status;
-    sscanf(buff, "\r\n%[^,],%[^,],%d,%d,%d,%[^,],%[^,],%[^,],%[^,],%[^,],%d,%d,%d,%[^,],%d\r\nOK\r\n", conf->ssid,
-           conf->password, conf->security, &dhcp, &ip_v, ip_addr, mask, gw, dns1, dns2, &conf->join_retry_count,
-           &auto_conn, &conf->wep_auth, cc, &status);
-
-    conf->dhcp = dhcp == 1;
-    parse_ip_str(ip_addr, conf->ip);
-    parse_ip_str(mask, conf->netmask);
-    parse_ip_str(gw, conf->gateway);
-    parse_ip_str(dns1, conf->primary_dns);
-    parse_ip_str(dns2, conf->secondary_dns);
+    conf->security = (WifiSecurity) security;
+    conf->wep_auth = (WEPAuthType) wep_auth;
     switch (cc[0]) {
         case 'U':
             conf->country_code = US_0;
@@ -312,41 +739,100 @@ ISM43362_RET ism43362_read_wifi_config(JoinWifiConfig *conf) {
         default:
             return BadResponse;
     }
-    conf->is_connected = status == 1;
 
 #ifdef USART1_LOG
     char m[200];
     snprintf(m, sizeof(m), "ssid: '%s'\r\n", conf->ssid);
     HAL_UART_Transmit(&huart1, m, strlen(m), 1000);
-    snprintf(m, sizeof(m), "ip: '%s', [%d %d %d %d]\r\n", ip_addr, conf->ip[0], conf->ip[1], conf->ip[2], conf->ip[3]);
+    snprintf(m, sizeof(m), "ip: [%d %d %d %d]\r\n", conf->ip[0], conf->ip[1], conf->ip[2], conf->ip[3]);
     HAL_UART_Transmit(&huart1, m, strlen(m), 1000);
-    snprintf(m, sizeof(m), "ssid: '%s'\r\n", cc);
+    snprintf(m, sizeof(m), "country: '%s'\r\n", cc);
     HAL_UART_Transmit(&huart1, m, strlen(m), 1000);
 #endif
 
     return ret;
 }
 
+ISM43362_RET ism43362_is_connected(bool *connected) {
+    const ISM43362Field field = {.type = ISM_FIELD_BOOL, .dst = connected};
+    ISM43362Parser parser;
+    ism43362_parser_init(&parser, &field, 1, NULL);
+    ISM43362_RET ret = ism43362_execute_parsed("CS\r\n", &parser);
+    RET_IF_NOT_OK(ret);
+    return parser.matched ? Ok : BadResponse;
+}
+
 ISM43362_RET ism43362_set_socket(Socket s) {
-    uint8_t buff[200] = {0};
-    size_t buff_size = sizeof(buff);
-    size_t resp_size;
-    char cmd[7] = {0};
-    snprintf(cmd, sizeof(cmd), "P0=%d\r\n", s);
-    return ism43362_execute_cmd(cmd, buff, buff_size, &resp_size);
+    if (selected_socket == (int) s) {
+        return Ok;
+    }
+    if ((unsigned) s >= 4) {
+        return Error;
+    }
+    ISM43362_RET ret = execute_checked(select_cmds[s]);
+    selected_socket = ret == Ok ? (int) s : -1;
+    return ret;
+}
+
+int ism43362_get_selected_socket() { return selected_socket; }
+
+bool ism43362_socket_is_open(Socket s) { return shadow[s].open; }
+
+bool ism43362_socket_state_known(Socket s) { return shadow[s].valid != 0; }
+
+void ism43362_mark_socket_closed(Socket s) { shadow[s].open = false; }
+
+// selects the socket and sends the setting, unless the module already has that value
+static ISM43362_RET set_socket_param(Socket s, SocketParam param, uint32_t value) {
+    SocketShadow *sh = &shadow[s];
+    uint16_t bit = 1 << param;
+    // a timeout set by the application replaces the one ism43362_poll() would put back
+    if (param == PARAM_READ_TIMEOUT) {
+        sh->polled = false;
+    }
+    if ((sh->valid & bit) && sh->values[param] == value) {
+        return Ok;
+    }
+    ISM43362_RET ret = ism43362_set_socket(s);
+    RET_IF_NOT_OK(ret);
+
+    char cmd[24];
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, cmd, sizeof(cmd));
+    if (param == PARAM_REMOTE_IP) {
+        const uint8_t ip[4] = {value >> 24, value >> 16, value >> 8, value};
+        ism43362_enc_param_ip(&e, param_cmds[param], ip);
+    } else {
+        ism43362_enc_param(&e, param_cmds[param], value);
+    }
+    ret = execute_checked(cmd);
+    if (ret == Ok) {
+        sh->values[param] = value;
+        sh->valid |= bit;
+    } else {
+        sh->valid &= ~bit;
+    }
+    return ret;
+}
+
+static uint32_t ip_to_u32(const uint8_t *ip) {
+    return ((uint32_t) ip[0] << 24) | ((uint32_t) ip[1] << 16) | ((uint32_t) ip[2] << 8) | ip[3];
 }
 
 ISM43362_RET ism43362_get_remote(WifiRemote *remote) {
-    uint8_t buff[1000];
-    size_t read_len;
-    ISM43362_RET ret = ism43362_execute_cmd("P?\r\n", buff, sizeof(buff), &read_len);
+    // protocol,ip,local port,host ip,port,...
+    const ISM43362Field fields[] = {
+        {.type = ISM_FIELD_SKIP},
+        {.type = ISM_FIELD_IP, .dst = remote->ip},
+        {.type = ISM_FIELD_SKIP},
+        {.type = ISM_FIELD_SKIP},
+        {.type = ISM_FIELD_U16, .dst = &remote->port},
+    };
+    ISM43362Parser parser;
+    ism43362_parser_init(&parser, fields, sizeof(fields) / sizeof(fields[0]), NULL);
+    ISM43362_RET ret = ism43362_execute_parsed("P?\r\n", &parser);
     RET_IF_NOT_OK(ret);
-    int proto;
-    int local_port;
-    uint8_t host_ip[4];
-    sscanf(buff, "\r\n%d,%d.%d.%d.%d,%d,%d.%d.%d.%d,%d,", &proto, remote->ip, remote->ip + 1, remote->ip + 2,
-           remote->ip + 3, &local_port, host_ip, host_ip + 1, host_ip + 2, host_ip + 3, &remote->port);
-    return Ok;
+    return parser.matched ? Ok : BadResponse;
 }
 
 WifiClientConfig ism43362_get_default_client_config() {
@@ -364,76 +850,391 @@ ISM43362_RET ism43362_start_wifi_client(const WifiClientConfig *client) {
         return Error;
     }
 
-    char cmd[100];
-    uint8_t buff[200] = {0};
-    size_t buff_size = sizeof(buff);
-    size_t resp_len;
-
-    ISM43362_RET ret = ism43362_set_socket(client->s);
+    Socket s = client->s;
+    ISM43362_RET ret = set_socket_param(s, PARAM_PROTOCOL, client->protocol);
     RET_IF_NOT_OK(ret);
-
-    snprintf(cmd, sizeof(cmd), "P1=%d\r\n", client->protocol);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
+    ret = set_socket_param(s, PARAM_REMOTE_IP, ip_to_u32(client->remote.ip));
     RET_IF_NOT_OK(ret);
-
-    snprintf(cmd, sizeof(cmd), "P3=%d.%d.%d.%d\r\n", client->remote.ip[0], client->remote.ip[1], client->remote.ip[2],
-             client->remote.ip[3]);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
+    ret = set_socket_param(s, PARAM_REMOTE_PORT, client->remote.port);
+    RET_IF_NOT_OK(ret);
+    ret = set_socket_param(s, PARAM_READ_PACKET_SIZE, client->read_packet_size);
+    RET_IF_NOT_OK(ret);
+    ret = set_socket_param(s, PARAM_READ_TIMEOUT, client->read_timeout_ms);
+    RET_IF_NOT_OK(ret);
+    ret = set_socket_param(s, PARAM_WRITE_TIMEOUT, client->write_timeout_ms);
     RET_IF_NOT_OK(ret);
 
-    snprintf(cmd, sizeof(cmd), "P4=%d\r\n", client->remote.port);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
+    // the connection is always opened, the remote might have closed it
+    ret = ism43362_set_socket(s);
     RET_IF_NOT_OK(ret);
+    ret = execute_checked("P6=1\r\n");
+    shadow[s].open = ret == Ok;
+    return ret;
+}
 
-    snprintf(cmd, sizeof(cmd), "R1=%d\r\n", client->read_packet_size);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
+ISM43362_RET ism43362_send(const uint8_t *packet, size_t size) {
+    ISM43362Segment seg = {.data = packet, .len = size};
+    size_t sent;
+    return ism43362_sendv(&seg, 1, &sent);
+}
+
+// accepted is the number of bytes the module reports as sent, the whole payload if it doesn't report it
+static ISM43362_RET send_payload(const ISM43362Segment *payload, size_t count, size_t *accepted) {
+    *accepted = 0;
+    if (count > ISM43362_MAX_SEGMENTS) {
+        return Error;
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size += payload[i].len;
+    }
+    if (size > ISM43362_MAX_PAYLOAD) {
+        return Error;
+    }
+
+    // the payload goes out straight from the caller's buffers, between the header and the trailer
+    char header[12];
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, header, sizeof(header));
+    ism43362_enc_str(&e, "S3=");
+    ism43362_enc_u32(&e, size);
+    ism43362_enc_char(&e, '\r');
+    ISM43362Segment segs[ISM43362_MAX_SEGMENTS + 2];
+    segs[0].data = (const uint8_t *) header;
+    segs[0].len = strlen(header);
+    for (size_t i = 0; i < count; i++) {
+        segs[i + 1] = payload[i];
+    }
+    segs[count + 1].data = (const uint8_t *) "\r\n";
+    segs[count + 1].len = 2;
+
+    // "\r\nBYTES\r\nOK\r\n> "
+    uint16_t reported;
+    const ISM43362Field field = {.type = ISM_FIELD_U16, .dst = &reported};
+    ISM43362Parser parser;
+    ism43362_parser_init(&parser, &field, 1, NULL);
+    ISM43362_RET ret = execute_streamed(segs, count + 2, &parser);
     RET_IF_NOT_OK(ret);
+    *accepted = parser.matched && reported < size ? reported : size;
+    return Ok;
+}
 
-    snprintf(cmd, sizeof(cmd), "R2=%d\r\n", client->read_timeout_ms);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
+ISM43362_RET ism43362_sendv(const ISM43362Segment *payload, size_t count, size_t *sent) {
+    return send_payload(payload, count, sent);
+}
+
+#if ISM43362_POOL_PAYLOAD_SIZE < ISM43362_MAX_PAYLOAD + R0_TRAILER_LEN + 2 * ISM_SPI_RX_CHUNK
+#error "ISM43362_POOL_PAYLOAD_SIZE can't hold a packet and its framing"
+#endif
+
+static ISM43362_RET read_stash(RxStash *stash, uint8_t *packet_buff, size_t buff_size, size_t *packet_size) {
+    size_t len = stash->len < buff_size ? stash->len : buff_size;
+    memcpy(packet_buff, stash->data + stash->off, len);
+    stash->off += len;
+    stash->len -= len;
+    *packet_size = len;
+    if (stash->len > 0) {
+        return PacketBufferTooSmall;
+    }
+    release_stash(stash);
+    return Ok;
+}
+
+ISM43362_RET ism43362_socket_send(Socket s, const uint8_t *packet, size_t size) {
+    ISM43362_RET ret = ism43362_set_socket(s);
     RET_IF_NOT_OK(ret);
+    return ism43362_send(packet, size);
+}
 
-    snprintf(cmd, sizeof(cmd), "S2=%d\r\n", client->write_timeout_ms);
-    ret = ism43362_execute_cmd(cmd, buff, buff_size, &resp_len);
+ISM43362_RET ism43362_socket_read(Socket s, uint8_t *packet_buff, size_t buff_size, size_t *packet_size) {
+    *packet_size = 0;
+    ISM43362_RET ret = ism43362_set_socket(s);
     RET_IF_NOT_OK(ret);
+    return ism43362_read(packet_buff, buff_size, packet_size);
+}
 
-    return ism43362_execute_cmd("P6=1\r\n", buff, buff_size, &resp_len);
+// connections accepted by the TCP servers, read from the module messages (MR) only by ism43362_read_messages(), so
+// no event is lost between the functions that look for them
+static WifiRemote accept_queue[ISM43362_ACCEPT_QUEUE_LEN];
+static uint8_t accept_head = 0;
+static uint8_t accept_count = 0;
+static uint32_t dropped_accepts = 0;
+static WifiRemote parsed_accept;
+
+static void queue_accept(void *ctx) {
+    (void) ctx;
+    if (accept_count == ISM43362_ACCEPT_QUEUE_LEN) {
+        dropped_accepts++;
+        return;
+    }
+    accept_queue[(accept_head + accept_count) % ISM43362_ACCEPT_QUEUE_LEN] = parsed_accept;
+    accept_count++;
 }
 
-ISM43362_RET ism43362_send(uint8_t *packet, size_t size) {
-    uint8_t cmd[2000] = {0};
-    snprintf(cmd, sizeof(cmd), "S3=%d\r", size);
-    size_t start_data = strlen(cmd);
-    memcpy((void *) (cmd + start_data), (void *) packet, size);
+ISM43362_RET ism43362_read_messages() {
+    // "[SOMA][TCP SVR] Accepted a.b.c.d:port", one line per connection
+    const ISM43362Field fields[] = {
+        {.type = ISM_FIELD_SKIP},
+        {.type = ISM_FIELD_SKIP},
+        {.type = ISM_FIELD_MATCH, .literal = "Accepted"},
+        {.type = ISM_FIELD_IP, .dst = parsed_accept.ip},
+        {.type = ISM_FIELD_U16, .dst = &parsed_accept.port},
+    };
+    ISM43362Parser parser;
+    ism43362_parser_init(&parser, fields, sizeof(fields) / sizeof(fields[0]), " :");
+    ism43362_parser_set_callback(&parser, queue_accept, NULL);
+    return ism43362_execute_parsed("MR\r\n", &parser);
+}
 
-    size_t base_end = start_data + size;
-    cmd[base_end] = '\r';
-    cmd[base_end + 1] = '\n';
-    size_t cmd_len = base_end + 2;
+uint8_t ism43362_pending_accepts() { return accept_count; }
 
-    uint8_t buff[200];
-    size_t resp_size;
-    return ism43362_transmit_buffer(cmd, cmd_len, buff, sizeof(buff), &resp_size);
+bool ism43362_take_accept(WifiRemote *remote) {
+    if (accept_count == 0) {
+        return false;
+    }
+    *remote = accept_queue[accept_head];
+    accept_head = (accept_head + 1) % ISM43362_ACCEPT_QUEUE_LEN;
+    accept_count--;
+    return true;
 }
 
-ISM43362_RET ism43362_read(uint8_t *packet_buff, size_t buff_size, size_t *packet_size) {
-    uint8_t resp[2000] = {0};
-    size_t resp_len;
-    ISM43362_RET ret = ism43362_execute_cmd("R0\r\n", resp, sizeof(resp), &resp_len);
-    RET_IF_NOT_OK(ret);
+uint32_t ism43362_dropped_accepts() { return dropped_accepts; }
 
-    size_t rec_pckt_len = resp_len - 10; // "\r\nDATA\r\nOK\r\n> "
-    size_t len;
-    ISM43362_RET retval = Ok;
-    if (rec_pckt_len > buff_size) {
-        len = buff_size;
-        retval = PacketBufferTooSmall;
-    } else {
-        len = rec_pckt_len;
+// R0 on the selected socket, without putting back the read timeout lowered by the poll
+static ISM43362_RET read_packet(uint8_t *packet_buff, size_t buff_size, size_t *packet_size);
+
+ISM43362_RET ism43362_poll(uint8_t sockets, ISM43362PollResult *res) {
+    ISM43362PollResult zero = {0};
+    *res = zero;
+    for (uint8_t i = 0; i < 4; i++) {
+        if ((sockets & (1 << i)) && !shadow[i].polled && !(shadow[i].valid & (1 << PARAM_READ_TIMEOUT))) {
+            return Error;
+        }
     }
-    memcpy(packet_buff, resp + 2, len);
-    *packet_size = len;
-    return retval;
+
+    bool messages_read = false;
+    for (uint8_t i = 0; i < 4; i++) {
+        uint8_t bit = 1 << i;
+        if ((sockets & bit) == 0) {
+            continue;
+        }
+        Socket s = (Socket) i;
+        if (rx_stash[s].len > 0) {
+            res->readable |= bit;
+            continue;
+        }
+
+        // an idle socket answers after the read timeout, lowered until the next ism43362_read()
+        SocketShadow *sh = &shadow[s];
+        if (!sh->polled && sh->values[PARAM_READ_TIMEOUT] > ISM43362_POLL_READ_TIMEOUT_MS) {
+            uint32_t prev_timeout = sh->values[PARAM_READ_TIMEOUT];
+            ISM43362_RET ret = set_socket_param(s, PARAM_READ_TIMEOUT, ISM43362_POLL_READ_TIMEOUT_MS);
+            RET_IF_NOT_OK(ret);
+            sh->polled = true;
+            sh->read_timeout = prev_timeout;
+        }
+        ISM43362_RET ret = ism43362_set_socket(s);
+        RET_IF_NOT_OK(ret);
+        // with an empty buffer the data goes in the stash, where the next read finds it
+        uint8_t none;
+        size_t read_len;
+        ret = read_packet(&none, 0, &read_len);
+        if (ret == PacketBufferTooSmall) {
+            res->readable |= bit;
+        } else {
+            RET_IF_NOT_OK(ret);
+        }
+
+        if (sh->tcp_server) {
+            // the accepts stay queued for ism43362_take_accept(), MR is read once per poll
+            if (accept_count == 0 && !messages_read) {
+                ret = ism43362_read_messages();
+                RET_IF_NOT_OK(ret);
+                messages_read = true;
+            }
+            if (accept_count > 0) {
+                res->accepted |= bit;
+            }
+        }
+    }
+    return Ok;
+}
+
+ISM43362_RET ism43362_send_all(Socket s, const uint8_t *data, size_t len, size_t *sent) {
+    *sent = 0;
+    uint8_t retries = 0;
+    while (*sent < len) {
+        size_t chunk = len - *sent;
+        if (chunk > ISM43362_MAX_PAYLOAD) {
+            chunk = ISM43362_MAX_PAYLOAD;
+        }
+        // the socket is selected again only if a timeout made the driver forget it
+        ISM43362_RET ret = ism43362_set_socket(s);
+        size_t accepted = 0;
+        if (ret == Ok) {
+            const ISM43362Segment seg = {.data = data + *sent, .len = chunk};
+            ret = send_payload(&seg, 1, &accepted);
+        }
+        // once a command went out the data might have been sent, repeating it could duplicate it
+        if (ret == Timeout && !cmd_transmitted && retries < ISM43362_BULK_RETRIES) {
+            retries++;
+            continue;
+        }
+        RET_IF_NOT_OK(ret);
+        if (accepted == 0) {
+            if (retries >= ISM43362_BULK_RETRIES) {
+                return Timeout;
+            }
+            retries++;
+            continue;
+        }
+        *sent += accepted;
+        retries = 0;
+    }
+    return Ok;
+}
+
+ISM43362_RET ism43362_read_exact(Socket s, uint8_t *buff, size_t len, size_t *received, uint32_t timeout_ms) {
+    *received = 0;
+    uint32_t start = HAL_GetTick();
+    while (*received < len) {
+        if (HAL_GetTick() - start >= timeout_ms) {
+            return Timeout;
+        }
+        size_t read_len;
+        // what doesn't fit stays in the stash for the next read
+        ISM43362_RET ret = ism43362_socket_read(s, buff + *received, len - *received, &read_len);
+        if (ret != Ok && ret != PacketBufferTooSmall) {
+            return ret;
+        }
+        *received += read_len;
+    }
+    return Ok;
+}
+
+// reads the response of R0, stash can be NULL or without a buffer when the response fits packet_buff
+static ISM43362_RET receive_data(RxStash *stash, uint8_t *packet_buff, size_t buff_size, size_t *packet_size) {
+    // "\r\nDATA\r\nOK\r\n> ", the data is read straight into the caller's buffer, once it's full the rest
+    // goes in the stash, the trailer ends up after the data in either of them
+    uint8_t lead[2] = {0};
+    size_t in_buff = 0;
+    size_t in_stash = 0;
+    bool stash_full = false;
+    ISM_ENABLE_CSN();
+    if (ISM_DATA_RDY()) {
+        spi_receive(lead, 1);
+    }
+    while (ISM_DATA_RDY()) {
+        uint8_t *dst = packet_buff + in_buff;
+        size_t words = (buff_size - in_buff) / 2;
+        if (words == 0) {
+            size_t stash_size = stash != NULL && stash->data != NULL ? ism43362_pool_size(ISM_POOL_PAYLOAD) : 0;
+            words = (stash_size - in_stash) / 2;
+            if (words == 0) {
+                stash_full = true;
+                break;
+            }
+            dst = stash->data + in_stash;
+        }
+        if (words > ISM_SPI_RX_CHUNK) {
+            words = ISM_SPI_RX_CHUNK;
+        }
+        spi_receive(dst, words);
+        if (dst == packet_buff + in_buff) {
+            in_buff += words * 2;
+        } else {
+            in_stash += words * 2;
+        }
+    }
+    ISM_DISABLE_CSN();
+    stats.frames++;
+
+#define RX_AT(i) ((i) < in_buff ? packet_buff[i] : stash->data[(i) - in_buff])
+    while (in_buff + in_stash > 0 && RX_AT(in_buff + in_stash - 1) == ISM_SPI_PAD) {
+        if (in_stash > 0) {
+            in_stash--;
+        } else {
+            in_buff--;
+        }
+    }
+    if (stash_full) {
+        return RespBufferTooSmall;
+    }
+
+    size_t total = in_buff + in_stash;
+    if (lead[0] != '\r' || lead[1] != '\n' || total < R0_TRAILER_LEN) {
+        return BadResponse;
+    }
+    size_t data_len = total - R0_TRAILER_LEN;
+    for (size_t i = 0; i < R0_TRAILER_LEN; i++) {
+        if (RX_AT(data_len + i) != R0_TRAILER[i]) {
+            return BadResponse;
+        }
+    }
+#undef RX_AT
+
+#ifdef USART1_LOG
+    HAL_UART_Transmit(&huart1, packet_buff, data_len < in_buff ? data_len : in_buff, 1000);
+#endif
+
+    if (data_len <= in_buff) {
+        *packet_size = data_len;
+        return Ok;
+    }
+    *packet_size = in_buff;
+    stash->off = 0;
+    stash->len = data_len - in_buff;
+    return PacketBufferTooSmall;
+}
+
+// the longest R0 response of the socket, with the read packet size the driver knows or the largest one
+static size_t max_r0_response(int s) {
+    uint32_t packet = shadow[s].valid & (1 << PARAM_READ_PACKET_SIZE) ? shadow[s].values[PARAM_READ_PACKET_SIZE]
+                                                                      : ISM43362_MAX_PAYLOAD;
+    if (packet > ISM43362_MAX_PAYLOAD) {
+        packet = ISM43362_MAX_PAYLOAD;
+    }
+    // the leading "\r\n" isn't stored, one more byte for a padded word
+    return packet + R0_TRAILER_LEN + 1;
+}
+
+static ISM43362_RET read_packet(uint8_t *packet_buff, size_t buff_size, size_t *packet_size) {
+    *packet_size = 0;
+    // without knowing the selected socket nothing can be stashed, the whole response must fit the buffer
+    RxStash *stash = selected_socket >= 0 ? &rx_stash[selected_socket] : NULL;
+    if (stash != NULL && stash->len > 0) {
+        return read_stash(stash, packet_buff, buff_size, packet_size);
+    }
+
+    // the stash is reserved before the data is requested, once sent by the module it would be lost
+    if (stash != NULL && stash->data == NULL && buff_size < max_r0_response(selected_socket)) {
+        stash->data = ism43362_pool_borrow(ISM_POOL_PAYLOAD);
+        if (stash->data == NULL) {
+            return NoBuffer;
+        }
+    }
+
+    const ISM43362Segment cmd = {.data = (const uint8_t *) "R0\r\n", .len = 4};
+    ISM43362_RET ret = send_command(&cmd, 1);
+    if (ret != Ok) {
+        release_stash(stash);
+        return ret;
+    }
+    ret = receive_data(stash, packet_buff, buff_size, packet_size);
+    // the stash buffer is kept only if the data went in it
+    release_stash(stash);
+    return ret;
+}
+
+ISM43362_RET ism43362_read(uint8_t *packet_buff, size_t buff_size, size_t *packet_size) {
+    *packet_size = 0;
+    int s = selected_socket;
+    if (s >= 0 && rx_stash[s].len == 0 && shadow[s].polled) {
+        ISM43362_RET ret = set_socket_param((Socket) s, PARAM_READ_TIMEOUT, shadow[s].read_timeout);
+        RET_IF_NOT_OK(ret);
+    }
+    return read_packet(packet_buff, buff_size, packet_size);
 }
 
 WifiBaseServerConfig ism43362_get_default_base_server_config() {
@@ -450,41 +1251,36 @@ static ISM43362_RET ism43362_setup_server(WifiBaseServerConfig *conf) {
         return Error;
     }
 
-    uint8_t buff[1000];
-    size_t read_len;
-    char cmd[100];
-
-    snprintf(cmd, sizeof(cmd), "P0=%d\r\n", conf->s);
-    ISM43362_RET ret = ism43362_execute_cmd(cmd, buff, sizeof(buff), &read_len);
+    Socket s = conf->s;
+    ISM43362_RET ret = set_socket_param(s, PARAM_LOCAL_PORT, conf->local_port);
     RET_IF_NOT_OK(ret);
-
-    snprintf(cmd, sizeof(cmd), "P2=%d\r\n", conf->local_port);
-    ret = ism43362_execute_cmd(cmd, buff, sizeof(buff), &read_len);
+    ret = set_socket_param(s, PARAM_READ_PACKET_SIZE, conf->read_packet_size);
     RET_IF_NOT_OK(ret);
-
-    snprintf(cmd, sizeof(cmd), "R1=%d\r\n", conf->read_packet_size);
-    ret = ism43362_execute_cmd(cmd, buff, sizeof(buff), &read_len);
+    ret = set_socket_param(s, PARAM_READ_TIMEOUT, conf->read_timeout_ms);
     RET_IF_NOT_OK(ret);
+    return set_socket_param(s, PARAM_WRITE_TIMEOUT, conf->write_timeout_ms);
+}
 
-    snprintf(cmd, sizeof(cmd), "R2=%d\r\n", conf->read_timeout_ms);
-    ret = ism43362_execute_cmd(cmd, buff, sizeof(buff), &read_len);
+// starts the server on the selected socket, unless it's already running
+static ISM43362_RET start_server(Socket s, const char *cmd) {
+    if (shadow[s].open) {
+        return Ok;
+    }
+    ISM43362_RET ret = ism43362_set_socket(s);
     RET_IF_NOT_OK(ret);
-
-    snprintf(cmd, sizeof(cmd), "S2=%d\r\n", conf->write_timeout_ms);
-    return ism43362_execute_cmd(cmd, buff, sizeof(buff), &read_len);
+    ret = execute_checked(cmd);
+    shadow[s].open = ret == Ok;
+    return ret;
 }
 
 ISM43362_RET ism43362_start_udp_server(WifiBaseServerConfig *conf) {
     ISM43362_RET ret = ism43362_setup_server(conf);
     RET_IF_NOT_OK(ret);
 
-    uint8_t buff[1000];
-    size_t read_len;
-
-    ret = ism43362_execute_cmd("P1=1\r\n", buff, sizeof(buff), &read_len);
+    ret = set_socket_param(conf->s, PARAM_PROTOCOL, UDP);
     RET_IF_NOT_OK(ret);
 
-    return ism43362_execute_cmd("P5=1\r\n", buff, sizeof(buff), &read_len);
+    return start_server(conf->s, "P5=1\r\n");
 }
 
 WifiTcpServerConfig ism43362_get_default_tcp_server_config() {
@@ -499,21 +1295,25 @@ ISM43362_RET ism43362_start_tcp_server(WifiTcpServerConfig *conf) {
     ISM43362_RET ret = ism43362_setup_server(&conf->base_conf);
     RET_IF_NOT_OK(ret);
 
-    uint8_t buff[500];
-    size_t read_len;
-    char cmd[100];
-
-    snprintf(cmd, sizeof(cmd), "P8=%d\r\n", conf->listen_backlogs);
-    ret = ism43362_execute_cmd(cmd, buff, sizeof(buff), &read_len);
+    ret = set_socket_param(conf->base_conf.s, PARAM_LISTEN_BACKLOGS, conf->listen_backlogs);
     RET_IF_NOT_OK(ret);
 
     if (conf->keep_alive_enabled) {
-        snprintf(cmd, sizeof(cmd), "PK=1,%d\r\n", conf->keep_alive_timeout_ms);
-        ret = ism43362_execute_cmd(cmd, buff, sizeof(buff), &read_len);
+        ret = ism43362_set_socket(conf->base_conf.s);
+        RET_IF_NOT_OK(ret);
+        char cmd[24];
+        ISM43362Encoder e;
+        ism43362_enc_init(&e, cmd, sizeof(cmd));
+        ism43362_enc_str(&e, "PK=1,");
+        ism43362_enc_u32(&e, conf->keep_alive_timeout_ms);
+        ism43362_enc_str(&e, "\r\n");
+        ret = execute_checked(cmd);
         RET_IF_NOT_OK(ret);
     }
 
-    return ism43362_execute_cmd("P5=11\r\n", buff, sizeof(buff), &read_len);
+    ret = start_server(conf->base_conf.s, "P5=11\r\n");
+    shadow[conf->base_conf.s].tcp_server = ret == Ok;
+    return ret;
 }
 
 ISM43362_RET ism43362_check_tcp_server_connection(RemoteTcpConnection *conn) {
@@ -521,24 +1321,97 @@ ISM43362_RET ism43362_check_tcp_server_connection(RemoteTcpConnection *conn) {
         return Error;
     }
 
-    uint8_t buff[2000];
-    size_t read_len;
-    ISM43362_RET ret = ism43362_execute_cmd("MR\r\n", buff, sizeof(buff), &read_len);
-    RET_IF_NOT_OK(ret);
-    if (strstr(buff, "Accepted") == NULL) {
-        conn->connected = false;
-        return Ok;
+    if (accept_count == 0) {
+        ISM43362_RET ret = ism43362_read_messages();
+        RET_IF_NOT_OK(ret);
     }
+    conn->connected = ism43362_take_accept(&conn->remote);
+    return Ok;
+}
 
-    conn->connected = true;
-    sscanf(buff, "\r\n[SOMA][TCP SVR] Accepted %d.%d.%d.%d:%d", conn->remote.ip, conn->remote.ip + 1,
-           conn->remote.ip + 2, conn->remote.ip + 3, &conn->remote.port);
+ISM43362_RET ism43362_tcp_server_close_curr_conn() { return execute_checked("P5=10\r\n"); }
 
-    return Ok;
+// the socket settings in the order the start functions send them
+static void encode_server_params(ISM43362Encoder *e, const WifiBaseServerConfig *conf) {
+    ism43362_enc_str(e, select_cmds[conf->s]);
+    ism43362_enc_param(e, param_cmds[PARAM_LOCAL_PORT], conf->local_port);
+    ism43362_enc_param(e, param_cmds[PARAM_READ_PACKET_SIZE], conf->read_packet_size);
+    ism43362_enc_param(e, param_cmds[PARAM_READ_TIMEOUT], conf->read_timeout_ms);
+    ism43362_enc_param(e, param_cmds[PARAM_WRITE_TIMEOUT], conf->write_timeout_ms);
+}
+
+static ISM43362_RET finish_setup(ISM43362Encoder *e, ISM43362SocketSetup *setup, const WifiBaseServerConfig *conf,
+                                 bool tcp_server) {
+    setup->len = e->len;
+    setup->s = conf->s;
+    setup->tcp_server = tcp_server;
+    setup->read_timeout_ms = conf->read_timeout_ms;
+    return e->overflow ? Error : Ok;
+}
+
+bool ism43362_client_script(const WifiClientConfig *client, char *script, size_t size, size_t *len) {
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, script, size);
+    ism43362_enc_str(&e, select_cmds[client->s]);
+    ism43362_enc_param(&e, param_cmds[PARAM_PROTOCOL], client->protocol);
+    ism43362_enc_param_ip(&e, param_cmds[PARAM_REMOTE_IP], client->remote.ip);
+    ism43362_enc_param(&e, param_cmds[PARAM_REMOTE_PORT], client->remote.port);
+    ism43362_enc_param(&e, param_cmds[PARAM_READ_PACKET_SIZE], client->read_packet_size);
+    ism43362_enc_param(&e, param_cmds[PARAM_READ_TIMEOUT], client->read_timeout_ms);
+    ism43362_enc_param(&e, param_cmds[PARAM_WRITE_TIMEOUT], client->write_timeout_ms);
+    ism43362_enc_str(&e, "P6=1\r\n");
+    *len = e.len;
+    return !e.overflow;
+}
+
+ISM43362_RET ism43362_encode_client_setup(const WifiClientConfig *client, ISM43362SocketSetup *setup) {
+    if (client == NULL || (unsigned) client->s >= 4) {
+        return Error;
+    }
+    setup->s = client->s;
+    setup->tcp_server = false;
+    setup->read_timeout_ms = client->read_timeout_ms;
+    return ism43362_client_script(client, setup->cmds, sizeof(setup->cmds), &setup->len) ? Ok : Error;
 }
 
-ISM43362_RET ism43362_tcp_server_close_curr_conn() {
-    uint8_t buff[500];
-    size_t read_len;
-    return ism43362_execute_cmd("P5=10\r\n", buff, sizeof(buff), &read_len);
+ISM43362_RET ism43362_encode_udp_server_setup(const WifiBaseServerConfig *conf, ISM43362SocketSetup *setup) {
+    if (conf == NULL || (unsigned) conf->s >= 4) {
+        return Error;
+    }
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, setup->cmds, sizeof(setup->cmds));
+    encode_server_params(&e, conf);
+    ism43362_enc_param(&e, param_cmds[PARAM_PROTOCOL], UDP);
+    ism43362_enc_str(&e, "P5=1\r\n");
+    return finish_setup(&e, setup, conf, false);
+}
+
+ISM43362_RET ism43362_encode_tcp_server_setup(const WifiTcpServerConfig *conf, ISM43362SocketSetup *setup) {
+    if (conf == NULL || (unsigned) conf->base_conf.s >= 4) {
+        return Error;
+    }
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, setup->cmds, sizeof(setup->cmds));
+    encode_server_params(&e, &conf->base_conf);
+    ism43362_enc_param(&e, param_cmds[PARAM_LISTEN_BACKLOGS], conf->listen_backlogs);
+    if (conf->keep_alive_enabled) {
+        ism43362_enc_str(&e, "PK=1,");
+        ism43362_enc_u32(&e, conf->keep_alive_timeout_ms);
+        ism43362_enc_str(&e, "\r\n");
+    }
+    ism43362_enc_str(&e, "P5=11\r\n");
+    return finish_setup(&e, setup, &conf->base_conf, true);
+}
+
+ISM43362_RET ism43362_replay_setup(const ISM43362SocketSetup *setup) {
+    // every setting is sent again, the copy of the socket state is rebuilt from scratch
+    ism43362_forget_socket(setup->s);
+    ISM43362_RET ret = execute_script(setup->cmds, setup->len);
+    shadow[setup->s].open = ret == Ok;
+    shadow[setup->s].tcp_server = ret == Ok && setup->tcp_server;
+    if (ret == Ok) {
+        shadow[setup->s].values[PARAM_READ_TIMEOUT] = setup->read_timeout_ms;
+        shadow[setup->s].valid |= 1 << PARAM_READ_TIMEOUT;
+    }
+    return ret;
 }
@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "ism43362_parser.h"
+
 typedef enum {
     Ok,
     Error,
@@ -12,14 +14,71 @@ typedef enum {
     BadResponse,
     WrongInitMsg,
     PacketBufferTooSmall,
+    Timeout,
+    NotConnected,
+    NoBuffer,
 } ISM43362_RET;
 
 void ism43362_drdy_exti_callback();
+
+typedef struct {
+    uint32_t ready_ms; // for the module to accept a command
+    uint32_t cmd_ms; // for the response
+    uint32_t connect_ms; // for the response when joining a network or connecting to a remote
+    // R0 and S3 answer after the read or write timeout of the socket, this is added to it
+    uint32_t data_margin_ms;
+} ISM43362Timeouts;
+
+// largest read and write timeout of a socket, used for R0 and S3 when the driver doesn't know the socket one
+#define ISM43362_MAX_SOCKET_TIMEOUT_MS 30000
+
+ISM43362Timeouts ism43362_get_default_timeouts();
+ISM43362Timeouts ism43362_get_timeouts();
+void ism43362_set_timeouts(const ISM43362Timeouts *t);
+
+// called while waiting for the module, e.g. to sleep with __WFI() or yield to the scheduler
+typedef void (*ISM43362IdleHook)(void);
+
+// NULL to busy wait
+void ism43362_set_idle_hook(ISM43362IdleHook hook);
+
+typedef struct {
+    uint32_t frames; // commands executed
+    uint32_t bytes_sent;
+    uint32_t bytes_received;
+    uint32_t spi_calls; // calls to the HAL SPI transfer functions
+    uint32_t join_cmds; // commands executed by the last join
+} ISM43362Stats;
+
+ISM43362Stats ism43362_get_stats();
+void ism43362_reset_stats();
 void ism43362_ret_to_str(ISM43362_RET ret, char *s, size_t len);
 ISM43362_RET ism43362_reset_module();
 ISM43362_RET ism43362_transmit_buffer(const uint8_t *tr_buffer, size_t tr_size, uint8_t *resp, size_t resp_buff_len,
                                       size_t *resp_len);
+
+// a piece of a command, consecutive segments are sent as a single buffer
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+} ISM43362Segment;
+
+ISM43362_RET ism43362_transmit_segments(const ISM43362Segment *segs, size_t count, uint8_t *resp,
+                                        size_t resp_buff_len, size_t *resp_len);
 ISM43362_RET ism43362_execute_cmd(const char *cmd, uint8_t *resp, size_t resp_buff_len, size_t *resp_len);
+// executes the command parsing the response while it's read, without storing it
+ISM43362_RET ism43362_execute_parsed(const char *cmd, ISM43362Parser *parser);
+
+// steps of a command, for the callers that don't want to block: when the module is ready the command is started,
+// then the response is received once the data ready interrupt arrived
+bool ism43362_module_ready();
+ISM43362_RET ism43362_start_segments(const ISM43362Segment *segs, size_t count);
+bool ism43362_response_ready();
+ISM43362_RET ism43362_receive_response(uint8_t *resp, size_t resp_buff_len, size_t *resp_len);
+// only checks that the response is OK, without storing it
+ISM43362_RET ism43362_receive_checked();
+// removes the framing around the data of an R0 response
+ISM43362_RET ism43362_strip_r0(uint8_t *resp, size_t resp_len, size_t *payload_len);
 ISM43362_RET ism43362_enter_cmd_mode();
 ISM43362_RET ism43362_enter_machine_mode();
 
@@ -47,11 +106,40 @@ typedef struct {
 
 JoinWifiConfig ism43362_get_default_wifi_config();
 ISM43362_RET ism43362_join_network(const JoinWifiConfig *conf);
+// only sends the settings that differ from the ones applied by the last join, or read with C? the first time
+ISM43362_RET ism43362_fast_join_network(const JoinWifiConfig *conf);
+
+#ifndef ISM43362_SCRIPT_LEN
+#define ISM43362_SCRIPT_LEN 320
+#endif
+
+// writes the commands that apply the settings differing from curr, or all of them if curr is NULL, without C0,
+// returns false if they don't fit
+bool ism43362_join_script(const JoinWifiConfig *conf, const JoinWifiConfig *curr, char *script, size_t size,
+                          size_t *len);
+// C0 and P6=1 wait for the network, so they use the connect timeout
+bool ism43362_is_connect_cmd(const char *cmd);
+// response timeout of the command, for the callers that wait for it themselves
+uint32_t ism43362_cmd_timeout_ms(const char *cmd, size_t len);
 ISM43362_RET ism43362_read_wifi_config(JoinWifiConfig *conf);
+// CS, cheaper than reading the whole configuration
+ISM43362_RET ism43362_is_connected(bool *connected);
 
 typedef enum { SOCKET_0 = 0, SOCKET_1 = 1, SOCKET_2 = 2, SOCKET_3 = 3 } Socket;
 
+// the driver keeps a copy of the selected socket and of the settings of each socket, the commands that wouldn't
+// change them are skipped
 ISM43362_RET ism43362_set_socket(Socket s);
+// -1 if unknown
+int ism43362_get_selected_socket();
+bool ism43362_socket_is_open(Socket s);
+// false if the driver has no copy of the socket settings, e.g. after a timeout
+bool ism43362_socket_state_known(Socket s);
+// the connection or server was lost, the next start sends the command again
+void ism43362_mark_socket_closed(Socket s);
+// to call if the module was reset or configured without the driver
+void ism43362_forget_state();
+void ism43362_forget_socket(Socket s);
 
 typedef enum { TCP = 0, UDP = 1, UDP_LITE = 2 } TransportProtocol;
 
@@ -73,8 +161,47 @@ typedef struct {
 
 WifiClientConfig ism43362_get_default_client_config();
 ISM43362_RET ism43362_start_wifi_client(const WifiClientConfig *client);
-ISM43362_RET ism43362_send(uint8_t *packet, size_t size);
+#define ISM43362_MAX_PAYLOAD 1460
+#define ISM43362_MAX_SEGMENTS 8
+
+ISM43362_RET ism43362_send(const uint8_t *packet, size_t size);
+// sends the concatenation of the segments as a single packet, without copying them, sent is the number of bytes the
+// module accepted, the caller sends the rest again if it's short
+ISM43362_RET ism43362_sendv(const ISM43362Segment *payload, size_t count, size_t *sent);
 ISM43362_RET ism43362_read(uint8_t *packet_buff, size_t buff_size, size_t *packet_size);
+// select the socket only if needed
+ISM43362_RET ism43362_socket_send(Socket s, const uint8_t *packet, size_t size);
+ISM43362_RET ism43362_socket_read(Socket s, uint8_t *packet_buff, size_t buff_size, size_t *packet_size);
+
+#ifndef ISM43362_POLL_READ_TIMEOUT_MS
+#define ISM43362_POLL_READ_TIMEOUT_MS 1
+#endif
+
+typedef struct {
+    uint8_t readable; // bit per socket with data, read with ism43362_socket_read()
+    // bit per polled TCP server socket while accepted connections are queued, take them with ism43362_take_accept(),
+    // the module messages don't tell which server accepted them
+    uint8_t accepted;
+} ISM43362PollResult;
+
+// checks the sockets in the mask, the ones with data already received are not queried again. The read timeout of
+// the polled sockets is lowered to ISM43362_POLL_READ_TIMEOUT_MS and left there, so polling an idle socket again
+// only costs its R0, the next ism43362_read() of the socket puts the previous timeout back first. Returns Error
+// without sending anything if the driver doesn't know the read timeout of a socket, it couldn't be put back (the
+// socket wasn't started through the driver or was forgotten after a timeout). The reads of ism43362_async.h don't
+// put the timeout back, don't mix them with ism43362_poll() on the same socket.
+ISM43362_RET ism43362_poll(uint8_t sockets, ISM43362PollResult *res);
+
+#ifndef ISM43362_BULK_RETRIES
+#define ISM43362_BULK_RETRIES 2
+#endif
+
+// sends data of any size in ISM43362_MAX_PAYLOAD chunks, a chunk is sent again up to ISM43362_BULK_RETRIES times only
+// if the module didn't get it (not ready) or accepted none of it, a timeout after sending returns Timeout, sent is
+// the number of bytes accepted by the module, also on error
+ISM43362_RET ism43362_send_all(Socket s, const uint8_t *data, size_t len, size_t *sent);
+// reads until len bytes are received or timeout_ms expires, in which case it returns Timeout
+ISM43362_RET ism43362_read_exact(Socket s, uint8_t *buff, size_t len, size_t *received, uint32_t timeout_ms);
 
 typedef struct {
     Socket s;
@@ -102,7 +229,41 @@ typedef struct {
 } RemoteTcpConnection;
 
 ISM43362_RET ism43362_start_tcp_server(WifiTcpServerConfig *conf);
+// takes the oldest queued accepted connection, reading the module messages if there's none
 ISM43362_RET ism43362_check_tcp_server_connection(RemoteTcpConnection *conn);
+
+#ifndef ISM43362_ACCEPT_QUEUE_LEN
+#define ISM43362_ACCEPT_QUEUE_LEN 6
+#endif
+
+// MR is only read here, the accepted connections it reports are queued until taken, so the functions looking for
+// them don't steal each other's events, the ones that don't fit the queue are counted as dropped
+ISM43362_RET ism43362_read_messages();
+uint8_t ism43362_pending_accepts();
+bool ism43362_take_accept(WifiRemote *remote);
+uint32_t ism43362_dropped_accepts();
 ISM43362_RET ism43362_tcp_server_close_curr_conn();
 
+#ifndef ISM43362_SETUP_LEN
+#define ISM43362_SETUP_LEN 128
+#endif
+
+// the commands that configure and start a socket, encoded once and executed again e.g. after every reconnect
+typedef struct {
+    char cmds[ISM43362_SETUP_LEN];
+    size_t len;
+    Socket s;
+    bool tcp_server;
+    uint32_t read_timeout_ms; // known by the driver after the replay, for ism43362_poll()
+} ISM43362SocketSetup;
+
+// writes the commands that select the socket, apply every setting of the client and connect, returns false if they
+// don't fit
+bool ism43362_client_script(const WifiClientConfig *client, char *script, size_t size, size_t *len);
+ISM43362_RET ism43362_encode_client_setup(const WifiClientConfig *client, ISM43362SocketSetup *setup);
+ISM43362_RET ism43362_encode_udp_server_setup(const WifiBaseServerConfig *conf, ISM43362SocketSetup *setup);
+ISM43362_RET ism43362_encode_tcp_server_setup(const WifiTcpServerConfig *conf, ISM43362SocketSetup *setup);
+// sends every command of the setup, also the settings the module might already have
+ISM43362_RET ism43362_replay_setup(const ISM43362SocketSetup *setup);
+
 #endif
@@ -0,0 +1,270 @@
+#include "ism43362_async.h"
+
+#include <string.h>
+
+#include "../Inc/main.h"
+#include "ism43362_encode.h"
+
+typedef enum { PHASE_WAIT_READY, PHASE_WAIT_RESPONSE } Phase;
+
+static ISM43362Request *head = NULL;
+static ISM43362Request *tail = NULL;
+static Phase phase = PHASE_WAIT_READY;
+static uint32_t phase_start = 0;
+static uint32_t phase_timeout_ms = 0;
+static size_t cmd_end = 0; // end of the command being executed in the script
+
+static ISM43362_RET submit(ISM43362Request *req, ISM43362RequestCallback callback, void *ctx) {
+    req->pos = 0;
+    req->rx_len = 0;
+    req->ret = Ok;
+    req->callback = callback;
+    req->ctx = ctx;
+    req->next = NULL;
+    req->status = ISM_REQ_QUEUED;
+    if (tail == NULL) {
+        head = req;
+    } else {
+        tail->next = req;
+    }
+    tail = req;
+    return Ok;
+}
+
+static bool can_submit(const ISM43362Request *req) {
+    return req->status == ISM_REQ_IDLE || req->status == ISM_REQ_DONE;
+}
+
+// prepares the script, the request can't be reused until it's done
+static ISM43362_RET init_request(ISM43362Request *req, const char *script) {
+    if (!can_submit(req)) {
+        return Error;
+    }
+    size_t len = strlen(script);
+    if (len >= sizeof(req->script)) {
+        return Error;
+    }
+    memcpy(req->script, script, len + 1);
+    req->script_len = len;
+    req->payload = NULL;
+    req->payload_len = 0;
+    req->rx = NULL;
+    req->rx_size = 0;
+    req->forget = ISM_FORGET_NONE;
+    return Ok;
+}
+
+ISM43362_RET ism43362_async_script(ISM43362Request *req, const char *script, int8_t forget,
+                                   ISM43362RequestCallback callback, void *ctx) {
+    if (forget < ISM_FORGET_NONE || forget > ISM_FORGET_ALL) {
+        return Error;
+    }
+    ISM43362_RET ret = init_request(req, script);
+    if (ret != Ok) {
+        return ret;
+    }
+    req->forget = forget;
+    return submit(req, callback, ctx);
+}
+
+ISM43362_RET ism43362_async_join(ISM43362Request *req, const JoinWifiConfig *conf, ISM43362RequestCallback callback,
+                                 void *ctx) {
+    if (!can_submit(req) || conf == NULL || strlen(conf->ssid) == 0) {
+        return Error;
+    }
+    size_t len;
+    if (!ism43362_join_script(conf, NULL, req->script, sizeof(req->script) - 4, &len)) {
+        return Error;
+    }
+    memcpy(req->script + len, "C0\r\n", 5);
+    req->script_len = len + 4;
+    req->payload = NULL;
+    req->payload_len = 0;
+    req->rx = NULL;
+    req->rx_size = 0;
+    // joining drops the connections and changes the module configuration
+    req->forget = ISM_FORGET_ALL;
+    return submit(req, callback, ctx);
+}
+
+ISM43362_RET ism43362_async_start_client(ISM43362Request *req, const WifiClientConfig *client,
+                                         ISM43362RequestCallback callback, void *ctx) {
+    if (!can_submit(req) || client == NULL || (unsigned) client->s >= 4) {
+        return Error;
+    }
+    size_t len;
+    if (!ism43362_client_script(client, req->script, sizeof(req->script), &len)) {
+        return Error;
+    }
+    req->script_len = len;
+    req->payload = NULL;
+    req->payload_len = 0;
+    req->rx = NULL;
+    req->rx_size = 0;
+    req->forget = client->s;
+    return submit(req, callback, ctx);
+}
+
+ISM43362_RET ism43362_async_send(ISM43362Request *req, Socket s, const uint8_t *data, size_t len,
+                                 ISM43362RequestCallback callback, void *ctx) {
+    if ((unsigned) s >= 4 || len > ISM43362_MAX_PAYLOAD) {
+        return Error;
+    }
+    // the S3 header ends with '\r' only, the payload and "\r\n" follow it
+    char script[24];
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, script, sizeof(script));
+    ism43362_enc_param(&e, "P0", s);
+    ism43362_enc_str(&e, "S3=");
+    ism43362_enc_u32(&e, len);
+    ism43362_enc_char(&e, '\r');
+    ISM43362_RET ret = init_request(req, script);
+    if (ret != Ok) {
+        return ret;
+    }
+    req->payload = data;
+    req->payload_len = len;
+    return submit(req, callback, ctx);
+}
+
+ISM43362_RET ism43362_async_read(ISM43362Request *req, Socket s, uint8_t *buff, size_t size,
+                                 ISM43362RequestCallback callback, void *ctx) {
+    if ((unsigned) s >= 4) {
+        return Error;
+    }
+    char script[16];
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, script, sizeof(script));
+    ism43362_enc_param(&e, "P0", s);
+    ism43362_enc_str(&e, "R0\r\n");
+    ISM43362_RET ret = init_request(req, script);
+    if (ret != Ok) {
+        return ret;
+    }
+    req->rx = buff;
+    req->rx_size = size;
+    return submit(req, callback, ctx);
+}
+
+bool ism43362_async_done(const ISM43362Request *req) { return req->status == ISM_REQ_DONE; }
+
+bool ism43362_async_idle() { return head == NULL; }
+
+static void complete(ISM43362Request *req, ISM43362_RET ret) {
+    head = req->next;
+    if (head == NULL) {
+        tail = NULL;
+    }
+    phase = PHASE_WAIT_READY;
+    if (ret == Timeout) {
+        ism43362_forget_state();
+    }
+    req->ret = ret;
+    req->status = ISM_REQ_DONE;
+    if (req->callback != NULL) {
+        req->callback(req, req->ctx);
+    }
+}
+
+static void find_cmd_end(const ISM43362Request *req) {
+    cmd_end = req->pos;
+    while (cmd_end < req->script_len && req->script[cmd_end] != '\n') {
+        cmd_end++;
+    }
+    if (cmd_end < req->script_len) {
+        cmd_end++;
+    }
+}
+
+static ISM43362_RET start_command(ISM43362Request *req, uint32_t now) {
+    const char *cmd = req->script + req->pos;
+    bool last = cmd_end == req->script_len;
+    ISM43362Segment segs[3] = {{.data = (const uint8_t *) cmd, .len = cmd_end - req->pos}};
+    size_t count = 1;
+    if (last && req->payload != NULL) {
+        segs[1].data = req->payload;
+        segs[1].len = req->payload_len;
+        segs[2].data = (const uint8_t *) "\r\n";
+        segs[2].len = 2;
+        count = 3;
+    }
+    ISM43362_RET ret = ism43362_start_segments(segs, count);
+
+    phase = PHASE_WAIT_RESPONSE;
+    phase_start = now;
+    phase_timeout_ms = ism43362_cmd_timeout_ms(cmd, cmd_end - req->pos);
+    return ret;
+}
+
+static ISM43362_RET receive(ISM43362Request *req) {
+    bool last = cmd_end == req->script_len;
+    if (!last || req->rx == NULL) {
+        return ism43362_receive_checked();
+    }
+    ISM43362_RET ret = ism43362_receive_response(req->rx, req->rx_size, &req->rx_len);
+    if (ret != Ok) {
+        return ret;
+    }
+    size_t resp_len = req->rx_len;
+    return ism43362_strip_r0(req->rx, resp_len, &req->rx_len);
+}
+
+void ism43362_process() {
+    while (head != NULL) {
+        ISM43362Request *req = head;
+        uint32_t now = HAL_GetTick();
+        if (req->status == ISM_REQ_QUEUED) {
+            req->status = ISM_REQ_RUNNING;
+            phase = PHASE_WAIT_READY;
+            phase_start = now;
+            // not at submit, the requests queued before this one still rely on the state
+            if (req->forget == ISM_FORGET_ALL) {
+                ism43362_forget_state();
+            } else if (req->forget != ISM_FORGET_NONE) {
+                ism43362_forget_socket((Socket) req->forget);
+            }
+        }
+
+        if (phase == PHASE_WAIT_READY) {
+            if (req->pos >= req->script_len) {
+                complete(req, Ok);
+                continue;
+            }
+            find_cmd_end(req);
+            // the socket is selected only if needed
+            const char *cmd = req->script + req->pos;
+            if (cmd[0] == 'P' && cmd[1] == '0' && cmd[2] == '=' && ism43362_get_selected_socket() == cmd[3] - '0') {
+                req->pos = cmd_end;
+                continue;
+            }
+            if (!ism43362_module_ready()) {
+                if (now - phase_start >= ism43362_get_timeouts().ready_ms) {
+                    complete(req, Timeout);
+                    continue;
+                }
+                return;
+            }
+            ISM43362_RET ret = start_command(req, now);
+            if (ret != Ok) {
+                complete(req, ret);
+                continue;
+            }
+        }
+
+        if (!ism43362_response_ready()) {
+            if (now - phase_start >= phase_timeout_ms) {
+                complete(req, Timeout);
+                continue;
+            }
+            return;
+        }
+        ISM43362_RET ret = receive(req);
+        if (ret != Ok) {
+            complete(req, ret);
+            continue;
+        }
+        req->pos = cmd_end;
+        phase = PHASE_WAIT_READY;
+        phase_start = HAL_GetTick();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef ISM43362_ASYNC_H
+#define ISM43362_ASYNC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ism43362.h"
+
+// Non-blocking use of the module: requests are queued and executed one command at a time by ism43362_process(),
+// which never waits for the module, so it can be called in the main loop next to the sensor sampling. A request is
+// a script of commands, the last one can be followed by a payload (S3) or have its response stored (R0).
+// The blocking functions must not be used while requests are pending.
+
+typedef enum { ISM_REQ_IDLE, ISM_REQ_QUEUED, ISM_REQ_RUNNING, ISM_REQ_DONE } ISM43362RequestStatus;
+
+typedef struct ISM43362Request ISM43362Request;
+
+#define ISM_FORGET_NONE -1
+#define ISM_FORGET_ALL 4
+
+// called by ism43362_process() when the request is done
+typedef void (*ISM43362RequestCallback)(ISM43362Request *req, void *ctx);
+
+// owned by the caller until it's done
+struct ISM43362Request {
+    char script[ISM43362_SCRIPT_LEN];
+    size_t script_len;
+    size_t pos; // of the next command
+    const uint8_t *payload; // sent after the last command
+    size_t payload_len;
+    uint8_t *rx; // stores the response of the last command
+    size_t rx_size;
+    size_t rx_len;
+    // the driver state the request makes stale, forgotten when it starts executing: a socket, ISM_FORGET_ALL or
+    // ISM_FORGET_NONE
+    int8_t forget;
+
+    volatile ISM43362RequestStatus status;
+    ISM43362_RET ret;
+    ISM43362RequestCallback callback;
+    void *ctx;
+    ISM43362Request *next;
+};
+
+// executes the commands in the script, each terminated by "\r\n", forget is the driver state the script makes
+// stale (a socket, ISM_FORGET_ALL if unsure or ISM_FORGET_NONE)
+ISM43362_RET ism43362_async_script(ISM43362Request *req, const char *script, int8_t forget,
+                                   ISM43362RequestCallback callback, void *ctx);
+ISM43362_RET ism43362_async_join(ISM43362Request *req, const JoinWifiConfig *conf, ISM43362RequestCallback callback,
+                                 void *ctx);
+ISM43362_RET ism43362_async_start_client(ISM43362Request *req, const WifiClientConfig *client,
+                                         ISM43362RequestCallback callback, void *ctx);
+// data must stay valid until the request is done, s must be one of the 4 sockets
+ISM43362_RET ism43362_async_send(ISM43362Request *req, Socket s, const uint8_t *data, size_t len,
+                                 ISM43362RequestCallback callback, void *ctx);
+// the data is in buff[0..req->rx_len], buff also receives the framing, so it needs 11 bytes more than the data
+ISM43362_RET ism43362_async_read(ISM43362Request *req, Socket s, uint8_t *buff, size_t size,
+                                 ISM43362RequestCallback callback, void *ctx);
+
+bool ism43362_async_done(const ISM43362Request *req);
+bool ism43362_async_idle();
+// advances the request being executed, to call periodically and after the data ready interrupt
+void ism43362_process();
+
+#endif
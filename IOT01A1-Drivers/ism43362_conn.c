@@ -0,0 +1,218 @@
+#include "ism43362_conn.h"
+
+#include "../Inc/main.h"
+
+#define TICK_REACHED(now, t) ((int32_t) ((now) - (t)) >= 0)
+
+ISM43362ConnConfig ism43362_conn_get_default_config() {
+    ISM43362ConnConfig conf = {.probe_period_ms = 5000, .backoff_min_ms = 500, .backoff_max_ms = 60000};
+    return conf;
+}
+
+static ISM43362_RET start_socket(ConnSocket *sock) {
+    // without the driver copy every setting would be sent anyway, the encoded ones are sent as they are
+    if (sock->kind != CONN_SOCKET_UNUSED && !ism43362_socket_state_known(sock->setup.s)) {
+        return ism43362_replay_setup(&sock->setup);
+    }
+    switch (sock->kind) {
+        case CONN_SOCKET_CLIENT:
+            return ism43362_start_wifi_client(&sock->conf.client);
+        case CONN_SOCKET_UDP_SERVER:
+            return ism43362_start_udp_server(&sock->conf.udp_server);
+        case CONN_SOCKET_TCP_SERVER:
+            return ism43362_start_tcp_server(&sock->conf.tcp_server);
+        default:
+            return Ok;
+    }
+}
+
+static uint32_t next_backoff(const ISM43362Conn *c, uint32_t backoff_ms) {
+    return backoff_ms * 2 > c->conf.backoff_max_ms ? c->conf.backoff_max_ms : backoff_ms * 2;
+}
+
+// the first restart is tried at the next poll
+static void socket_lost(ISM43362Conn *c, Socket s, uint32_t now) {
+    if (c->lost_sockets == 0) {
+        c->next_restart = now;
+        c->restart_backoff_ms = c->conf.backoff_min_ms;
+    }
+    c->lost_sockets |= 1 << s;
+}
+
+// restarts the lost sockets, the ones that fail stay in the mask until the next attempt
+static void restart_sockets(ISM43362Conn *c, uint32_t now) {
+    if (!TICK_REACHED(now, c->next_restart)) {
+        return;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        if ((c->lost_sockets & (1 << i)) == 0) {
+            continue;
+        }
+        ism43362_mark_socket_closed((Socket) i);
+        if (start_socket(&c->sockets[i]) == Ok) {
+            c->lost_sockets &= ~(1 << i);
+            c->stats.socket_restarts++;
+        } else {
+            c->stats.failed_restarts++;
+        }
+    }
+    if (c->lost_sockets != 0) {
+        c->next_restart = HAL_GetTick() + c->restart_backoff_ms;
+        c->restart_backoff_ms = next_backoff(c, c->restart_backoff_ms);
+    }
+}
+
+static void link_lost(ISM43362Conn *c, uint32_t now) {
+    c->up = false;
+    c->down_since = now;
+    c->next_attempt = now;
+    c->backoff_ms = c->conf.backoff_min_ms;
+    c->stats.link_losses++;
+    for (uint8_t i = 0; i < 4; i++) {
+        if (c->sockets[i].kind != CONN_SOCKET_UNUSED) {
+            socket_lost(c, (Socket) i, now);
+        }
+    }
+}
+
+static void try_rejoin(ISM43362Conn *c, uint32_t now) {
+    if (ism43362_fast_join_network(&c->wifi) != Ok) {
+        c->stats.failed_rejoins++;
+        c->next_attempt = now + c->backoff_ms;
+        c->backoff_ms = next_backoff(c, c->backoff_ms);
+        return;
+    }
+
+    // the sockets are restarted at once on the new link
+    c->next_restart = now;
+    c->restart_backoff_ms = c->conf.backoff_min_ms;
+    restart_sockets(c, now);
+    uint32_t after = HAL_GetTick();
+    uint32_t downtime = after - c->down_since;
+    c->up = true;
+    c->probe_now = false;
+    c->last_probe = after;
+    c->stats.rejoins++;
+    c->stats.downtime_ms += downtime;
+    c->stats.last_reconnect_ms = downtime;
+    if (downtime > c->stats.max_reconnect_ms) {
+        c->stats.max_reconnect_ms = downtime;
+    }
+}
+
+ISM43362_RET ism43362_conn_init(ISM43362Conn *c, const ISM43362ConnConfig *conf, const JoinWifiConfig *wifi) {
+    ISM43362Conn zero = {0};
+    *c = zero;
+    c->conf = *conf;
+    c->wifi = *wifi;
+    c->backoff_ms = conf->backoff_min_ms;
+
+    uint32_t now = HAL_GetTick();
+    ISM43362_RET ret = ism43362_join_network(wifi);
+    if (ret != Ok) {
+        // ism43362_conn_poll() keeps trying
+        c->down_since = now;
+        c->next_attempt = now + c->backoff_ms;
+        return ret;
+    }
+    c->up = true;
+    c->last_probe = now;
+    return Ok;
+}
+
+static ISM43362_RET add_socket(ISM43362Conn *c, Socket s, const ConnSocket *sock) {
+    c->sockets[s] = *sock;
+    uint32_t now = HAL_GetTick();
+    if (!c->up) {
+        socket_lost(c, s, now);
+        return NotConnected;
+    }
+    ISM43362_RET ret = start_socket(&c->sockets[s]);
+    if (ret != Ok) {
+        // the start is tried again after the backoff
+        socket_lost(c, s, HAL_GetTick());
+        c->next_restart = HAL_GetTick() + c->restart_backoff_ms;
+        c->restart_backoff_ms = next_backoff(c, c->restart_backoff_ms);
+        c->probe_now = true;
+    }
+    return ret;
+}
+
+ISM43362_RET ism43362_conn_add_client(ISM43362Conn *c, const WifiClientConfig *client) {
+    ConnSocket sock = {.kind = CONN_SOCKET_CLIENT, .conf.client = *client};
+    ISM43362_RET ret = ism43362_encode_client_setup(client, &sock.setup);
+    if (ret != Ok) {
+        return ret;
+    }
+    return add_socket(c, client->s, &sock);
+}
+
+ISM43362_RET ism43362_conn_add_udp_server(ISM43362Conn *c, const WifiBaseServerConfig *server) {
+    ConnSocket sock = {.kind = CONN_SOCKET_UDP_SERVER, .conf.udp_server = *server};
+    ISM43362_RET ret = ism43362_encode_udp_server_setup(server, &sock.setup);
+    if (ret != Ok) {
+        return ret;
+    }
+    return add_socket(c, server->s, &sock);
+}
+
+ISM43362_RET ism43362_conn_add_tcp_server(ISM43362Conn *c, const WifiTcpServerConfig *server) {
+    ConnSocket sock = {.kind = CONN_SOCKET_TCP_SERVER, .conf.tcp_server = *server};
+    ISM43362_RET ret = ism43362_encode_tcp_server_setup(server, &sock.setup);
+    if (ret != Ok) {
+        return ret;
+    }
+    return add_socket(c, server->base_conf.s, &sock);
+}
+
+void ism43362_conn_poll(ISM43362Conn *c) {
+    uint32_t now = HAL_GetTick();
+    if (!c->up) {
+        if (TICK_REACHED(now, c->next_attempt)) {
+            try_rejoin(c, now);
+        }
+        return;
+    }
+
+    if (c->probe_now || now - c->last_probe >= c->conf.probe_period_ms) {
+        c->probe_now = false;
+        c->last_probe = now;
+        bool connected = false;
+        if (ism43362_is_connected(&connected) != Ok || !connected) {
+            link_lost(c, now);
+            return;
+        }
+    }
+    if (c->lost_sockets != 0) {
+        restart_sockets(c, now);
+    }
+}
+
+bool ism43362_conn_is_up(const ISM43362Conn *c) { return c->up; }
+
+// a failed command might mean the link or the socket is gone
+static ISM43362_RET check_ret(ISM43362Conn *c, Socket s, ISM43362_RET ret) {
+    if (ret == BadResponse || ret == Timeout) {
+        c->probe_now = true;
+        if (c->sockets[s].kind != CONN_SOCKET_UNUSED) {
+            socket_lost(c, s, HAL_GetTick());
+        }
+    }
+    return ret;
+}
+
+ISM43362_RET ism43362_conn_send(ISM43362Conn *c, Socket s, const uint8_t *packet, size_t size) {
+    if (!c->up || (c->lost_sockets & (1 << s))) {
+        return NotConnected;
+    }
+    return check_ret(c, s, ism43362_socket_send(s, packet, size));
+}
+
+ISM43362_RET ism43362_conn_read(ISM43362Conn *c, Socket s, uint8_t *packet_buff, size_t buff_size,
+                                size_t *packet_size) {
+    *packet_size = 0;
+    if (!c->up || (c->lost_sockets & (1 << s))) {
+        return NotConnected;
+    }
+    return check_ret(c, s, ism43362_socket_read(s, packet_buff, buff_size, packet_size));
+}
@@ -0,0 +1,75 @@
+#ifndef ISM43362_CONN_H
+#define ISM43362_CONN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ism43362.h"
+
+// Keeps the module connected: the link is probed periodically with CS, when it's lost the network is joined again
+// with exponential backoff and the sockets that were open are restarted. The restarts that fail, e.g. a client whose
+// remote is down and takes the whole connect timeout, are tried again with the same backoff. While the link is down
+// the sends and reads return NotConnected immediately.
+
+typedef struct {
+    uint32_t probe_period_ms;
+    uint32_t backoff_min_ms;
+    uint32_t backoff_max_ms;
+} ISM43362ConnConfig;
+
+typedef enum { CONN_SOCKET_UNUSED, CONN_SOCKET_CLIENT, CONN_SOCKET_UDP_SERVER, CONN_SOCKET_TCP_SERVER } ConnSocketKind;
+
+typedef struct {
+    ConnSocketKind kind;
+    union {
+        WifiClientConfig client;
+        WifiBaseServerConfig udp_server;
+        WifiTcpServerConfig tcp_server;
+    } conf;
+    ISM43362SocketSetup setup; // replayed when the driver lost the socket settings
+} ConnSocket;
+
+typedef struct {
+    uint32_t link_losses;
+    uint32_t rejoins;
+    uint32_t failed_rejoins;
+    uint32_t socket_restarts;
+    uint32_t failed_restarts;
+    uint32_t downtime_ms; // total
+    uint32_t last_reconnect_ms; // from the loss detection to the link back up
+    uint32_t max_reconnect_ms;
+} ISM43362ConnStats;
+
+typedef struct {
+    ISM43362ConnConfig conf;
+    JoinWifiConfig wifi;
+    ConnSocket sockets[4];
+
+    bool up;
+    bool probe_now; // a command failed, the link is checked at the next poll
+    uint8_t lost_sockets; // bit per socket to restart
+    uint32_t last_probe;
+    uint32_t down_since;
+    uint32_t next_attempt;
+    uint32_t backoff_ms;
+    uint32_t next_restart;
+    uint32_t restart_backoff_ms;
+
+    ISM43362ConnStats stats;
+} ISM43362Conn;
+
+ISM43362ConnConfig ism43362_conn_get_default_config();
+// joins the network
+ISM43362_RET ism43362_conn_init(ISM43362Conn *c, const ISM43362ConnConfig *conf, const JoinWifiConfig *wifi);
+// start the socket and restart it after a loss
+ISM43362_RET ism43362_conn_add_client(ISM43362Conn *c, const WifiClientConfig *client);
+ISM43362_RET ism43362_conn_add_udp_server(ISM43362Conn *c, const WifiBaseServerConfig *server);
+ISM43362_RET ism43362_conn_add_tcp_server(ISM43362Conn *c, const WifiTcpServerConfig *server);
+// to call periodically, e.g. in the main loop
+void ism43362_conn_poll(ISM43362Conn *c);
+bool ism43362_conn_is_up(const ISM43362Conn *c);
+ISM43362_RET ism43362_conn_send(ISM43362Conn *c, Socket s, const uint8_t *packet, size_t size);
+ISM43362_RET ism43362_conn_read(ISM43362Conn *c, Socket s, uint8_t *packet_buff, size_t buff_size,
+                                size_t *packet_size);
+
+#endif
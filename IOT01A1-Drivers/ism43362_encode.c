@@ -0,0 +1,77 @@
+#include "ism43362_encode.h"
+
+void ism43362_enc_init(ISM43362Encoder *e, char *buff, size_t size) {
+    e->buff = buff;
+    e->size = size;
+    e->len = 0;
+    e->overflow = size == 0;
+    if (size > 0) {
+        buff[0] = 0;
+    }
+}
+
+// appends n bytes, one byte is kept for the terminator
+static void append(ISM43362Encoder *e, const char *data, size_t n) {
+    if (e->overflow) {
+        return;
+    }
+    if (n >= e->size - e->len) {
+        e->overflow = true;
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        e->buff[e->len++] = data[i];
+    }
+    e->buff[e->len] = 0;
+}
+
+void ism43362_enc_str(ISM43362Encoder *e, const char *s) {
+    size_t n = 0;
+    while (s[n] != 0) {
+        n++;
+    }
+    append(e, s, n);
+}
+
+void ism43362_enc_char(ISM43362Encoder *e, char c) { append(e, &c, 1); }
+
+void ism43362_enc_u32(ISM43362Encoder *e, uint32_t v) {
+    // the digits are written from the last one
+    char digits[10];
+    size_t n = sizeof(digits);
+    do {
+        digits[--n] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    append(e, digits + n, sizeof(digits) - n);
+}
+
+void ism43362_enc_ip(ISM43362Encoder *e, const uint8_t *ip) {
+    for (size_t i = 0; i < 4; i++) {
+        if (i > 0) {
+            ism43362_enc_char(e, '.');
+        }
+        ism43362_enc_u32(e, ip[i]);
+    }
+}
+
+void ism43362_enc_param(ISM43362Encoder *e, const char *name, uint32_t v) {
+    ism43362_enc_str(e, name);
+    ism43362_enc_char(e, '=');
+    ism43362_enc_u32(e, v);
+    ism43362_enc_str(e, "\r\n");
+}
+
+void ism43362_enc_param_ip(ISM43362Encoder *e, const char *name, const uint8_t *ip) {
+    ism43362_enc_str(e, name);
+    ism43362_enc_char(e, '=');
+    ism43362_enc_ip(e, ip);
+    ism43362_enc_str(e, "\r\n");
+}
+
+void ism43362_enc_param_str(ISM43362Encoder *e, const char *name, const char *s) {
+    ism43362_enc_str(e, name);
+    ism43362_enc_char(e, '=');
+    ism43362_enc_str(e, s);
+    ism43362_enc_str(e, "\r\n");
+}
@@ -0,0 +1,30 @@
+#ifndef ISM43362_ENCODE_H
+#define ISM43362_ENCODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Builds the module commands without the printf family: strings and numbers are appended to a buffer, which is
+// always terminated, what doesn't fit sets overflow and the following appends are ignored.
+
+typedef struct {
+    char *buff;
+    size_t size;
+    size_t len;
+    bool overflow;
+} ISM43362Encoder;
+
+void ism43362_enc_init(ISM43362Encoder *e, char *buff, size_t size);
+void ism43362_enc_str(ISM43362Encoder *e, const char *s);
+void ism43362_enc_char(ISM43362Encoder *e, char c);
+// decimal
+void ism43362_enc_u32(ISM43362Encoder *e, uint32_t v);
+// "a.b.c.d"
+void ism43362_enc_ip(ISM43362Encoder *e, const uint8_t *ip);
+// "name=value\r\n"
+void ism43362_enc_param(ISM43362Encoder *e, const char *name, uint32_t v);
+void ism43362_enc_param_ip(ISM43362Encoder *e, const char *name, const uint8_t *ip);
+void ism43362_enc_param_str(ISM43362Encoder *e, const char *name, const char *s);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef ISM43362_OS_H
+#define ISM43362_OS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Operating system primitives used by the RTOS mode, ports are provided for FreeRTOS (define ISM43362_OS_FREERTOS)
+// and pthreads (define ISM43362_OS_PTHREAD, for host tests), others can be written filling the same table.
+
+#define ISM43362_OS_WAIT_FOREVER 0xFFFFFFFF
+
+typedef struct {
+    // bounded queue of fixed size items, copied in and out
+    void *(*queue_create)(size_t len, size_t item_size);
+    bool (*queue_send)(void *q, const void *item, uint32_t timeout_ms);
+    bool (*queue_receive)(void *q, void *item, uint32_t timeout_ms);
+
+    // binary semaphore given from an interrupt
+    void *(*signal_create)(void);
+    bool (*signal_wait)(void *s, uint32_t timeout_ms);
+    void (*signal_give_from_isr)(void *s);
+
+    // direct notification of a task, e.g. FreeRTOS task notifications, it must not be shared with the application
+    void *(*task_self)(void);
+    void (*task_notify)(void *task);
+    void (*task_wait)(void);
+
+    // mutex taken by tasks, not from interrupts
+    void *(*lock_create)(void);
+    void (*lock)(void *l);
+    void (*unlock)(void *l);
+} ISM43362OsPort;
+
+#ifdef ISM43362_OS_FREERTOS
+extern const ISM43362OsPort ism43362_os_freertos;
+#endif
+#ifdef ISM43362_OS_PTHREAD
+extern const ISM43362OsPort ism43362_os_pthread;
+#endif
+
+#endif
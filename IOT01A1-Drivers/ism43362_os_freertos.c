@@ -0,0 +1,75 @@
+#include "ism43362_os.h"
+
+#ifdef ISM43362_OS_FREERTOS
+
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "task.h"
+
+// the notification used to wake the tasks waiting for the owner task, the index 0 is used by the application and by
+// the CMSIS-RTOS2 thread flags
+#ifndef ISM43362_OS_NOTIFY_INDEX
+#define ISM43362_OS_NOTIFY_INDEX 1
+#endif
+
+#if !defined(configTASK_NOTIFICATION_ARRAY_ENTRIES) || configTASK_NOTIFICATION_ARRAY_ENTRIES <= ISM43362_OS_NOTIFY_INDEX
+#error "set configTASK_NOTIFICATION_ARRAY_ENTRIES above ISM43362_OS_NOTIFY_INDEX (FreeRTOS 10.4 or later)"
+#endif
+
+// rounded up, pdMS_TO_TICKS() truncates and a short wait below the tick period would become a poll
+static TickType_t to_ticks(uint32_t timeout_ms) {
+    if (timeout_ms == ISM43362_OS_WAIT_FOREVER) {
+        return portMAX_DELAY;
+    }
+    return (TickType_t) (((uint64_t) timeout_ms * configTICK_RATE_HZ + 999) / 1000);
+}
+
+static void *queue_create(size_t len, size_t item_size) { return xQueueCreate(len, item_size); }
+
+static bool queue_send(void *q, const void *item, uint32_t timeout_ms) {
+    return xQueueSend((QueueHandle_t) q, item, to_ticks(timeout_ms)) == pdPASS;
+}
+
+static bool queue_receive(void *q, void *item, uint32_t timeout_ms) {
+    return xQueueReceive((QueueHandle_t) q, item, to_ticks(timeout_ms)) == pdPASS;
+}
+
+static void *signal_create(void) { return xSemaphoreCreateBinary(); }
+
+static bool signal_wait(void *s, uint32_t timeout_ms) {
+    return xSemaphoreTake((SemaphoreHandle_t) s, to_ticks(timeout_ms)) == pdTRUE;
+}
+
+static void signal_give_from_isr(void *s) {
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR((SemaphoreHandle_t) s, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void *task_self(void) { return xTaskGetCurrentTaskHandle(); }
+
+static void task_notify(void *task) { xTaskNotifyGiveIndexed((TaskHandle_t) task, ISM43362_OS_NOTIFY_INDEX); }
+
+static void task_wait(void) { ulTaskNotifyTakeIndexed(ISM43362_OS_NOTIFY_INDEX, pdTRUE, portMAX_DELAY); }
+
+static void *lock_create(void) { return xSemaphoreCreateMutex(); }
+
+static void lock(void *l) { xSemaphoreTake((SemaphoreHandle_t) l, portMAX_DELAY); }
+
+static void unlock(void *l) { xSemaphoreGive((SemaphoreHandle_t) l); }
+
+const ISM43362OsPort ism43362_os_freertos = {.queue_create = queue_create,
+                                             .queue_send = queue_send,
+                                             .queue_receive = queue_receive,
+                                             .signal_create = signal_create,
+                                             .signal_wait = signal_wait,
+                                             .signal_give_from_isr = signal_give_from_isr,
+                                             .task_self = task_self,
+                                             .task_notify = task_notify,
+                                             .task_wait = task_wait,
+                                             .lock_create = lock_create,
+                                             .lock = lock,
+                                             .unlock = unlock};
+
+#endif
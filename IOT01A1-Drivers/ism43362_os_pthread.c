@@ -0,0 +1,172 @@
+#include "ism43362_os.h"
+
+#ifdef ISM43362_OS_PTHREAD
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} Waitable;
+
+static void waitable_init(Waitable *w) {
+    pthread_mutex_init(&w->mutex, NULL);
+    pthread_cond_init(&w->cond, NULL);
+}
+
+// waits on the condition with the mutex held, returns false on timeout
+static bool waitable_wait(Waitable *w, uint32_t timeout_ms) {
+    if (timeout_ms == ISM43362_OS_WAIT_FOREVER) {
+        return pthread_cond_wait(&w->cond, &w->mutex) == 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(&w->cond, &w->mutex, &ts) == 0;
+}
+
+typedef struct {
+    Waitable w;
+    uint8_t *items;
+    size_t len;
+    size_t item_size;
+    size_t head;
+    size_t count;
+} Queue;
+
+static void *queue_create(size_t len, size_t item_size) {
+    Queue *q = calloc(1, sizeof(Queue));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->items = calloc(len, item_size);
+    if (q->items == NULL) {
+        free(q);
+        return NULL;
+    }
+    waitable_init(&q->w);
+    q->len = len;
+    q->item_size = item_size;
+    return q;
+}
+
+static bool queue_send(void *queue, const void *item, uint32_t timeout_ms) {
+    Queue *q = queue;
+    pthread_mutex_lock(&q->w.mutex);
+    while (q->count == q->len) {
+        if (!waitable_wait(&q->w, timeout_ms)) {
+            pthread_mutex_unlock(&q->w.mutex);
+            return false;
+        }
+    }
+    memcpy(q->items + ((q->head + q->count) % q->len) * q->item_size, item, q->item_size);
+    q->count++;
+    pthread_cond_broadcast(&q->w.cond);
+    pthread_mutex_unlock(&q->w.mutex);
+    return true;
+}
+
+static bool queue_receive(void *queue, void *item, uint32_t timeout_ms) {
+    Queue *q = queue;
+    pthread_mutex_lock(&q->w.mutex);
+    while (q->count == 0) {
+        if (!waitable_wait(&q->w, timeout_ms)) {
+            pthread_mutex_unlock(&q->w.mutex);
+            return false;
+        }
+    }
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->len;
+    q->count--;
+    pthread_cond_broadcast(&q->w.cond);
+    pthread_mutex_unlock(&q->w.mutex);
+    return true;
+}
+
+typedef struct {
+    Waitable w;
+    bool given;
+} Signal;
+
+static void *signal_create(void) {
+    Signal *s = calloc(1, sizeof(Signal));
+    if (s != NULL) {
+        waitable_init(&s->w);
+    }
+    return s;
+}
+
+static bool signal_wait(void *signal, uint32_t timeout_ms) {
+    Signal *s = signal;
+    pthread_mutex_lock(&s->w.mutex);
+    while (!s->given) {
+        if (!waitable_wait(&s->w, timeout_ms)) {
+            pthread_mutex_unlock(&s->w.mutex);
+            return false;
+        }
+    }
+    s->given = false;
+    pthread_mutex_unlock(&s->w.mutex);
+    return true;
+}
+
+// the simulated interrupt runs in a thread
+static void signal_give_from_isr(void *signal) {
+    Signal *s = signal;
+    pthread_mutex_lock(&s->w.mutex);
+    s->given = true;
+    pthread_cond_signal(&s->w.cond);
+    pthread_mutex_unlock(&s->w.mutex);
+}
+
+// each thread has its own notification
+static __thread Signal task_signal;
+static __thread bool task_signal_ready = false;
+
+static void *task_self(void) {
+    if (!task_signal_ready) {
+        waitable_init(&task_signal.w);
+        task_signal.given = false;
+        task_signal_ready = true;
+    }
+    return &task_signal;
+}
+
+static void task_notify(void *task) { signal_give_from_isr(task); }
+
+static void task_wait(void) { signal_wait(task_self(), ISM43362_OS_WAIT_FOREVER); }
+
+static void *lock_create(void) {
+    pthread_mutex_t *m = calloc(1, sizeof(pthread_mutex_t));
+    if (m != NULL) {
+        pthread_mutex_init(m, NULL);
+    }
+    return m;
+}
+
+static void lock(void *l) { pthread_mutex_lock(l); }
+
+static void unlock(void *l) { pthread_mutex_unlock(l); }
+
+const ISM43362OsPort ism43362_os_pthread = {.queue_create = queue_create,
+                                            .queue_send = queue_send,
+                                            .queue_receive = queue_receive,
+                                            .signal_create = signal_create,
+                                            .signal_wait = signal_wait,
+                                            .signal_give_from_isr = signal_give_from_isr,
+                                            .task_self = task_self,
+                                            .task_notify = task_notify,
+                                            .task_wait = task_wait,
+                                            .lock_create = lock_create,
+                                            .lock = lock,
+                                            .unlock = unlock};
+
+#endif
@@ -0,0 +1,251 @@
+#include "ism43362_parser.h"
+
+#define ISM_PARSER_PAD 0x15
+
+void ism43362_parser_init(ISM43362Parser *p, const ISM43362Field *fields, size_t count, const char *separators) {
+    ISM43362Parser zero = {0};
+    *p = zero;
+    p->fields = fields;
+    p->count = fields == NULL || count > ISM43362_PARSER_MAX_FIELDS ? 0 : count;
+    p->separators = separators == NULL ? "," : separators;
+    p->status = ISM_PARSE_RUNNING;
+}
+
+void ism43362_parser_set_callback(ISM43362Parser *p, ISM43362MatchCallback on_match, void *ctx) {
+    p->on_match = on_match;
+    p->ctx = ctx;
+}
+
+static bool is_separator(const ISM43362Parser *p, uint8_t c) {
+    for (const char *s = p->separators; *s != 0; s++) {
+        if (*s == c) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parsing_fields(const ISM43362Parser *p) {
+    return !p->matched && !p->line_failed && !p->line_done && p->field < p->count;
+}
+
+static bool add_digit(ISM43362Parser *p, uint8_t c, uint32_t max) {
+    if (c < '0' || c > '9' || p->value > (max - (c - '0')) / 10) {
+        p->line_failed = true;
+        return false;
+    }
+    p->value = p->value * 10 + (c - '0');
+    return true;
+}
+
+static void field_char(ISM43362Parser *p, uint8_t c) {
+    const ISM43362Field *f = &p->fields[p->field];
+    switch (f->type) {
+        case ISM_FIELD_SKIP:
+            break;
+        case ISM_FIELD_MATCH:
+            if (f->literal[p->field_len] != c) {
+                p->line_failed = true;
+            }
+            break;
+        case ISM_FIELD_STR:
+            if (p->field_len + 1 < f->size && p->str_len < ISM43362_PARSER_STR_STAGE) {
+                p->str[p->str_len++] = c;
+            }
+            break;
+        case ISM_FIELD_U8:
+        case ISM_FIELD_BOOL:
+            add_digit(p, c, UINT8_MAX);
+            break;
+        case ISM_FIELD_U16:
+            add_digit(p, c, UINT16_MAX);
+            break;
+        case ISM_FIELD_U32:
+            add_digit(p, c, UINT32_MAX);
+            break;
+        case ISM_FIELD_IP:
+            if (c == '.' && p->octet < 3 && p->octet_digits) {
+                p->values[p->field] = p->values[p->field] << 8 | p->value;
+                p->octet++;
+                p->value = 0;
+                p->octet_digits = false;
+            } else {
+                p->octet_digits = add_digit(p, c, UINT8_MAX);
+            }
+            break;
+    }
+    p->field_len++;
+}
+
+// the line matched all the fields, the staged values go to the destinations
+static void commit_fields(ISM43362Parser *p) {
+    for (size_t i = 0; i < p->count; i++) {
+        const ISM43362Field *f = &p->fields[i];
+        uint32_t v = p->values[i];
+        switch (f->type) {
+            case ISM_FIELD_SKIP:
+            case ISM_FIELD_MATCH:
+                break;
+            case ISM_FIELD_STR: {
+                if (f->size == 0) {
+                    break;
+                }
+                // the end of this string is the start of the next one
+                uint16_t end = p->str_len;
+                for (size_t j = i + 1; j < p->count; j++) {
+                    if (p->fields[j].type == ISM_FIELD_STR) {
+                        end = p->str_start[j];
+                        break;
+                    }
+                }
+                size_t len = 0;
+                for (uint16_t j = p->str_start[i]; j < end; j++) {
+                    ((char *) f->dst)[len++] = p->str[j];
+                }
+                ((char *) f->dst)[len] = 0;
+                break;
+            }
+            case ISM_FIELD_U8:
+                *(uint8_t *) f->dst = v;
+                break;
+            case ISM_FIELD_U16:
+                *(uint16_t *) f->dst = v;
+                break;
+            case ISM_FIELD_U32:
+                *(uint32_t *) f->dst = v;
+                break;
+            case ISM_FIELD_BOOL:
+                *(bool *) f->dst = v == 1;
+                break;
+            case ISM_FIELD_IP:
+                for (int o = 3; o >= 0; o--) {
+                    ((uint8_t *) f->dst)[o] = v;
+                    v >>= 8;
+                }
+                break;
+        }
+    }
+}
+
+static void finish_field(ISM43362Parser *p) {
+    const ISM43362Field *f = &p->fields[p->field];
+    switch (f->type) {
+        case ISM_FIELD_SKIP:
+        case ISM_FIELD_STR:
+            break;
+        case ISM_FIELD_MATCH:
+            if (f->literal[p->field_len] != 0) {
+                p->line_failed = true;
+                return;
+            }
+            break;
+        case ISM_FIELD_U8:
+        case ISM_FIELD_U16:
+        case ISM_FIELD_U32:
+        case ISM_FIELD_BOOL:
+            p->values[p->field] = p->value;
+            break;
+        case ISM_FIELD_IP:
+            if (p->octet != 3 || !p->octet_digits) {
+                p->line_failed = true;
+                return;
+            }
+            p->values[p->field] = p->values[p->field] << 8 | p->value;
+            break;
+    }
+    p->field++;
+    p->field_len = 0;
+    p->value = 0;
+    p->octet = 0;
+    p->octet_digits = false;
+    if (p->field < p->count) {
+        p->str_start[p->field] = p->str_len;
+        p->values[p->field] = 0;
+    }
+    if (p->field == p->count) {
+        p->matches++;
+        commit_fields(p);
+        if (p->on_match != NULL) {
+            p->on_match(p->ctx);
+            p->line_done = true;
+        } else {
+            p->matched = true;
+        }
+    }
+}
+
+static bool line_is(const ISM43362Parser *p, const char *s, bool exact) {
+    size_t i = 0;
+    for (; s[i] != 0; i++) {
+        if (i >= p->line_len || p->line_start[i] != s[i]) {
+            return false;
+        }
+    }
+    return !exact || i == p->line_len;
+}
+
+static void reset_fields(ISM43362Parser *p) {
+    p->field = 0;
+    p->field_len = 0;
+    p->value = 0;
+    p->octet = 0;
+    p->octet_digits = false;
+    p->values[0] = 0;
+    p->str_start[0] = 0;
+    p->str_len = 0;
+}
+
+static void end_line(ISM43362Parser *p) {
+    // a payload line looking like a status is followed by other lines, only the last one counts
+    if (p->line_len > 0) {
+        p->ok_seen = line_is(p, "OK", true);
+        p->error_seen = line_is(p, "ERROR", false);
+    }
+    p->line_len = 0;
+    p->line_failed = false;
+    p->line_done = false;
+    p->prompt = false;
+    if (!p->matched) {
+        reset_fields(p);
+    }
+}
+
+void ism43362_parser_feed(ISM43362Parser *p, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        // after the prompt only the SPI padding follows, anything else means it was part of the payload
+        if (p->status != ISM_PARSE_RUNNING) {
+            if (c == ISM_PARSER_PAD) {
+                continue;
+            }
+            p->status = ISM_PARSE_RUNNING;
+        }
+        if (c == '\n') {
+            end_line(p);
+            continue;
+        }
+        if (c == '\r') {
+            if (p->line_len > 0 && parsing_fields(p)) {
+                finish_field(p);
+            }
+            continue;
+        }
+        if (p->prompt && p->line_len == 1 && c == ' ') {
+            p->status = p->error_seen ? ISM_PARSE_ERROR : ISM_PARSE_OK;
+        }
+        p->prompt = p->line_len == 0 && c == '>' && (p->ok_seen || p->error_seen);
+
+        if (p->line_len < sizeof(p->line_start)) {
+            p->line_start[p->line_len] = c;
+        }
+        p->line_len++;
+        if (!parsing_fields(p)) {
+            continue;
+        }
+        if (is_separator(p, c)) {
+            finish_field(p);
+        } else {
+            field_char(p, c);
+        }
+    }
+}
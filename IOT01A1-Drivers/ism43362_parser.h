@@ -0,0 +1,85 @@
+#ifndef ISM43362_PARSER_H
+#define ISM43362_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental parser of the module responses, it's fed the bytes as they are read from the SPI and recognizes the
+// OK/ERROR line followed by the "> " prompt, only when they end the response (only the SPI padding follows), so the
+// same text in a payload doesn't end the parse. The lines before it are matched against a table of fields, the
+// values are kept in the parser and copied to the destinations only when a whole line matches, the first such line
+// fills them.
+
+#ifndef ISM43362_PARSER_MAX_FIELDS
+#define ISM43362_PARSER_MAX_FIELDS 16
+#endif
+
+// room for the string fields of a line, a string not fitting is truncated
+#ifndef ISM43362_PARSER_STR_STAGE
+#define ISM43362_PARSER_STR_STAGE 112
+#endif
+
+typedef enum {
+    ISM_FIELD_SKIP,
+    ISM_FIELD_MATCH, // the field must be equal to literal, otherwise the line is skipped
+    ISM_FIELD_STR, // char[size], always terminated
+    ISM_FIELD_U8, // the numbers out of range don't match
+    ISM_FIELD_U16,
+    ISM_FIELD_U32,
+    ISM_FIELD_BOOL, // "1" is true
+    ISM_FIELD_IP, // uint8_t[4], "a.b.c.d" with every octet up to 255
+} ISM43362FieldType;
+
+typedef struct {
+    ISM43362FieldType type;
+    void *dst;
+    size_t size; // only for ISM_FIELD_STR
+    const char *literal; // only for ISM_FIELD_MATCH
+} ISM43362Field;
+
+// OK and ERROR are final once the whole response was fed
+typedef enum { ISM_PARSE_RUNNING, ISM_PARSE_OK, ISM_PARSE_ERROR } ISM43362ParseStatus;
+
+// called for every line matching all the fields, while the destinations hold its values
+typedef void (*ISM43362MatchCallback)(void *ctx);
+
+typedef struct {
+    const ISM43362Field *fields;
+    size_t count;
+    const char *separators;
+
+    ISM43362ParseStatus status;
+    bool matched; // a line matched all the fields
+    ISM43362MatchCallback on_match; // NULL to stop at the first matching line
+    void *ctx;
+    uint16_t matches;
+    // the last non empty line is the status, the prompt after it ends the parse
+    bool ok_seen;
+    bool error_seen;
+    bool prompt;
+
+    // current line
+    char line_start[5];
+    size_t line_len;
+    bool line_failed;
+    bool line_done;
+    size_t field;
+    size_t field_len;
+    uint32_t value;
+    uint8_t octet;
+    bool octet_digits;
+    uint32_t values[ISM43362_PARSER_MAX_FIELDS]; // the IP octets are packed
+    uint16_t str_start[ISM43362_PARSER_MAX_FIELDS];
+    uint16_t str_len;
+    char str[ISM43362_PARSER_STR_STAGE];
+} ISM43362Parser;
+
+// fields can be NULL to only check the trailer, separators NULL means ",", a table with more than
+// ISM43362_PARSER_MAX_FIELDS fields never matches
+void ism43362_parser_init(ISM43362Parser *p, const ISM43362Field *fields, size_t count, const char *separators);
+// every matching line is passed to on_match instead of only the first one
+void ism43362_parser_set_callback(ISM43362Parser *p, ISM43362MatchCallback on_match, void *ctx);
+void ism43362_parser_feed(ISM43362Parser *p, const uint8_t *data, size_t len);
+
+#endif
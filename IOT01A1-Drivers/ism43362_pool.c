@@ -0,0 +1,114 @@
+#include "ism43362_pool.h"
+
+#if ISM43362_POOL_CMD_COUNT > 32 || ISM43362_POOL_PAYLOAD_COUNT > 32
+#error "at most 32 buffers per class"
+#endif
+
+// the storage is made of words so the buffers can be used for 16 bits SPI DMA transfers
+#define POOL_WORDS(size) (((size) + 3) / 4)
+
+static uint32_t cmd_storage[ISM43362_POOL_CMD_COUNT][POOL_WORDS(ISM43362_POOL_CMD_SIZE)];
+static uint32_t payload_storage[ISM43362_POOL_PAYLOAD_COUNT][POOL_WORDS(ISM43362_POOL_PAYLOAD_SIZE)];
+
+typedef struct {
+    uint8_t *base;
+    size_t stride;
+    uint32_t used; // bit per buffer
+    ISM43362PoolUsage usage;
+} Pool;
+
+static Pool pools[ISM_POOL_CLASSES] = {
+    {.base = (uint8_t *) cmd_storage,
+     .stride = sizeof(cmd_storage[0]),
+     .usage = {.size = ISM43362_POOL_CMD_SIZE, .count = ISM43362_POOL_CMD_COUNT}},
+    {.base = (uint8_t *) payload_storage,
+     .stride = sizeof(payload_storage[0]),
+     .usage = {.size = ISM43362_POOL_PAYLOAD_SIZE, .count = ISM43362_POOL_PAYLOAD_COUNT}},
+};
+
+static void (*lock_fn)(void *l) = NULL;
+static void (*unlock_fn)(void *l) = NULL;
+static void *lock_arg = NULL;
+
+void ism43362_pool_set_lock(void (*lock)(void *l), void (*unlock)(void *l), void *l) {
+    lock_fn = lock;
+    unlock_fn = unlock;
+    lock_arg = l;
+}
+
+static void pool_lock() {
+    if (lock_fn != NULL) {
+        lock_fn(lock_arg);
+    }
+}
+
+static void pool_unlock() {
+    if (unlock_fn != NULL) {
+        unlock_fn(lock_arg);
+    }
+}
+
+static uint8_t *borrow(Pool *p) {
+    for (uint8_t i = 0; i < p->usage.count; i++) {
+        uint32_t bit = (uint32_t) 1 << i;
+        if (p->used & bit) {
+            continue;
+        }
+        p->used |= bit;
+        p->usage.in_use++;
+        if (p->usage.in_use > p->usage.high_water) {
+            p->usage.high_water = p->usage.in_use;
+        }
+        return p->base + i * p->stride;
+    }
+    p->usage.failures++;
+    return NULL;
+}
+
+uint8_t *ism43362_pool_borrow(ISM43362PoolClass c) {
+    pool_lock();
+    uint8_t *buff = borrow(&pools[c]);
+    pool_unlock();
+    return buff;
+}
+
+static void give_back(Pool *p, uint8_t *buff) {
+    if (buff == NULL || buff < p->base) {
+        return;
+    }
+    size_t i = (size_t) (buff - p->base) / p->stride;
+    if (i >= p->usage.count) {
+        return;
+    }
+    uint32_t bit = (uint32_t) 1 << i;
+    // returned twice
+    if ((p->used & bit) == 0) {
+        return;
+    }
+    p->used &= ~bit;
+    p->usage.in_use--;
+}
+
+void ism43362_pool_return(ISM43362PoolClass c, uint8_t *buff) {
+    pool_lock();
+    give_back(&pools[c], buff);
+    pool_unlock();
+}
+
+size_t ism43362_pool_size(ISM43362PoolClass c) { return pools[c].usage.size; }
+
+ISM43362PoolUsage ism43362_pool_get_usage(ISM43362PoolClass c) {
+    pool_lock();
+    ISM43362PoolUsage usage = pools[c].usage;
+    pool_unlock();
+    return usage;
+}
+
+void ism43362_pool_reset_usage() {
+    pool_lock();
+    for (size_t c = 0; c < ISM_POOL_CLASSES; c++) {
+        pools[c].usage.high_water = pools[c].usage.in_use;
+        pools[c].usage.failures = 0;
+    }
+    pool_unlock();
+}
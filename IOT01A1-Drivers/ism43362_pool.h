@@ -0,0 +1,50 @@
+#ifndef ISM43362_POOL_H
+#define ISM43362_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ism43362.h"
+
+// Fixed pool of buffers owned by the driver, used instead of large stack buffers. The sizes and counts of every class
+// are set at compile time, a buffer is borrowed for as long as it's needed and returned after, and the highest number
+// of buffers in use at the same time is recorded to size the pool. In RTOS mode ism43362_rtos_init() sets a lock, so
+// the other tasks can borrow and return buffers too, never from an interrupt.
+
+// commands and scripts, e.g. the join script
+#ifndef ISM43362_POOL_CMD_SIZE
+#define ISM43362_POOL_CMD_SIZE ISM43362_SCRIPT_LEN
+#endif
+#ifndef ISM43362_POOL_CMD_COUNT
+#define ISM43362_POOL_CMD_COUNT 2
+#endif
+// received data, one per socket with unread data plus one for the application
+#ifndef ISM43362_POOL_PAYLOAD_SIZE
+#define ISM43362_POOL_PAYLOAD_SIZE (ISM43362_MAX_PAYLOAD + 140)
+#endif
+#ifndef ISM43362_POOL_PAYLOAD_COUNT
+#define ISM43362_POOL_PAYLOAD_COUNT 5
+#endif
+
+typedef enum { ISM_POOL_CMD, ISM_POOL_PAYLOAD, ISM_POOL_CLASSES } ISM43362PoolClass;
+
+typedef struct {
+    size_t size; // of each buffer
+    uint8_t count;
+    uint8_t in_use;
+    uint8_t high_water; // most buffers in use at the same time
+    uint32_t failures; // borrows with no free buffer
+} ISM43362PoolUsage;
+
+// NULL if every buffer of the class is in use
+uint8_t *ism43362_pool_borrow(ISM43362PoolClass c);
+void ism43362_pool_return(ISM43362PoolClass c, uint8_t *buff);
+size_t ism43362_pool_size(ISM43362PoolClass c);
+ISM43362PoolUsage ism43362_pool_get_usage(ISM43362PoolClass c);
+// restarts the high water marks from the buffers in use
+void ism43362_pool_reset_usage();
+// called around every access to the pool, e.g. the lock of ISM43362OsPort, NULL for none
+void ism43362_pool_set_lock(void (*lock)(void *l), void (*unlock)(void *l), void *l);
+
+#endif
@@ -0,0 +1,116 @@
+#include "ism43362_rtos.h"
+
+#include "ism43362_pool.h"
+
+typedef enum { RTOS_JOIN, RTOS_START_CLIENT, RTOS_SEND, RTOS_READ, RTOS_CALL } RtosRequestKind;
+
+// lives on the stack of the calling task, which waits until it's done
+typedef struct {
+    RtosRequestKind kind;
+    const void *conf;
+    Socket s;
+    const uint8_t *data;
+    uint8_t *buff;
+    size_t size;
+    size_t *len;
+    ISM43362RtosFunction fn;
+    void *arg;
+
+    void *task;
+    ISM43362_RET ret;
+} RtosRequest;
+
+static const ISM43362OsPort *os = NULL;
+static void *queue = NULL;
+static void *drdy = NULL;
+
+// the driver waits on the interrupt, with a short timeout since the module ready is a level
+static void wait_drdy() { os->signal_wait(drdy, 1); }
+
+ISM43362_RET ism43362_rtos_init(const ISM43362OsPort *port) {
+    os = port;
+    // the queue holds pointers to the requests
+    queue = os->queue_create(ISM43362_RTOS_QUEUE_LEN, sizeof(RtosRequest *));
+    drdy = os->signal_create();
+    void *pool_lock = os->lock_create();
+    if (queue == NULL || drdy == NULL || pool_lock == NULL) {
+        return Error;
+    }
+    // the other tasks can borrow buffers while the owner task uses the pool
+    ism43362_pool_set_lock(os->lock, os->unlock, pool_lock);
+    ism43362_set_idle_hook(wait_drdy);
+    return Ok;
+}
+
+void ism43362_rtos_drdy_exti_callback() {
+    ism43362_drdy_exti_callback();
+    if (drdy != NULL) {
+        os->signal_give_from_isr(drdy);
+    }
+}
+
+static ISM43362_RET execute(RtosRequest *req) {
+    switch (req->kind) {
+        case RTOS_JOIN:
+            return ism43362_join_network(req->conf);
+        case RTOS_START_CLIENT:
+            return ism43362_start_wifi_client(req->conf);
+        case RTOS_SEND:
+            return ism43362_socket_send(req->s, req->data, req->size);
+        case RTOS_READ:
+            return ism43362_socket_read(req->s, req->buff, req->size, req->len);
+        case RTOS_CALL:
+            return req->fn(req->arg);
+        default:
+            return Error;
+    }
+}
+
+void ism43362_rtos_task(void *arg) {
+    (void) arg;
+    for (;;) {
+        RtosRequest *req;
+        if (!os->queue_receive(queue, &req, ISM43362_OS_WAIT_FOREVER)) {
+            continue;
+        }
+        req->ret = execute(req);
+        os->task_notify(req->task);
+    }
+}
+
+static ISM43362_RET submit(RtosRequest *req) {
+    if (queue == NULL) {
+        return Error;
+    }
+    req->task = os->task_self();
+    if (!os->queue_send(queue, &req, ISM43362_RTOS_SUBMIT_TIMEOUT_MS)) {
+        return Timeout;
+    }
+    os->task_wait();
+    return req->ret;
+}
+
+ISM43362_RET ism43362_rtos_join(const JoinWifiConfig *conf) {
+    RtosRequest req = {.kind = RTOS_JOIN, .conf = conf};
+    return submit(&req);
+}
+
+ISM43362_RET ism43362_rtos_start_client(const WifiClientConfig *client) {
+    RtosRequest req = {.kind = RTOS_START_CLIENT, .conf = client};
+    return submit(&req);
+}
+
+ISM43362_RET ism43362_rtos_send(Socket s, const uint8_t *data, size_t len) {
+    RtosRequest req = {.kind = RTOS_SEND, .s = s, .data = data, .size = len};
+    return submit(&req);
+}
+
+ISM43362_RET ism43362_rtos_read(Socket s, uint8_t *buff, size_t size, size_t *len) {
+    RtosRequest req = {.kind = RTOS_READ, .s = s, .buff = buff, .size = size, .len = len};
+    return submit(&req);
+}
+
+ISM43362_RET ism43362_rtos_call(ISM43362RtosFunction fn, void *arg) {
+    RtosRequest req = {.kind = RTOS_CALL, .fn = fn, .arg = arg};
+    return submit(&req);
+}
@@ -0,0 +1,41 @@
+#ifndef ISM43362_RTOS_H
+#define ISM43362_RTOS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ism43362.h"
+#include "ism43362_os.h"
+
+// RTOS mode: a single task, running ism43362_rtos_task(), owns the SPI link and executes the requests the other tasks
+// submit through a bounded queue. The calling task sleeps until its request is done and the owner task sleeps on
+// the data ready interrupt instead of spinning. The other functions of the driver must only be called by the owner
+// task, e.g. through ism43362_rtos_call().
+
+#ifndef ISM43362_RTOS_QUEUE_LEN
+#define ISM43362_RTOS_QUEUE_LEN 8
+#endif
+// how long a task waits for room in the queue before getting Timeout
+#ifndef ISM43362_RTOS_SUBMIT_TIMEOUT_MS
+#define ISM43362_RTOS_SUBMIT_TIMEOUT_MS 1000
+#endif
+
+// executed by the owner task
+typedef ISM43362_RET (*ISM43362RtosFunction)(void *arg);
+
+// to call before starting the scheduler, os is e.g. &ism43362_os_freertos
+ISM43362_RET ism43362_rtos_init(const ISM43362OsPort *os);
+// to call from the EXTI callback instead of ism43362_drdy_exti_callback()
+void ism43362_rtos_drdy_exti_callback();
+// body of the owner task, never returns
+void ism43362_rtos_task(void *arg);
+
+// called by the other tasks, they block until the owner task is done
+ISM43362_RET ism43362_rtos_join(const JoinWifiConfig *conf);
+ISM43362_RET ism43362_rtos_start_client(const WifiClientConfig *client);
+ISM43362_RET ism43362_rtos_send(Socket s, const uint8_t *data, size_t len);
+ISM43362_RET ism43362_rtos_read(Socket s, uint8_t *buff, size_t size, size_t *len);
+ISM43362_RET ism43362_rtos_call(ISM43362RtosFunction fn, void *arg);
+
+#endif
@@ -0,0 +1,155 @@
+#include "ism43362_server.h"
+
+#include "../Inc/main.h"
+
+static void emit(ISM43362TcpServer *srv, TcpServerEventType type, const TcpServerConn *conn) {
+    if (srv->callback == NULL) {
+        return;
+    }
+    TcpServerEvent ev = {.type = type, .id = conn->id, .remote = conn->remote};
+    srv->callback(&ev, srv->ctx);
+}
+
+ISM43362_RET ism43362_tcp_server_init(ISM43362TcpServer *srv, const WifiTcpServerConfig *conf,
+                                      TcpServerEventCallback callback, void *ctx) {
+    ISM43362TcpServer zero = {0};
+    *srv = zero;
+    srv->conf = *conf;
+    if (srv->conf.listen_backlogs == 0) {
+        srv->conf.listen_backlogs = 1;
+    } else if (srv->conf.listen_backlogs > ISM43362_MAX_BACKLOG) {
+        srv->conf.listen_backlogs = ISM43362_MAX_BACKLOG;
+    }
+    srv->callback = callback;
+    srv->ctx = ctx;
+    // the first call reads the messages
+    srv->last_messages = HAL_GetTick() - ISM43362_SERVER_MESSAGES_MS;
+    return ism43362_start_tcp_server(&srv->conf);
+}
+
+static void on_accept(ISM43362TcpServer *srv, const WifiRemote *remote) {
+    if (srv->count >= srv->conf.listen_backlogs) {
+        srv->dropped_accepts++;
+        return;
+    }
+    if (srv->count == 0) {
+        srv->last_activity = HAL_GetTick();
+    }
+    TcpServerConn *conn = &srv->conns[srv->count];
+    conn->id = srv->next_id++;
+    conn->state = srv->count == 0 ? TCP_CONN_ACTIVE : TCP_CONN_PENDING;
+    conn->remote = *remote;
+    srv->count++;
+    emit(srv, TCP_SERVER_ACCEPTED, conn);
+}
+
+// a failed probe drops the connection like a failed transfer
+static ISM43362_RET check_ret(ISM43362TcpServer *srv, ISM43362_RET ret);
+
+// the data the probe receives stays in the driver for the next read, the poll also reads the module messages if no
+// accept is queued
+static ISM43362_RET probe_idle(ISM43362TcpServer *srv, bool *probed) {
+    *probed = false;
+    uint32_t now = HAL_GetTick();
+    if (ISM43362_SERVER_PROBE_MS == 0 || srv->count == 0 || now - srv->last_activity < ISM43362_SERVER_PROBE_MS) {
+        return Ok;
+    }
+    *probed = true;
+    srv->last_activity = now;
+    ISM43362PollResult res;
+    ISM43362_RET ret = ism43362_poll(1 << srv->conf.base_conf.s, &res);
+    // without a free buffer the probe is tried again later
+    return ret == NoBuffer ? Ok : check_ret(srv, ret);
+}
+
+ISM43362_RET ism43362_tcp_server_process(ISM43362TcpServer *srv) {
+    bool probed;
+    ISM43362_RET ret = probe_idle(srv, &probed);
+    uint32_t now = HAL_GetTick();
+    if (probed) {
+        srv->last_messages = now;
+    } else if (ism43362_pending_accepts() == 0 && now - srv->last_messages >= ISM43362_SERVER_MESSAGES_MS) {
+        srv->last_messages = now;
+        ret = ism43362_read_messages();
+    }
+    // the accepts found by other functions, e.g. ism43362_poll(), are already queued
+    WifiRemote remote;
+    while (ism43362_take_accept(&remote)) {
+        on_accept(srv, &remote);
+    }
+    return ret;
+}
+
+static int find(const ISM43362TcpServer *srv, uint8_t id) {
+    for (uint8_t i = 0; i < srv->count; i++) {
+        if (srv->conns[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const TcpServerConn *ism43362_tcp_server_get(const ISM43362TcpServer *srv, uint8_t id) {
+    int i = find(srv, id);
+    return i < 0 ? NULL : &srv->conns[i];
+}
+
+// removes the active connection, the next one in the backlog takes its place
+static void drop_active(ISM43362TcpServer *srv) {
+    TcpServerConn closed = srv->conns[0];
+    closed.state = TCP_CONN_FREE;
+    for (uint8_t i = 1; i < srv->count; i++) {
+        srv->conns[i - 1] = srv->conns[i];
+    }
+    srv->count--;
+    if (srv->count > 0) {
+        srv->conns[0].state = TCP_CONN_ACTIVE;
+        srv->last_activity = HAL_GetTick();
+    }
+    emit(srv, TCP_SERVER_CLOSED, &closed);
+}
+
+// a failed transfer on the active connection means the remote has gone
+static ISM43362_RET check_ret(ISM43362TcpServer *srv, ISM43362_RET ret) {
+    srv->last_activity = HAL_GetTick();
+    if (ret == BadResponse && srv->count > 0) {
+        drop_active(srv);
+    }
+    return ret;
+}
+
+ISM43362_RET ism43362_tcp_server_read(ISM43362TcpServer *srv, uint8_t id, uint8_t *buff, size_t buff_size,
+                                      size_t *read_len) {
+    *read_len = 0;
+    if (find(srv, id) != 0) {
+        return NotConnected;
+    }
+    return check_ret(srv, ism43362_socket_read(srv->conf.base_conf.s, buff, buff_size, read_len));
+}
+
+ISM43362_RET ism43362_tcp_server_write(ISM43362TcpServer *srv, uint8_t id, const uint8_t *data, size_t len) {
+    if (find(srv, id) != 0) {
+        return NotConnected;
+    }
+    return check_ret(srv, ism43362_socket_send(srv->conf.base_conf.s, data, len));
+}
+
+ISM43362_RET ism43362_tcp_server_close(ISM43362TcpServer *srv, uint8_t id) {
+    int i = find(srv, id);
+    if (i < 0) {
+        return NotConnected;
+    }
+    if (i != 0) {
+        return Error;
+    }
+    ISM43362_RET ret = ism43362_set_socket(srv->conf.base_conf.s);
+    if (ret != Ok) {
+        return ret;
+    }
+    ret = ism43362_tcp_server_close_curr_conn();
+    if (ret != Ok) {
+        return ret;
+    }
+    drop_active(srv);
+    return Ok;
+}
@@ -0,0 +1,77 @@
+#ifndef ISM43362_SERVER_H
+#define ISM43362_SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ism43362.h"
+
+// TCP server tracking every accepted connection. The module serves the connections of a server socket one at a
+// time, in the order they were accepted: the first one is active and can be read and written, the others wait in the
+// backlog until the ones before them are closed. Accepts and closes are reported through the callback.
+// The module doesn't signal accepts or closes, so ism43362_tcp_server_process() asks for the module messages (MR) at
+// most every ISM43362_SERVER_MESSAGES_MS, and a closed peer is only noticed by a transfer on the active connection or
+// by the probe of an idle one.
+
+#define ISM43362_MAX_BACKLOG 6
+
+// an active connection idle for this long is probed with a short read to notice a closed peer, 0 disables the probe
+#ifndef ISM43362_SERVER_PROBE_MS
+#define ISM43362_SERVER_PROBE_MS 1000
+#endif
+
+// the accepts are noticed this late at most, the ones queued by other functions, e.g. ism43362_poll(), are reported
+// at the next call
+#ifndef ISM43362_SERVER_MESSAGES_MS
+#define ISM43362_SERVER_MESSAGES_MS 100
+#endif
+
+typedef enum { TCP_CONN_FREE, TCP_CONN_PENDING, TCP_CONN_ACTIVE } TcpConnState;
+
+typedef struct {
+    uint8_t id;
+    TcpConnState state;
+    WifiRemote remote;
+} TcpServerConn;
+
+typedef enum { TCP_SERVER_ACCEPTED, TCP_SERVER_CLOSED } TcpServerEventType;
+
+typedef struct {
+    TcpServerEventType type;
+    uint8_t id;
+    WifiRemote remote;
+} TcpServerEvent;
+
+typedef void (*TcpServerEventCallback)(const TcpServerEvent *ev, void *ctx);
+
+typedef struct {
+    WifiTcpServerConfig conf;
+    TcpServerEventCallback callback;
+    void *ctx;
+
+    // in accept order
+    TcpServerConn conns[ISM43362_MAX_BACKLOG];
+    uint8_t count;
+    uint8_t next_id;
+    uint32_t dropped_accepts; // accepted by the module beyond listen_backlogs
+    uint32_t last_activity; // tick of the last transfer or probe of the active connection
+    uint32_t last_messages; // tick of the last MR
+} ISM43362TcpServer;
+
+// starts the server, listen_backlogs is limited to ISM43362_MAX_BACKLOG
+ISM43362_RET ism43362_tcp_server_init(ISM43362TcpServer *srv, const WifiTcpServerConfig *conf,
+                                      TcpServerEventCallback callback, void *ctx);
+// reports the connections accepted since the last call, reading the module messages with a single MR if none is
+// already queued by the driver and the last MR is ISM43362_SERVER_MESSAGES_MS old, and probes the active connection
+// when it's idle
+ISM43362_RET ism43362_tcp_server_process(ISM43362TcpServer *srv);
+// NULL if there's no connection with the id
+const TcpServerConn *ism43362_tcp_server_get(const ISM43362TcpServer *srv, uint8_t id);
+// the connection must be active, otherwise NotConnected is returned
+ISM43362_RET ism43362_tcp_server_read(ISM43362TcpServer *srv, uint8_t id, uint8_t *buff, size_t buff_size,
+                                      size_t *read_len);
+ISM43362_RET ism43362_tcp_server_write(ISM43362TcpServer *srv, uint8_t id, const uint8_t *data, size_t len);
+// only the active connection can be closed, the next one becomes active
+ISM43362_RET ism43362_tcp_server_close(ISM43362TcpServer *srv, uint8_t id);
+
+#endif
@@ -0,0 +1,77 @@
+#include "ism43362_txq.h"
+
+#include <string.h>
+
+#include "../Inc/main.h"
+
+ISM43362TxQueueConfig ism43362_txq_get_default_config() {
+    ISM43362TxQueueConfig conf = {.threshold = ISM43362_MAX_PAYLOAD, .max_latency_ms = 20};
+    return conf;
+}
+
+void ism43362_txq_init(ISM43362TxQueue *q, Socket s, const ISM43362TxQueueConfig *conf) {
+    q->s = s;
+    q->conf = *conf;
+    if (q->conf.threshold == 0 || q->conf.threshold > ISM43362_MAX_PAYLOAD) {
+        q->conf.threshold = ISM43362_MAX_PAYLOAD;
+    }
+    q->len = 0;
+    q->records = 0;
+    q->first_tick = 0;
+    ISM43362TxQueueStats zero = {0};
+    q->stats = zero;
+}
+
+ISM43362_RET ism43362_txq_flush(ISM43362TxQueue *q) {
+    if (q->len == 0) {
+        return Ok;
+    }
+    // the module can take only part of the frame, the rest goes in the next S3
+    size_t sent = 0;
+    ISM43362_RET ret = ism43362_send_all(q->s, q->buff, q->len, &sent);
+    q->stats.bytes += sent;
+    if (ret != Ok) {
+        // what wasn't sent stays queued, in order
+        memmove(q->buff, q->buff + sent, q->len - sent);
+        q->len -= sent;
+        q->stats.send_errors++;
+        return ret;
+    }
+    q->stats.frames++;
+    q->stats.records += q->records;
+    q->stats.latency_ms += HAL_GetTick() - q->first_tick;
+    q->len = 0;
+    q->records = 0;
+    return Ok;
+}
+
+ISM43362_RET ism43362_txq_write(ISM43362TxQueue *q, const uint8_t *record, size_t len) {
+    if (len > ISM43362_MAX_PAYLOAD) {
+        return Error;
+    }
+    if (q->len + len > ISM43362_MAX_PAYLOAD) {
+        ISM43362_RET ret = ism43362_txq_flush(q);
+        if (ret != Ok) {
+            return ret;
+        }
+    }
+
+    if (q->len == 0) {
+        q->first_tick = HAL_GetTick();
+    }
+    memcpy(q->buff + q->len, record, len);
+    q->len += len;
+    q->records++;
+
+    if (q->len >= q->conf.threshold) {
+        return ism43362_txq_flush(q);
+    }
+    return Ok;
+}
+
+ISM43362_RET ism43362_txq_poll(ISM43362TxQueue *q) {
+    if (q->len > 0 && HAL_GetTick() - q->first_tick >= q->conf.max_latency_ms) {
+        return ism43362_txq_flush(q);
+    }
+    return Ok;
+}
@@ -0,0 +1,47 @@
+#ifndef ISM43362_TXQ_H
+#define ISM43362_TXQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ism43362.h"
+
+// Transmit queue of a socket that packs small records in a single S3 command: the records are appended to a buffer
+// which is sent when it reaches threshold bytes, when the oldest record has waited max_latency_ms or when
+// ism43362_txq_flush() is called.
+
+typedef struct {
+    uint16_t threshold; // up to ISM43362_MAX_PAYLOAD
+    uint32_t max_latency_ms;
+} ISM43362TxQueueConfig;
+
+typedef struct {
+    uint32_t frames; // flushes, a single S3 unless the module accepted only part of it
+    uint32_t records;
+    uint32_t bytes;
+    uint32_t latency_ms; // sum of the time the oldest record of each frame waited, divide by frames for the average
+    uint32_t send_errors;
+} ISM43362TxQueueStats;
+
+typedef struct {
+    Socket s;
+    ISM43362TxQueueConfig conf;
+
+    uint8_t buff[ISM43362_MAX_PAYLOAD];
+    uint16_t len;
+    uint16_t records;
+    uint32_t first_tick; // HAL_GetTick() when the oldest record was queued
+
+    ISM43362TxQueueStats stats;
+} ISM43362TxQueue;
+
+ISM43362TxQueueConfig ism43362_txq_get_default_config();
+void ism43362_txq_init(ISM43362TxQueue *q, Socket s, const ISM43362TxQueueConfig *conf);
+// the queue is flushed first if the record doesn't fit, then after if it reached the threshold
+ISM43362_RET ism43362_txq_write(ISM43362TxQueue *q, const uint8_t *record, size_t len);
+// sends the queued records now, the bytes not sent stay queued if the send fails
+ISM43362_RET ism43362_txq_flush(ISM43362TxQueue *q);
+// flushes the queue if the oldest record has waited max_latency_ms, to call periodically
+ISM43362_RET ism43362_txq_poll(ISM43362TxQueue *q);
+
+#endif
@@ -0,0 +1,121 @@
+#include "sensor_engine.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+
+#ifdef SENSOR_ENGINE_USE_IT
+#define ENGINE_MEM_READ HAL_I2C_Mem_Read_IT
+#else
+#define ENGINE_MEM_READ HAL_I2C_Mem_Read_DMA
+#endif
+
+#define ENTER_CRITICAL()                                                                                               \
+    uint32_t primask = __get_PRIMASK();                                                                                \
+    __disable_irq()
+#define EXIT_CRITICAL()                                                                                                \
+    if (primask == 0) {                                                                                                \
+        __enable_irq();                                                                                                \
+    }
+
+void sensor_engine_init(SensorEngine *engine, I2C_HandleTypeDef *hi2c, SensorSampleCallback callback) {
+    engine->hi2c = hi2c;
+    engine->callback = callback;
+    engine->queue_head = 0;
+    engine->queue_count = 0;
+    engine->busy = false;
+    engine->ring_head = 0;
+    engine->ring_tail = 0;
+    engine->dropped_samples = 0;
+    engine->bus_errors = 0;
+}
+
+// starts the transfer of the request at the head of the queue, if any, must run with the I2C interrupt masked
+static void start_next(SensorEngine *engine) {
+    while (engine->queue_count > 0) {
+        SensorBurst b = sensor_sample_burst(engine->queue[engine->queue_head]);
+        if (ENGINE_MEM_READ(b.hi2c, b.addr, b.reg, I2C_MEMADD_SIZE_8BIT, engine->raw, b.len) == HAL_OK) {
+            engine->busy = true;
+            return;
+        }
+        // the request is dropped, otherwise it would be retried forever
+        engine->bus_errors++;
+        engine->queue_head = (engine->queue_head + 1) % SENSOR_ENGINE_QUEUE_LEN;
+        engine->queue_count--;
+    }
+    engine->busy = false;
+}
+
+bool sensor_engine_request(SensorEngine *engine, Sensor s) {
+    if (sensor_sample_burst(s).hi2c != engine->hi2c) {
+        return false;
+    }
+
+    bool queued = false;
+    ENTER_CRITICAL();
+    if (engine->queue_count < SENSOR_ENGINE_QUEUE_LEN) {
+        uint8_t idx = (engine->queue_head + engine->queue_count) % SENSOR_ENGINE_QUEUE_LEN;
+        engine->queue[idx] = s;
+        engine->queue_count++;
+        queued = true;
+        if (!engine->busy) {
+            start_next(engine);
+        }
+    }
+    EXIT_CRITICAL();
+    return queued;
+}
+
+bool sensor_engine_pop(SensorEngine *engine, SensorSample *sample) {
+    if (engine->ring_tail == engine->ring_head) {
+        return false;
+    }
+    *sample = engine->ring[engine->ring_tail];
+    engine->ring_tail = (engine->ring_tail + 1) % SENSOR_ENGINE_RING_LEN;
+    return true;
+}
+
+bool sensor_engine_is_idle(const SensorEngine *engine) { return !engine->busy && engine->queue_count == 0; }
+
+void sensor_engine_i2c_rx_cplt_callback(SensorEngine *engine, I2C_HandleTypeDef *hi2c) {
+    if (hi2c != engine->hi2c || !engine->busy) {
+        return;
+    }
+
+    Sensor s = engine->queue[engine->queue_head];
+    uint8_t raw[SENSOR_SAMPLE_MAX_LEN];
+    for (uint8_t i = 0; i < SENSOR_SAMPLE_MAX_LEN; i++) {
+        raw[i] = engine->raw[i];
+    }
+    engine->queue_head = (engine->queue_head + 1) % SENSOR_ENGINE_QUEUE_LEN;
+    engine->queue_count--;
+    // back-to-back, the next transfer is started before converting this sample
+    start_next(engine);
+
+    SensorSample sample;
+    sensor_convert_sample(s, raw, &sample);
+    sample.tick = HAL_GetTick();
+
+    if (engine->callback != NULL) {
+        engine->callback(&sample);
+    }
+
+    uint16_t next_head = (engine->ring_head + 1) % SENSOR_ENGINE_RING_LEN;
+    if (next_head == engine->ring_tail) {
+        engine->dropped_samples++;
+        return;
+    }
+    engine->ring[engine->ring_head] = sample;
+    engine->ring_head = next_head;
+}
+
+void sensor_engine_i2c_error_callback(SensorEngine *engine, I2C_HandleTypeDef *hi2c) {
+    if (hi2c != engine->hi2c || !engine->busy) {
+        return;
+    }
+    engine->bus_errors++;
+    engine->queue_head = (engine->queue_head + 1) % SENSOR_ENGINE_QUEUE_LEN;
+    engine->queue_count--;
+    start_next(engine);
+}
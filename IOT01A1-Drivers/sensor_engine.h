@@ -0,0 +1,55 @@
+#ifndef SENSOR_ENGINE_H
+#define SENSOR_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+#include "sensors.h"
+
+// Non-blocking sampling of the sensors on one I2C bus: requested samples are queued and read back-to-back with
+// HAL_I2C_Mem_Read_DMA, or HAL_I2C_Mem_Read_IT if SENSOR_ENGINE_USE_IT is defined, while the CPU is free to do
+// something else.
+
+#ifndef SENSOR_ENGINE_QUEUE_LEN
+#define SENSOR_ENGINE_QUEUE_LEN 8
+#endif
+#ifndef SENSOR_ENGINE_RING_LEN
+#define SENSOR_ENGINE_RING_LEN 32
+#endif
+
+// called from the I2C interrupt for every converted sample
+typedef void (*SensorSampleCallback)(const SensorSample *sample);
+
+typedef struct {
+    I2C_HandleTypeDef *hi2c;
+    SensorSampleCallback callback; // NULL to only use the ring buffer
+
+    // pending requests, the head is the one on the bus when busy is set
+    Sensor queue[SENSOR_ENGINE_QUEUE_LEN];
+    uint8_t queue_head;
+    volatile uint8_t queue_count;
+    volatile bool busy;
+    uint8_t raw[SENSOR_SAMPLE_MAX_LEN];
+
+    // converted samples, written by the interrupt and read by sensor_engine_pop()
+    SensorSample ring[SENSOR_ENGINE_RING_LEN];
+    volatile uint16_t ring_head;
+    volatile uint16_t ring_tail;
+
+    volatile uint32_t dropped_samples; // ring buffer full
+    volatile uint32_t bus_errors;
+} SensorEngine;
+
+void sensor_engine_init(SensorEngine *engine, I2C_HandleTypeDef *hi2c, SensorSampleCallback callback);
+// queues a sample read, starting the transfer if the bus is idle, returns false if the queue is full or the
+// sensor isn't on the engine's bus
+bool sensor_engine_request(SensorEngine *engine, Sensor s);
+bool sensor_engine_pop(SensorEngine *engine, SensorSample *sample);
+bool sensor_engine_is_idle(const SensorEngine *engine);
+
+// to be called from HAL_I2C_MemRxCpltCallback and HAL_I2C_ErrorCallback
+void sensor_engine_i2c_rx_cplt_callback(SensorEngine *engine, I2C_HandleTypeDef *hi2c);
+void sensor_engine_i2c_error_callback(SensorEngine *engine, I2C_HandleTypeDef *hi2c);
+
+#endif
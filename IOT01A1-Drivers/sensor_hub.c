@@ -0,0 +1,207 @@
+#include "sensor_hub.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+
+static uint32_t hal_clock_us() { return HAL_GetTick() * 1000; }
+
+static uint32_t lps22hb_period_us(LPS22HBUpdateRate rate) {
+    switch (rate) {
+        case LPS_HZ_1:
+            return 1000000;
+        case LPS_HZ_10:
+            return 100000;
+        case LPS_HZ_25:
+            return 40000;
+        case LPS_HZ_50:
+            return 20000;
+        case LPS_HZ_75:
+            return 13333;
+        default:
+            return 0;
+    }
+}
+
+static uint32_t hts221_period_us(HTS221UpdateRate rate) {
+    switch (rate) {
+        case HTS_HZ_1:
+            return 1000000;
+        case HTS_HZ_7:
+            return 142857;
+        case HTS_HZ_12_5:
+            return 80000;
+        default:
+            return 0;
+    }
+}
+
+// accelerometer and gyroscope share the encoding of the update rates
+static uint32_t lsm6dsl_period_us(uint8_t rate) {
+    static const uint32_t periods[] = {0, 80000, 38462, 19231, 9615, 4808, 2404, 1200, 602, 300, 150};
+    if (rate >= sizeof(periods) / sizeof(periods[0])) {
+        return 0;
+    }
+    return periods[rate];
+}
+
+static uint32_t lis3mdl_period_us(LIS3MDLUpdateRate rate) {
+    static const uint32_t periods[] = {1600000, 800000, 400000, 200000, 100000, 50000, 25000, 12500};
+    if (rate >= sizeof(periods) / sizeof(periods[0])) {
+        return 0;
+    }
+    return periods[rate];
+}
+
+static uint32_t sensor_period_us(Sensor s) {
+    switch (s.kind) {
+        case SENSOR_LPS22HB:
+            return lps22hb_period_us(((const LPS22HBDevice *) s.dev)->update_rate);
+        case SENSOR_HTS221:
+            return hts221_period_us(((const HTS221Device *) s.dev)->update_rate);
+        case SENSOR_LSM6DSL: {
+            const LSM6DSLDevice *dev = s.dev;
+            // the gyroscope alone is used only if the accelerometer is off
+            uint8_t rate = dev->xl_update_rate != XL_POWER_OFF ? dev->xl_update_rate : dev->g_update_rate;
+            return lsm6dsl_period_us(rate);
+        }
+        case SENSOR_LIS3MDL:
+            return lis3mdl_period_us(((const LIS3MDLDevice *) s.dev)->update_rate);
+        default:
+            return 0;
+    }
+}
+
+// start, device address, sub-address, repeated start, device address, data and stop, 9 clocks per byte
+static uint32_t transfer_us(uint32_t bus_hz, uint16_t len) {
+    uint32_t bits = 9 * (3 + (uint32_t) len) + 3;
+    return (uint32_t) (((uint64_t) bits * 1000000 + bus_hz - 1) / bus_hz);
+}
+
+void sensor_hub_init(SensorHub *hub, SensorHubClock clock_us, uint32_t bus_hz) {
+    hub->task_count = 0;
+    hub->clock_us = clock_us != NULL ? clock_us : hal_clock_us;
+    hub->bus_hz = bus_hz;
+    hub->last_us = hub->clock_us();
+    hub->elapsed_us = 0;
+    hub->busy_us = 0;
+    hub->ring_head = 0;
+    hub->ring_tail = 0;
+    hub->dropped_samples = 0;
+}
+
+bool sensor_hub_add(SensorHub *hub, Sensor s) {
+    uint32_t period = sensor_period_us(s);
+    if (hub->task_count >= SENSOR_HUB_MAX_SENSORS || period == 0) {
+        return false;
+    }
+
+    SensorHubTask *t = &hub->tasks[hub->task_count++];
+    t->sensor = s;
+    t->period_us = period;
+    t->release_us = hub->clock_us();
+    t->status_us = sensor_data_ready(s)->use_irq ? 0 : transfer_us(hub->bus_hz, 1);
+    t->transfer_us = transfer_us(hub->bus_hz, sensor_sample_burst(s).len) + t->status_us;
+    t->samples = 0;
+    t->bus_errors = 0;
+    t->missed_deadlines = 0;
+    return true;
+}
+
+static void push_sample(SensorHub *hub, const SensorSample *sample) {
+    uint16_t next_head = (hub->ring_head + 1) % SENSOR_HUB_RING_LEN;
+    if (next_head == hub->ring_tail) {
+        hub->dropped_samples++;
+        return;
+    }
+    hub->ring[hub->ring_head] = *sample;
+    hub->ring_head = next_head;
+}
+
+uint8_t sensor_hub_poll(SensorHub *hub) {
+    uint8_t read = 0;
+    // due sensors without a new output or with a failed read, left for the next poll
+    uint32_t skipped = 0;
+    for (;;) {
+        uint32_t now = hub->clock_us();
+        hub->elapsed_us += now - hub->last_us;
+        hub->last_us = now;
+        SensorHubTask *next = NULL;
+        uint8_t next_index = 0;
+        uint32_t next_deadline = 0;
+        for (uint8_t i = 0; i < hub->task_count; i++) {
+            SensorHubTask *t = &hub->tasks[i];
+            if ((skipped & ((uint32_t) 1 << i)) || (int32_t) (now - t->release_us) < 0) {
+                continue;
+            }
+            uint32_t deadline = t->release_us + t->period_us;
+            if (next == NULL || (int32_t) (deadline - next_deadline) < 0) {
+                next = t;
+                next_index = i;
+                next_deadline = deadline;
+            }
+        }
+        if (next == NULL) {
+            return read;
+        }
+
+        SensorSample sample;
+        SensorReadStatus status = sensor_read_new_sample(next->sensor, &sample);
+        if (status != SENSOR_NEW_DATA) {
+            skipped |= (uint32_t) 1 << next_index;
+            if (status == SENSOR_BUS_ERROR) {
+                next->bus_errors++;
+                hub->busy_us += next->transfer_us;
+            } else {
+                hub->busy_us += next->status_us;
+            }
+            continue;
+        }
+        hub->busy_us += next->transfer_us;
+        next->samples++;
+        push_sample(hub, &sample);
+        read++;
+
+        // the output registers only hold the last update, every release that passed in the meantime is lost
+        uint32_t done = hub->clock_us();
+        next->release_us += next->period_us;
+        while ((int32_t) (done - next->release_us) >= 0) {
+            next->missed_deadlines++;
+            next->release_us += next->period_us;
+        }
+    }
+}
+
+bool sensor_hub_pop(SensorHub *hub, SensorSample *sample) {
+    if (hub->ring_tail == hub->ring_head) {
+        return false;
+    }
+    *sample = hub->ring[hub->ring_tail];
+    hub->ring_tail = (hub->ring_tail + 1) % SENSOR_HUB_RING_LEN;
+    return true;
+}
+
+float sensor_hub_bus_utilisation(const SensorHub *hub) {
+    uint64_t elapsed = hub->elapsed_us + (uint32_t) (hub->clock_us() - hub->last_us);
+    if (elapsed == 0) {
+        return 0.f;
+    }
+    return (float) hub->busy_us / (float) elapsed;
+}
+
+float sensor_hub_estimated_load(const SensorHub *hub) {
+    float load = 0.f;
+    for (uint8_t i = 0; i < hub->task_count; i++) {
+        load += (float) hub->tasks[i].transfer_us / (float) hub->tasks[i].period_us;
+    }
+    return load;
+}
+
+uint32_t sensor_hub_missed_deadlines(const SensorHub *hub) {
+    uint32_t missed = 0;
+    for (uint8_t i = 0; i < hub->task_count; i++) {
+        missed += hub->tasks[i].missed_deadlines;
+    }
+    return missed;
+}
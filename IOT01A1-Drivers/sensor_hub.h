@@ -0,0 +1,71 @@
+#ifndef SENSOR_HUB_H
+#define SENSOR_HUB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+// Reads every registered sensor once per output update, as configured in its device struct, scheduling the
+// reads on the shared bus earliest deadline first. The samples of all the sensors come out of a single ring
+// buffer in the order they were read. The reads go through sensor_read_new_sample(), a sensor whose output isn't
+// updated yet when it's due (its clock is a little slower than the nominal rate) is tried again at the next poll.
+#if SENSOR_HUB_MAX_SENSORS > 32
+#error "at most 32 sensors"
+#endif
+
+#ifndef SENSOR_HUB_MAX_SENSORS
+#define SENSOR_HUB_MAX_SENSORS 4
+#endif
+#ifndef SENSOR_HUB_RING_LEN
+#define SENSOR_HUB_RING_LEN 32
+#endif
+
+// microseconds, free running and allowed to wrap
+typedef uint32_t (*SensorHubClock)(void);
+
+typedef struct {
+    Sensor sensor;
+    uint32_t period_us;
+    uint32_t release_us; // when the next output update is expected, the deadline is one period later
+    uint32_t transfer_us; // estimated bus time of a sample, with the status read if there's no data ready interrupt
+    uint32_t status_us; // estimated bus time of the status read, 0 with the data ready interrupt
+    uint32_t samples;
+    uint32_t bus_errors;
+    uint32_t missed_deadlines; // output updates overwritten before being read
+} SensorHubTask;
+
+typedef struct {
+    SensorHubTask tasks[SENSOR_HUB_MAX_SENSORS];
+    uint8_t task_count;
+    SensorHubClock clock_us;
+    uint32_t bus_hz;
+    // the 32 bits clock wraps (every ~71 minutes with HAL_GetTick()), the time is accumulated at every poll
+    uint32_t last_us;
+    uint64_t elapsed_us;
+    uint64_t busy_us;
+
+    SensorSample ring[SENSOR_HUB_RING_LEN];
+    uint16_t ring_head;
+    uint16_t ring_tail;
+    uint32_t dropped_samples; // ring buffer full
+} SensorHub;
+
+// clock_us can be NULL to use HAL_GetTick(), whose resolution limits the usable rates to less than 1 kHz
+void sensor_hub_init(SensorHub *hub, SensorHubClock clock_us, uint32_t bus_hz);
+// the sensor must already be initialized, returns false if the hub is full or the sensor is powered down
+bool sensor_hub_add(SensorHub *hub, Sensor s);
+// reads every sensor that has a new output, returns the number of samples read
+uint8_t sensor_hub_poll(SensorHub *hub);
+bool sensor_hub_pop(SensorHub *hub, SensorSample *sample);
+
+// fraction of time the bus was busy since sensor_hub_init(), from 0 to 1, sensor_hub_poll() must be called at least
+// once per wrap of the clock. The busy time is the sum of the estimated transfer times of the reads, not measured:
+// a read takes less than the 1 ms resolution of HAL_GetTick(), and a measure would include the interrupts that
+// preempted the read while the bus was idle
+float sensor_hub_bus_utilisation(const SensorHub *hub);
+// fraction of bus time needed by the configured rates, above 1 the deadlines can't be met
+float sensor_hub_estimated_load(const SensorHub *hub);
+uint32_t sensor_hub_missed_deadlines(const SensorHub *hub);
+
+#endif
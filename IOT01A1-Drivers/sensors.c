@@ -1,53 +1,146 @@
 #include "sensors.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "main.h"
 
-extern I2C_HandleTypeDef hi2c2;
+// ~11 bytes per ms at 100 kHz, plus margin for the address phase
+#define I2C_TIMEOUT_MS(len) (2 + (len) / 10)
+
+static HAL_StatusTypeDef read_regs(I2C_HandleTypeDef *hi2c, uint16_t dev_addr, uint8_t reg, uint8_t *buff,
+                                   uint16_t len) {
+    return HAL_I2C_Mem_Read(hi2c, dev_addr, reg, 1, buff, len, I2C_TIMEOUT_MS(len));
+}
+
+static void write_reg(I2C_HandleTypeDef *hi2c, uint16_t dev_addr, uint8_t reg, uint8_t val) {
+    HAL_I2C_Mem_Write(hi2c, dev_addr, reg, 1, &val, 1, 1);
+}
+
+static void write_regs(I2C_HandleTypeDef *hi2c, uint16_t dev_addr, uint8_t reg, uint8_t *buff, uint16_t len) {
+    HAL_I2C_Mem_Write(hi2c, dev_addr, reg, 1, buff, len, I2C_TIMEOUT_MS(len));
+}
+
+static int16_t to_int16(const uint8_t *l_h) { return (int16_t) (((uint16_t) l_h[1] << 8) | l_h[0]); }
+
+// fixed point scale factors are Q8.24, so that the smallest ones (accelerometer) keep enough precision, and give
+// Q16.16 values, a 64 bits multiplication is a single instruction on the M4
+#define Q24(x) ((int32_t) ((x) * 16777216.0 + 0.5))
+
+static int32_t scale_q16(int32_t raw, int32_t scale_q24) { return (int32_t) (((int64_t) raw * scale_q24) >> 8); }
+
+static Vec3i vec3i_from_raw(const uint8_t *raw) {
+    Vec3i v = {.x = to_int16(raw), .y = to_int16(raw + 2), .z = to_int16(raw + 4)};
+    return v;
+}
+
+static Vec3Q16 vec3q16_from_raw(const uint8_t *raw, int32_t scale_q24) {
+    Vec3Q16 v = {
+            .x = scale_q16(to_int16(raw), scale_q24),
+            .y = scale_q16(to_int16(raw + 2), scale_q24),
+            .z = scale_q16(to_int16(raw + 4), scale_q24),
+    };
+    return v;
+}
+
+void sensors_convert_q16(const int16_t *raw, int32_t *out, size_t len, int32_t scale_q24) {
+    for (size_t i = 0; i < len; i++) {
+        out[i] = (int32_t) (((int64_t) raw[i] * scale_q24) >> 8);
+    }
+}
+
+void sensors_convert_float(const int16_t *raw, float *out, size_t len, float scale) {
+    for (size_t i = 0; i < len; i++) {
+        out[i] = (float) raw[i] * scale;
+    }
+}
+
+// raw is X_L, X_H, Y_L, Y_H, Z_L, Z_H as laid out by every 3 axis sensor on the board
+static Vec3 vec3_from_raw(const uint8_t *raw, float scale) {
+    Vec3 v = {
+            .x = (float) to_int16(raw) * scale,
+            .y = (float) to_int16(raw + 2) * scale,
+            .z = (float) to_int16(raw + 4) * scale,
+    };
+    return v;
+}
 
 #define LPS22HB_ADDR 0xba
 #define LPS22HB_CTRL1 0x10
+#define LPS22HB_CTRL2 0x11
+#define LPS22HB_IF_ADD_INC 0x10
+#define LPS22HB_CTRL3 0x12
+#define LPS22HB_INT_DRDY 0x04
+#define LPS22HB_STATUS 0x27
+#define LPS22HB_P_DA 0x01
+#define LPS22HB_T_DA 0x02
+#define LPS22HB_P_OR 0x10
+#define LPS22HB_T_OR 0x20
 #define LPS22HB_PRESS_XL 0x28
 #define LPS22HB_PRESS_L 0x29
 #define LPS22HB_PRESS_H 0x2a
 #define LPS22HB_TEMP_L 0x2b
 #define LPS22HB_TEMP_H 0x2c
 
-void lps22hb_init(LPS22HBUpdateRate update_rate) {
-    uint8_t payload = update_rate;
-    HAL_I2C_Mem_Write(&hi2c2, LPS22HB_ADDR, LPS22HB_CTRL1, 1, &payload, 1, 1);
+LPS22HBDevice lps22hb_get_default_device(I2C_HandleTypeDef *hi2c) {
+    LPS22HBDevice dev = {.hi2c = hi2c, .addr = LPS22HB_ADDR, .update_rate = LPS_HZ_1};
+    return dev;
 }
 
-float lps22hb_read_press() {
-    uint8_t press_xl, press_l, press_h;
-    HAL_I2C_Mem_Read(&hi2c2, LPS22HB_ADDR, LPS22HB_PRESS_XL, 1, &press_xl, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, LPS22HB_ADDR, LPS22HB_PRESS_L, 1, &press_l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, LPS22HB_ADDR, LPS22HB_PRESS_H, 1, &press_h, 1, 1);
+void lps22hb_init(LPS22HBDevice *dev, LPS22HBUpdateRate update_rate) {
+    lps22hb_set_update_rate(dev, update_rate);
+    // register auto-increment, already the reset value but burst reads depend on it
+    write_reg(dev->hi2c, dev->addr, LPS22HB_CTRL2, LPS22HB_IF_ADD_INC);
+}
 
-    uint32_t tmp = press_xl | ((uint32_t) press_l << 8) | ((uint32_t) press_h << 16);
+void lps22hb_set_update_rate(LPS22HBDevice *dev, LPS22HBUpdateRate update_rate) {
+    write_reg(dev->hi2c, dev->addr, LPS22HB_CTRL1, update_rate);
+    dev->update_rate = update_rate;
+}
+
+static int32_t lps22hb_press_raw(const uint8_t *press) {
+    uint32_t tmp = press[0] | ((uint32_t) press[1] << 8) | ((uint32_t) press[2] << 16);
     if (tmp & 0x00800000) { // 24 bits complement
         tmp |= 0xFF000000;
     }
-    int32_t raw = (int32_t) tmp;
-    return (float) raw / 4096.f;
+    return (int32_t) tmp;
 }
 
-float lps22hb_read_temp() {
-    uint8_t temp_l, temp_h;
-    HAL_I2C_Mem_Read(&hi2c2, LPS22HB_ADDR, LPS22HB_TEMP_L, 1, &temp_l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, LPS22HB_ADDR, LPS22HB_TEMP_H, 1, &temp_h, 1, 1);
+static float lps22hb_press_from_raw(const uint8_t *press) { return (float) lps22hb_press_raw(press) / 4096.f; }
 
-    uint32_t tmp = temp_l | (temp_h << 8);
-    if (tmp & 0x00008000) { // 16 bits complement
-        tmp |= 0xFFFF0000;
-    }
-    int32_t raw = (int32_t) tmp;
-    return (float) raw / 100.f;
+static float lps22hb_temp_from_raw(const uint8_t *temp) { return (float) to_int16(temp) / 100.f; }
+
+float lps22hb_read_press(const LPS22HBDevice *dev) {
+    uint8_t press[3];
+    read_regs(dev->hi2c, dev->addr, LPS22HB_PRESS_XL, press, sizeof(press));
+    return lps22hb_press_from_raw(press);
+}
+
+float lps22hb_read_temp(const LPS22HBDevice *dev) {
+    uint8_t temp[2];
+    read_regs(dev->hi2c, dev->addr, LPS22HB_TEMP_L, temp, sizeof(temp));
+    return lps22hb_temp_from_raw(temp);
+}
+
+int32_t lps22hb_read_press_q16(const LPS22HBDevice *dev) {
+    uint8_t press[3];
+    read_regs(dev->hi2c, dev->addr, LPS22HB_PRESS_XL, press, sizeof(press));
+    return lps22hb_press_raw(press) * 16; // 4096 LSB/hPa
+}
+
+int32_t lps22hb_read_temp_q16(const LPS22HBDevice *dev) {
+    uint8_t temp[2];
+    read_regs(dev->hi2c, dev->addr, LPS22HB_TEMP_L, temp, sizeof(temp));
+    return scale_q16(to_int16(temp), Q24(0.01));
 }
 
 #define HTS221_ADDR 0xbe
 #define HTS221_CTRL1 0x20
+#define HTS221_CTRL3 0x22
+#define HTS221_DRDY_EN 0x04
+#define HTS221_STATUS 0x27
+#define HTS221_T_DA 0x01
+#define HTS221_H_DA 0x02
 #define HTS221_T0_DEGC 0x32
 #define HTS221_T1_DEGC 0x33
 #define HTS221_T_MSB 0x35
@@ -65,78 +158,190 @@ float lps22hb_read_temp() {
 #define HTS221_T_OUT_H 0x2b
 #define HTS221_H_OUT_L 0x28
 #define HTS221_H_OUT_H 0x29
+#define HTS221_AUTO_INC 0x80 // MSB of the sub-address enables auto-increment
+#define HTS221_CALIB_START HTS221_H0_RH
+#define HTS221_CALIB_LEN 16
+#define HTS221_CALIBRATION_BLOB_VERSION 1
+
+// linear interpolation between the two calibration points, done with integers only, a line without slope is
+// flat at y0 like its float version
+static void hts221_fixed_line(int32_t y0, int32_t y1, int16_t x0, int16_t x1, int32_t *m_q24, int32_t *b_q16) {
+    int32_t dx = (int32_t) x1 - x0;
+    // the slope can be negative, so it's scaled with a multiplication instead of a shift
+    *m_q24 = dx != 0 ? (int32_t) ((int64_t) (y1 - y0) * (1LL << 24) / dx) : 0;
+    *b_q16 = y0 * (1 << 16) - scale_q16(x0, *m_q24);
+}
 
-HTS221CalibrationMeaseures hts221_init(HTS221UpdateRate update_rate) {
-    uint8_t payload = update_rate | 0x80;
-    HAL_I2C_Mem_Write(&hi2c2, HTS221_ADDR, HTS221_CTRL1, 1, &payload, 1, 1);
+// false if the points have the same output, the slope would be infinite
+static bool hts221_float_line(int32_t y0, int32_t y1, int16_t x0, int16_t x1, float *m, float *b) {
+    bool valid = x1 != x0;
+    *m = valid ? (float) (y1 - y0) / ((float) x1 - (float) x0) : 0.f;
+    *b = (float) y0 - *m * (float) x0;
+    return valid;
+}
+
+static void hts221_compute_fixed_coefficients(HTS221CalibrationMeaseures *m) {
+    hts221_fixed_line(m->t0_degc, m->t1_degc, m->t0_out, m->t1_out, &m->t_m_q24, &m->t_b_q16);
+    hts221_fixed_line(m->h0_rh, m->h1_rh, m->h0_out, m->h1_out, &m->h_m_q24, &m->h_b_q16);
+}
+
+HTS221Device hts221_get_default_device(I2C_HandleTypeDef *hi2c) {
+    HTS221Device dev = {.hi2c = hi2c, .addr = HTS221_ADDR, .update_rate = HTS_HZ_1, .calib = {0}};
+    return dev;
+}
+
+static void hts221_compute_coefficients(HTS221CalibrationMeaseures *m) {
+    bool t_valid = hts221_float_line(m->t0_degc, m->t1_degc, m->t0_out, m->t1_out, &m->t_m, &m->t_b);
+    bool h_valid = hts221_float_line(m->h0_rh, m->h1_rh, m->h0_out, m->h1_out, &m->h_m, &m->h_b);
+    m->valid = t_valid && h_valid;
+    hts221_compute_fixed_coefficients(m);
+}
 
+// regs is the calibration block from H0_RH (0x30) to T1_OUT_H (0x3f)
+static HTS221CalibrationMeaseures hts221_parse_calibration(const uint8_t *regs) {
+#define CALIB_REG(r) regs[(r) - HTS221_CALIB_START]
     HTS221CalibrationMeaseures measeures = {0};
-    // temperature measurements
-    uint8_t t0_degc_l = 0, t1_degc_l = 0, t_msb = 0, t0_out_l = 0, t0_out_h = 0, t1_out_l = 0, t1_out_h = 0;
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_T0_DEGC, 1, &t0_degc_l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_T1_DEGC, 1, &t1_degc_l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_T_MSB, 1, &t_msb, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_T0_OUT_L, 1, &t0_out_l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_T0_OUT_H, 1, &t0_out_h, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_T1_OUT_L, 1, &t1_out_l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_T1_OUT_H, 1, &t1_out_h, 1, 1);
-
-    uint16_t t0_degc = t0_degc_l | ((t_msb & 0x03) << 8); // t_msb[1:0] + t0_degc_l
-    uint16_t t1_degc = t1_degc_l | ((t_msb & 0x0c) << 6); // t_msb[3:2] + t1_degc_l
 
+    // temperature measurements
+    uint8_t t_msb = CALIB_REG(HTS221_T_MSB);
+    uint16_t t0_degc = CALIB_REG(HTS221_T0_DEGC) | ((t_msb & 0x03) << 8); // t_msb[1:0] + t0_degc_l
+    uint16_t t1_degc = CALIB_REG(HTS221_T1_DEGC) | ((t_msb & 0x0c) << 6); // t_msb[3:2] + t1_degc_l
     measeures.t0_degc = (t0_degc) >> 3; // division by 8
     measeures.t1_degc = (t1_degc) >> 3; // division by 8
-    measeures.t0_out = ((int16_t) t0_out_h << 8) | t0_out_l;
-    measeures.t1_out = ((int16_t) t1_out_h << 8) | t1_out_l;
-    measeures.t_m = (float) (measeures.t1_degc - measeures.t0_degc) / ((float) (measeures.t1_out - measeures.t0_out));
-    measeures.t_b = (float) measeures.t0_degc - measeures.t_m * (float) measeures.t0_out;
+    measeures.t0_out = to_int16(&CALIB_REG(HTS221_T0_OUT_L));
+    measeures.t1_out = to_int16(&CALIB_REG(HTS221_T1_OUT_L));
 
     // humidity measurements
-    uint8_t h0_rh, h1_rh, h0_out_l, h0_out_h, h1_out_l, h1_out_h;
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_H0_RH, 1, &h0_rh, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_H1_RH, 1, &h1_rh, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_H0_OUT_L, 1, &h0_out_l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_H0_OUT_H, 1, &h0_out_h, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_H1_OUT_L, 1, &h1_out_l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_H1_OUT_H, 1, &h1_out_h, 1, 1);
-
-    measeures.h0_rh = (uint16_t) h0_rh >> 1; // division by 2
-    measeures.h1_rh = (uint16_t) h1_rh >> 1; // division by 2
-    measeures.h0_out = ((int16_t) h0_out_h << 8) | h0_out_l;
-    measeures.h1_out = ((int16_t) h1_out_h << 8) | h1_out_l;
-    measeures.h_m = (float) (measeures.h1_rh - measeures.h0_rh) / ((float) (measeures.h1_out - measeures.h0_out));
-    measeures.h_b = (float) measeures.h0_rh - measeures.h_m * (float) measeures.h0_out;
+    measeures.h0_rh = (uint16_t) CALIB_REG(HTS221_H0_RH) >> 1; // division by 2
+    measeures.h1_rh = (uint16_t) CALIB_REG(HTS221_H1_RH) >> 1; // division by 2
+    measeures.h0_out = to_int16(&CALIB_REG(HTS221_H0_OUT_L));
+    measeures.h1_out = to_int16(&CALIB_REG(HTS221_H1_OUT_L));
+#undef CALIB_REG
 
+    hts221_compute_coefficients(&measeures);
     return measeures;
 }
 
-float hts221_read_temp(const HTS221CalibrationMeaseures *measeures) {
-    uint8_t t_out_l, t_out_h;
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_T_OUT_L, 1, &t_out_l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_T_OUT_H, 1, &t_out_h, 1, 1);
-    uint32_t ut_out = ((uint32_t) t_out_h << 8) | t_out_l;
-    if (ut_out & 0x00008000) {
-        ut_out |= 0xFFFF0000;
+void hts221_init(HTS221Device *dev, HTS221UpdateRate update_rate) {
+    write_reg(dev->hi2c, dev->addr, HTS221_CTRL1, update_rate | 0x80);
+    dev->update_rate = update_rate;
+
+    uint8_t regs[HTS221_CALIB_LEN];
+    read_regs(dev->hi2c, dev->addr, HTS221_CALIB_START | HTS221_AUTO_INC, regs, sizeof(regs));
+    dev->calib = hts221_parse_calibration(regs);
+}
+
+static void put_u16(uint8_t *b, uint16_t v) {
+    b[0] = v & 0xff;
+    b[1] = v >> 8;
+}
+
+static uint16_t get_u16(const uint8_t *b) { return b[0] | ((uint16_t) b[1] << 8); }
+
+static uint8_t blob_checksum(const uint8_t *blob) {
+    uint8_t sum = 0xa5;
+    for (size_t i = 0; i < HTS221_CALIBRATION_BLOB_LEN - 1; i++) {
+        sum = (uint8_t) ((sum << 1) | (sum >> 7)) ^ blob[i];
     }
-    int32_t t_out = (int32_t) ut_out;
-    return (float) t_out * measeures->t_m + measeures->t_b;
+    return sum;
+}
+
+void hts221_save_calibration(const HTS221Device *dev, uint8_t *blob) {
+    const HTS221CalibrationMeaseures *m = &dev->calib;
+    blob[0] = HTS221_CALIBRATION_BLOB_VERSION;
+    put_u16(blob + 1, (uint16_t) m->t0_out);
+    put_u16(blob + 3, m->t0_degc);
+    put_u16(blob + 5, (uint16_t) m->t1_out);
+    put_u16(blob + 7, m->t1_degc);
+    put_u16(blob + 9, (uint16_t) m->h0_out);
+    put_u16(blob + 11, m->h0_rh);
+    put_u16(blob + 13, (uint16_t) m->h1_out);
+    put_u16(blob + 15, m->h1_rh);
+    blob[HTS221_CALIBRATION_BLOB_LEN - 1] = blob_checksum(blob);
 }
 
-float hts221_read_hum(const HTS221CalibrationMeaseures *measeures) {
-    uint8_t h_out_l, h_out_h;
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_H_OUT_L, 1, &h_out_l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, HTS221_ADDR, HTS221_H_OUT_H, 1, &h_out_h, 1, 1);
-    uint32_t uh_out = ((uint32_t) h_out_h << 8) | h_out_h;
-    if (uh_out & 0x00008000) {
-        uh_out |= 0xFFFF0000;
+bool hts221_init_from_calibration(HTS221Device *dev, HTS221UpdateRate update_rate, const uint8_t *blob) {
+    if (blob[0] != HTS221_CALIBRATION_BLOB_VERSION || blob[HTS221_CALIBRATION_BLOB_LEN - 1] != blob_checksum(blob)) {
+        return false;
     }
-    int32_t h_out = (int32_t) uh_out;
-    return (float) h_out * measeures->h_m + measeures->h_b;
+
+    HTS221CalibrationMeaseures m = {0};
+    m.t0_out = (int16_t) get_u16(blob + 1);
+    m.t0_degc = get_u16(blob + 3);
+    m.t1_out = (int16_t) get_u16(blob + 5);
+    m.t1_degc = get_u16(blob + 7);
+    m.h0_out = (int16_t) get_u16(blob + 9);
+    m.h0_rh = get_u16(blob + 11);
+    m.h1_out = (int16_t) get_u16(blob + 13);
+    m.h1_rh = get_u16(blob + 15);
+    hts221_compute_coefficients(&m);
+    if (!m.valid) {
+        return false;
+    }
+    dev->calib = m;
+
+    write_reg(dev->hi2c, dev->addr, HTS221_CTRL1, update_rate | 0x80);
+    dev->update_rate = update_rate;
+    return true;
+}
+
+static float hts221_temp_from_raw(const HTS221Device *dev, const uint8_t *t_out) {
+    return (float) to_int16(t_out) * dev->calib.t_m + dev->calib.t_b;
+}
+
+static float hts221_hum_from_raw(const HTS221Device *dev, const uint8_t *h_out) {
+    return (float) to_int16(h_out) * dev->calib.h_m + dev->calib.h_b;
+}
+
+float hts221_read_temp(const HTS221Device *dev) {
+    uint8_t t_out[2];
+    read_regs(dev->hi2c, dev->addr, HTS221_T_OUT_L | HTS221_AUTO_INC, t_out, sizeof(t_out));
+    return hts221_temp_from_raw(dev, t_out);
+}
+
+float hts221_read_hum(const HTS221Device *dev) {
+    uint8_t h_out[2];
+    read_regs(dev->hi2c, dev->addr, HTS221_H_OUT_L | HTS221_AUTO_INC, h_out, sizeof(h_out));
+    return hts221_hum_from_raw(dev, h_out);
+}
+
+void hts221_read_hum_temp(const HTS221Device *dev, float *hum, float *temp) {
+    uint8_t out[4]; // H_OUT followed by T_OUT
+    read_regs(dev->hi2c, dev->addr, HTS221_H_OUT_L | HTS221_AUTO_INC, out, sizeof(out));
+    *hum = hts221_hum_from_raw(dev, out);
+    *temp = hts221_temp_from_raw(dev, out + 2);
+}
+
+int32_t hts221_read_temp_q16(const HTS221Device *dev) {
+    uint8_t t_out[2];
+    read_regs(dev->hi2c, dev->addr, HTS221_T_OUT_L | HTS221_AUTO_INC, t_out, sizeof(t_out));
+    return scale_q16(to_int16(t_out), dev->calib.t_m_q24) + dev->calib.t_b_q16;
+}
+
+int32_t hts221_read_hum_q16(const HTS221Device *dev) {
+    uint8_t h_out[2];
+    read_regs(dev->hi2c, dev->addr, HTS221_H_OUT_L | HTS221_AUTO_INC, h_out, sizeof(h_out));
+    return scale_q16(to_int16(h_out), dev->calib.h_m_q24) + dev->calib.h_b_q16;
 }
 
 #define LSM6DSL_ADDR 0xd4
+#define LSM6DSL_FIFO_CTRL1 0x06
+#define LSM6DSL_FIFO_CTRL5 0x0a
+#define LSM6DSL_INT1_CTRL 0x0d
+#define LSM6DSL_INT1_DRDY_XL 0x01
 #define LSM6DSL_CTRL1_XL 0x10
 #define LSM6DSL_CTRL2_G 0x11
+#define LSM6DSL_CTRL3_C 0x12
+#define LSM6DSL_BDU 0x40
+#define LSM6DSL_IF_INC 0x04
+#define LSM6DSL_CTRL10_C 0x19
+#define LSM6DSL_TIMER_EN 0x20
+#define LSM6DSL_WAKE_UP_DUR 0x5c
+#define LSM6DSL_TIMER_HR 0x10
+#define LSM6DSL_STATUS 0x1e
+#define LSM6DSL_XLDA 0x01
+#define LSM6DSL_GDA 0x02
+#define LSM6DSL_OUT_TEMP_L 0x20
 #define LSM6DSL_X_L_G 0x22
 #define LSM6DSL_X_H_G 0x23
 #define LSM6DSL_Y_L_G 0x24
@@ -149,43 +354,33 @@ float hts221_read_hum(const HTS221CalibrationMeaseures *measeures) {
 #define LSM6DSL_Y_H_XL 0x2b
 #define LSM6DSL_Z_L_XL 0x2c
 #define LSM6DSL_Z_H_XL 0x2d
-
-void lsm6dsl_init(LSM6DSLXLUpdateRate accel_update_rate, LSM6DSLXLFullScale accel_full_scale,
-                  LSM6DSLGUpdateRate gyro_update_rate, LSM6DSLGFullScale gyro_full_scale) {
-    uint8_t xl_payload = (accel_update_rate << 4) | (accel_full_scale << 2);
-    HAL_I2C_Mem_Write(&hi2c2, LSM6DSL_ADDR, LSM6DSL_CTRL1_XL, 1, &xl_payload, 1, 1);
-    uint8_t g_payload = (gyro_update_rate << 4) | (gyro_full_scale << 2);
-    HAL_I2C_Mem_Write(&hi2c2, LSM6DSL_ADDR, LSM6DSL_CTRL2_G, 1, &g_payload, 1, 1);
-}
-
-static float lsm6dsl_read_component(uint16_t l_addr, uint16_t h_addr, float scale) {
-    uint8_t l, h;
-    HAL_I2C_Mem_Read(&hi2c2, LSM6DSL_ADDR, l_addr, 1, &l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, LSM6DSL_ADDR, h_addr, 1, &h, 1, 1);
-    uint32_t u_val = ((uint32_t) h << 8) | l;
-    if (u_val & 0x00008000) {
-        u_val |= 0xFFFF0000;
-    }
-    int32_t i_val = (int32_t) u_val;
-    return (float) i_val * scale;
-}
-
-Vec3 lsm6dsl_read_accel() {
-    uint8_t ctrl1;
-    HAL_I2C_Mem_Read(&hi2c2, LSM6DSL_ADDR, LSM6DSL_CTRL1_XL, 1, &ctrl1, 1, 1);
-    uint8_t fs_xl = (ctrl1 >> 2) & 0x03;
+#define LSM6DSL_FIFO_STATUS1 0x3a
+#define LSM6DSL_FIFO_WATERM 0x80
+#define LSM6DSL_FIFO_OVER_RUN 0x40
+#define LSM6DSL_FIFO_FULL_SMART 0x20
+#define LSM6DSL_FIFO_DATA_OUT_L 0x3e
+#define LSM6DSL_TIMESTAMP0 0x40
+
+#define LSM6DSL_FIFO_SAMPLE_WORDS 6
+#define LSM6DSL_FIFO_MAX_WORDS 0x7ff
+#ifndef LSM6DSL_FIFO_BURST_SAMPLES
+#define LSM6DSL_FIFO_BURST_SAMPLES 64
+#endif
+
+// returns the scale in m/s^2 per LSB
+static float lsm6dsl_accel_scale(LSM6DSLXLFullScale full_scale) {
     float scale;
-    switch (fs_xl) {
-        case 0x00:
+    switch (full_scale) {
+        case XL_2_G:
             scale = 0.061f;
             break;
-        case 0x01:
+        case XL_16_G:
             scale = 0.488f;
             break;
-        case 0x02:
+        case XL_4_G:
             scale = 0.122f;
             break;
-        case 0x03:
+        case XL_8_G:
             scale = 0.244f;
             break;
         default:
@@ -193,44 +388,190 @@ Vec3 lsm6dsl_read_accel() {
     };
 
     const float mg_to_ms2 = 9.81f / 1000.f;
-    Vec3 xl = {
-            .x = lsm6dsl_read_component(LSM6DSL_X_L_XL, LSM6DSL_X_H_XL, scale) * mg_to_ms2,
-            .y = lsm6dsl_read_component(LSM6DSL_Y_L_XL, LSM6DSL_Y_H_XL, scale) * mg_to_ms2,
-            .z = lsm6dsl_read_component(LSM6DSL_Z_L_XL, LSM6DSL_Z_H_XL, scale) * mg_to_ms2,
-    };
-
-    return xl;
+    return scale * mg_to_ms2;
 }
 
-Vec3 lsm6dsl_read_gyro() {
-    uint8_t ctrl2;
-    HAL_I2C_Mem_Read(&hi2c2, LSM6DSL_ADDR, LSM6DSL_CTRL2_G, 1, &ctrl2, 1, 1);
-    uint8_t fs_g = (ctrl2 >> 2) & 0x03;
+// returns the scale in dps per LSB
+static float lsm6dsl_gyro_scale(LSM6DSLGFullScale full_scale) {
     float scale;
-    switch (fs_g) {
-        case 0x00:
+    switch (full_scale) {
+        case G_250_DPS:
             scale = 8.75f;
             break;
-        case 0x01:
+        case G_500_DPS:
             scale = 17.5f;
             break;
-        case 0x02:
+        case G_1000_DPS:
             scale = 35.0f;
             break;
-        case 0x03:
+        case G_2000_DPS:
             scale = 70.0f;
             break;
         default:
             scale = 1.0f;
     };
 
-    Vec3 g = {
-            .x = lsm6dsl_read_component(LSM6DSL_X_L_G, LSM6DSL_X_H_G, scale) / 1000.f,
-            .y = lsm6dsl_read_component(LSM6DSL_Y_L_G, LSM6DSL_Y_H_G, scale) / 1000.f,
-            .z = lsm6dsl_read_component(LSM6DSL_Z_L_G, LSM6DSL_Z_H_G, scale) / 1000.f,
+    return scale / 1000.f;
+}
+
+static int32_t lsm6dsl_accel_scale_q24(LSM6DSLXLFullScale full_scale) {
+    const double mg_to_ms2 = 9.81 / 1000.;
+    switch (full_scale) {
+        case XL_2_G:
+            return Q24(0.061 * mg_to_ms2);
+        case XL_16_G:
+            return Q24(0.488 * mg_to_ms2);
+        case XL_4_G:
+            return Q24(0.122 * mg_to_ms2);
+        case XL_8_G:
+            return Q24(0.244 * mg_to_ms2);
+        default:
+            return Q24(1.0);
+    }
+}
+
+static int32_t lsm6dsl_gyro_scale_q24(LSM6DSLGFullScale full_scale) {
+    switch (full_scale) {
+        case G_250_DPS:
+            return Q24(8.75 / 1000.);
+        case G_500_DPS:
+            return Q24(17.5 / 1000.);
+        case G_1000_DPS:
+            return Q24(35.0 / 1000.);
+        case G_2000_DPS:
+            return Q24(70.0 / 1000.);
+        default:
+            return Q24(1.0);
+    }
+}
+
+LSM6DSLDevice lsm6dsl_get_default_device(I2C_HandleTypeDef *hi2c) {
+    LSM6DSLDevice dev = {.hi2c = hi2c,
+                         .addr = LSM6DSL_ADDR,
+                         .xl_update_rate = XL_POWER_OFF,
+                         .xl_full_scale = XL_2_G,
+                         .g_update_rate = G_POWER_DOWN,
+                         .g_full_scale = G_250_DPS,
+                         .xl_scale = lsm6dsl_accel_scale(XL_2_G),
+                         .g_scale = lsm6dsl_gyro_scale(G_250_DPS),
+                         .xl_scale_q24 = lsm6dsl_accel_scale_q24(XL_2_G),
+                         .g_scale_q24 = lsm6dsl_gyro_scale_q24(G_250_DPS),
+                         .timestamp_enabled = false,
+                         .fifo_enabled = false,
+                         .fifo_overruns = 0};
+    return dev;
+}
+
+void lsm6dsl_init(LSM6DSLDevice *dev, LSM6DSLXLUpdateRate accel_update_rate, LSM6DSLXLFullScale accel_full_scale,
+                  LSM6DSLGUpdateRate gyro_update_rate, LSM6DSLGFullScale gyro_full_scale) {
+    lsm6dsl_set_accel_config(dev, accel_update_rate, accel_full_scale);
+    lsm6dsl_set_gyro_config(dev, gyro_update_rate, gyro_full_scale);
+    // register auto-increment, already the reset value but burst reads depend on it, block data update keeps
+    // the output registers from changing in the middle of a burst
+    write_reg(dev->hi2c, dev->addr, LSM6DSL_CTRL3_C, LSM6DSL_BDU | LSM6DSL_IF_INC);
+}
+
+void lsm6dsl_set_accel_config(LSM6DSLDevice *dev, LSM6DSLXLUpdateRate update_rate, LSM6DSLXLFullScale full_scale) {
+    write_reg(dev->hi2c, dev->addr, LSM6DSL_CTRL1_XL, (update_rate << 4) | (full_scale << 2));
+    dev->xl_update_rate = update_rate;
+    dev->xl_full_scale = full_scale;
+    dev->xl_scale = lsm6dsl_accel_scale(full_scale);
+    dev->xl_scale_q24 = lsm6dsl_accel_scale_q24(full_scale);
+}
+
+void lsm6dsl_set_gyro_config(LSM6DSLDevice *dev, LSM6DSLGUpdateRate update_rate, LSM6DSLGFullScale full_scale) {
+    write_reg(dev->hi2c, dev->addr, LSM6DSL_CTRL2_G, (update_rate << 4) | (full_scale << 2));
+    dev->g_update_rate = update_rate;
+    dev->g_full_scale = full_scale;
+    dev->g_scale = lsm6dsl_gyro_scale(full_scale);
+    dev->g_scale_q24 = lsm6dsl_gyro_scale_q24(full_scale);
+}
+
+void lsm6dsl_enable_timestamp(LSM6DSLDevice *dev) {
+    write_reg(dev->hi2c, dev->addr, LSM6DSL_WAKE_UP_DUR, LSM6DSL_TIMER_HR); // 25us resolution
+    write_reg(dev->hi2c, dev->addr, LSM6DSL_CTRL10_C, LSM6DSL_TIMER_EN);
+    dev->timestamp_enabled = true;
+}
+
+Vec3 lsm6dsl_read_accel(const LSM6DSLDevice *dev) {
+    uint8_t raw[6];
+    read_regs(dev->hi2c, dev->addr, LSM6DSL_X_L_XL, raw, sizeof(raw));
+    return vec3_from_raw(raw, dev->xl_scale);
+}
+
+Vec3 lsm6dsl_read_gyro(const LSM6DSLDevice *dev) {
+    uint8_t raw[6];
+    read_regs(dev->hi2c, dev->addr, LSM6DSL_X_L_G, raw, sizeof(raw));
+    return vec3_from_raw(raw, dev->g_scale);
+}
+
+void lsm6dsl_read_accel_gyro(const LSM6DSLDevice *dev, Vec3 *accel, Vec3 *gyro) {
+    uint8_t raw[12]; // gyro output registers are followed by the accelerometer ones
+    read_regs(dev->hi2c, dev->addr, LSM6DSL_X_L_G, raw, sizeof(raw));
+    *gyro = vec3_from_raw(raw, dev->g_scale);
+    *accel = vec3_from_raw(raw + 6, dev->xl_scale);
+}
+
+Vec3i lsm6dsl_read_accel_raw(const LSM6DSLDevice *dev) {
+    uint8_t raw[6];
+    read_regs(dev->hi2c, dev->addr, LSM6DSL_X_L_XL, raw, sizeof(raw));
+    return vec3i_from_raw(raw);
+}
+
+Vec3i lsm6dsl_read_gyro_raw(const LSM6DSLDevice *dev) {
+    uint8_t raw[6];
+    read_regs(dev->hi2c, dev->addr, LSM6DSL_X_L_G, raw, sizeof(raw));
+    return vec3i_from_raw(raw);
+}
+
+Vec3Q16 lsm6dsl_read_accel_q16(const LSM6DSLDevice *dev) {
+    uint8_t raw[6];
+    read_regs(dev->hi2c, dev->addr, LSM6DSL_X_L_XL, raw, sizeof(raw));
+    return vec3q16_from_raw(raw, dev->xl_scale_q24);
+}
+
+Vec3Q16 lsm6dsl_read_gyro_q16(const LSM6DSLDevice *dev) {
+    uint8_t raw[6];
+    read_regs(dev->hi2c, dev->addr, LSM6DSL_X_L_G, raw, sizeof(raw));
+    return vec3q16_from_raw(raw, dev->g_scale_q24);
+}
+
+// raw is OUT_TEMP, gyro and accelerometer outputs, which are contiguous
+static LSM6DSLSample lsm6dsl_imu_from_raw(const LSM6DSLDevice *dev, const uint8_t *raw) {
+    LSM6DSLSample sample = {
+            .gyro = vec3_from_raw(raw + 2, dev->g_scale),
+            .accel = vec3_from_raw(raw + 8, dev->xl_scale),
+            .temp = 25.f + (float) to_int16(raw) / 256.f,
+            .timestamp = 0,
     };
+    return sample;
+}
+
+static uint32_t lsm6dsl_timestamp_from_raw(const uint8_t *ts) {
+    return ts[0] | ((uint32_t) ts[1] << 8) | ((uint32_t) ts[2] << 16);
+}
+
+LSM6DSLSample lsm6dsl_read_imu(const LSM6DSLDevice *dev) {
+    if (dev->timestamp_enabled && !dev->fifo_enabled) {
+        // OUT_TEMP_L to TIMESTAMP2, the registers in between are only read
+        uint8_t raw[LSM6DSL_TIMESTAMP0 + 3 - LSM6DSL_OUT_TEMP_L];
+        read_regs(dev->hi2c, dev->addr, LSM6DSL_OUT_TEMP_L, raw, sizeof(raw));
+        LSM6DSLSample sample = lsm6dsl_imu_from_raw(dev, raw);
+        sample.timestamp = lsm6dsl_timestamp_from_raw(raw + LSM6DSL_TIMESTAMP0 - LSM6DSL_OUT_TEMP_L);
+        return sample;
+    }
+
+    uint8_t raw[14];
+    read_regs(dev->hi2c, dev->addr, LSM6DSL_OUT_TEMP_L, raw, sizeof(raw));
+    LSM6DSLSample sample = lsm6dsl_imu_from_raw(dev, raw);
 
-    return g;
+    if (dev->timestamp_enabled) {
+        uint8_t ts[3];
+        read_regs(dev->hi2c, dev->addr, LSM6DSL_TIMESTAMP0, ts, sizeof(ts));
+        sample.timestamp = lsm6dsl_timestamp_from_raw(ts);
+    }
+
+    return sample;
 }
 
 #define LIS3MDL_ADDR 0x3c
@@ -238,66 +579,399 @@ Vec3 lsm6dsl_read_gyro() {
 #define LIS3MDL_CTRL2 0x21
 #define LIS3MDL_CTRL3 0x22
 #define LIS3MDL_CTRL4 0x23
+#define LIS3MDL_STATUS 0x27
+#define LIS3MDL_ZYXDA 0x08
+#define LIS3MDL_ZYXOR 0x80
 #define LIS3MDL_X_L 0x28
 #define LIS3MDL_X_H 0x29
 #define LIS3MDL_Y_L 0x2a
 #define LIS3MDL_Y_H 0x2b
 #define LIS3MDL_Z_L 0x2c
 #define LIS3MDL_Z_H 0x2d
+#define LIS3MDL_AUTO_INC 0x80 // MSB of the sub-address enables auto-increment
+#define LIS3MDL_HIGH_PERF 0x02
 
-void lis3mdl_init(LIS3MDLUpdateRate update_rate, LIS3MDLFullScale full_scale) {
-    const uint8_t HIGH_PERF = 0x02;
-    uint8_t ctrl1 = (HIGH_PERF << 5) | (update_rate << 2);
-    HAL_I2C_Mem_Write(&hi2c2, LIS3MDL_ADDR, LIS3MDL_CTRL1, 1, &ctrl1, 1, 1);
-    uint8_t ctrl2 = full_scale << 5;
-    HAL_I2C_Mem_Write(&hi2c2, LIS3MDL_ADDR, LIS3MDL_CTRL2, 1, &ctrl2, 1, 1);
-    uint8_t ctrl3 = 0;
-    HAL_I2C_Mem_Write(&hi2c2, LIS3MDL_ADDR, LIS3MDL_CTRL3, 1, &ctrl3, 1, 1);
-    uint8_t ctrl4 = HIGH_PERF << 2;
-    HAL_I2C_Mem_Write(&hi2c2, LIS3MDL_ADDR, LIS3MDL_CTRL4, 1, &ctrl4, 1, 1);
-}
-
-static float lis3mdl_read_component(uint8_t addr_l, uint8_t addr_h, float scale) {
-    uint8_t l, h;
-    HAL_I2C_Mem_Read(&hi2c2, LIS3MDL_ADDR, addr_l, 1, &l, 1, 1);
-    HAL_I2C_Mem_Read(&hi2c2, LIS3MDL_ADDR, addr_h, 1, &h, 1, 1);
-    uint32_t uval = ((uint32_t) h << 8) | l;
-
-    if (uval & 0x00008000) {
-        uval |= 0xFFFF0000;
-    }
-
-    int32_t ival = (int32_t) uval;
-    return ((float) ival) * scale;
-}
-
-Vec3 lis3mdl_read_mag() {
-    uint8_t ctrl2;
-    HAL_I2C_Mem_Read(&hi2c2, LIS3MDL_ADDR, LIS3MDL_CTRL2, 1, &ctrl2, 1, 1);
-    uint8_t full_scale = (ctrl2 >> 5) & 0x03;
+static float lis3mdl_scale(LIS3MDLFullScale full_scale) {
     float scale;
     switch (full_scale) {
-        case 0x0:
+        case LIS_4_GAUSS:
             scale = 0.14f;
             break;
-        case 0x1:
+        case LIS_8_GAUSS:
             scale = 0.29f;
             break;
-        case 0x2:
+        case LIS_12_GAUSS:
             scale = 0.43f;
             break;
-        case 0x3:
+        case LIS_16_GAUSS:
             scale = 0.58f;
             break;
         default:
             scale = 1.0f;
     };
+    return scale;
+}
+
+static int32_t lis3mdl_scale_q24(LIS3MDLFullScale full_scale) {
+    switch (full_scale) {
+        case LIS_4_GAUSS:
+            return Q24(0.14);
+        case LIS_8_GAUSS:
+            return Q24(0.29);
+        case LIS_12_GAUSS:
+            return Q24(0.43);
+        case LIS_16_GAUSS:
+            return Q24(0.58);
+        default:
+            return Q24(1.0);
+    }
+}
+
+LIS3MDLDevice lis3mdl_get_default_device(I2C_HandleTypeDef *hi2c) {
+    LIS3MDLDevice dev = {.hi2c = hi2c,
+                         .addr = LIS3MDL_ADDR,
+                         .update_rate = LIS_10_HZ,
+                         .full_scale = LIS_4_GAUSS,
+                         .scale = lis3mdl_scale(LIS_4_GAUSS),
+                         .scale_q24 = lis3mdl_scale_q24(LIS_4_GAUSS)};
+    return dev;
+}
+
+void lis3mdl_init(LIS3MDLDevice *dev, LIS3MDLUpdateRate update_rate, LIS3MDLFullScale full_scale) {
+    lis3mdl_set_update_rate(dev, update_rate);
+    lis3mdl_set_full_scale(dev, full_scale);
+    write_reg(dev->hi2c, dev->addr, LIS3MDL_CTRL3, 0);
+    write_reg(dev->hi2c, dev->addr, LIS3MDL_CTRL4, LIS3MDL_HIGH_PERF << 2);
+}
+
+void lis3mdl_set_update_rate(LIS3MDLDevice *dev, LIS3MDLUpdateRate update_rate) {
+    write_reg(dev->hi2c, dev->addr, LIS3MDL_CTRL1, (LIS3MDL_HIGH_PERF << 5) | (update_rate << 2));
+    dev->update_rate = update_rate;
+}
+
+void lis3mdl_set_full_scale(LIS3MDLDevice *dev, LIS3MDLFullScale full_scale) {
+    write_reg(dev->hi2c, dev->addr, LIS3MDL_CTRL2, full_scale << 5);
+    dev->full_scale = full_scale;
+    dev->scale = lis3mdl_scale(full_scale);
+    dev->scale_q24 = lis3mdl_scale_q24(full_scale);
+}
+
+Vec3 lis3mdl_read_mag(const LIS3MDLDevice *dev) {
+    uint8_t raw[6];
+    read_regs(dev->hi2c, dev->addr, LIS3MDL_X_L | LIS3MDL_AUTO_INC, raw, sizeof(raw));
+    return vec3_from_raw(raw, dev->scale);
+}
+
+Vec3i lis3mdl_read_mag_raw(const LIS3MDLDevice *dev) {
+    uint8_t raw[6];
+    read_regs(dev->hi2c, dev->addr, LIS3MDL_X_L | LIS3MDL_AUTO_INC, raw, sizeof(raw));
+    return vec3i_from_raw(raw);
+}
+
+Vec3Q16 lis3mdl_read_mag_q16(const LIS3MDLDevice *dev) {
+    uint8_t raw[6];
+    read_regs(dev->hi2c, dev->addr, LIS3MDL_X_L | LIS3MDL_AUTO_INC, raw, sizeof(raw));
+    return vec3q16_from_raw(raw, dev->scale_q24);
+}
+
+Sensor lps22hb_sensor(LPS22HBDevice *dev) {
+    Sensor s = {.kind = SENSOR_LPS22HB, .dev = dev};
+    return s;
+}
+
+Sensor hts221_sensor(HTS221Device *dev) {
+    Sensor s = {.kind = SENSOR_HTS221, .dev = dev};
+    return s;
+}
+
+Sensor lsm6dsl_sensor(LSM6DSLDevice *dev) {
+    Sensor s = {.kind = SENSOR_LSM6DSL, .dev = dev};
+    return s;
+}
+
+Sensor lis3mdl_sensor(LIS3MDLDevice *dev) {
+    Sensor s = {.kind = SENSOR_LIS3MDL, .dev = dev};
+    return s;
+}
+
+SensorBurst sensor_sample_burst(Sensor s) {
+    SensorBurst b = {0};
+    switch (s.kind) {
+        case SENSOR_LPS22HB: {
+            const LPS22HBDevice *dev = s.dev;
+            b.hi2c = dev->hi2c;
+            b.addr = dev->addr;
+            b.reg = LPS22HB_PRESS_XL; // pressure followed by temperature
+            b.len = 5;
+            break;
+        }
+        case SENSOR_HTS221: {
+            const HTS221Device *dev = s.dev;
+            b.hi2c = dev->hi2c;
+            b.addr = dev->addr;
+            b.reg = HTS221_H_OUT_L | HTS221_AUTO_INC; // humidity followed by temperature
+            b.len = 4;
+            break;
+        }
+        case SENSOR_LSM6DSL: {
+            const LSM6DSLDevice *dev = s.dev;
+            b.hi2c = dev->hi2c;
+            b.addr = dev->addr;
+            b.reg = LSM6DSL_OUT_TEMP_L;
+            b.len = 14;
+            break;
+        }
+        case SENSOR_LIS3MDL: {
+            const LIS3MDLDevice *dev = s.dev;
+            b.hi2c = dev->hi2c;
+            b.addr = dev->addr;
+            b.reg = LIS3MDL_X_L | LIS3MDL_AUTO_INC;
+            b.len = 6;
+            break;
+        }
+    }
+    return b;
+}
+
+void sensor_convert_sample(Sensor s, const uint8_t *raw, SensorSample *sample) {
+    sample->kind = s.kind;
+    switch (s.kind) {
+        case SENSOR_LPS22HB:
+            sample->data.lps22hb.press = lps22hb_press_from_raw(raw);
+            sample->data.lps22hb.temp = lps22hb_temp_from_raw(raw + 3);
+            break;
+        case SENSOR_HTS221:
+            sample->data.hts221.hum = hts221_hum_from_raw(s.dev, raw);
+            sample->data.hts221.temp = hts221_temp_from_raw(s.dev, raw + 2);
+            break;
+        case SENSOR_LSM6DSL:
+            sample->data.lsm6dsl = lsm6dsl_imu_from_raw(s.dev, raw);
+            break;
+        case SENSOR_LIS3MDL:
+            sample->data.lis3mdl = vec3_from_raw(raw, ((const LIS3MDLDevice *) s.dev)->scale);
+            break;
+    }
+}
+
+SensorSample sensor_read_sample(Sensor s) {
+    uint8_t raw[SENSOR_SAMPLE_MAX_LEN];
+    SensorBurst b = sensor_sample_burst(s);
+    read_regs(b.hi2c, b.addr, b.reg, raw, b.len);
+
+    SensorSample sample;
+    sensor_convert_sample(s, raw, &sample);
+    sample.tick = HAL_GetTick();
+    return sample;
+}
+
+SensorDataReady *sensor_data_ready(Sensor s) {
+    switch (s.kind) {
+        case SENSOR_LPS22HB:
+            return &((LPS22HBDevice *) s.dev)->drdy;
+        case SENSOR_HTS221:
+            return &((HTS221Device *) s.dev)->drdy;
+        case SENSOR_LSM6DSL:
+            return &((LSM6DSLDevice *) s.dev)->drdy;
+        case SENSOR_LIS3MDL:
+            return &((LIS3MDLDevice *) s.dev)->drdy;
+        default:
+            return NULL;
+    }
+}
+
+// status register of each sensor, with the bits that must all be set for a new sample, as the burst holds every
+// output, and the bits telling one was lost
+static void sensor_status_bits(Sensor s, uint8_t *reg, uint8_t *new_data, uint8_t *overrun) {
+    switch (s.kind) {
+        case SENSOR_LPS22HB:
+            *reg = LPS22HB_STATUS;
+            *new_data = LPS22HB_P_DA | LPS22HB_T_DA;
+            *overrun = LPS22HB_P_OR | LPS22HB_T_OR;
+            break;
+        case SENSOR_HTS221:
+            *reg = HTS221_STATUS;
+            *new_data = HTS221_H_DA | HTS221_T_DA;
+            *overrun = 0;
+            break;
+        case SENSOR_LSM6DSL: {
+            // only the sensors that are on produce new outputs
+            const LSM6DSLDevice *dev = s.dev;
+            *reg = LSM6DSL_STATUS;
+            *new_data = (dev->xl_update_rate != XL_POWER_OFF ? LSM6DSL_XLDA : 0) |
+                        (dev->g_update_rate != G_POWER_DOWN ? LSM6DSL_GDA : 0);
+            *overrun = 0;
+            break;
+        }
+        case SENSOR_LIS3MDL:
+            *reg = LIS3MDL_STATUS;
+            *new_data = LIS3MDL_ZYXDA;
+            *overrun = LIS3MDL_ZYXOR;
+            break;
+    }
+}
+
+// tests and clears the flag with the interrupts masked, an edge arriving between the two would be lost otherwise
+static bool drdy_take(SensorDataReady *drdy) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool ready = drdy->ready;
+    drdy->ready = false;
+    if (primask == 0) {
+        __enable_irq();
+    }
+    return ready;
+}
+
+SensorReadStatus sensor_read_new_sample(Sensor s, SensorSample *sample) {
+    SensorBurst b = sensor_sample_burst(s);
+    SensorDataReady *drdy = sensor_data_ready(s);
+
+    if (drdy->use_irq) {
+        if (!drdy_take(drdy)) {
+            drdy->stale_reads++;
+            return SENSOR_NO_NEW_DATA;
+        }
+    } else {
+        uint8_t reg, new_data, overrun, status;
+        sensor_status_bits(s, &reg, &new_data, &overrun);
+        if (read_regs(b.hi2c, b.addr, reg, &status, 1) != HAL_OK) {
+            return SENSOR_BUS_ERROR;
+        }
+        if (new_data == 0 || (status & new_data) != new_data) {
+            drdy->stale_reads++;
+            return SENSOR_NO_NEW_DATA;
+        }
+        if (status & overrun) {
+            drdy->overruns++;
+        }
+    }
+
+    uint8_t raw[SENSOR_SAMPLE_MAX_LEN];
+    if (read_regs(b.hi2c, b.addr, b.reg, raw, b.len) != HAL_OK) {
+        return SENSOR_BUS_ERROR;
+    }
+    sensor_convert_sample(s, raw, sample);
+    sample->tick = HAL_GetTick();
+    return SENSOR_NEW_DATA;
+}
+
+// the first read is allowed without waiting the interrupt, as the line could already be high and no edge
+// would come until the output is read
+void lps22hb_enable_drdy_interrupt(LPS22HBDevice *dev) {
+    write_reg(dev->hi2c, dev->addr, LPS22HB_CTRL3, LPS22HB_INT_DRDY);
+    dev->drdy.use_irq = true;
+    dev->drdy.ready = true;
+}
+
+void hts221_enable_drdy_interrupt(HTS221Device *dev) {
+    write_reg(dev->hi2c, dev->addr, HTS221_CTRL3, HTS221_DRDY_EN);
+    dev->drdy.use_irq = true;
+    dev->drdy.ready = true;
+}
+
+void lsm6dsl_enable_drdy_interrupt(LSM6DSLDevice *dev) {
+    write_reg(dev->hi2c, dev->addr, LSM6DSL_INT1_CTRL, LSM6DSL_INT1_DRDY_XL);
+    dev->drdy.use_irq = true;
+    dev->drdy.ready = true;
+}
+
+void lis3mdl_enable_drdy_interrupt(LIS3MDLDevice *dev) {
+    // the DRDY pin of the LIS3MDL is always enabled
+    dev->drdy.use_irq = true;
+    dev->drdy.ready = true;
+}
+
+void sensor_drdy_exti_callback(Sensor s) { sensor_data_ready(s)->ready = true; }
+
+LSM6DSLFifoConfig lsm6dsl_get_default_fifo_config() {
+    LSM6DSLFifoConfig conf = {
+            .mode = FIFO_CONTINUOUS, .update_rate = XL_104_HZ, .decimation = FIFO_DEC_NONE, .watermark = 100};
+    return conf;
+}
+
+void lsm6dsl_fifo_init(LSM6DSLDevice *dev, const LSM6DSLFifoConfig *conf) {
+    uint32_t fth = (uint32_t) conf->watermark * LSM6DSL_FIFO_SAMPLE_WORDS;
+    if (fth > LSM6DSL_FIFO_MAX_WORDS) {
+        fth = LSM6DSL_FIFO_MAX_WORDS;
+    }
+
+    // going through bypass mode empties the FIFO, so a new configuration doesn't start with stale data
+    write_reg(dev->hi2c, dev->addr, LSM6DSL_FIFO_CTRL5, FIFO_BYPASS);
+
+    uint8_t ctrl[5] = {
+            fth & 0xff, // FIFO_CTRL1, FTH[7:0]
+            (fth >> 8) & 0x07, // FIFO_CTRL2, FTH[10:8]
+            (conf->decimation << 3) | conf->decimation, // FIFO_CTRL3, gyro and accelerometer decimation
+            0x00, // FIFO_CTRL4, no third and fourth data set
+            (conf->update_rate << 3) | conf->mode, // FIFO_CTRL5
+    };
+    write_regs(dev->hi2c, dev->addr, LSM6DSL_FIFO_CTRL1, ctrl, sizeof(ctrl));
+    dev->fifo_enabled = conf->mode != FIFO_BYPASS;
+}
+
+static uint16_t lsm6dsl_fifo_words(const uint8_t *status) { return status[0] | ((uint16_t) (status[1] & 0x07) << 8); }
 
-    Vec3 mag = {
-            .x = lis3mdl_read_component(LIS3MDL_X_L, LIS3MDL_X_H, scale),
-            .y = lis3mdl_read_component(LIS3MDL_Y_L, LIS3MDL_Y_H, scale),
-            .z = lis3mdl_read_component(LIS3MDL_Z_L, LIS3MDL_Z_H, scale),
+LSM6DSLFifoStatus lsm6dsl_fifo_status(const LSM6DSLDevice *dev) {
+    uint8_t st[2]; // FIFO_STATUS1, FIFO_STATUS2
+    read_regs(dev->hi2c, dev->addr, LSM6DSL_FIFO_STATUS1, st, sizeof(st));
+    LSM6DSLFifoStatus status = {
+            .samples = lsm6dsl_fifo_words(st) / LSM6DSL_FIFO_SAMPLE_WORDS,
+            .watermark_reached = (st[1] & LSM6DSL_FIFO_WATERM) != 0,
+            .overrun = (st[1] & LSM6DSL_FIFO_OVER_RUN) != 0,
+            .full = (st[1] & LSM6DSL_FIFO_FULL_SMART) != 0,
     };
+    return status;
+}
+
+size_t lsm6dsl_fifo_read(LSM6DSLDevice *dev, LSM6DSLFifoBuffer *buff, size_t max_samples) {
+    static uint8_t raw[LSM6DSL_FIFO_BURST_SAMPLES * LSM6DSL_FIFO_SAMPLE_WORDS * 2];
+
+    uint8_t st[4]; // FIFO_STATUS1 to FIFO_STATUS4
+    read_regs(dev->hi2c, dev->addr, LSM6DSL_FIFO_STATUS1, st, sizeof(st));
+    uint16_t words = lsm6dsl_fifo_words(st);
+    uint16_t pattern = st[2] | ((uint16_t) (st[3] & 0x03) << 8); // index of the next word in the sample
+    if (st[1] & LSM6DSL_FIFO_OVER_RUN) {
+        dev->fifo_overruns++;
+    }
+
+    // after an overrun, or if a previous read was cut short, the FIFO may not start at gyro x, the words of the
+    // partial sample are dropped to get back in line
+    if (pattern != 0) {
+        uint16_t skip = LSM6DSL_FIFO_SAMPLE_WORDS - pattern;
+        if (skip > words) {
+            return 0;
+        }
+        read_regs(dev->hi2c, dev->addr, LSM6DSL_FIFO_DATA_OUT_L, raw, skip * 2);
+        words -= skip;
+    }
+
+    size_t n = words / LSM6DSL_FIFO_SAMPLE_WORDS;
+    if (n > max_samples) {
+        n = max_samples;
+    }
+    if (n > buff->capacity) {
+        n = buff->capacity;
+    }
+
+    size_t done = 0;
+    while (done < n) {
+        size_t chunk = n - done;
+        if (chunk > LSM6DSL_FIFO_BURST_SAMPLES) {
+            chunk = LSM6DSL_FIFO_BURST_SAMPLES;
+        }
+        read_regs(dev->hi2c, dev->addr, LSM6DSL_FIFO_DATA_OUT_L, raw, chunk * LSM6DSL_FIFO_SAMPLE_WORDS * 2);
+        for (size_t i = 0; i < chunk; i++) {
+            const uint8_t *s = raw + i * LSM6DSL_FIFO_SAMPLE_WORDS * 2;
+            size_t j = done + i;
+            buff->gyro_x[j] = (float) to_int16(s) * dev->g_scale;
+            buff->gyro_y[j] = (float) to_int16(s + 2) * dev->g_scale;
+            buff->gyro_z[j] = (float) to_int16(s + 4) * dev->g_scale;
+            buff->accel_x[j] = (float) to_int16(s + 6) * dev->xl_scale;
+            buff->accel_y[j] = (float) to_int16(s + 8) * dev->xl_scale;
+            buff->accel_z[j] = (float) to_int16(s + 10) * dev->xl_scale;
+        }
+        done += chunk;
+    }
 
-    return mag;
+    return n;
 }
@@ -1,8 +1,22 @@
 #ifndef SENSORS_H
 #define SENSORS_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "main.h"
+
+typedef enum { SENSOR_NEW_DATA, SENSOR_NO_NEW_DATA, SENSOR_BUS_ERROR } SensorReadStatus;
+
+// data ready bookkeeping of each device, used by sensor_read_new_sample()
+typedef struct {
+    bool use_irq; // set by the *_enable_drdy_interrupt functions, ready then replaces the status register
+    volatile bool ready; // set by sensor_drdy_exti_callback()
+    uint32_t stale_reads; // reads skipped because there was no new output
+    uint32_t overruns; // outputs overwritten before being read, only LPS22HB and LIS3MDL report them
+} SensorDataReady;
+
 typedef enum {
     LPS_HZ_1 = 0x10,
     LPS_HZ_10 = 0x20,
@@ -11,9 +25,21 @@ typedef enum {
     LPS_HZ_75 = 0x50
 } LPS22HBUpdateRate;
 
-void lps22hb_init(LPS22HBUpdateRate update_rate);
-float lps22hb_read_press();
-float lps22hb_read_temp();
+typedef struct {
+    I2C_HandleTypeDef *hi2c;
+    uint16_t addr;
+    LPS22HBUpdateRate update_rate;
+    SensorDataReady drdy;
+} LPS22HBDevice;
+
+LPS22HBDevice lps22hb_get_default_device(I2C_HandleTypeDef *hi2c);
+void lps22hb_init(LPS22HBDevice *dev, LPS22HBUpdateRate update_rate);
+void lps22hb_set_update_rate(LPS22HBDevice *dev, LPS22HBUpdateRate update_rate);
+float lps22hb_read_press(const LPS22HBDevice *dev);
+float lps22hb_read_temp(const LPS22HBDevice *dev);
+// Q16.16 hPa and degrees
+int32_t lps22hb_read_press_q16(const LPS22HBDevice *dev);
+int32_t lps22hb_read_temp_q16(const LPS22HBDevice *dev);
 
 typedef enum {
     HTS_HZ_1 = 0x01,
@@ -34,11 +60,39 @@ typedef struct {
     float t_b;
     float h_m;
     float h_b;
+    // fixed point equivalents of the coefficients above
+    int32_t t_m_q24;
+    int32_t t_b_q16;
+    int32_t h_m_q24;
+    int32_t h_b_q16;
+    // false if both points of a line have the same output, its readings are then the value of the first point
+    bool valid;
 } HTS221CalibrationMeaseures;
 
-HTS221CalibrationMeaseures hts221_init(HTS221UpdateRate update_rate);
-float hts221_read_temp(const HTS221CalibrationMeaseures *measeures);
-float hts221_read_hum(const HTS221CalibrationMeaseures *measeures);
+typedef struct {
+    I2C_HandleTypeDef *hi2c;
+    uint16_t addr;
+    HTS221UpdateRate update_rate;
+    HTS221CalibrationMeaseures calib;
+    SensorDataReady drdy;
+} HTS221Device;
+
+HTS221Device hts221_get_default_device(I2C_HandleTypeDef *hi2c);
+void hts221_init(HTS221Device *dev, HTS221UpdateRate update_rate);
+
+// the calibration can be stored by the application, e.g. in flash, and restored at the next boot without
+// reading it from the sensor, the restore fails if the blob is corrupted or the calibration isn't valid
+#define HTS221_CALIBRATION_BLOB_LEN 18
+void hts221_save_calibration(const HTS221Device *dev, uint8_t *blob);
+bool hts221_init_from_calibration(HTS221Device *dev, HTS221UpdateRate update_rate, const uint8_t *blob);
+
+float hts221_read_temp(const HTS221Device *dev);
+float hts221_read_hum(const HTS221Device *dev);
+// both values with a single burst
+void hts221_read_hum_temp(const HTS221Device *dev, float *hum, float *temp);
+// Q16.16 degrees and %rH
+int32_t hts221_read_temp_q16(const HTS221Device *dev);
+int32_t hts221_read_hum_q16(const HTS221Device *dev);
 
 typedef enum {
     XL_POWER_OFF = 0x00,
@@ -78,10 +132,109 @@ typedef struct {
     float z;
 } Vec3;
 
-void lsm6dsl_init(LSM6DSLXLUpdateRate accel_update_rate, LSM6DSLXLFullScale accel_full_scale,
+// raw output of the sensor
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} Vec3i;
+
+// Q16.16, same units as Vec3
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t z;
+} Vec3Q16;
+
+// the full scales and the derived scale factors are cached, so reads don't need to fetch the CTRL registers
+typedef struct {
+    I2C_HandleTypeDef *hi2c;
+    uint16_t addr;
+    LSM6DSLXLUpdateRate xl_update_rate;
+    LSM6DSLXLFullScale xl_full_scale;
+    LSM6DSLGUpdateRate g_update_rate;
+    LSM6DSLGFullScale g_full_scale;
+    float xl_scale; // m/s^2 per LSB
+    float g_scale; // dps per LSB
+    int32_t xl_scale_q24; // Q8.24 of xl_scale
+    int32_t g_scale_q24; // Q8.24 of g_scale
+    bool timestamp_enabled;
+    bool fifo_enabled; // not in bypass mode, reading FIFO_DATA_OUT would take data from it
+    uint32_t fifo_overruns; // times the FIFO was found overwritten by lsm6dsl_fifo_read()
+    SensorDataReady drdy;
+} LSM6DSLDevice;
+
+LSM6DSLDevice lsm6dsl_get_default_device(I2C_HandleTypeDef *hi2c);
+void lsm6dsl_init(LSM6DSLDevice *dev, LSM6DSLXLUpdateRate accel_update_rate, LSM6DSLXLFullScale accel_full_scale,
                   LSM6DSLGUpdateRate gyro_update_rate, LSM6DSLGFullScale gyro_full_scale);
-Vec3 lsm6dsl_read_accel();
-Vec3 lsm6dsl_read_gyro();
+void lsm6dsl_set_accel_config(LSM6DSLDevice *dev, LSM6DSLXLUpdateRate update_rate, LSM6DSLXLFullScale full_scale);
+void lsm6dsl_set_gyro_config(LSM6DSLDevice *dev, LSM6DSLGUpdateRate update_rate, LSM6DSLGFullScale full_scale);
+Vec3 lsm6dsl_read_accel(const LSM6DSLDevice *dev);
+Vec3 lsm6dsl_read_gyro(const LSM6DSLDevice *dev);
+// reads both sensors with a single burst, cheaper than lsm6dsl_read_accel() + lsm6dsl_read_gyro()
+void lsm6dsl_read_accel_gyro(const LSM6DSLDevice *dev, Vec3 *accel, Vec3 *gyro);
+Vec3i lsm6dsl_read_accel_raw(const LSM6DSLDevice *dev);
+Vec3i lsm6dsl_read_gyro_raw(const LSM6DSLDevice *dev);
+Vec3Q16 lsm6dsl_read_accel_q16(const LSM6DSLDevice *dev);
+Vec3Q16 lsm6dsl_read_gyro_q16(const LSM6DSLDevice *dev);
+
+typedef struct {
+    Vec3 accel;
+    Vec3 gyro;
+    float temp;
+    uint32_t timestamp; // 25us per LSB, 0 if lsm6dsl_enable_timestamp() wasn't called
+} LSM6DSLSample;
+
+void lsm6dsl_enable_timestamp(LSM6DSLDevice *dev);
+// accelerometer, gyroscope and temperature from the same output update, and the timestamp from the same burst
+// unless the FIFO is enabled: the burst would cross FIFO_DATA_OUT, so the timestamp is read right after and can be
+// up to one output period later than the sample
+LSM6DSLSample lsm6dsl_read_imu(const LSM6DSLDevice *dev);
+
+typedef enum { FIFO_BYPASS = 0x00, FIFO_STOP_WHEN_FULL = 0x01, FIFO_CONTINUOUS = 0x06 } LSM6DSLFifoMode;
+
+typedef enum {
+    FIFO_DEC_NONE = 0x01,
+    FIFO_DEC_2 = 0x02,
+    FIFO_DEC_3 = 0x03,
+    FIFO_DEC_4 = 0x04,
+    FIFO_DEC_8 = 0x05,
+    FIFO_DEC_16 = 0x06,
+    FIFO_DEC_32 = 0x07
+} LSM6DSLFifoDecimation;
+
+// both accelerometer and gyroscope are stored with the same decimation, so every FIFO sample is the 6 word
+// pattern gyro x, y, z, accelerometer x, y, z
+typedef struct {
+    LSM6DSLFifoMode mode;
+    LSM6DSLXLUpdateRate update_rate; // must not be higher than the sensors' update rates
+    LSM6DSLFifoDecimation decimation;
+    uint16_t watermark; // in samples, 1 to 341
+} LSM6DSLFifoConfig;
+
+typedef struct {
+    uint16_t samples; // complete samples stored
+    bool watermark_reached;
+    bool overrun;
+    bool full;
+} LSM6DSLFifoStatus;
+
+// structure of arrays, each of them must hold at least capacity values
+typedef struct {
+    float *accel_x;
+    float *accel_y;
+    float *accel_z;
+    float *gyro_x;
+    float *gyro_y;
+    float *gyro_z;
+    size_t capacity;
+} LSM6DSLFifoBuffer;
+
+LSM6DSLFifoConfig lsm6dsl_get_default_fifo_config();
+void lsm6dsl_fifo_init(LSM6DSLDevice *dev, const LSM6DSLFifoConfig *conf);
+LSM6DSLFifoStatus lsm6dsl_fifo_status(const LSM6DSLDevice *dev);
+// drains up to max_samples complete samples into buff, returns the number of samples read
+size_t lsm6dsl_fifo_read(LSM6DSLDevice *dev, LSM6DSLFifoBuffer *buff, size_t max_samples);
 
 typedef enum {
     LIS_0_625_HZ = 0x00,
@@ -96,7 +249,82 @@ typedef enum {
 
 typedef enum { LIS_4_GAUSS = 0x00, LIS_8_GAUSS = 0x01, LIS_12_GAUSS = 0x02, LIS_16_GAUSS = 0x03 } LIS3MDLFullScale;
 
-void lis3mdl_init(LIS3MDLUpdateRate update_rate, LIS3MDLFullScale full_scale);
-Vec3 lis3mdl_read_mag();
+typedef struct {
+    I2C_HandleTypeDef *hi2c;
+    uint16_t addr;
+    LIS3MDLUpdateRate update_rate;
+    LIS3MDLFullScale full_scale;
+    float scale;
+    int32_t scale_q24; // Q8.24 of scale
+    SensorDataReady drdy;
+} LIS3MDLDevice;
+
+LIS3MDLDevice lis3mdl_get_default_device(I2C_HandleTypeDef *hi2c);
+void lis3mdl_init(LIS3MDLDevice *dev, LIS3MDLUpdateRate update_rate, LIS3MDLFullScale full_scale);
+void lis3mdl_set_update_rate(LIS3MDLDevice *dev, LIS3MDLUpdateRate update_rate);
+void lis3mdl_set_full_scale(LIS3MDLDevice *dev, LIS3MDLFullScale full_scale);
+Vec3 lis3mdl_read_mag(const LIS3MDLDevice *dev);
+Vec3i lis3mdl_read_mag_raw(const LIS3MDLDevice *dev);
+Vec3Q16 lis3mdl_read_mag_q16(const LIS3MDLDevice *dev);
+
+// batch conversion of raw values, e.g. arrays of Vec3i seen as 3 * n int16_t, with the scale factors of the
+// device structs
+void sensors_convert_q16(const int16_t *raw, int32_t *out, size_t len, int32_t scale_q24);
+void sensors_convert_float(const int16_t *raw, float *out, size_t len, float scale);
+
+// generic access to any of the sensors above, used by the asynchronous engine: a complete sample of each
+// sensor is a single register burst, read as-is and converted afterwards
+typedef enum { SENSOR_LPS22HB, SENSOR_HTS221, SENSOR_LSM6DSL, SENSOR_LIS3MDL } SensorKind;
+
+typedef struct {
+    SensorKind kind;
+    void *dev; // the device struct matching kind
+} Sensor;
+
+Sensor lps22hb_sensor(LPS22HBDevice *dev);
+Sensor hts221_sensor(HTS221Device *dev);
+Sensor lsm6dsl_sensor(LSM6DSLDevice *dev);
+Sensor lis3mdl_sensor(LIS3MDLDevice *dev);
+
+typedef struct {
+    SensorKind kind;
+    uint32_t tick; // HAL_GetTick() when the sample was read
+    union {
+        struct {
+            float press;
+            float temp;
+        } lps22hb;
+        struct {
+            float hum;
+            float temp;
+        } hts221;
+        LSM6DSLSample lsm6dsl; // timestamp isn't part of the burst and is left to 0
+        Vec3 lis3mdl;
+    } data;
+} SensorSample;
+
+#define SENSOR_SAMPLE_MAX_LEN 14
+
+typedef struct {
+    I2C_HandleTypeDef *hi2c;
+    uint16_t addr;
+    uint8_t reg; // sub-address, with the auto-increment bit when needed
+    uint16_t len; // at most SENSOR_SAMPLE_MAX_LEN
+} SensorBurst;
+
+SensorBurst sensor_sample_burst(Sensor s);
+void sensor_convert_sample(Sensor s, const uint8_t *raw, SensorSample *sample);
+SensorSample sensor_read_sample(Sensor s);
+// like sensor_read_sample() but checks the data ready flags first, so the same output is never returned twice
+SensorReadStatus sensor_read_new_sample(Sensor s, SensorSample *sample);
+SensorDataReady *sensor_data_ready(Sensor s);
+
+// routes the data ready output of the sensor to its interrupt pin (LSM6DSL INT1 for the accelerometer), the
+// EXTI callback of the pin must then call sensor_drdy_exti_callback()
+void lps22hb_enable_drdy_interrupt(LPS22HBDevice *dev);
+void hts221_enable_drdy_interrupt(HTS221Device *dev);
+void lsm6dsl_enable_drdy_interrupt(LSM6DSLDevice *dev);
+void lis3mdl_enable_drdy_interrupt(LIS3MDLDevice *dev);
+void sensor_drdy_exti_callback(Sensor s);
 
 #endif
@@ -0,0 +1,72 @@
+#ifndef MAIN_H
+#define MAIN_H
+
+// Host stand-in for the CubeMX main.h: the HAL types and functions used by the drivers, implemented by hal_stub.c
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum { HAL_OK, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT } HAL_StatusTypeDef;
+typedef enum { HAL_I2C_STATE_READY = 0x20, HAL_I2C_STATE_BUSY_RX = 0x22 } HAL_I2C_StateTypeDef;
+typedef enum { HAL_SPI_STATE_READY = 1, HAL_SPI_STATE_BUSY = 2 } HAL_SPI_StateTypeDef;
+typedef enum { GPIO_PIN_RESET = 0, GPIO_PIN_SET } GPIO_PinState;
+
+typedef struct {
+    int Instance;
+} I2C_HandleTypeDef;
+
+typedef struct {
+    int Instance;
+} SPI_HandleTypeDef;
+
+typedef struct {
+    int Instance;
+} UART_HandleTypeDef;
+
+typedef struct {
+    int port;
+} GPIO_TypeDef;
+
+#define I2C_MEMADD_SIZE_8BIT 1
+
+extern GPIO_TypeDef *GPIOE;
+
+#define ISM43362_SPI3_CSN_GPIO_Port GPIOE
+#define ISM43362_SPI3_CSN_Pin 0x0001
+#define ISM43362_DRDY_EXTI1_GPIO_Port GPIOE
+#define ISM43362_DRDY_EXTI1_Pin 0x0002
+#define ISM43362_RST_GPIO_Port GPIOE
+#define ISM43362_RST_Pin 0x0100
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg, uint16_t reg_size,
+                                   uint8_t *data, uint16_t len, uint32_t timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg, uint16_t reg_size,
+                                    uint8_t *data, uint16_t len, uint32_t timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg, uint16_t reg_size,
+                                       uint8_t *data, uint16_t len);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg, uint16_t reg_size,
+                                      uint8_t *data, uint16_t len);
+HAL_I2C_StateTypeDef HAL_I2C_GetState(I2C_HandleTypeDef *hi2c);
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, const uint8_t *data, uint16_t words, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t words, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, const uint8_t *data, uint16_t words);
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t words);
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t len, uint32_t timeout);
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+
+void HAL_Delay(uint32_t ms);
+uint32_t HAL_GetTick(void);
+
+void __NOP(void);
+void __WFI(void);
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+
+#endif
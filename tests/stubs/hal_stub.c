@@ -0,0 +1,413 @@
+#include "hal_stub.h"
+
+#include <string.h>
+
+static GPIO_TypeDef gpioe = {.port = 4};
+GPIO_TypeDef *GPIOE = &gpioe;
+
+SPI_HandleTypeDef hspi3 = {.Instance = 3};
+UART_HandleTypeDef huart1 = {.Instance = 1};
+
+static uint64_t now_ns = 0;
+static uint32_t primask = 0;
+
+uint64_t stub_time_ns(void) { return now_ns; }
+
+static void module_update(void);
+
+void stub_advance_ns(uint64_t ns) {
+    now_ns += ns;
+    module_update();
+}
+
+uint32_t HAL_GetTick(void) {
+    // reading the clock takes time too, so the loops waiting on it always end
+    stub_advance_ns(STUB_TICK_READ_NS);
+    return (uint32_t) (now_ns / 1000000);
+}
+
+void HAL_Delay(uint32_t ms) { stub_advance_ns((uint64_t) ms * 1000000); }
+
+void __NOP(void) { stub_advance_ns(STUB_TICK_READ_NS); }
+
+void __WFI(void) { stub_advance_ns(1000); }
+
+void __disable_irq(void) { primask = 1; }
+
+void __enable_irq(void) { primask = 0; }
+
+uint32_t __get_PRIMASK(void) { return primask; }
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t len, uint32_t timeout) {
+    (void) huart;
+    (void) data;
+    (void) len;
+    (void) timeout;
+    return HAL_OK;
+}
+
+// I2C
+
+#define I2C_DEVICES 8
+
+typedef struct {
+    uint16_t addr;
+    uint8_t regs[256];
+    StubRegReadHook hook;
+} I2cDevice;
+
+static I2cDevice devices[I2C_DEVICES];
+static size_t device_count = 0;
+static StubI2cStats i2c_stats;
+static uint32_t i2c_failures = 0;
+
+typedef struct {
+    bool pending;
+    I2C_HandleTypeDef *hi2c;
+    uint16_t addr;
+    uint8_t reg;
+    uint8_t *data;
+    uint16_t len;
+} I2cTransfer;
+
+static I2cTransfer transfer;
+static StubI2cCallback rx_cplt_callback = NULL;
+static StubI2cCallback error_callback = NULL;
+
+static I2cDevice *find_device(uint16_t addr) {
+    for (size_t i = 0; i < device_count; i++) {
+        if (devices[i].addr == addr) {
+            return &devices[i];
+        }
+    }
+    if (device_count == I2C_DEVICES) {
+        return NULL;
+    }
+    I2cDevice *dev = &devices[device_count++];
+    memset(dev, 0, sizeof(*dev));
+    dev->addr = addr;
+    return dev;
+}
+
+// HTS221 and LIS3MDL, the MSB of the sub-address enables the auto-increment
+static bool auto_inc_msb(uint16_t addr) { return addr == 0xbe || addr == 0x3c; }
+
+static uint8_t reg_index(uint16_t addr, uint16_t reg) { return auto_inc_msb(addr) ? reg & 0x7f : reg & 0xff; }
+
+uint8_t *stub_i2c_regs(uint16_t addr) { return find_device(addr)->regs; }
+
+void stub_i2c_set_read_hook(uint16_t addr, StubRegReadHook hook) { find_device(addr)->hook = hook; }
+
+void stub_i2c_fail_next(uint32_t n) { i2c_failures = n; }
+
+StubI2cStats stub_i2c_stats(void) { return i2c_stats; }
+
+void stub_i2c_reset_stats(void) { memset(&i2c_stats, 0, sizeof(i2c_stats)); }
+
+void stub_i2c_set_callbacks(StubI2cCallback rx_cplt, StubI2cCallback error) {
+    rx_cplt_callback = rx_cplt;
+    error_callback = error;
+}
+
+static bool take_failure(void) {
+    if (i2c_failures == 0) {
+        return false;
+    }
+    i2c_failures--;
+    return true;
+}
+
+static void read_device(uint16_t addr, uint16_t reg, uint8_t *data, uint16_t len) {
+    I2cDevice *dev = find_device(addr);
+    uint8_t r = reg_index(addr, reg);
+    for (uint16_t i = 0; i < len; i++) {
+        data[i] = dev->hook != NULL ? dev->hook(addr, r, i) : dev->regs[(uint8_t) (r + i)];
+    }
+    i2c_stats.transactions++;
+    i2c_stats.bytes_read += len;
+    stub_advance_ns((uint64_t) (len + 3) * STUB_I2C_BYTE_NS);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg, uint16_t reg_size,
+                                   uint8_t *data, uint16_t len, uint32_t timeout) {
+    (void) hi2c;
+    (void) reg_size;
+    (void) timeout;
+    if (take_failure()) {
+        return HAL_ERROR;
+    }
+    read_device(addr, reg, data, len);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg, uint16_t reg_size,
+                                    uint8_t *data, uint16_t len, uint32_t timeout) {
+    (void) hi2c;
+    (void) reg_size;
+    (void) timeout;
+    if (take_failure()) {
+        return HAL_ERROR;
+    }
+    I2cDevice *dev = find_device(addr);
+    uint8_t r = reg_index(addr, reg);
+    for (uint16_t i = 0; i < len; i++) {
+        dev->regs[(uint8_t) (r + i)] = data[i];
+    }
+    i2c_stats.transactions++;
+    i2c_stats.bytes_written += len;
+    stub_advance_ns((uint64_t) (len + 2) * STUB_I2C_BYTE_NS);
+    return HAL_OK;
+}
+
+static HAL_StatusTypeDef start_read(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg, uint8_t *data,
+                                    uint16_t len) {
+    if (transfer.pending) {
+        return HAL_BUSY;
+    }
+    if (take_failure()) {
+        return HAL_ERROR;
+    }
+    I2cTransfer t = {.pending = true, .hi2c = hi2c, .addr = addr, .reg = (uint8_t) reg, .data = data, .len = len};
+    transfer = t;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg, uint16_t reg_size,
+                                       uint8_t *data, uint16_t len) {
+    (void) reg_size;
+    return start_read(hi2c, addr, reg, data, len);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t addr, uint16_t reg, uint16_t reg_size,
+                                      uint8_t *data, uint16_t len) {
+    (void) reg_size;
+    return start_read(hi2c, addr, reg, data, len);
+}
+
+HAL_I2C_StateTypeDef HAL_I2C_GetState(I2C_HandleTypeDef *hi2c) {
+    (void) hi2c;
+    return transfer.pending ? HAL_I2C_STATE_BUSY_RX : HAL_I2C_STATE_READY;
+}
+
+bool stub_i2c_complete(bool fail) {
+    if (!transfer.pending) {
+        return false;
+    }
+    I2cTransfer t = transfer;
+    transfer.pending = false;
+    if (fail) {
+        if (error_callback != NULL) {
+            error_callback(t.hi2c);
+        }
+        return true;
+    }
+    read_device(t.addr, t.reg, t.data, t.len);
+    if (rx_cplt_callback != NULL) {
+        rx_cplt_callback(t.hi2c);
+    }
+    return true;
+}
+
+// SPI and module
+
+#define FRAME_SIZE 4096
+#define SPI_PAD 0x15
+
+typedef enum { MODULE_READY, MODULE_CMD, MODULE_BUSY, MODULE_RESP, MODULE_DONE, MODULE_RESET } ModuleState;
+
+static ModuleState state = MODULE_READY;
+static bool csn_low = false;
+static void (*exti_callback)(void) = NULL;
+static StubModuleHandler module_handler = NULL;
+static uint64_t latency_ns = 0;
+static uint64_t ready_at = 0;
+static bool stalled = false;
+static uint8_t frame[FRAME_SIZE];
+static size_t frame_len = 0;
+static uint8_t resp[FRAME_SIZE];
+static size_t resp_len = 0;
+static size_t resp_pos = 0;
+static StubSpiStats spi_stats;
+
+void stub_module_init(void (*exti)(void), StubModuleHandler handler) {
+    exti_callback = exti;
+    module_handler = handler;
+    state = MODULE_READY;
+    csn_low = false;
+    latency_ns = 0;
+    stalled = false;
+    frame_len = 0;
+}
+
+void stub_module_set_latency_ns(uint64_t ns) { latency_ns = ns; }
+
+void stub_module_delay_response(uint64_t ns) { ready_at += ns; }
+
+StubSpiStats stub_spi_stats(void) { return spi_stats; }
+
+void stub_spi_reset_stats(void) { memset(&spi_stats, 0, sizeof(spi_stats)); }
+
+static void raise_drdy(ModuleState next) {
+    state = next;
+    if (exti_callback != NULL) {
+        exti_callback();
+    }
+}
+
+static void module_update(void) {
+    if (state == MODULE_BUSY && !stalled && now_ns >= ready_at) {
+        raise_drdy(MODULE_RESP);
+    }
+}
+
+static bool drdy_high(void) {
+    module_update();
+    return state == MODULE_READY || state == MODULE_RESP;
+}
+
+static void end_frame(void) {
+    spi_stats.frames++;
+    ready_at = now_ns + latency_ns;
+    resp_len = 0;
+    resp_pos = 0;
+    state = MODULE_BUSY;
+    size_t len = module_handler != NULL ? module_handler(frame, frame_len, resp, sizeof(resp)) : 0;
+    stalled = len == STUB_NO_RESPONSE;
+    resp_len = stalled ? 0 : len;
+    frame_len = 0;
+    module_update();
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState pin_state) {
+    (void) port;
+    if (pin == ISM43362_SPI3_CSN_Pin) {
+        bool low = pin_state == GPIO_PIN_RESET;
+        if (low == csn_low) {
+            return;
+        }
+        csn_low = low;
+        if (low && state == MODULE_READY) {
+            state = MODULE_CMD;
+        } else if (!low && state == MODULE_CMD) {
+            end_frame();
+        } else if (!low && state == MODULE_DONE) {
+            raise_drdy(MODULE_READY);
+        }
+    } else if (pin == ISM43362_RST_Pin) {
+        if (pin_state == GPIO_PIN_RESET) {
+            state = MODULE_RESET;
+            stalled = false;
+        } else if (state == MODULE_RESET) {
+            static const uint8_t cursor[] = {SPI_PAD, SPI_PAD, '\r', '\n', '>', ' '};
+            memcpy(resp, cursor, sizeof(cursor));
+            resp_len = sizeof(cursor);
+            resp_pos = 0;
+            ready_at = now_ns;
+            state = MODULE_BUSY;
+            module_update();
+        }
+    }
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin) {
+    (void) port;
+    if (pin == ISM43362_DRDY_EXTI1_Pin) {
+        stub_advance_ns(STUB_TICK_READ_NS);
+        return drdy_high() ? GPIO_PIN_SET : GPIO_PIN_RESET;
+    }
+    return GPIO_PIN_RESET;
+}
+
+static void spi_cost(uint16_t words) {
+    spi_stats.calls++;
+    stub_advance_ns(STUB_SPI_CALL_NS + (uint64_t) words * STUB_SPI_WORD_NS);
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, const uint8_t *data, uint16_t words, uint32_t timeout) {
+    (void) hspi;
+    (void) timeout;
+    if (!csn_low || state != MODULE_CMD || frame_len + words * 2u > sizeof(frame)) {
+        spi_stats.protocol_errors++;
+    } else {
+        memcpy(frame + frame_len, data, words * 2u);
+        frame_len += words * 2u;
+    }
+    spi_stats.words_sent += words;
+    spi_cost(words);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t words, uint32_t timeout) {
+    (void) hspi;
+    (void) timeout;
+    if (!csn_low || state != MODULE_RESP) {
+        spi_stats.protocol_errors++;
+        memset(data, SPI_PAD, words * 2u);
+    } else {
+        // past the end of the response the module clocks out padding
+        for (size_t i = 0; i < words * 2u; i++) {
+            data[i] = resp_pos < resp_len ? resp[resp_pos++] : SPI_PAD;
+        }
+        if (resp_pos >= resp_len) {
+            state = MODULE_DONE;
+        }
+    }
+    spi_stats.words_received += words;
+    spi_cost(words);
+    return HAL_OK;
+}
+
+static uint32_t dma_stalls = 0;
+static bool dma_busy = false;
+
+void stub_spi_stall_dma(uint32_t count) { dma_stalls = count; }
+
+static bool dma_stall(void) {
+    if (dma_stalls == 0) {
+        return false;
+    }
+    dma_stalls--;
+    dma_busy = true;
+    spi_stats.calls++;
+    return true;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, const uint8_t *data, uint16_t words) {
+    if (dma_stall()) {
+        return HAL_OK;
+    }
+    return HAL_SPI_Transmit(hspi, data, words, 0);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *data, uint16_t words) {
+    if (dma_stall()) {
+        return HAL_OK;
+    }
+    return HAL_SPI_Receive(hspi, data, words, 0);
+}
+
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+    return dma_busy ? HAL_SPI_STATE_BUSY : HAL_SPI_STATE_READY;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi) {
+    (void) hspi;
+    dma_busy = false;
+    return HAL_OK;
+}
+
+void stub_reset(void) {
+    now_ns = 0;
+    dma_stalls = 0;
+    dma_busy = false;
+    primask = 0;
+    device_count = 0;
+    i2c_failures = 0;
+    memset(&transfer, 0, sizeof(transfer));
+    rx_cplt_callback = NULL;
+    error_callback = NULL;
+    stub_i2c_reset_stats();
+    stub_module_init(NULL, NULL);
+    stub_spi_reset_stats();
+}
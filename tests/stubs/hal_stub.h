@@ -0,0 +1,74 @@
+#ifndef HAL_STUB_H
+#define HAL_STUB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "main.h"
+
+// Host implementation of the HAL functions in main.h: a simulated clock, an I2C bus of register files and an SPI
+// link to a simulated module with its DRDY line. Everything runs on the calling thread, the simulated time only
+// moves when the drivers call the HAL.
+
+// clears the clock, the I2C devices and the module
+void stub_reset(void);
+
+// simulated time, HAL_GetTick() returns it in ms
+uint64_t stub_time_ns(void);
+void stub_advance_ns(uint64_t ns);
+
+// register file of the device at the 8 bits address, the devices in auto_inc_msb() ignore the MSB of the
+// sub-address, which enables their auto-increment
+uint8_t *stub_i2c_regs(uint16_t addr);
+// called for every byte read from the device instead of the register file, with the sub-address the burst
+// started at and the offset in it, e.g. to pop a FIFO
+typedef uint8_t (*StubRegReadHook)(uint16_t addr, uint8_t start, uint16_t offset);
+void stub_i2c_set_read_hook(uint16_t addr, StubRegReadHook hook);
+// the next n transfers fail with HAL_ERROR
+void stub_i2c_fail_next(uint32_t n);
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+} StubI2cStats;
+
+StubI2cStats stub_i2c_stats(void);
+void stub_i2c_reset_stats(void);
+
+// the DMA and IT reads are completed by stub_i2c_complete(), which calls the callbacks like the I2C interrupt
+typedef void (*StubI2cCallback)(I2C_HandleTypeDef *hi2c);
+void stub_i2c_set_callbacks(StubI2cCallback rx_cplt, StubI2cCallback error);
+// returns false if no transfer is pending, a pending transfer fails if fail is set
+bool stub_i2c_complete(bool fail);
+
+// the module: every frame sent with CSN low is passed to the handler when CSN goes high, the response is clocked
+// out after the latency, with DRDY high, and exti is called on every rising edge of DRDY
+#define STUB_NO_RESPONSE ((size_t) -1)
+typedef size_t (*StubModuleHandler)(const uint8_t *frame, size_t len, uint8_t *resp, size_t size);
+void stub_module_init(void (*exti)(void), StubModuleHandler handler);
+void stub_module_set_latency_ns(uint64_t ns);
+// added to the latency of the response being prepared, e.g. for a read timeout
+void stub_module_delay_response(uint64_t ns);
+
+typedef struct {
+    uint32_t calls; // HAL SPI functions
+    uint32_t words_sent;
+    uint32_t words_received;
+    uint32_t frames; // commands received
+    uint32_t protocol_errors; // transfers in the wrong state, e.g. sending while the module isn't ready
+} StubSpiStats;
+
+StubSpiStats stub_spi_stats(void);
+void stub_spi_reset_stats(void);
+// the next count DMA transfers never complete, nothing is transferred and the SPI stays busy until aborted
+void stub_spi_stall_dma(uint32_t count);
+
+// cost of the HAL calls and of the transfers in the simulated time
+#define STUB_SPI_CALL_NS 4000
+#define STUB_SPI_WORD_NS 1600
+#define STUB_I2C_BYTE_NS 90000
+#define STUB_TICK_READ_NS 50
+
+#endif
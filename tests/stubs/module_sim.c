@@ -0,0 +1,251 @@
+#include "module_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal_stub.h"
+
+#define SOCKETS 4
+#define RX_SIZE 8192
+#define TX_SIZE 16384
+#define MESSAGES 8
+#define CODES 64
+
+static const char *const param_codes[] = {"P1", "P2", "P3", "P4", "P8", "R1", "R2", "S2"};
+#define PARAMS (sizeof(param_codes) / sizeof(param_codes[0]))
+
+typedef struct {
+    uint8_t rx[RX_SIZE];
+    size_t rx_len;
+    uint8_t tx[TX_SIZE];
+    size_t tx_len;
+    uint32_t params[PARAMS];
+} SimSocket;
+
+static SimSocket sockets[SOCKETS];
+static int selected = 0;
+static char messages[MESSAGES][64];
+static size_t message_count = 0;
+static char wifi_config[200];
+static size_t s3_accept = 0;
+
+static char fail_prefix[8];
+static uint32_t fail_count = 0;
+static bool fail_stall = false;
+
+static struct {
+    char code[3];
+    uint32_t count;
+} counts[CODES];
+static uint32_t total = 0;
+static char last[64];
+
+static size_t handle(const uint8_t *frame, size_t len, uint8_t *resp, size_t size);
+
+void sim_init(void (*exti)(void)) {
+    memset(sockets, 0, sizeof(sockets));
+    for (int s = 0; s < SOCKETS; s++) {
+        sockets[s].params[5] = 1460; // R1
+        sockets[s].params[6] = 1000; // R2
+    }
+    selected = 0;
+    message_count = 0;
+    strcpy(wifi_config, "ssid,pass,3,1,0,10.0.0.5,255.255.255.0,10.0.0.1,8.8.8.8,8.8.4.4,5,0,0,US,1");
+    s3_accept = 0;
+    fail_count = 0;
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+    last[0] = 0;
+    stub_module_init(exti, handle);
+}
+
+void sim_push_rx(int s, const void *data, size_t len) {
+    SimSocket *sock = &sockets[s];
+    if (sock->rx_len + len > RX_SIZE) {
+        len = RX_SIZE - sock->rx_len;
+    }
+    memcpy(sock->rx + sock->rx_len, data, len);
+    sock->rx_len += len;
+}
+
+size_t sim_take_tx(int s, uint8_t *out, size_t size) {
+    SimSocket *sock = &sockets[s];
+    size_t len = sock->tx_len < size ? sock->tx_len : size;
+    memcpy(out, sock->tx, len);
+    memmove(sock->tx, sock->tx + len, sock->tx_len - len);
+    sock->tx_len -= len;
+    return len;
+}
+
+size_t sim_tx_len(int s) { return sockets[s].tx_len; }
+
+void sim_push_message(const char *line) {
+    if (message_count < MESSAGES) {
+        snprintf(messages[message_count++], sizeof(messages[0]), "%s", line);
+    }
+}
+
+void sim_set_wifi_config(const char *csv) { snprintf(wifi_config, sizeof(wifi_config), "%s", csv); }
+
+void sim_fail(const char *prefix, uint32_t count, bool stall) {
+    snprintf(fail_prefix, sizeof(fail_prefix), "%s", prefix);
+    fail_count = count;
+    fail_stall = stall;
+}
+
+void sim_set_s3_accept(size_t max) { s3_accept = max; }
+
+uint32_t sim_count(const char *code) {
+    for (size_t i = 0; i < CODES; i++) {
+        if (strcmp(counts[i].code, code) == 0) {
+            return counts[i].count;
+        }
+    }
+    return 0;
+}
+
+uint32_t sim_total_commands(void) { return total; }
+
+const char *sim_last_command(void) { return last; }
+
+int sim_selected_socket(void) { return selected; }
+
+uint32_t sim_socket_param(int s, const char *code) {
+    for (size_t i = 0; i < PARAMS; i++) {
+        if (strcmp(param_codes[i], code) == 0) {
+            return sockets[s].params[i];
+        }
+    }
+    return 0;
+}
+
+static void count(const char *code) {
+    total++;
+    for (size_t i = 0; i < CODES; i++) {
+        if (counts[i].code[0] == 0) {
+            memcpy(counts[i].code, code, 2);
+            counts[i].code[2] = 0;
+        }
+        if (memcmp(counts[i].code, code, 2) == 0) {
+            counts[i].count++;
+            return;
+        }
+    }
+}
+
+// "\r\n" body "\r\nOK\r\n> "
+static size_t respond(uint8_t *resp, size_t size, const void *body, size_t len, bool ok) {
+    const char *status = ok ? "\r\nOK\r\n> " : "\r\nERROR\r\n> ";
+    size_t status_len = strlen(status);
+    if (2 + len + status_len > size) {
+        return 0;
+    }
+    memcpy(resp, "\r\n", 2);
+    memcpy(resp + 2, body, len);
+    memcpy(resp + 2 + len, status, status_len);
+    return 2 + len + status_len;
+}
+
+static size_t respond_str(uint8_t *resp, size_t size, const char *body) {
+    return respond(resp, size, body, strlen(body), true);
+}
+
+static size_t read_data(uint8_t *resp, size_t size) {
+    SimSocket *sock = &sockets[selected];
+    size_t len = sock->rx_len < sock->params[5] ? sock->rx_len : sock->params[5];
+    if (len == 0) {
+        // an idle socket answers after its read timeout
+        stub_module_delay_response((uint64_t) sock->params[6] * 1000000);
+    }
+    size_t n = respond(resp, size, sock->rx, len, true);
+    memmove(sock->rx, sock->rx + len, sock->rx_len - len);
+    sock->rx_len -= len;
+    return n;
+}
+
+static size_t send_data(const uint8_t *frame, size_t len, uint8_t *resp, size_t size) {
+    // "S3=n\r" payload "\r\n"
+    const uint8_t *cr = memchr(frame, '\r', len);
+    if (cr == NULL) {
+        return respond_str(resp, size, "");
+    }
+    size_t header = (size_t) (cr - frame) + 1;
+    size_t n = strtoul((const char *) frame + 3, NULL, 10);
+    if (header + n > len) {
+        return respond(resp, size, "", 0, false);
+    }
+    size_t accepted = s3_accept != 0 && s3_accept < n ? s3_accept : n;
+    SimSocket *sock = &sockets[selected];
+    if (sock->tx_len + accepted <= TX_SIZE) {
+        memcpy(sock->tx + sock->tx_len, frame + header, accepted);
+        sock->tx_len += accepted;
+    }
+    char body[16];
+    snprintf(body, sizeof(body), "%zu", accepted);
+    return respond_str(resp, size, body);
+}
+
+static size_t read_messages(uint8_t *resp, size_t size) {
+    char body[MESSAGES * 66] = "";
+    for (size_t i = 0; i < message_count; i++) {
+        if (i > 0) {
+            strcat(body, "\r\n");
+        }
+        strcat(body, messages[i]);
+    }
+    message_count = 0;
+    return respond_str(resp, size, body);
+}
+
+static size_t handle(const uint8_t *frame, size_t len, uint8_t *resp, size_t size) {
+    // the padding of an odd length frame is an extra '\n'
+    char cmd[64];
+    size_t cmd_len = len < sizeof(cmd) - 1 ? len : sizeof(cmd) - 1;
+    memcpy(cmd, frame, cmd_len);
+    cmd[cmd_len] = 0;
+    char *end = strpbrk(cmd, "\r\n");
+    if (end != NULL) {
+        *end = 0;
+    }
+    snprintf(last, sizeof(last), "%s", cmd);
+    count(cmd);
+
+    if (fail_count > 0 && strncmp(cmd, fail_prefix, strlen(fail_prefix)) == 0) {
+        fail_count--;
+        return fail_stall ? STUB_NO_RESPONSE : respond(resp, size, "", 0, false);
+    }
+
+    if (strncmp(cmd, "S3=", 3) == 0) {
+        return send_data(frame, len, resp, size);
+    }
+    if (strcmp(cmd, "R0") == 0) {
+        return read_data(resp, size);
+    }
+    if (strcmp(cmd, "MR") == 0) {
+        return read_messages(resp, size);
+    }
+    if (strcmp(cmd, "C?") == 0) {
+        return respond_str(resp, size, wifi_config);
+    }
+    if (strcmp(cmd, "CS") == 0) {
+        return respond_str(resp, size, "1");
+    }
+    if (strcmp(cmd, "P?") == 0) {
+        return respond_str(resp, size, "0,10.0.0.9,5025,10.0.0.5,40000,0,0,0,0");
+    }
+    if (strncmp(cmd, "P0=", 3) == 0) {
+        int s = atoi(cmd + 3);
+        if (s < 0 || s >= SOCKETS) {
+            return respond(resp, size, "", 0, false);
+        }
+        selected = s;
+        return respond_str(resp, size, "");
+    }
+    for (size_t i = 0; i < PARAMS; i++) {
+        if (strncmp(cmd, param_codes[i], 2) == 0 && cmd[2] == '=') {
+            sockets[selected].params[i] = strtoul(cmd + 3, NULL, 10);
+        }
+    }
+    return respond_str(resp, size, "");
+}
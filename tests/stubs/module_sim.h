@@ -0,0 +1,36 @@
+#ifndef MODULE_SIM_H
+#define MODULE_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Simulated ISM43362 answering the AT commands the driver uses: the socket settings are stored, S3 payloads are
+// collected per socket, R0 returns the data pushed by the test and MR the queued messages. Every command is
+// counted by its two characters code.
+
+// resets the module, exti is the DRDY interrupt handler, e.g. ism43362_drdy_exti_callback
+void sim_init(void (*exti)(void));
+
+// data the remote sends to the socket, returned by the next R0 up to the read packet size
+void sim_push_rx(int s, const void *data, size_t len);
+// bytes received with S3 on the socket, returns how many were copied
+size_t sim_take_tx(int s, uint8_t *out, size_t size);
+size_t sim_tx_len(int s);
+// a "[SOMA]..." line returned by the next MR
+void sim_push_message(const char *line);
+// body of the C? response
+void sim_set_wifi_config(const char *csv);
+
+// the next count commands starting with prefix answer ERROR, or never answer if stall is set
+void sim_fail(const char *prefix, uint32_t count, bool stall);
+// caps the bytes accepted by every S3, 0 accepts everything
+void sim_set_s3_accept(size_t max);
+
+uint32_t sim_count(const char *code);
+uint32_t sim_total_commands(void);
+const char *sim_last_command(void);
+int sim_selected_socket(void);
+uint32_t sim_socket_param(int s, const char *code);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <math.h>
+#include <stdio.h>
+
+// Minimal checks for the host tests: a failed check is reported and the test keeps going, main() returns the
+// number of failures through TEST_END().
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                                   \
+            test_failures++;                                                                                           \
+        }                                                                                                              \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                                                 \
+    do {                                                                                                               \
+        long long a_ = (long long) (a), b_ = (long long) (b);                                                          \
+        if (a_ != b_) {                                                                                                \
+            fprintf(stderr, "%s:%d: %s == %s failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, a_, b_);             \
+            test_failures++;                                                                                           \
+        }                                                                                                              \
+    } while (0)
+
+#define CHECK_NEAR(a, b, eps)                                                                                          \
+    do {                                                                                                               \
+        double a_ = (double) (a), b_ = (double) (b);                                                                   \
+        if (fabs(a_ - b_) > (eps)) {                                                                                   \
+            fprintf(stderr, "%s:%d: %s ~= %s failed: %g != %g\n", __FILE__, __LINE__, #a, #b, a_, b_);                 \
+            test_failures++;                                                                                           \
+        }                                                                                                              \
+    } while (0)
+
+#define RUN(test)                                                                                                      \
+    do {                                                                                                               \
+        int before_ = test_failures;                                                                                   \
+        test();                                                                                                        \
+        printf("%s %s\n", test_failures == before_ ? "PASS" : "FAIL", #test);                                          \
+    } while (0)
+
+#define TEST_END() return test_failures == 0 ? 0 : 1
+
+#endif
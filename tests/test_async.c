@@ -0,0 +1,203 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "ism43362_async.h"
+#include "module_sim.h"
+#include "test.h"
+
+// the requests run from a main loop that also "samples" every simulated ms, ism43362_process() must never wait
+
+#define MS 1000000ULL
+
+typedef struct {
+    const char *name;
+    ISM43362_RET ret;
+} Completion;
+
+static Completion done[8];
+static size_t done_count;
+static uint64_t longest_process_ns;
+static uint32_t samples;
+
+static void on_done(ISM43362Request *req, void *ctx) {
+    CHECK(ism43362_async_done(req));
+    if (done_count < 8) {
+        Completion c = {.name = ctx, .ret = req->ret};
+        done[done_count] = c;
+    }
+    done_count++;
+}
+
+static void setup(void) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    ISM43362Timeouts t = ism43362_get_default_timeouts();
+    ism43362_set_timeouts(&t);
+    stub_module_set_latency_ns(300000);
+    done_count = 0;
+    longest_process_ns = 0;
+    samples = 0;
+}
+
+// the main loop, until the queue is empty or the time is up
+static void run(uint64_t max_ms) {
+    uint64_t end = stub_time_ns() + max_ms * MS;
+    while (!ism43362_async_idle() && stub_time_ns() < end) {
+        uint64_t start = stub_time_ns();
+        ism43362_process();
+        uint64_t spent = stub_time_ns() - start;
+        if (spent > longest_process_ns) {
+            longest_process_ns = spent;
+        }
+        samples++;
+        stub_advance_ns(MS);
+    }
+}
+
+static WifiClientConfig client_config(Socket s) {
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = s;
+    client.remote.ip[0] = 10;
+    client.remote.ip[3] = 9;
+    return client;
+}
+
+static void test_queue_order(void) {
+    setup();
+    static ISM43362Request start, send, read;
+    static uint8_t payload[300], rx[300 + 11];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (uint8_t) (i + 1);
+    }
+    WifiClientConfig client = client_config(SOCKET_1);
+    CHECK_EQ(ism43362_async_start_client(&start, &client, on_done, "start"), Ok);
+    CHECK_EQ(ism43362_async_send(&send, SOCKET_1, payload, sizeof(payload), on_done, "send"), Ok);
+    CHECK_EQ(ism43362_async_read(&read, SOCKET_1, rx, sizeof(rx), on_done, "read"), Ok);
+    // a request can't be submitted again while it's pending
+    CHECK_EQ(ism43362_async_send(&send, SOCKET_1, payload, 10, on_done, "again"), Error);
+    // nothing goes out before the main loop runs
+    CHECK_EQ(sim_total_commands(), 0);
+    sim_push_rx(1, "reply", 5);
+
+    run(1000);
+    CHECK(ism43362_async_idle());
+    CHECK_EQ(done_count, 3);
+    CHECK(strcmp(done[0].name, "start") == 0);
+    CHECK(strcmp(done[1].name, "send") == 0);
+    CHECK(strcmp(done[2].name, "read") == 0);
+    CHECK_EQ(done[0].ret, Ok);
+    CHECK_EQ(done[1].ret, Ok);
+    CHECK_EQ(done[2].ret, Ok);
+
+    CHECK_EQ(sim_count("P0"), 1);
+    CHECK_EQ(sim_count("P6"), 1);
+    CHECK_EQ(sim_socket_param(1, "R2"), 5000);
+    uint8_t out[sizeof(payload)];
+    CHECK_EQ(sim_take_tx(1, out, sizeof(out)), sizeof(payload));
+    CHECK(memcmp(out, payload, sizeof(payload)) == 0);
+    CHECK_EQ(read.rx_len, 5);
+    CHECK(memcmp(rx, "reply", 5) == 0);
+    CHECK(longest_process_ns < MS);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+}
+
+static void test_long_read_keeps_sampling(void) {
+    setup();
+    static ISM43362Request start, read;
+    static uint8_t rx[64];
+    WifiClientConfig client = client_config(SOCKET_2);
+    CHECK_EQ(ism43362_async_start_client(&start, &client, NULL, NULL), Ok);
+    run(1000);
+    CHECK_EQ(start.ret, Ok);
+
+    // the socket is idle, the module answers after the 5 s read timeout
+    CHECK_EQ(ism43362_async_read(&read, SOCKET_2, rx, sizeof(rx), on_done, "read"), Ok);
+    samples = 0;
+    uint64_t begin = stub_time_ns();
+    run(10000);
+    CHECK_EQ(done_count, 1);
+    CHECK_EQ(read.ret, Ok);
+    CHECK_EQ(read.rx_len, 0);
+    CHECK_NEAR((double) (stub_time_ns() - begin) / MS, 5000, 5);
+    CHECK(samples >= 4990);
+    CHECK(longest_process_ns < MS);
+}
+
+static void test_forget_when_started(void) {
+    setup();
+    CHECK_EQ(ism43362_set_socket(SOCKET_3), Ok);
+    static ISM43362Request send, join;
+    static const uint8_t payload[] = "data";
+    JoinWifiConfig conf = ism43362_get_default_wifi_config();
+    strcpy(conf.ssid, "net");
+    CHECK_EQ(ism43362_async_send(&send, SOCKET_3, payload, 4, on_done, "send"), Ok);
+    CHECK_EQ(ism43362_async_join(&join, &conf, on_done, "join"), Ok);
+    // the send queued before the join still relies on the selected socket
+    CHECK_EQ(ism43362_get_selected_socket(), 3);
+
+    run(1000);
+    CHECK_EQ(done_count, 2);
+    CHECK_EQ(done[0].ret, Ok);
+    CHECK_EQ(done[1].ret, Ok);
+    CHECK_EQ(sim_count("P0"), 1);
+    CHECK_EQ(sim_tx_len(3), 4);
+    CHECK_EQ(sim_count("C0"), 1);
+    // the join made it stale
+    CHECK_EQ(ism43362_get_selected_socket(), -1);
+}
+
+static void test_script_forget_and_sockets(void) {
+    setup();
+    static ISM43362Request req;
+    static uint8_t rx[32];
+    CHECK_EQ(ism43362_set_socket(SOCKET_2), Ok);
+    // a script selecting another socket leaves the driver copy stale unless it's forgotten
+    CHECK_EQ(ism43362_async_script(&req, "P0=0\r\nP5=0\r\n", ISM_FORGET_ALL, NULL, NULL), Ok);
+    run(1000);
+    CHECK_EQ(req.ret, Ok);
+    CHECK_EQ(ism43362_get_selected_socket(), 0);
+    CHECK_EQ(ism43362_async_script(&req, "CS\r\n", ISM_FORGET_ALL + 1, NULL, NULL), Error);
+
+    uint32_t commands = sim_total_commands();
+    CHECK_EQ(ism43362_async_send(&req, (Socket) 4, (const uint8_t *) "x", 1, NULL, NULL), Error);
+    CHECK_EQ(ism43362_async_read(&req, (Socket) 4, rx, sizeof(rx), NULL, NULL), Error);
+    CHECK(ism43362_async_idle());
+    run(10);
+    CHECK_EQ(sim_total_commands(), commands);
+}
+
+static void test_errors_and_timeouts(void) {
+    setup();
+    static ISM43362Request join, script;
+    JoinWifiConfig conf = ism43362_get_default_wifi_config();
+    strcpy(conf.ssid, "net");
+    sim_fail("C3", 1, false);
+    CHECK_EQ(ism43362_async_join(&join, &conf, on_done, "join"), Ok);
+    run(1000);
+    // the script stops at the failed command
+    CHECK_EQ(done_count, 1);
+    CHECK_EQ(join.ret, BadResponse);
+    CHECK_EQ(sim_count("C4"), 0);
+    CHECK_EQ(sim_count("C0"), 0);
+
+    // a module that stops answering ends the request, without blocking the loop
+    sim_fail("CS", 1, true);
+    CHECK_EQ(ism43362_async_script(&script, "CS\r\n", ISM_FORGET_NONE, on_done, "cs"), Ok);
+    uint64_t begin = stub_time_ns();
+    run(10000);
+    CHECK_EQ(done_count, 2);
+    CHECK_EQ(script.ret, Timeout);
+    CHECK_NEAR((double) (stub_time_ns() - begin) / MS, ism43362_get_timeouts().cmd_ms, 2);
+    CHECK(longest_process_ns < MS);
+}
+
+int main(void) {
+    RUN(test_queue_order);
+    RUN(test_long_read_keeps_sampling);
+    RUN(test_forget_when_started);
+    RUN(test_script_forget_and_sockets);
+    RUN(test_errors_and_timeouts);
+    TEST_END();
+}
@@ -0,0 +1,123 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "module_sim.h"
+#include "test.h"
+
+// large payloads go out in ISM43362_MAX_PAYLOAD chunks, only what the module never got is sent again
+
+#define MS 1000000ULL
+#define LEN 5000
+
+static uint8_t data[LEN];
+static uint8_t out[LEN + 100];
+
+static void setup(void) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    ISM43362Timeouts t = ism43362_get_default_timeouts();
+    ism43362_set_timeouts(&t);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = SOCKET_1;
+    client.read_timeout_ms = 100;
+    CHECK_EQ(ism43362_start_wifi_client(&client), Ok);
+    for (size_t i = 0; i < LEN; i++) {
+        data[i] = (uint8_t) (i * 13 + i / 256);
+    }
+}
+
+static void test_chunks(void) {
+    setup();
+    size_t sent = 0;
+    CHECK_EQ(ism43362_send_all(SOCKET_1, data, LEN, &sent), Ok);
+    CHECK_EQ(sent, LEN);
+    // 3 full chunks and the rest
+    CHECK_EQ(sim_count("S3"), 4);
+    CHECK_EQ(sim_take_tx(1, out, sizeof(out)), LEN);
+    CHECK(memcmp(out, data, LEN) == 0);
+
+    // the module takes part of every chunk, the next one starts after what it took
+    sim_set_s3_accept(1000);
+    CHECK_EQ(ism43362_send_all(SOCKET_1, data, LEN, &sent), Ok);
+    CHECK_EQ(sent, LEN);
+    CHECK_EQ(sim_count("S3"), 4 + 5);
+    CHECK_EQ(sim_take_tx(1, out, sizeof(out)), LEN);
+    CHECK(memcmp(out, data, LEN) == 0);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+}
+
+static void test_errors(void) {
+    setup();
+    // a refused chunk ends the transfer, it isn't sent again
+    size_t sent = 0;
+    CHECK_EQ(ism43362_send_all(SOCKET_1, data, 1460, &sent), Ok);
+    sim_take_tx(1, out, sizeof(out));
+    uint32_t s3 = sim_count("S3");
+    sim_fail("S3", 1, false);
+    CHECK(ism43362_send_all(SOCKET_1, data, LEN, &sent) != Ok);
+    CHECK_EQ(sent, 0);
+    CHECK_EQ(sim_count("S3"), s3 + 1);
+    CHECK_EQ(sim_tx_len(1), 0);
+
+    // a module that stops answering after the data went out isn't sent the chunk again
+    sim_fail("S3", 1, true);
+    CHECK_EQ(ism43362_send_all(SOCKET_1, data, LEN, &sent), Timeout);
+    CHECK_EQ(sent, 0);
+    CHECK_EQ(sim_count("S3"), s3 + 2);
+}
+
+static void test_not_ready_retries(void) {
+    setup();
+    // the module is stuck on a previous command, every attempt times out before sending anything
+    ISM43362Timeouts t = ism43362_get_default_timeouts();
+    t.ready_ms = 40;
+    t.cmd_ms = 60;
+    ism43362_set_timeouts(&t);
+    sim_fail("CS", 1, true);
+    bool connected;
+    CHECK_EQ(ism43362_is_connected(&connected), Timeout);
+    uint32_t commands = sim_total_commands();
+    size_t sent = 1;
+    uint64_t start = stub_time_ns();
+    CHECK_EQ(ism43362_send_all(SOCKET_1, data, LEN, &sent), Timeout);
+    CHECK_EQ(sent, 0);
+    CHECK_EQ(sim_total_commands(), commands);
+    CHECK_NEAR((double) (stub_time_ns() - start) / MS, (1 + ISM43362_BULK_RETRIES) * 40, 3);
+}
+
+static void test_read_exact(void) {
+    setup();
+    sim_push_rx(1, data, 2000);
+    sim_push_rx(1, data + 2000, 1000);
+    static uint8_t buff[3000];
+    size_t received = 0;
+    CHECK_EQ(ism43362_read_exact(SOCKET_1, buff, sizeof(buff), &received, 1000), Ok);
+    CHECK_EQ(received, 3000);
+    CHECK(memcmp(buff, data, 3000) == 0);
+
+    // a part of a read stays in the stash for the next one
+    sim_push_rx(1, data, 100);
+    CHECK_EQ(ism43362_read_exact(SOCKET_1, buff, 60, &received, 1000), Ok);
+    CHECK_EQ(received, 60);
+    CHECK_EQ(ism43362_read_exact(SOCKET_1, buff, 40, &received, 1000), Ok);
+    CHECK(memcmp(buff, data + 60, 40) == 0);
+
+    // less data than asked for: Timeout with what arrived, the idle reads take the socket read timeout
+    sim_push_rx(1, data, 10);
+    uint64_t start = stub_time_ns();
+    CHECK_EQ(ism43362_read_exact(SOCKET_1, buff, 20, &received, 250), Timeout);
+    CHECK_EQ(received, 10);
+    double elapsed = (double) (stub_time_ns() - start) / MS;
+    CHECK(elapsed >= 250);
+    CHECK(elapsed <= 250 + 100 + 5);
+}
+
+int main(void) {
+    RUN(test_chunks);
+    RUN(test_errors);
+    RUN(test_not_ready_retries);
+    RUN(test_read_exact);
+    TEST_END();
+}
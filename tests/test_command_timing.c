@@ -0,0 +1,131 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "module_sim.h"
+#include "test.h"
+
+// the commands wait for the DRDY edges with timeouts, a module that stops answering gives Timeout instead of a hang
+
+#define MS 1000000ULL
+
+static uint32_t idle_calls;
+
+static void count_idle(void) {
+    idle_calls++;
+    stub_advance_ns(1000);
+}
+
+static void setup(void) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    ISM43362Timeouts t = ism43362_get_default_timeouts();
+    ism43362_set_timeouts(&t);
+    ism43362_set_idle_hook(NULL);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+}
+
+// HAL_GetTick() counts whole ms, so the timeouts are within 1 ms
+static double elapsed_ms(uint64_t start) { return (double) (stub_time_ns() - start) / MS; }
+
+static void test_cmd_timeouts(void) {
+    setup();
+    ISM43362Timeouts t = ism43362_get_default_timeouts();
+    CHECK_EQ(ism43362_cmd_timeout_ms("CS\r\n", 4), t.cmd_ms);
+    CHECK_EQ(ism43362_cmd_timeout_ms("C0\r\n", 4), t.connect_ms);
+    CHECK_EQ(ism43362_cmd_timeout_ms("P6=1\r\n", 6), t.connect_ms);
+    CHECK_EQ(ism43362_cmd_timeout_ms("P6=0\r\n", 6), t.cmd_ms);
+    // without the socket settings R0 and S3 wait for the largest socket timeout
+    CHECK_EQ(ism43362_cmd_timeout_ms("R0\r\n", 4), ISM43362_MAX_SOCKET_TIMEOUT_MS + t.data_margin_ms);
+    CHECK_EQ(ism43362_cmd_timeout_ms("S3=10\r", 6), ISM43362_MAX_SOCKET_TIMEOUT_MS + t.data_margin_ms);
+
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = SOCKET_2;
+    client.read_timeout_ms = 200;
+    client.write_timeout_ms = 300;
+    CHECK_EQ(ism43362_start_wifi_client(&client), Ok);
+    CHECK_EQ(ism43362_cmd_timeout_ms("R0\r\n", 4), 200 + t.data_margin_ms);
+    CHECK_EQ(ism43362_cmd_timeout_ms("S3=10\r", 6), 300 + t.data_margin_ms);
+
+    // an idle socket answers R0 after its read timeout, which is no error
+    uint8_t buff[ISM43362_MAX_PAYLOAD + 16];
+    size_t len = 1;
+    uint64_t start = stub_time_ns();
+    CHECK_EQ(ism43362_read(buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(len, 0);
+    CHECK_NEAR(elapsed_ms(start), 200, 1);
+}
+
+static void test_stalled_module(void) {
+    setup();
+    CHECK_EQ(ism43362_set_socket(SOCKET_1), Ok);
+    sim_fail("CS", 1, true);
+    bool connected;
+    uint64_t start = stub_time_ns();
+    CHECK_EQ(ism43362_is_connected(&connected), Timeout);
+    CHECK_NEAR(elapsed_ms(start), ism43362_get_default_timeouts().cmd_ms, 1);
+    // the module might have been reset meanwhile
+    CHECK_EQ(ism43362_get_selected_socket(), -1);
+
+    // still busy, the next command can't even start
+    ISM43362Timeouts t = ism43362_get_default_timeouts();
+    t.ready_ms = 40;
+    t.cmd_ms = 60;
+    ism43362_set_timeouts(&t);
+    start = stub_time_ns();
+    CHECK_EQ(ism43362_is_connected(&connected), Timeout);
+    CHECK_NEAR(elapsed_ms(start), 40, 1);
+    CHECK_EQ(sim_count("CS"), 1);
+
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    CHECK_EQ(ism43362_is_connected(&connected), Ok);
+    CHECK(connected);
+
+    sim_fail("CS", 1, true);
+    start = stub_time_ns();
+    CHECK_EQ(ism43362_is_connected(&connected), Timeout);
+    CHECK_NEAR(elapsed_ms(start), 60, 1);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+}
+
+static void test_idle_hook(void) {
+    setup();
+    stub_module_set_latency_ns(2 * MS);
+    idle_calls = 0;
+    ism43362_set_idle_hook(count_idle);
+    bool connected;
+    CHECK_EQ(ism43362_is_connected(&connected), Ok);
+    // the hook runs while the module prepares the response, instead of spinning
+    CHECK(idle_calls >= 1000);
+    CHECK(idle_calls <= 2100);
+    ism43362_set_idle_hook(NULL);
+}
+
+// commands per second in simulated time, against the previous driver that waited 1 ms after every command
+static void test_commands_per_second(void) {
+    setup();
+    // processing time of a short command in the module
+    stub_module_set_latency_ns(30000);
+    const int n = 500;
+    bool connected;
+    stub_spi_reset_stats();
+    uint64_t start = stub_time_ns();
+    for (int i = 0; i < n; i++) {
+        CHECK_EQ(ism43362_is_connected(&connected), Ok);
+    }
+    double seconds = (stub_time_ns() - start) / 1e9;
+    double after = n / seconds;
+    double before = n / (seconds + n * 1e-3);
+    printf("CS: %.0f commands/s, %.0f commands/s with a 1 ms delay per command\n", after, before);
+    CHECK_EQ(sim_count("CS"), n);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+    CHECK(after > 5 * before);
+}
+
+int main(void) {
+    RUN(test_cmd_timeouts);
+    RUN(test_stalled_module);
+    RUN(test_idle_hook);
+    RUN(test_commands_per_second);
+    TEST_END();
+}
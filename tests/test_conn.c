@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "ism43362_conn.h"
+#include "module_sim.h"
+#include "test.h"
+
+// the link and the sockets are restarted with exponential backoff, a remote that refuses the connection isn't
+// retried at every poll
+
+#define MS 1000000ULL
+
+static ISM43362Conn conn;
+
+static void setup(void) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    ISM43362ConnConfig conf = ism43362_conn_get_default_config();
+    conf.probe_period_ms = 1000;
+    conf.backoff_min_ms = 500;
+    conf.backoff_max_ms = 4000;
+    JoinWifiConfig wifi = ism43362_get_default_wifi_config();
+    strcpy(wifi.ssid, "net");
+    strcpy(wifi.password, "secret");
+    CHECK_EQ(ism43362_conn_init(&conn, &conf, &wifi), Ok);
+    CHECK(ism43362_conn_is_up(&conn));
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = SOCKET_1;
+    CHECK_EQ(ism43362_conn_add_client(&conn, &client), Ok);
+}
+
+// polls every 10 ms for ms
+static void run(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 10) {
+        ism43362_conn_poll(&conn);
+        stub_advance_ns(10 * MS);
+    }
+}
+
+static void test_link_loss(void) {
+    setup();
+    uint32_t probes = sim_count("CS");
+    run(990);
+    CHECK_EQ(sim_count("CS"), probes);
+    run(20);
+    CHECK_EQ(sim_count("CS"), probes + 1);
+
+    // the probe fails and the joins too, twice
+    sim_fail("CS", 1, false);
+    run(1000);
+    CHECK(!ism43362_conn_is_up(&conn));
+    sim_fail("C0", 2, false);
+    CHECK_EQ(conn.stats.link_losses, 1);
+    uint8_t packet[4] = {0};
+    CHECK_EQ(ism43362_conn_send(&conn, SOCKET_1, packet, sizeof(packet)), NotConnected);
+
+    // the rejoins are 500 then 1000 ms apart
+    run(1600);
+    CHECK(ism43362_conn_is_up(&conn));
+    CHECK_EQ(conn.stats.failed_rejoins, 2);
+    CHECK_EQ(conn.stats.rejoins, 1);
+    CHECK_EQ(conn.stats.socket_restarts, 1);
+    CHECK(conn.stats.last_reconnect_ms >= 1500);
+    CHECK_EQ(conn.stats.downtime_ms, conn.stats.last_reconnect_ms);
+    CHECK_EQ(ism43362_conn_send(&conn, SOCKET_1, packet, sizeof(packet)), Ok);
+}
+
+static void test_socket_restart_backoff(void) {
+    setup();
+    uint8_t packet[4] = {0};
+    // a failed send marks the socket lost
+    sim_fail("S3", 1, false);
+    CHECK_EQ(ism43362_conn_send(&conn, SOCKET_1, packet, sizeof(packet)), BadResponse);
+    // the remote refuses the connection
+    sim_fail("P6", 100, false);
+    uint32_t starts = sim_count("P6");
+
+    // tried at once, then after 500, 1000, 2000, 4000 and 4000 ms
+    run(11600);
+    CHECK(ism43362_conn_is_up(&conn));
+    CHECK_EQ(sim_count("P6") - starts, 6);
+    CHECK_EQ(conn.stats.failed_restarts, 6);
+    CHECK_EQ(conn.stats.socket_restarts, 0);
+    CHECK_EQ(ism43362_conn_send(&conn, SOCKET_1, packet, sizeof(packet)), NotConnected);
+
+    sim_fail("P6", 0, false);
+    run(4000);
+    CHECK_EQ(conn.stats.socket_restarts, 1);
+    CHECK_EQ(ism43362_conn_send(&conn, SOCKET_1, packet, sizeof(packet)), Ok);
+    // a new loss starts from the shortest backoff
+    sim_fail("S3", 1, false);
+    CHECK_EQ(ism43362_conn_send(&conn, SOCKET_1, packet, sizeof(packet)), BadResponse);
+    sim_fail("P6", 1, false);
+    run(520);
+    CHECK_EQ(conn.stats.failed_restarts, 7);
+    CHECK_EQ(conn.stats.socket_restarts, 2);
+}
+
+int main(void) {
+    RUN(test_link_loss);
+    RUN(test_socket_restart_backoff);
+    TEST_END();
+}
@@ -0,0 +1,133 @@
+#include "hal_stub.h"
+#include "sensors.h"
+#include "test.h"
+
+// sensor_read_new_sample() only reads a sample when the status register, or the interrupt, tells every output of
+// the burst was updated
+
+static I2C_HandleTypeDef hi2c2 = {.Instance = 2};
+
+static void put_i16(uint16_t addr, uint8_t reg, int16_t v) {
+    uint8_t *regs = stub_i2c_regs(addr);
+    regs[reg] = (uint16_t) v & 0xff;
+    regs[reg + 1] = (uint16_t) v >> 8;
+}
+
+static SensorReadStatus read_new(Sensor s, uint32_t *transactions) {
+    SensorSample sample;
+    stub_i2c_reset_stats();
+    SensorReadStatus status = sensor_read_new_sample(s, &sample);
+    *transactions = stub_i2c_stats().transactions;
+    return status;
+}
+
+static void test_new_and_stale(void) {
+    stub_reset();
+    LIS3MDLDevice lis = lis3mdl_get_default_device(&hi2c2);
+    lis3mdl_init(&lis, LIS_80_HZ, LIS_4_GAUSS);
+    put_i16(0x3c, 0x28, 1000);
+    uint32_t transactions;
+
+    // only the status is read
+    stub_i2c_regs(0x3c)[0x27] = 0x00;
+    CHECK_EQ(read_new(lis3mdl_sensor(&lis), &transactions), SENSOR_NO_NEW_DATA);
+    CHECK_EQ(transactions, 1);
+    CHECK_EQ(lis.drdy.stale_reads, 1);
+
+    stub_i2c_regs(0x3c)[0x27] = 0x08; // ZYXDA
+    SensorSample sample;
+    stub_i2c_reset_stats();
+    CHECK_EQ(sensor_read_new_sample(lis3mdl_sensor(&lis), &sample), SENSOR_NEW_DATA);
+    CHECK_EQ(stub_i2c_stats().transactions, 2);
+    CHECK_EQ(sample.kind, SENSOR_LIS3MDL);
+    CHECK_NEAR(sample.data.lis3mdl.x, 1000 * 0.14f, 1e-3);
+    CHECK_EQ(lis.drdy.stale_reads, 1);
+    CHECK_EQ(lis.drdy.overruns, 0);
+
+    stub_i2c_fail_next(1);
+    CHECK_EQ(read_new(lis3mdl_sensor(&lis), &transactions), SENSOR_BUS_ERROR);
+}
+
+static void test_overruns(void) {
+    stub_reset();
+    LIS3MDLDevice lis = lis3mdl_get_default_device(&hi2c2);
+    lis3mdl_init(&lis, LIS_80_HZ, LIS_4_GAUSS);
+    LPS22HBDevice lps = lps22hb_get_default_device(&hi2c2);
+    lps22hb_init(&lps, LPS_HZ_25);
+    uint32_t transactions;
+
+    // the output is still new, the one before it was lost
+    stub_i2c_regs(0x3c)[0x27] = 0x88; // ZYXOR | ZYXDA
+    CHECK_EQ(read_new(lis3mdl_sensor(&lis), &transactions), SENSOR_NEW_DATA);
+    CHECK_EQ(lis.drdy.overruns, 1);
+    stub_i2c_regs(0xba)[0x27] = 0x13; // P_OR | T_DA | P_DA
+    CHECK_EQ(read_new(lps22hb_sensor(&lps), &transactions), SENSOR_NEW_DATA);
+    stub_i2c_regs(0xba)[0x27] = 0x23; // T_OR | T_DA | P_DA
+    CHECK_EQ(read_new(lps22hb_sensor(&lps), &transactions), SENSOR_NEW_DATA);
+    CHECK_EQ(lps.drdy.overruns, 2);
+
+    // an overrun without new data isn't counted, the next read sees it again
+    stub_i2c_regs(0x3c)[0x27] = 0x80;
+    CHECK_EQ(read_new(lis3mdl_sensor(&lis), &transactions), SENSOR_NO_NEW_DATA);
+    CHECK_EQ(lis.drdy.overruns, 1);
+}
+
+static void test_every_output_of_the_burst(void) {
+    stub_reset();
+    HTS221Device hts = hts221_get_default_device(&hi2c2);
+    hts221_init(&hts, HTS_HZ_1);
+    uint32_t transactions;
+    // humidity and temperature are both in the burst
+    const uint8_t partial[] = {0x01, 0x02};
+    for (size_t i = 0; i < sizeof(partial); i++) {
+        stub_i2c_regs(0xbe)[0x27] = partial[i];
+        CHECK_EQ(read_new(hts221_sensor(&hts), &transactions), SENSOR_NO_NEW_DATA);
+    }
+    stub_i2c_regs(0xbe)[0x27] = 0x03;
+    CHECK_EQ(read_new(hts221_sensor(&hts), &transactions), SENSOR_NEW_DATA);
+    CHECK_EQ(hts.drdy.stale_reads, 2);
+
+    LPS22HBDevice lps = lps22hb_get_default_device(&hi2c2);
+    lps22hb_init(&lps, LPS_HZ_25);
+    stub_i2c_regs(0xba)[0x27] = 0x01;
+    CHECK_EQ(read_new(lps22hb_sensor(&lps), &transactions), SENSOR_NO_NEW_DATA);
+
+    // the LSM6DSL outputs of the sensors that are off never change
+    LSM6DSLDevice lsm = lsm6dsl_get_default_device(&hi2c2);
+    lsm6dsl_init(&lsm, XL_104_HZ, XL_2_G, G_104_HZ, G_250_DPS);
+    stub_i2c_regs(0xd4)[0x1e] = 0x01; // XLDA
+    CHECK_EQ(read_new(lsm6dsl_sensor(&lsm), &transactions), SENSOR_NO_NEW_DATA);
+    stub_i2c_regs(0xd4)[0x1e] = 0x03;
+    CHECK_EQ(read_new(lsm6dsl_sensor(&lsm), &transactions), SENSOR_NEW_DATA);
+    lsm6dsl_set_gyro_config(&lsm, G_POWER_DOWN, G_250_DPS);
+    stub_i2c_regs(0xd4)[0x1e] = 0x01;
+    CHECK_EQ(read_new(lsm6dsl_sensor(&lsm), &transactions), SENSOR_NEW_DATA);
+}
+
+static void test_interrupt(void) {
+    stub_reset();
+    LIS3MDLDevice lis = lis3mdl_get_default_device(&hi2c2);
+    lis3mdl_init(&lis, LIS_80_HZ, LIS_4_GAUSS);
+    lis3mdl_enable_drdy_interrupt(&lis);
+    // the status register isn't read
+    stub_i2c_regs(0x3c)[0x27] = 0x00;
+    uint32_t transactions;
+
+    // the line might already be high, the first read doesn't wait for an edge
+    CHECK_EQ(read_new(lis3mdl_sensor(&lis), &transactions), SENSOR_NEW_DATA);
+    CHECK_EQ(transactions, 1);
+    CHECK_EQ(read_new(lis3mdl_sensor(&lis), &transactions), SENSOR_NO_NEW_DATA);
+    CHECK_EQ(transactions, 0);
+    sensor_drdy_exti_callback(lis3mdl_sensor(&lis));
+    CHECK_EQ(read_new(lis3mdl_sensor(&lis), &transactions), SENSOR_NEW_DATA);
+    CHECK_EQ(transactions, 1);
+    CHECK_EQ(lis.drdy.stale_reads, 1);
+}
+
+int main(void) {
+    RUN(test_new_and_stale);
+    RUN(test_overruns);
+    RUN(test_every_output_of_the_burst);
+    RUN(test_interrupt);
+    TEST_END();
+}
@@ -0,0 +1,137 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "ism43362_encode.h"
+#include "module_sim.h"
+#include "test.h"
+
+// the commands are built without printf, the result must match the printf formats they replace
+
+static void check_text(const ISM43362Encoder *e, const char *expected) {
+    CHECK(!e->overflow);
+    CHECK_EQ(e->len, strlen(expected));
+    if (strcmp(e->buff, expected) != 0) {
+        fprintf(stderr, "encoded: '%s', expected: '%s'\n", e->buff, expected);
+        CHECK(false);
+    }
+}
+
+static void test_numbers(void) {
+    const uint32_t values[] = {0, 1, 9, 10, 99, 100, 5025, 65535, 1000000000, 4294967295u};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        char buff[16], expected[16];
+        ISM43362Encoder e;
+        ism43362_enc_init(&e, buff, sizeof(buff));
+        ism43362_enc_u32(&e, values[i]);
+        snprintf(expected, sizeof(expected), "%lu", (unsigned long) values[i]);
+        check_text(&e, expected);
+    }
+
+    char buff[64];
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, buff, sizeof(buff));
+    const uint8_t ip[4] = {0, 10, 192, 255};
+    ism43362_enc_ip(&e, ip);
+    check_text(&e, "0.10.192.255");
+}
+
+static void test_params(void) {
+    char buff[64];
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, buff, sizeof(buff));
+    const uint8_t ip[4] = {192, 168, 1, 20};
+    ism43362_enc_param(&e, "P0", 3);
+    ism43362_enc_param_ip(&e, "P3", ip);
+    ism43362_enc_param_str(&e, "C1", "net");
+    ism43362_enc_char(&e, 'x');
+    check_text(&e, "P0=3\r\nP3=192.168.1.20\r\nC1=net\r\nx");
+}
+
+static void test_overflow(void) {
+    // "S3=1460\r" needs 9 bytes with the terminator
+    char buff[9];
+    ISM43362Encoder e;
+    ism43362_enc_init(&e, buff, sizeof(buff));
+    ism43362_enc_str(&e, "S3=");
+    ism43362_enc_u32(&e, 1460);
+    ism43362_enc_char(&e, '\r');
+    check_text(&e, "S3=1460\r");
+
+    // a value that doesn't fit isn't cut, and nothing is appended after it
+    memset(buff, 'z', sizeof(buff));
+    ism43362_enc_init(&e, buff, sizeof(buff));
+    ism43362_enc_str(&e, "S3=");
+    ism43362_enc_u32(&e, 146000);
+    CHECK(e.overflow);
+    ism43362_enc_char(&e, '\r');
+    CHECK_EQ(e.len, 3);
+    CHECK(strcmp(buff, "S3=") == 0);
+
+    // terminated even when the first string doesn't fit
+    ism43362_enc_init(&e, buff, sizeof(buff));
+    ism43362_enc_str(&e, "123456789");
+    CHECK(e.overflow);
+    CHECK_EQ(buff[0], 0);
+
+    ism43362_enc_init(&e, buff, 0);
+    CHECK(e.overflow);
+    ism43362_enc_char(&e, 'x');
+    CHECK_EQ(e.len, 0);
+}
+
+static void test_socket_setups(void) {
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = SOCKET_2;
+    client.remote.ip[0] = 10;
+    client.remote.ip[3] = 9;
+    ISM43362SocketSetup setup;
+    CHECK_EQ(ism43362_encode_client_setup(&client, &setup), Ok);
+    CHECK_EQ(setup.s, SOCKET_2);
+    CHECK(!setup.tcp_server);
+    CHECK_EQ(setup.len, strlen(setup.cmds));
+    CHECK(strcmp(setup.cmds, "P0=2\r\nP1=0\r\nP3=10.0.0.9\r\nP4=5025\r\nR1=1460\r\nR2=5000\r\nS2=5000\r\nP6=1\r\n") == 0);
+
+    WifiTcpServerConfig server = ism43362_get_default_tcp_server_config();
+    server.base_conf.s = SOCKET_1;
+    server.listen_backlogs = 3;
+    server.keep_alive_enabled = true;
+    server.keep_alive_timeout_ms = 7200000;
+    CHECK_EQ(ism43362_encode_tcp_server_setup(&server, &setup), Ok);
+    CHECK(setup.tcp_server);
+    CHECK(strcmp(setup.cmds, "P0=1\r\nP2=5024\r\nR1=1460\r\nR2=5000\r\nS2=5000\r\nP8=3\r\nPK=1,7200000\r\nP5=11\r\n") == 0);
+
+    client.s = (Socket) 4;
+    CHECK_EQ(ism43362_encode_client_setup(&client, &setup), Error);
+}
+
+static void test_replay(void) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = SOCKET_3;
+    client.read_timeout_ms = 700;
+    ISM43362SocketSetup setup;
+    CHECK_EQ(ism43362_encode_client_setup(&client, &setup), Ok);
+
+    // every command is sent on each replay, e.g. after the module lost its settings on a reconnect
+    CHECK_EQ(ism43362_replay_setup(&setup), Ok);
+    CHECK_EQ(ism43362_replay_setup(&setup), Ok);
+    CHECK_EQ(sim_count("P0"), 2);
+    CHECK_EQ(sim_count("R2"), 2);
+    CHECK_EQ(sim_count("P6"), 2);
+    CHECK_EQ(sim_socket_param(3, "R2"), 700);
+    CHECK_EQ(ism43362_get_selected_socket(), 3);
+
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+}
+
+int main(void) {
+    RUN(test_numbers);
+    RUN(test_params);
+    RUN(test_overflow);
+    RUN(test_socket_setups);
+    RUN(test_replay);
+    TEST_END();
+}
@@ -0,0 +1,216 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "sensors.h"
+#include "test.h"
+
+// the Q16.16 reads must match the float ones, and the stored HTS221 calibration must restore the same conversion
+
+static I2C_HandleTypeDef hi2c2 = {.Instance = 2};
+
+static const int16_t raw_values[] = {0, 1, -1, 1000, -1000, 12345, -23456, 32767, -32768};
+#define RAW_COUNT (sizeof(raw_values) / sizeof(raw_values[0]))
+
+static double from_q16(int32_t v) { return v / 65536.0; }
+
+// the Q8.24 scale factors round to about 1e-7 of the LSB value, the Q16.16 result to 2^-16
+static void check_q16(int32_t q, float f) { CHECK_NEAR(from_q16(q), f, 2e-5 + fabsf(f) * 2e-4); }
+
+static void put_i16(uint16_t addr, uint8_t reg, int16_t v) {
+    uint8_t *regs = stub_i2c_regs(addr);
+    regs[reg] = (uint16_t) v & 0xff;
+    regs[reg + 1] = (uint16_t) v >> 8;
+}
+
+static void put_vec(uint16_t addr, uint8_t reg, int16_t v) {
+    put_i16(addr, reg, v);
+    put_i16(addr, reg + 2, -v);
+    put_i16(addr, reg + 4, v / 2);
+}
+
+static void check_vec(Vec3Q16 q, Vec3 f) {
+    check_q16(q.x, f.x);
+    check_q16(q.y, f.y);
+    check_q16(q.z, f.z);
+}
+
+static void test_lsm6dsl(void) {
+    stub_reset();
+    const LSM6DSLXLFullScale xl[] = {XL_2_G, XL_4_G, XL_8_G, XL_16_G};
+    const LSM6DSLGFullScale g[] = {G_250_DPS, G_500_DPS, G_1000_DPS, G_2000_DPS};
+    LSM6DSLDevice dev = lsm6dsl_get_default_device(&hi2c2);
+    for (size_t fs = 0; fs < 4; fs++) {
+        lsm6dsl_init(&dev, XL_104_HZ, xl[fs], G_104_HZ, g[fs]);
+        for (size_t i = 0; i < RAW_COUNT; i++) {
+            put_vec(0xd4, 0x22, raw_values[i]);
+            put_vec(0xd4, 0x28, raw_values[i]);
+            check_vec(lsm6dsl_read_accel_q16(&dev), lsm6dsl_read_accel(&dev));
+            check_vec(lsm6dsl_read_gyro_q16(&dev), lsm6dsl_read_gyro(&dev));
+        }
+    }
+}
+
+static void test_lis3mdl(void) {
+    stub_reset();
+    const LIS3MDLFullScale fs[] = {LIS_4_GAUSS, LIS_8_GAUSS, LIS_12_GAUSS, LIS_16_GAUSS};
+    LIS3MDLDevice dev = lis3mdl_get_default_device(&hi2c2);
+    for (size_t f = 0; f < 4; f++) {
+        lis3mdl_init(&dev, LIS_80_HZ, fs[f]);
+        for (size_t i = 0; i < RAW_COUNT; i++) {
+            put_vec(0x3c, 0x28, raw_values[i]);
+            check_vec(lis3mdl_read_mag_q16(&dev), lis3mdl_read_mag(&dev));
+        }
+    }
+}
+
+static void test_lps22hb(void) {
+    stub_reset();
+    LPS22HBDevice dev = lps22hb_get_default_device(&hi2c2);
+    lps22hb_init(&dev, LPS_HZ_25);
+    const int32_t presses[] = {0, 260 * 4096, 1013 * 4096 + 2048, 1260 * 4096 + 4095, -4096};
+    uint8_t *regs = stub_i2c_regs(0xba);
+    for (size_t i = 0; i < sizeof(presses) / sizeof(presses[0]); i++) {
+        regs[0x28] = presses[i] & 0xff;
+        regs[0x29] = (presses[i] >> 8) & 0xff;
+        regs[0x2a] = (presses[i] >> 16) & 0xff;
+        CHECK_EQ(lps22hb_read_press_q16(&dev), presses[i] * 16);
+        check_q16(lps22hb_read_press_q16(&dev), lps22hb_read_press(&dev));
+    }
+    for (size_t i = 0; i < RAW_COUNT; i++) {
+        put_i16(0xba, 0x2b, raw_values[i]);
+        check_q16(lps22hb_read_temp_q16(&dev), lps22hb_read_temp(&dev));
+    }
+}
+
+// t0 and t1 in degrees, the other values as in the registers
+static void put_hts221_calibration(uint8_t h0_x2, uint8_t h1_x2, uint16_t t0, uint16_t t1, int16_t h0_out,
+                                   int16_t h1_out, int16_t t0_out, int16_t t1_out) {
+    uint8_t *regs = stub_i2c_regs(0xbe);
+    regs[0x30] = h0_x2;
+    regs[0x31] = h1_x2;
+    regs[0x32] = (t0 * 8) & 0xff;
+    regs[0x33] = (t1 * 8) & 0xff;
+    regs[0x35] = ((t0 * 8) >> 8) | (((t1 * 8) >> 8) << 2);
+    put_i16(0xbe, 0x36, h0_out);
+    put_i16(0xbe, 0x3a, h1_out);
+    put_i16(0xbe, 0x3c, t0_out);
+    put_i16(0xbe, 0x3e, t1_out);
+}
+
+static void check_hts221(const HTS221Device *dev) {
+    for (size_t i = 0; i < RAW_COUNT; i++) {
+        put_i16(0xbe, 0x28, raw_values[i]);
+        put_i16(0xbe, 0x2a, raw_values[i]);
+        check_q16(hts221_read_hum_q16(dev), hts221_read_hum(dev));
+        check_q16(hts221_read_temp_q16(dev), hts221_read_temp(dev));
+    }
+}
+
+static void test_hts221(void) {
+    stub_reset();
+    HTS221Device dev = hts221_get_default_device(&hi2c2);
+    put_hts221_calibration(60, 140, 10, 30, 1000, 5000, 300, 700);
+    hts221_init(&dev, HTS_HZ_1);
+    put_i16(0xbe, 0x28, 3000);
+    put_i16(0xbe, 0x2a, 500);
+    CHECK_NEAR(from_q16(hts221_read_hum_q16(&dev)), 50.0, 1e-4);
+    CHECK_NEAR(from_q16(hts221_read_temp_q16(&dev)), 20.0, 1e-4);
+    check_hts221(&dev);
+
+    // the output decreases with the temperature on some parts, the slope is negative
+    put_hts221_calibration(40, 160, 15, 35, -8000, 9000, 700, 300);
+    hts221_init(&dev, HTS_HZ_1);
+    CHECK(dev.calib.t_m_q24 < 0);
+    put_i16(0xbe, 0x2a, 500);
+    CHECK_NEAR(from_q16(hts221_read_temp_q16(&dev)), 25.0, 1e-4);
+    check_hts221(&dev);
+
+    // temperatures over 31 degrees use the MSB register
+    put_hts221_calibration(40, 160, 5, 60, -8000, 9000, -1000, 2000);
+    hts221_init(&dev, HTS_HZ_1);
+    CHECK_EQ(dev.calib.t1_degc, 60);
+    CHECK(dev.calib.valid);
+    check_hts221(&dev);
+}
+
+static void test_hts221_flat_calibration(void) {
+    stub_reset();
+    HTS221Device dev = hts221_get_default_device(&hi2c2);
+    // both temperature points have the same output, there's no slope to interpolate with
+    put_hts221_calibration(60, 140, 10, 30, 1000, 5000, 400, 400);
+    hts221_init(&dev, HTS_HZ_1);
+    CHECK(!dev.calib.valid);
+    // both paths read the first point instead of inf or a division by zero
+    put_i16(0xbe, 0x2a, 500);
+    CHECK_NEAR(hts221_read_temp(&dev), 10.0, 1e-6);
+    CHECK_NEAR(from_q16(hts221_read_temp_q16(&dev)), 10.0, 1e-6);
+    check_hts221(&dev);
+
+    // the same for the humidity, and a stored flat calibration isn't restored
+    put_hts221_calibration(60, 140, 10, 30, 2000, 2000, 300, 700);
+    hts221_init(&dev, HTS_HZ_1);
+    CHECK(!dev.calib.valid);
+    CHECK_NEAR(hts221_read_hum(&dev), 30.0, 1e-6);
+    check_hts221(&dev);
+    uint8_t blob[HTS221_CALIBRATION_BLOB_LEN];
+    hts221_save_calibration(&dev, blob);
+    HTS221Device restored = hts221_get_default_device(&hi2c2);
+    CHECK(!hts221_init_from_calibration(&restored, HTS_HZ_1, blob));
+}
+
+static void test_batch_conversion(void) {
+    LSM6DSLDevice dev = lsm6dsl_get_default_device(&hi2c2);
+    lsm6dsl_init(&dev, XL_104_HZ, XL_8_G, G_104_HZ, G_2000_DPS);
+    int32_t q[RAW_COUNT];
+    float f[RAW_COUNT];
+    sensors_convert_q16(raw_values, q, RAW_COUNT, dev.g_scale_q24);
+    sensors_convert_float(raw_values, f, RAW_COUNT, dev.g_scale);
+    for (size_t i = 0; i < RAW_COUNT; i++) {
+        CHECK_NEAR(f[i], raw_values[i] * dev.g_scale, 1e-6);
+        check_q16(q[i], f[i]);
+    }
+}
+
+static void test_calibration_blob(void) {
+    stub_reset();
+    HTS221Device dev = hts221_get_default_device(&hi2c2);
+    put_hts221_calibration(40, 160, 15, 35, -8000, 9000, 700, 300);
+    hts221_init(&dev, HTS_HZ_7);
+    uint8_t blob[HTS221_CALIBRATION_BLOB_LEN];
+    hts221_save_calibration(&dev, blob);
+
+    // a restore at boot doesn't read the calibration from the sensor, only CTRL1 is written
+    HTS221Device restored = hts221_get_default_device(&hi2c2);
+    memset(stub_i2c_regs(0xbe) + 0x30, 0, 16);
+    stub_i2c_reset_stats();
+    CHECK(hts221_init_from_calibration(&restored, HTS_HZ_7, blob));
+    CHECK_EQ(stub_i2c_stats().transactions, 1);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 0);
+    CHECK_EQ(stub_i2c_regs(0xbe)[0x20], HTS_HZ_7 | 0x80);
+    CHECK_EQ(restored.update_rate, HTS_HZ_7);
+    CHECK(memcmp(&restored.calib, &dev.calib, sizeof(dev.calib)) == 0);
+    check_hts221(&restored);
+
+    // any corrupted byte, or another version, is rejected and the device is left alone
+    for (size_t i = 0; i < HTS221_CALIBRATION_BLOB_LEN; i++) {
+        uint8_t bad[HTS221_CALIBRATION_BLOB_LEN];
+        memcpy(bad, blob, sizeof(bad));
+        bad[i] ^= 0x10;
+        HTS221Device other = hts221_get_default_device(&hi2c2);
+        stub_i2c_reset_stats();
+        CHECK(!hts221_init_from_calibration(&other, HTS_HZ_12_5, bad));
+        CHECK_EQ(stub_i2c_stats().transactions, 0);
+        CHECK_EQ(other.calib.t_m_q24, 0);
+    }
+}
+
+int main(void) {
+    RUN(test_lsm6dsl);
+    RUN(test_lis3mdl);
+    RUN(test_lps22hb);
+    RUN(test_hts221);
+    RUN(test_hts221_flat_calibration);
+    RUN(test_batch_conversion);
+    RUN(test_calibration_blob);
+    TEST_END();
+}
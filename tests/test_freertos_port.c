@@ -0,0 +1,132 @@
+#include "FreeRTOS.h"
+#include "ism43362_os.h"
+#include "test.h"
+
+// the FreeRTOS port converts the ms timeouts to ticks, rounding up: a wait never becomes shorter than asked for
+
+static TickType_t last_ticks;
+static BaseType_t result = pdPASS;
+static int yields;
+static int item;
+static int mutex;
+static int taken;
+static UBaseType_t last_index = 99;
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size) {
+    (void) len;
+    (void) item_size;
+    return &item;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *it, TickType_t ticks) {
+    (void) q;
+    (void) it;
+    last_ticks = ticks;
+    return result;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *it, TickType_t ticks) {
+    (void) q;
+    (void) it;
+    last_ticks = ticks;
+    return result;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return &item; }
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return &mutex; }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+    taken += s == &mutex;
+    last_ticks = ticks;
+    return result;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+    taken -= s == &mutex;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t s, BaseType_t *woken) {
+    (void) s;
+    *woken = pdTRUE;
+    return pdTRUE;
+}
+
+void portYIELD_FROM_ISR(BaseType_t woken) { yields += woken == pdTRUE; }
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return &item; }
+
+BaseType_t xTaskNotifyGiveIndexed(TaskHandle_t task, UBaseType_t index) {
+    (void) task;
+    last_index = index;
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTakeIndexed(UBaseType_t index, BaseType_t clear, TickType_t ticks) {
+    (void) clear;
+    last_index = index;
+    last_ticks = ticks;
+    return 1;
+}
+
+static TickType_t ticks_of(uint32_t timeout_ms) {
+    const ISM43362OsPort *os = &ism43362_os_freertos;
+    last_ticks = 12345;
+    os->signal_wait(os->signal_create(), timeout_ms);
+    return last_ticks;
+}
+
+static void test_timeouts_to_ticks(void) {
+    CHECK_EQ(ticks_of(0), 0);
+    // the 1 ms DRDY wait of the owner task is one tick, not a poll
+    CHECK_EQ(ticks_of(1), 1);
+    CHECK_EQ(ticks_of(10), 1);
+    CHECK_EQ(ticks_of(11), 2);
+    CHECK_EQ(ticks_of(5000), 500);
+    // no overflow in the conversion
+    CHECK_EQ(ticks_of(0xFFFFFFFE), 429496730);
+    CHECK_EQ(ticks_of(ISM43362_OS_WAIT_FOREVER), portMAX_DELAY);
+}
+
+static void test_port_calls(void) {
+    const ISM43362OsPort *os = &ism43362_os_freertos;
+    void *q = os->queue_create(8, sizeof(void *));
+    int it = 0;
+    result = pdPASS;
+    CHECK(os->queue_send(q, &it, 25));
+    CHECK_EQ(last_ticks, 3);
+    CHECK(os->queue_receive(q, &it, ISM43362_OS_WAIT_FOREVER));
+    CHECK_EQ(last_ticks, portMAX_DELAY);
+    result = pdFALSE;
+    CHECK(!os->queue_send(q, &it, 1));
+    CHECK(!os->queue_receive(q, &it, 1));
+    CHECK(!os->signal_wait(os->signal_create(), 1));
+    result = pdPASS;
+
+    // a task woken by the DRDY edge runs as soon as the interrupt returns
+    yields = 0;
+    os->signal_give_from_isr(os->signal_create());
+    CHECK_EQ(yields, 1);
+    os->task_wait();
+    CHECK_EQ(last_ticks, portMAX_DELAY);
+    // not the notification of the CMSIS-RTOS2 thread flags
+    CHECK_EQ(last_index, 1);
+    last_index = 99;
+    os->task_notify(os->task_self());
+    CHECK_EQ(last_index, 1);
+
+    void *l = os->lock_create();
+    CHECK(l == &mutex);
+    os->lock(l);
+    CHECK_EQ(taken, 1);
+    CHECK_EQ(last_ticks, portMAX_DELAY);
+    os->unlock(l);
+    CHECK_EQ(taken, 0);
+}
+
+int main(void) {
+    RUN(test_timeouts_to_ticks);
+    RUN(test_port_calls);
+    TEST_END();
+}
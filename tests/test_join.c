@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "module_sim.h"
+#include "test.h"
+
+// the join script only holds the settings that differ from the module, and the fast join reads them once
+
+static JoinWifiConfig wpa2_config(void) {
+    JoinWifiConfig conf = ism43362_get_default_wifi_config();
+    strcpy(conf.ssid, "net");
+    strcpy(conf.password, "secret");
+    conf.security = WPA2;
+    return conf;
+}
+
+static void check_script(const JoinWifiConfig *conf, const JoinWifiConfig *curr, const char *expected) {
+    char script[ISM43362_SCRIPT_LEN];
+    size_t len = 0;
+    CHECK(ism43362_join_script(conf, curr, script, sizeof(script), &len));
+    CHECK_EQ(len, strlen(expected));
+    if (strcmp(script, expected) != 0) {
+        fprintf(stderr, "script:\n%s\nexpected:\n%s\n", script, expected);
+        CHECK(false);
+    }
+}
+
+static void test_full_script(void) {
+    JoinWifiConfig conf = wpa2_config();
+    check_script(&conf, NULL,
+                 "C1=net\r\nC2=secret\r\nC3=3\r\nC4=1\r\nC8=255.255.255.255\r\nC9=255.255.255.255\r\n"
+                 "CA=255.255.255.255\r\nCB=5\r\nCN=US/0\r\n");
+
+    // static address, WEP and no password
+    conf.dhcp = false;
+    const uint8_t ip[4] = {192, 168, 1, 20}, mask[4] = {255, 255, 255, 0};
+    memcpy(conf.ip, ip, 4);
+    memcpy(conf.netmask, mask, 4);
+    conf.security = WEP;
+    conf.wep_auth = WEP_SHARED_KEY;
+    conf.password[0] = 0;
+    conf.country_code = JP_0;
+    check_script(&conf, NULL,
+                 "C1=net\r\nC3=1\r\nC4=0\r\nC6=192.168.1.20\r\nC7=255.255.255.0\r\nC8=255.255.255.255\r\n"
+                 "C9=255.255.255.255\r\nCA=255.255.255.255\r\nCB=5\r\nCE=1\r\nCN=JP/0\r\n");
+}
+
+static void test_delta_script(void) {
+    JoinWifiConfig conf = wpa2_config();
+    JoinWifiConfig curr = conf;
+    check_script(&conf, &curr, "");
+
+    strcpy(conf.password, "other");
+    conf.primary_dns[0] = 8;
+    check_script(&conf, &curr, "C2=other\r\nC9=8.255.255.255\r\n");
+
+    // the addresses only matter without DHCP
+    conf = curr;
+    conf.ip[3] = 9;
+    check_script(&conf, &curr, "");
+    // the netmask is the same as the module one
+    conf.dhcp = false;
+    check_script(&conf, &curr, "C4=0\r\nC6=0.0.0.9\r\n");
+}
+
+static void test_script_errors(void) {
+    JoinWifiConfig conf = wpa2_config();
+    char script[40];
+    size_t len;
+    CHECK(!ism43362_join_script(&conf, NULL, script, sizeof(script), &len));
+    // an ssid and a password of the largest sizes still fit
+    memset(conf.ssid, 's', sizeof(conf.ssid) - 1);
+    memset(conf.password, 'p', sizeof(conf.password) - 1);
+    char full[ISM43362_SCRIPT_LEN];
+    CHECK(ism43362_join_script(&conf, NULL, full, sizeof(full), &len));
+    conf.country_code = (CountryCode) 7;
+    CHECK(!ism43362_join_script(&conf, NULL, full, sizeof(full), &len));
+}
+
+static void setup(void) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+}
+
+static void test_read_config(void) {
+    setup();
+    JoinWifiConfig conf;
+    memset(&conf, 0, sizeof(conf));
+    CHECK_EQ(ism43362_read_wifi_config(&conf), Ok);
+    CHECK(strcmp(conf.ssid, "ssid") == 0);
+    CHECK(strcmp(conf.password, "pass") == 0);
+    CHECK_EQ(conf.security, WPA2);
+    CHECK(conf.dhcp);
+    CHECK_EQ(conf.ip[3], 5);
+    CHECK_EQ(conf.netmask[2], 255);
+    CHECK_EQ(conf.gateway[3], 1);
+    CHECK_EQ(conf.primary_dns[0], 8);
+    CHECK_EQ(conf.secondary_dns[3], 4);
+    CHECK_EQ(conf.join_retry_count, 5);
+    CHECK_EQ(conf.country_code, US_0);
+    CHECK(conf.is_connected);
+
+    sim_set_wifi_config("ssid,pass,3,1,0,10.0.0.300,255.255.255.0,10.0.0.1,8.8.8.8,8.8.4.4,5,0,0,US,1");
+    CHECK_EQ(ism43362_read_wifi_config(&conf), BadResponse);
+}
+
+static void test_fast_join(void) {
+    setup();
+    JoinWifiConfig conf = wpa2_config();
+    CHECK_EQ(ism43362_join_network(&conf), Ok);
+    CHECK_EQ(ism43362_get_stats().join_cmds, 10);
+    CHECK_EQ(sim_count("C0"), 1);
+    CHECK(strcmp(sim_last_command(), "C0") == 0);
+
+    // the settings applied by the last join are kept, only C0 is left
+    CHECK_EQ(ism43362_fast_join_network(&conf), Ok);
+    CHECK_EQ(ism43362_get_stats().join_cmds, 1);
+    strcpy(conf.password, "changed");
+    CHECK_EQ(ism43362_fast_join_network(&conf), Ok);
+    CHECK_EQ(ism43362_get_stats().join_cmds, 2);
+    CHECK_EQ(sim_count("C2"), 2);
+
+    // after a reset the module configuration is read once with C?
+    setup();
+    sim_set_wifi_config("net,changed,3,1,0,0.0.0.0,0.0.0.0,255.255.255.255,255.255.255.255,255.255.255.255,5,0,0,"
+                        "US,0");
+    CHECK_EQ(ism43362_fast_join_network(&conf), Ok);
+    CHECK_EQ(ism43362_get_stats().join_cmds, 2);
+    CHECK_EQ(sim_count("C?"), 1);
+    CHECK_EQ(sim_total_commands(), 2);
+
+    // a failed setting leaves the copy stale, the next fast join reads the module again
+    conf.join_retry_count = 3;
+    conf.security = WPA;
+    sim_fail("C3", 1, false);
+    CHECK(ism43362_fast_join_network(&conf) != Ok);
+    CHECK_EQ(sim_count("C0"), 1);
+    CHECK_EQ(ism43362_fast_join_network(&conf), Ok);
+    CHECK_EQ(sim_count("C?"), 2);
+}
+
+int main(void) {
+    RUN(test_full_script);
+    RUN(test_delta_script);
+    RUN(test_script_errors);
+    RUN(test_read_config);
+    RUN(test_fast_join);
+    TEST_END();
+}
@@ -0,0 +1,198 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "sensors.h"
+#include "test.h"
+
+// lsm6dsl_fifo_read() against a simulated FIFO: FIFO_STATUS1 to FIFO_STATUS4 report the stored words and the
+// pattern of the next one, every read of FIFO_DATA_OUT pops the words in order
+
+#define LSM6DSL 0xd4
+#define FIFO_WORDS 4096
+
+static I2C_HandleTypeDef hi2c2 = {.Instance = 2};
+
+static struct {
+    int16_t words[FIFO_WORDS];
+    size_t len;
+    size_t pos;
+    uint16_t pattern; // index of the next word in the 6 word sample
+    uint8_t flags; // FIFO_STATUS2 bits 7 to 3
+} fifo;
+
+static void fifo_reset(uint16_t pattern, uint8_t flags) {
+    memset(&fifo, 0, sizeof(fifo));
+    fifo.pattern = pattern;
+    fifo.flags = flags;
+}
+
+static void fifo_push(int16_t w) { fifo.words[fifo.len++] = w; }
+
+// sample n holds gyro n, n + 1, n + 2 and accelerometer -n, -n - 1, -n - 2
+static void fifo_push_sample(int16_t n) {
+    fifo_push(n);
+    fifo_push(n + 1);
+    fifo_push(n + 2);
+    fifo_push(-n);
+    fifo_push(-n - 1);
+    fifo_push(-n - 2);
+}
+
+static uint8_t fifo_read(uint16_t addr, uint8_t start, uint16_t offset) {
+    uint16_t stored = (uint16_t) (fifo.len - fifo.pos);
+    if (start == 0x3a && offset < 4) {
+        switch (offset) {
+            case 0:
+                return stored & 0xff;
+            case 1:
+                return fifo.flags | ((stored >> 8) & 0x07);
+            case 2:
+                return fifo.pattern & 0xff;
+            default:
+                return fifo.pattern >> 8;
+        }
+    }
+    if (start == 0x3e) {
+        // the data output rolls back to FIFO_DATA_OUT_L, the high byte pops the word
+        if (fifo.pos == fifo.len) {
+            return 0;
+        }
+        uint16_t w = (uint16_t) fifo.words[fifo.pos];
+        if (offset % 2 == 0) {
+            return w & 0xff;
+        }
+        fifo.pos++;
+        fifo.pattern = (fifo.pattern + 1) % 6;
+        return w >> 8;
+    }
+    return stub_i2c_regs(addr)[(uint8_t) (start + offset)];
+}
+
+#define CAPACITY 200
+
+static float ax[CAPACITY], ay[CAPACITY], az[CAPACITY], gx[CAPACITY], gy[CAPACITY], gz[CAPACITY];
+
+static LSM6DSLFifoBuffer buffer(size_t capacity) {
+    LSM6DSLFifoBuffer b = {ax, ay, az, gx, gy, gz, capacity};
+    return b;
+}
+
+static LSM6DSLDevice init_device(void) {
+    stub_reset();
+    LSM6DSLDevice dev = lsm6dsl_get_default_device(&hi2c2);
+    lsm6dsl_init(&dev, XL_104_HZ, XL_2_G, G_104_HZ, G_250_DPS);
+    stub_i2c_set_read_hook(LSM6DSL, fifo_read);
+    return dev;
+}
+
+static void check_sample(size_t i, int16_t n) {
+    const float g = 8.75f / 1000, xl = 0.061f * 9.81f / 1000;
+    CHECK_NEAR(gx[i], n * g, 1e-4);
+    CHECK_NEAR(gy[i], (n + 1) * g, 1e-4);
+    CHECK_NEAR(gz[i], (n + 2) * g, 1e-4);
+    CHECK_NEAR(ax[i], -n * xl, 1e-4);
+    CHECK_NEAR(ay[i], (-n - 1) * xl, 1e-4);
+    CHECK_NEAR(az[i], (-n - 2) * xl, 1e-4);
+}
+
+static void test_config_registers(void) {
+    LSM6DSLDevice dev = init_device();
+    LSM6DSLFifoConfig conf = lsm6dsl_get_default_fifo_config();
+    conf.watermark = 100;
+    conf.decimation = FIFO_DEC_2;
+    stub_i2c_reset_stats();
+    lsm6dsl_fifo_init(&dev, &conf);
+    // bypass first, then FIFO_CTRL1 to FIFO_CTRL5 in one burst
+    CHECK_EQ(stub_i2c_stats().transactions, 2);
+    const uint8_t *regs = stub_i2c_regs(LSM6DSL);
+    CHECK_EQ(regs[0x06], 600 & 0xff);
+    CHECK_EQ(regs[0x07], 600 >> 8);
+    CHECK_EQ(regs[0x08], (FIFO_DEC_2 << 3) | FIFO_DEC_2);
+    CHECK_EQ(regs[0x09], 0);
+    CHECK_EQ(regs[0x0a], (XL_104_HZ << 3) | FIFO_CONTINUOUS);
+
+    // the threshold saturates at the FIFO size
+    conf.watermark = 341 + 100;
+    lsm6dsl_fifo_init(&dev, &conf);
+    CHECK_EQ(regs[0x06] | (regs[0x07] << 8), 0x7ff);
+}
+
+static void test_status(void) {
+    LSM6DSLDevice dev = init_device();
+    fifo_reset(0, 0x80);
+    for (int16_t i = 0; i < 7; i++) {
+        fifo_push_sample(i * 10);
+    }
+    fifo_push(1); // a partial sample isn't counted
+    LSM6DSLFifoStatus st = lsm6dsl_fifo_status(&dev);
+    CHECK_EQ(st.samples, 7);
+    CHECK(st.watermark_reached);
+    CHECK(!st.overrun);
+    CHECK(!st.full);
+}
+
+static void test_drain_in_bursts(void) {
+    LSM6DSLDevice dev = init_device();
+    fifo_reset(0, 0);
+    for (int16_t i = 0; i < 150; i++) {
+        fifo_push_sample(i * 3);
+    }
+    LSM6DSLFifoBuffer b = buffer(CAPACITY);
+
+    stub_i2c_reset_stats();
+    CHECK_EQ(lsm6dsl_fifo_read(&dev, &b, 100), 100);
+    // the status, then 64 and 36 samples
+    CHECK_EQ(stub_i2c_stats().transactions, 3);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 4 + 100 * 12);
+    for (size_t i = 0; i < 100; i++) {
+        check_sample(i, (int16_t) (i * 3));
+    }
+
+    // the rest, limited by the buffer capacity
+    b = buffer(30);
+    CHECK_EQ(lsm6dsl_fifo_read(&dev, &b, 100), 30);
+    for (size_t i = 0; i < 30; i++) {
+        check_sample(i, (int16_t) ((100 + i) * 3));
+    }
+    b = buffer(CAPACITY);
+    CHECK_EQ(lsm6dsl_fifo_read(&dev, &b, 100), 20);
+    check_sample(19, 149 * 3);
+    CHECK_EQ(lsm6dsl_fifo_read(&dev, &b, 100), 0);
+    CHECK_EQ(dev.fifo_overruns, 0);
+}
+
+static void test_realign_partial_sample(void) {
+    LSM6DSLDevice dev = init_device();
+    // the FIFO starts at accelerometer x of a sample overwritten by an overrun
+    fifo_reset(3, 0x40);
+    fifo_push(-1000);
+    fifo_push(-1001);
+    fifo_push(-1002);
+    fifo_push_sample(40);
+    fifo_push_sample(50);
+    LSM6DSLFifoBuffer b = buffer(CAPACITY);
+
+    stub_i2c_reset_stats();
+    CHECK_EQ(lsm6dsl_fifo_read(&dev, &b, 10), 2);
+    // the status, the 3 words skipped and the samples
+    CHECK_EQ(stub_i2c_stats().transactions, 3);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 4 + 3 * 2 + 2 * 12);
+    check_sample(0, 40);
+    check_sample(1, 50);
+    CHECK_EQ(dev.fifo_overruns, 1);
+    CHECK_EQ(fifo.pattern, 0);
+
+    // not even the rest of the partial sample is stored yet
+    fifo_reset(2, 0);
+    fifo_push(7);
+    CHECK_EQ(lsm6dsl_fifo_read(&dev, &b, 10), 0);
+    CHECK_EQ(fifo.pos, 0);
+}
+
+int main(void) {
+    RUN(test_config_registers);
+    RUN(test_status);
+    RUN(test_drain_in_bursts);
+    RUN(test_realign_partial_sample);
+    TEST_END();
+}
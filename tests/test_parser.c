@@ -0,0 +1,217 @@
+#include <string.h>
+
+#include "ism43362_parser.h"
+#include "test.h"
+
+// the responses are fed whole, a byte at a time and with the SPI padding, the result must be the same
+
+static void feed(ISM43362Parser *p, const char *s) { ism43362_parser_feed(p, (const uint8_t *) s, strlen(s)); }
+
+static void feed_bytes(ISM43362Parser *p, const char *s) {
+    for (size_t i = 0; s[i] != 0; i++) {
+        ism43362_parser_feed(p, (const uint8_t *) s + i, 1);
+    }
+}
+
+static ISM43362ParseStatus status_of(const char *resp, bool bytes) {
+    ISM43362Parser p;
+    ism43362_parser_init(&p, NULL, 0, NULL);
+    bytes ? feed_bytes(&p, resp) : feed(&p, resp);
+    return p.status;
+}
+
+static void check_status(const char *resp, ISM43362ParseStatus expected) {
+    CHECK_EQ(status_of(resp, false), expected);
+    CHECK_EQ(status_of(resp, true), expected);
+}
+
+static void test_trailer(void) {
+    check_status("\r\nOK\r\n> ", ISM_PARSE_OK);
+    check_status("\r\n1\r\nOK\r\n> ", ISM_PARSE_OK);
+    check_status("\r\nOK\r\n> \x15\x15\x15", ISM_PARSE_OK);
+    check_status("\r\nERROR\r\n> ", ISM_PARSE_ERROR);
+    check_status("\r\nERROR: bad parameter\r\n> \x15", ISM_PARSE_ERROR);
+    check_status("\r\nOK\r\n>", ISM_PARSE_RUNNING);
+    check_status("\r\nOK\r\n", ISM_PARSE_RUNNING);
+    check_status("\r\n> ", ISM_PARSE_RUNNING);
+    check_status("\r\nOKAY\r\n> ", ISM_PARSE_RUNNING);
+}
+
+static void test_status_inside_payload(void) {
+    // data that looks like a response end, but is followed by more data
+    check_status("\r\nOK\r\n> data\r\nOK\r\n> ", ISM_PARSE_OK);
+    check_status("\r\nOK\r\n> \x15x\r\nERROR\r\n> ", ISM_PARSE_ERROR);
+    check_status("\r\nERROR\r\n> more\r\nOK\r\n> ", ISM_PARSE_OK);
+    check_status("\r\nOK\r\nmore\r\n> ", ISM_PARSE_RUNNING);
+
+    // the status is tentative while the padding is fed
+    ISM43362Parser p;
+    ism43362_parser_init(&p, NULL, 0, NULL);
+    feed(&p, "\r\nOK\r\n> ");
+    CHECK_EQ(p.status, ISM_PARSE_OK);
+    feed(&p, "\x15\x15");
+    CHECK_EQ(p.status, ISM_PARSE_OK);
+    feed(&p, "x");
+    CHECK_EQ(p.status, ISM_PARSE_RUNNING);
+    feed(&p, "\r\nOK\r\n> ");
+    CHECK_EQ(p.status, ISM_PARSE_OK);
+}
+
+typedef struct {
+    char ssid[8];
+    char pass[16];
+    uint8_t security;
+    bool dhcp;
+    uint8_t ip[4];
+    uint16_t port;
+    uint32_t big;
+} Config;
+
+#define CONFIG_FIELDS(c)                                                                                               \
+    {                                                                                                                  \
+        {.type = ISM_FIELD_STR, .dst = (c)->ssid, .size = sizeof((c)->ssid)},                                          \
+        {.type = ISM_FIELD_STR, .dst = (c)->pass, .size = sizeof((c)->pass)},                                          \
+        {.type = ISM_FIELD_U8, .dst = &(c)->security},                                                                 \
+        {.type = ISM_FIELD_BOOL, .dst = &(c)->dhcp},                                                                   \
+        {.type = ISM_FIELD_SKIP},                                                                                      \
+        {.type = ISM_FIELD_IP, .dst = (c)->ip},                                                                        \
+        {.type = ISM_FIELD_U16, .dst = &(c)->port},                                                                    \
+        {.type = ISM_FIELD_U32, .dst = &(c)->big},                                                                     \
+    }
+
+static bool parse_config(const char *resp, Config *c, bool bytes) {
+    const ISM43362Field fields[] = CONFIG_FIELDS(c);
+    ISM43362Parser p;
+    ism43362_parser_init(&p, fields, sizeof(fields) / sizeof(fields[0]), NULL);
+    bytes ? feed_bytes(&p, resp) : feed(&p, resp);
+    return p.status == ISM_PARSE_OK && p.matched;
+}
+
+static void test_fields(void) {
+    for (int bytes = 0; bytes < 2; bytes++) {
+        Config c;
+        memset(&c, 0xee, sizeof(c));
+        CHECK(parse_config("\r\nnet,secret,3,1,x,10.0.0.255,65535,4294967295\r\nOK\r\n> \x15", &c, bytes));
+        CHECK(strcmp(c.ssid, "net") == 0);
+        CHECK(strcmp(c.pass, "secret") == 0);
+        CHECK_EQ(c.security, 3);
+        CHECK(c.dhcp);
+        CHECK_EQ(c.ip[0], 10);
+        CHECK_EQ(c.ip[1], 0);
+        CHECK_EQ(c.ip[2], 0);
+        CHECK_EQ(c.ip[3], 255);
+        CHECK_EQ(c.port, 65535);
+        CHECK_EQ(c.big, 4294967295u);
+
+        // strings longer than the destination are truncated, the first matching line fills the fields
+        CHECK(parse_config("\r\nnetwork-name,p,0,0,,1.2.3.4,1,2\r\nother,q,1,1,,5.6.7.8,3,4\r\nOK\r\n> ", &c, bytes));
+        CHECK(strcmp(c.ssid, "network") == 0);
+        CHECK(strcmp(c.pass, "p") == 0);
+        CHECK(!c.dhcp);
+        CHECK_EQ(c.ip[3], 4);
+        CHECK_EQ(c.big, 2);
+    }
+}
+
+static void test_rejected_lines(void) {
+    const char *bad[] = {
+            "\r\nnet,secret,3,1,x,10.0.0.256,80,1\r\nOK\r\n> ", // octet over 255
+            "\r\nnet,secret,3,1,x,10.0..1,80,1\r\nOK\r\n> ", // empty octet
+            "\r\nnet,secret,3,1,x,10.0.0,80,1\r\nOK\r\n> ", // 3 octets
+            "\r\nnet,secret,3,1,x,10.0.0.1.2,80,1\r\nOK\r\n> ", // 5 octets
+            "\r\nnet,secret,256,1,x,10.0.0.1,80,1\r\nOK\r\n> ", // U8 overflow
+            "\r\nnet,secret,3,1,x,10.0.0.1,65536,1\r\nOK\r\n> ", // U16 overflow
+            "\r\nnet,secret,3,1,x,10.0.0.1,80,4294967296\r\nOK\r\n> ", // U32 overflow
+            "\r\nnet,secret,3,1,x,10.0.0.1,8a,1\r\nOK\r\n> ", // not a number
+            "\r\nnet,secret,3,1,x,10.0.0.1\r\nOK\r\n> ", // missing fields
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        Config c;
+        memset(&c, 0xee, sizeof(c));
+        CHECK(!parse_config(bad[i], &c, false));
+        // nothing is written from a line that doesn't match
+        CHECK_EQ((uint8_t) c.ssid[0], 0xee);
+        CHECK_EQ(c.security, 0xee);
+        CHECK_EQ(c.ip[0], 0xee);
+    }
+
+    // a later valid line still matches
+    Config c;
+    CHECK(parse_config("\r\nnet,secret,3,1,x,10.0.0.256,80,1\r\nnet,s,4,0,x,10.0.0.7,80,1\r\nOK\r\n> ", &c, false));
+    CHECK_EQ(c.security, 4);
+    CHECK_EQ(c.ip[3], 7);
+}
+
+static void test_match_literal_and_limits(void) {
+    uint16_t port = 0;
+    const ISM43362Field fields[] = {
+            {.type = ISM_FIELD_MATCH, .literal = "port"},
+            {.type = ISM_FIELD_U16, .dst = &port},
+    };
+    ISM43362Parser p;
+    ism43362_parser_init(&p, fields, 2, "=");
+    feed(&p, "\r\nports=1\r\npor=2\r\nport=3\r\nOK\r\n> ");
+    CHECK(p.matched);
+    CHECK_EQ(port, 3);
+
+    // more fields than the parser stages never match
+    ISM43362Field many[ISM43362_PARSER_MAX_FIELDS + 1];
+    for (size_t i = 0; i < sizeof(many) / sizeof(many[0]); i++) {
+        ISM43362Field f = {.type = ISM_FIELD_SKIP};
+        many[i] = f;
+    }
+    ism43362_parser_init(&p, many, sizeof(many) / sizeof(many[0]), NULL);
+    feed(&p, "\r\na,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p,q\r\nOK\r\n> ");
+    CHECK_EQ(p.status, ISM_PARSE_OK);
+    CHECK(!p.matched);
+}
+
+typedef struct {
+    uint8_t ip[4];
+    uint16_t port;
+    uint8_t count;
+    uint16_t ports[4];
+} Accepts;
+
+static void on_accept(void *ctx) {
+    Accepts *a = ctx;
+    if (a->count < 4) {
+        a->ports[a->count] = a->port;
+    }
+    a->count++;
+}
+
+static void test_message_callback(void) {
+    // the MR lines of ism43362_read_messages()
+    Accepts a = {0};
+    const ISM43362Field fields[] = {
+            {.type = ISM_FIELD_SKIP},
+            {.type = ISM_FIELD_SKIP},
+            {.type = ISM_FIELD_MATCH, .literal = "Accepted"},
+            {.type = ISM_FIELD_IP, .dst = a.ip},
+            {.type = ISM_FIELD_U16, .dst = &a.port},
+    };
+    ISM43362Parser p;
+    ism43362_parser_init(&p, fields, 5, " :");
+    ism43362_parser_set_callback(&p, on_accept, &a);
+    feed_bytes(&p, "\r\n[SOMA][TCP SVR] Accepted 10.0.0.9:40000\r\n"
+                   "[SOMA][TCP SVR] Closed 10.0.0.9:40000\r\n"
+                   "[SOMA][TCP SVR] Accepted 10.0.0.300:1\r\n"
+                   "[SOMA][TCP SVR] Accepted 10.0.0.10:40001\r\nOK\r\n> \x15\x15");
+    CHECK_EQ(p.status, ISM_PARSE_OK);
+    CHECK_EQ(a.count, 2);
+    CHECK_EQ(p.matches, 2);
+    CHECK_EQ(a.ports[0], 40000);
+    CHECK_EQ(a.ports[1], 40001);
+    CHECK_EQ(a.ip[3], 10);
+}
+
+int main(void) {
+    RUN(test_trailer);
+    RUN(test_status_inside_payload);
+    RUN(test_fields);
+    RUN(test_rejected_lines);
+    RUN(test_match_literal_and_limits);
+    RUN(test_message_callback);
+    TEST_END();
+}
@@ -0,0 +1,153 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "module_sim.h"
+#include "test.h"
+
+// polling reads every socket with a short timeout, keeps what it finds for the next read, and the next read puts
+// the previous timeout back
+
+#define MS 1000000ULL
+
+static void setup(void) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = SOCKET_1;
+    client.read_timeout_ms = 3000;
+    CHECK_EQ(ism43362_start_wifi_client(&client), Ok);
+    WifiTcpServerConfig server = ism43362_get_default_tcp_server_config();
+    server.base_conf.s = SOCKET_2;
+    CHECK_EQ(ism43362_start_tcp_server(&server), Ok);
+}
+
+static void test_readable(void) {
+    setup();
+    sim_push_rx(1, "hello", 5);
+    ISM43362PollResult res;
+    uint64_t start = stub_time_ns();
+    CHECK_EQ(ism43362_poll(0x06, &res), Ok);
+    CHECK_EQ(res.readable, 0x02);
+    CHECK_EQ(res.accepted, 0);
+    // the idle socket answered after the poll timeout, not its own
+    CHECK((stub_time_ns() - start) / MS < 20);
+    CHECK_EQ(sim_socket_param(1, "R2"), ISM43362_POLL_READ_TIMEOUT_MS);
+    CHECK_EQ(sim_socket_param(2, "R2"), ISM43362_POLL_READ_TIMEOUT_MS);
+
+    // the data is kept by the driver, polling again doesn't ask the module
+    uint32_t r0 = sim_count("R0");
+    CHECK_EQ(ism43362_poll(0x02, &res), Ok);
+    CHECK_EQ(res.readable, 0x02);
+    CHECK_EQ(sim_count("R0"), r0);
+    uint8_t buff[16];
+    size_t len;
+    CHECK_EQ(ism43362_socket_read(SOCKET_1, buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(len, 5);
+    CHECK(memcmp(buff, "hello", 5) == 0);
+    CHECK_EQ(sim_count("R0"), r0);
+
+    // the next read from the module waits the socket own timeout again
+    CHECK_EQ(ism43362_socket_read(SOCKET_1, buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(sim_socket_param(1, "R2"), 3000);
+    CHECK_EQ(sim_socket_param(2, "R2"), ISM43362_POLL_READ_TIMEOUT_MS);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+}
+
+static void test_commands(void) {
+    setup();
+    ISM43362PollResult res;
+    CHECK_EQ(ism43362_poll(0x02, &res), Ok);
+    // an idle socket polled again only costs its R0
+    uint32_t commands = sim_total_commands();
+    for (int i = 0; i < 10; i++) {
+        CHECK_EQ(ism43362_poll(0x02, &res), Ok);
+        CHECK_EQ(res.readable, 0);
+    }
+    CHECK_EQ(sim_total_commands(), commands + 10);
+    CHECK_EQ(sim_count("R2"), 3);
+
+    // the timeout is put back even when the poll failed
+    sim_fail("R0", 1, false);
+    CHECK(ism43362_poll(0x02, &res) != Ok);
+    sim_push_rx(1, "x", 1);
+    uint8_t buff[16];
+    size_t len;
+    CHECK_EQ(ism43362_socket_read(SOCKET_1, buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(len, 1);
+    CHECK_EQ(sim_socket_param(1, "R2"), 3000);
+
+    // a timeout set meanwhile isn't overwritten
+    CHECK_EQ(ism43362_poll(0x02, &res), Ok);
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = SOCKET_1;
+    client.read_timeout_ms = 700;
+    CHECK_EQ(ism43362_start_wifi_client(&client), Ok);
+    CHECK_EQ(ism43362_socket_read(SOCKET_1, buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(sim_socket_param(1, "R2"), 700);
+}
+
+static void test_unknown_timeout(void) {
+    setup();
+    // it couldn't be put back, nothing is sent
+    uint32_t commands = sim_total_commands();
+    ISM43362PollResult res;
+    CHECK_EQ(ism43362_poll(0x03, &res), Error);
+    CHECK_EQ(sim_total_commands(), commands);
+
+    // a replayed setup is known
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = SOCKET_0;
+    client.read_timeout_ms = 2500;
+    ISM43362SocketSetup setup;
+    CHECK_EQ(ism43362_encode_client_setup(&client, &setup), Ok);
+    CHECK_EQ(ism43362_replay_setup(&setup), Ok);
+    CHECK_EQ(ism43362_poll(0x03, &res), Ok);
+    uint8_t buff[16];
+    size_t len;
+    CHECK_EQ(ism43362_socket_read(SOCKET_0, buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(sim_socket_param(0, "R2"), 2500);
+}
+
+static void test_accepts(void) {
+    setup();
+    sim_push_message("[SOMA][TCP SVR] Accepted 10.0.0.9:40000");
+    ISM43362PollResult res;
+    CHECK_EQ(ism43362_poll(0x06, &res), Ok);
+    CHECK_EQ(res.accepted, 0x04);
+    CHECK_EQ(sim_count("MR"), 1);
+
+    // reported until taken, without reading the messages again
+    CHECK_EQ(ism43362_poll(0x04, &res), Ok);
+    CHECK_EQ(res.accepted, 0x04);
+    CHECK_EQ(sim_count("MR"), 1);
+    CHECK_EQ(ism43362_pending_accepts(), 1);
+    RemoteTcpConnection conn;
+    CHECK_EQ(ism43362_check_tcp_server_connection(&conn), Ok);
+    CHECK(conn.connected);
+    CHECK_EQ(conn.remote.port, 40000);
+    CHECK_EQ(ism43362_pending_accepts(), 0);
+    CHECK_EQ(sim_count("MR"), 1);
+
+    // the accepts that don't fit the queue are counted
+    for (int i = 0; i < ISM43362_ACCEPT_QUEUE_LEN + 2; i++) {
+        char line[64];
+        snprintf(line, sizeof(line), "[SOMA][TCP SVR] Accepted 10.0.0.%d:%d", i + 1, 41000 + i);
+        sim_push_message(line);
+    }
+    CHECK_EQ(ism43362_read_messages(), Ok);
+    CHECK_EQ(ism43362_pending_accepts(), ISM43362_ACCEPT_QUEUE_LEN);
+    CHECK_EQ(ism43362_dropped_accepts(), 2);
+    WifiRemote remote;
+    CHECK(ism43362_take_accept(&remote));
+    CHECK_EQ(remote.port, 41000);
+}
+
+int main(void) {
+    RUN(test_readable);
+    RUN(test_commands);
+    RUN(test_unknown_timeout);
+    RUN(test_accepts);
+    TEST_END();
+}
@@ -0,0 +1,140 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "ism43362_pool.h"
+#include "module_sim.h"
+#include "test.h"
+
+// the pool hands out each buffer once, reports when it's exhausted and the driver returns what it borrows
+
+static void test_sizes(void) {
+    CHECK_EQ(ism43362_pool_size(ISM_POOL_CMD), ISM43362_POOL_CMD_SIZE);
+    CHECK_EQ(ism43362_pool_size(ISM_POOL_PAYLOAD), ISM43362_POOL_PAYLOAD_SIZE);
+    ISM43362PoolUsage u = ism43362_pool_get_usage(ISM_POOL_PAYLOAD);
+    CHECK_EQ(u.size, ISM43362_POOL_PAYLOAD_SIZE);
+    CHECK_EQ(u.count, ISM43362_POOL_PAYLOAD_COUNT);
+    CHECK_EQ(u.in_use, 0);
+}
+
+static void test_borrow_and_return(void) {
+    uint8_t *buffs[ISM43362_POOL_PAYLOAD_COUNT];
+    for (size_t i = 0; i < ISM43362_POOL_PAYLOAD_COUNT; i++) {
+        buffs[i] = ism43362_pool_borrow(ISM_POOL_PAYLOAD);
+        CHECK(buffs[i] != NULL);
+        // word aligned for the DMA transfers
+        CHECK_EQ((uintptr_t) buffs[i] % 4, 0);
+        memset(buffs[i], (int) i, ISM43362_POOL_PAYLOAD_SIZE);
+    }
+    // the buffers don't overlap
+    for (size_t i = 0; i < ISM43362_POOL_PAYLOAD_COUNT; i++) {
+        CHECK_EQ(buffs[i][0], i);
+        CHECK_EQ(buffs[i][ISM43362_POOL_PAYLOAD_SIZE - 1], i);
+    }
+
+    // exhausted
+    CHECK(ism43362_pool_borrow(ISM_POOL_PAYLOAD) == NULL);
+    CHECK(ism43362_pool_borrow(ISM_POOL_PAYLOAD) == NULL);
+    ISM43362PoolUsage u = ism43362_pool_get_usage(ISM_POOL_PAYLOAD);
+    CHECK_EQ(u.in_use, ISM43362_POOL_PAYLOAD_COUNT);
+    CHECK_EQ(u.high_water, ISM43362_POOL_PAYLOAD_COUNT);
+    CHECK_EQ(u.failures, 2);
+    // the other classes are separate
+    CHECK_EQ(ism43362_pool_get_usage(ISM_POOL_CMD).in_use, 0);
+
+    // the returned buffer is the next one borrowed
+    ism43362_pool_return(ISM_POOL_PAYLOAD, buffs[2]);
+    CHECK_EQ(ism43362_pool_get_usage(ISM_POOL_PAYLOAD).in_use, ISM43362_POOL_PAYLOAD_COUNT - 1);
+    CHECK(ism43362_pool_borrow(ISM_POOL_PAYLOAD) == buffs[2]);
+
+    // returned twice, NULL, or not from the pool: ignored
+    for (size_t i = 0; i < ISM43362_POOL_PAYLOAD_COUNT; i++) {
+        ism43362_pool_return(ISM_POOL_PAYLOAD, buffs[i]);
+    }
+    uint8_t other[4];
+    ism43362_pool_return(ISM_POOL_PAYLOAD, buffs[0]);
+    ism43362_pool_return(ISM_POOL_PAYLOAD, NULL);
+    ism43362_pool_return(ISM_POOL_PAYLOAD, other);
+    ism43362_pool_return(ISM_POOL_CMD, buffs[1]);
+    u = ism43362_pool_get_usage(ISM_POOL_PAYLOAD);
+    CHECK_EQ(u.in_use, 0);
+    CHECK_EQ(u.high_water, ISM43362_POOL_PAYLOAD_COUNT);
+    CHECK_EQ(ism43362_pool_get_usage(ISM_POOL_CMD).in_use, 0);
+
+    // the high water mark restarts from the buffers in use
+    uint8_t *kept = ism43362_pool_borrow(ISM_POOL_PAYLOAD);
+    ism43362_pool_reset_usage();
+    u = ism43362_pool_get_usage(ISM_POOL_PAYLOAD);
+    CHECK_EQ(u.high_water, 1);
+    CHECK_EQ(u.failures, 0);
+    ism43362_pool_return(ISM_POOL_PAYLOAD, kept);
+}
+
+static void test_driver_returns_buffers(void) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    ism43362_pool_reset_usage();
+
+    JoinWifiConfig conf = ism43362_get_default_wifi_config();
+    strcpy(conf.ssid, "net");
+    CHECK_EQ(ism43362_join_network(&conf), Ok);
+    strcpy(conf.ssid, "other");
+    CHECK_EQ(ism43362_fast_join_network(&conf), Ok);
+    ISM43362PoolUsage u = ism43362_pool_get_usage(ISM_POOL_CMD);
+    CHECK_EQ(u.in_use, 0);
+    CHECK_EQ(u.high_water, 1);
+
+    // without a free buffer the join fails instead of using the stack
+    uint8_t *buffs[ISM43362_POOL_CMD_COUNT];
+    for (size_t i = 0; i < ISM43362_POOL_CMD_COUNT; i++) {
+        buffs[i] = ism43362_pool_borrow(ISM_POOL_CMD);
+    }
+    uint32_t commands = sim_total_commands();
+    CHECK_EQ(ism43362_join_network(&conf), NoBuffer);
+    CHECK_EQ(sim_total_commands(), commands);
+    CHECK_EQ(ism43362_pool_get_usage(ISM_POOL_CMD).failures, 1);
+    for (size_t i = 0; i < ISM43362_POOL_CMD_COUNT; i++) {
+        ism43362_pool_return(ISM_POOL_CMD, buffs[i]);
+    }
+    CHECK_EQ(ism43362_join_network(&conf), Ok);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+}
+
+static int depth;
+static int locks;
+
+static void lock(void *l) {
+    CHECK(l == &depth);
+    CHECK_EQ(depth, 0);
+    depth++;
+    locks++;
+}
+
+static void unlock(void *l) {
+    CHECK(l == &depth);
+    CHECK_EQ(depth, 1);
+    depth--;
+}
+
+static void test_lock(void) {
+    ism43362_pool_set_lock(lock, unlock, &depth);
+    uint8_t *buff = ism43362_pool_borrow(ISM_POOL_CMD);
+    CHECK(buff != NULL);
+    ism43362_pool_return(ISM_POOL_CMD, buff);
+    ism43362_pool_get_usage(ISM_POOL_CMD);
+    ism43362_pool_reset_usage();
+    CHECK_EQ(locks, 4);
+    CHECK_EQ(depth, 0);
+    ism43362_pool_set_lock(NULL, NULL, NULL);
+    ism43362_pool_return(ISM_POOL_CMD, ism43362_pool_borrow(ISM_POOL_CMD));
+    CHECK_EQ(locks, 4);
+}
+
+int main(void) {
+    RUN(test_sizes);
+    RUN(test_borrow_and_return);
+    RUN(test_driver_returns_buffers);
+    RUN(test_lock);
+    TEST_END();
+}
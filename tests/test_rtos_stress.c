@@ -0,0 +1,143 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "ism43362_pool.h"
+#include "ism43362_rtos.h"
+#include "module_sim.h"
+#include "test.h"
+
+// one worker thread per socket sends and reads through the owner thread at the same time as the others: every
+// socket must get its own data, in order, and the SPI link must only be used by the owner thread
+
+#define WORKERS 4
+#define MESSAGES 60
+
+static pthread_t owner;
+static atomic_uint foreign_hal_calls;
+static atomic_uint drdy_edges;
+
+// runs inside the HAL calls, on the thread that made them
+static void drdy_exti(void) {
+    if (!pthread_equal(pthread_self(), owner)) {
+        atomic_fetch_add(&foreign_hal_calls, 1);
+    }
+    atomic_fetch_add(&drdy_edges, 1);
+    ism43362_rtos_drdy_exti_callback();
+}
+
+static void *owner_main(void *arg) {
+    ism43362_rtos_task(arg);
+    return NULL;
+}
+
+static size_t message(int s, int i, char dir, char *out) {
+    // different lengths, so the S3 frames are both odd and even
+    return (size_t) sprintf(out, "%c%d-%d%.*s;", dir, s, i, i % 7, "xxxxxxx");
+}
+
+typedef struct {
+    Socket s;
+    ISM43362_RET ret;
+    char received[MESSAGES * 16];
+    size_t received_len;
+} Worker;
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    size_t expected = 0;
+    for (int i = 0; i < MESSAGES; i++) {
+        char m[16];
+        expected += message(w->s, i, 'r', m);
+    }
+    for (int i = 0; i < MESSAGES && w->ret == Ok; i++) {
+        char m[16];
+        size_t len = message(w->s, i, 't', m);
+        // the pool is shared with the owner task, which borrows payload buffers for the reads
+        uint8_t *buff = ism43362_pool_borrow(ISM_POOL_PAYLOAD);
+        ism43362_pool_return(ISM_POOL_PAYLOAD, buff);
+        w->ret = ism43362_rtos_send(w->s, (const uint8_t *) m, len);
+        // the read side a bit at a time, interleaved with the sends
+        if (w->ret == Ok && w->received_len < expected) {
+            static __thread uint8_t buff[ISM43362_MAX_PAYLOAD + 16];
+            size_t n = 0;
+            w->ret = ism43362_rtos_read(w->s, buff, sizeof(buff), &n);
+            if (w->received_len + n <= sizeof(w->received)) {
+                memcpy(w->received + w->received_len, buff, n);
+                w->received_len += n;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent_sockets(void) {
+    stub_reset();
+    sim_init(drdy_exti);
+    // the reset runs before the owner task starts
+    owner = pthread_self();
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    CHECK_EQ(ism43362_rtos_init(&ism43362_os_pthread), Ok);
+
+    // each read returns a few messages, so the workers need several reads
+    for (int s = 0; s < WORKERS; s++) {
+        for (int i = 0; i < MESSAGES; i++) {
+            char m[16];
+            size_t len = message(s, i, 'r', m);
+            sim_push_rx(s, m, len);
+        }
+    }
+
+    CHECK_EQ(pthread_create(&owner, NULL, owner_main, NULL), 0);
+    for (int s = 0; s < WORKERS; s++) {
+        WifiClientConfig client = ism43362_get_default_client_config();
+        client.s = (Socket) s;
+        client.read_packet_size = 40;
+        CHECK_EQ(ism43362_rtos_start_client(&client), Ok);
+    }
+
+    static Worker workers[WORKERS];
+    pthread_t threads[WORKERS];
+    for (int s = 0; s < WORKERS; s++) {
+        workers[s].s = (Socket) s;
+        workers[s].ret = Ok;
+        CHECK_EQ(pthread_create(&threads[s], NULL, worker_main, &workers[s]), 0);
+    }
+    for (int s = 0; s < WORKERS; s++) {
+        pthread_join(threads[s], NULL);
+    }
+
+    for (int s = 0; s < WORKERS; s++) {
+        CHECK_EQ(workers[s].ret, Ok);
+        char expected[MESSAGES * 16];
+        size_t expected_len = 0;
+        for (int i = 0; i < MESSAGES; i++) {
+            expected_len += message(s, i, 't', expected + expected_len);
+        }
+        uint8_t tx[MESSAGES * 16];
+        CHECK_EQ(sim_take_tx(s, tx, sizeof(tx)), expected_len);
+        CHECK(memcmp(tx, expected, expected_len) == 0);
+
+        expected_len = 0;
+        for (int i = 0; i < MESSAGES; i++) {
+            expected_len += message(s, i, 'r', expected + expected_len);
+        }
+        CHECK_EQ(workers[s].received_len, expected_len);
+        CHECK(memcmp(workers[s].received, expected, expected_len) == 0);
+    }
+
+    printf("%u DRDY edges, %u S3, %u R0, %u P0\n", atomic_load(&drdy_edges), sim_count("S3"), sim_count("R0"),
+           sim_count("P0"));
+    CHECK_EQ(atomic_load(&foreign_hal_calls), 0);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+    CHECK_EQ(sim_count("S3"), WORKERS * MESSAGES);
+    CHECK_EQ(ism43362_pool_get_usage(ISM_POOL_PAYLOAD).in_use, 0);
+    // the owner task doesn't exit, the process does
+}
+
+int main(void) {
+    RUN(test_concurrent_sockets);
+    TEST_END();
+}
@@ -0,0 +1,103 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "module_sim.h"
+#include "test.h"
+
+// the segments of ism43362_sendv() go out as a single S3 payload, whatever their lengths, and a short accept by the
+// module is reported so the caller can send the rest
+
+static void setup(void) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = SOCKET_1;
+    CHECK_EQ(ism43362_start_wifi_client(&client), Ok);
+    CHECK_EQ(ism43362_set_socket(SOCKET_1), Ok);
+}
+
+static void test_one_payload(void) {
+    setup();
+    uint32_t s3 = sim_count("S3");
+    // odd lengths from odd addresses, the words sent on the SPI straddle the segments
+    static const char text[] = "xheader:body-0123456789!";
+    const ISM43362Segment segs[] = {
+        {.data = (const uint8_t *) text + 1, .len = 3}, {.data = (const uint8_t *) text + 4, .len = 5},
+        {.data = (const uint8_t *) text + 9, .len = 0}, {.data = (const uint8_t *) text + 9, .len = 1},
+        {.data = (const uint8_t *) text + 10, .len = 14},
+    };
+    size_t sent = 0;
+    CHECK_EQ(ism43362_sendv(segs, 5, &sent), Ok);
+    CHECK_EQ(sent, 23);
+    CHECK_EQ(sim_count("S3"), s3 + 1);
+    uint8_t out[64];
+    CHECK_EQ(sim_take_tx(1, out, sizeof(out)), 23);
+    CHECK(memcmp(out, text + 1, 23) == 0);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+
+    // an even total made of odd segments
+    const ISM43362Segment pair[] = {
+        {.data = (const uint8_t *) "abc", .len = 3},
+        {.data = (const uint8_t *) "d", .len = 1},
+    };
+    CHECK_EQ(ism43362_sendv(pair, 2, &sent), Ok);
+    CHECK_EQ(sent, 4);
+    CHECK_EQ(sim_take_tx(1, out, sizeof(out)), 4);
+    CHECK(memcmp(out, "abcd", 4) == 0);
+}
+
+static void test_partial_accept(void) {
+    setup();
+    static const char text[] = "first-segment|second-segment";
+    const ISM43362Segment segs[] = {
+        {.data = (const uint8_t *) text, .len = 14},
+        {.data = (const uint8_t *) text + 14, .len = 14},
+    };
+    sim_set_s3_accept(10);
+    size_t sent = 0;
+    CHECK_EQ(ism43362_sendv(segs, 2, &sent), Ok);
+    CHECK_EQ(sent, 10);
+    uint8_t out[64];
+    CHECK_EQ(sim_take_tx(1, out, sizeof(out)), 10);
+    CHECK(memcmp(out, text, 10) == 0);
+
+    // the rest, starting in the middle of the first segment
+    sim_set_s3_accept(0);
+    const ISM43362Segment rest[] = {
+        {.data = (const uint8_t *) text + 10, .len = 4},
+        {.data = (const uint8_t *) text + 14, .len = 14},
+    };
+    CHECK_EQ(ism43362_sendv(rest, 2, &sent), Ok);
+    CHECK_EQ(sent, 18);
+    CHECK_EQ(sim_take_tx(1, out, sizeof(out)), 18);
+    CHECK(memcmp(out, text + 10, 18) == 0);
+}
+
+static void test_limits(void) {
+    setup();
+    uint32_t commands = sim_total_commands();
+    static uint8_t big[ISM43362_MAX_PAYLOAD];
+    const ISM43362Segment over[] = {{.data = big, .len = ISM43362_MAX_PAYLOAD}, {.data = big, .len = 1}};
+    size_t sent = 1;
+    CHECK_EQ(ism43362_sendv(over, 2, &sent), Error);
+    CHECK_EQ(sent, 0);
+    ISM43362Segment many[ISM43362_MAX_SEGMENTS + 1];
+    for (size_t i = 0; i < ISM43362_MAX_SEGMENTS + 1; i++) {
+        many[i].data = big;
+        many[i].len = 1;
+    }
+    CHECK_EQ(ism43362_sendv(many, ISM43362_MAX_SEGMENTS + 1, &sent), Error);
+    CHECK_EQ(ism43362_sendv(many, ISM43362_MAX_SEGMENTS, &sent), Ok);
+    CHECK_EQ(sent, ISM43362_MAX_SEGMENTS);
+    // only the last one reached the module
+    CHECK_EQ(sim_total_commands(), commands + 1);
+}
+
+int main(void) {
+    RUN(test_one_payload);
+    RUN(test_partial_accept);
+    RUN(test_limits);
+    TEST_END();
+}
@@ -0,0 +1,162 @@
+#include "hal_stub.h"
+#include "sensor_engine.h"
+#include "sensors.h"
+#include "test.h"
+
+// the DMA reads are completed one at a time by stub_i2c_complete(), like the I2C interrupt would
+
+static I2C_HandleTypeDef hi2c2 = {.Instance = 2};
+static I2C_HandleTypeDef hi2c1 = {.Instance = 1};
+
+static SensorEngine engine;
+static LPS22HBDevice lps;
+static LSM6DSLDevice lsm;
+static LIS3MDLDevice lis;
+
+static SensorSample delivered[64];
+static size_t delivered_count;
+
+static void on_sample(const SensorSample *sample) {
+    if (delivered_count < 64) {
+        delivered[delivered_count] = *sample;
+    }
+    delivered_count++;
+}
+
+static void rx_cplt(I2C_HandleTypeDef *hi2c) { sensor_engine_i2c_rx_cplt_callback(&engine, hi2c); }
+
+static void error(I2C_HandleTypeDef *hi2c) { sensor_engine_i2c_error_callback(&engine, hi2c); }
+
+static void put_i16(uint16_t addr, uint8_t reg, int16_t v) {
+    uint8_t *regs = stub_i2c_regs(addr);
+    regs[reg] = (uint16_t) v & 0xff;
+    regs[reg + 1] = (uint16_t) v >> 8;
+}
+
+static void setup(SensorSampleCallback callback) {
+    stub_reset();
+    stub_i2c_set_callbacks(rx_cplt, error);
+    lps = lps22hb_get_default_device(&hi2c2);
+    lsm = lsm6dsl_get_default_device(&hi2c2);
+    lis = lis3mdl_get_default_device(&hi2c2);
+    lps22hb_init(&lps, LPS_HZ_25);
+    lsm6dsl_init(&lsm, XL_104_HZ, XL_2_G, G_104_HZ, G_250_DPS);
+    lis3mdl_init(&lis, LIS_80_HZ, LIS_4_GAUSS);
+    uint8_t *regs = stub_i2c_regs(0xba);
+    int32_t press = 1000 * 4096;
+    regs[0x28] = press & 0xff;
+    regs[0x29] = (press >> 8) & 0xff;
+    regs[0x2a] = (press >> 16) & 0xff;
+    put_i16(0xba, 0x2b, 2500);
+    put_i16(0xd4, 0x28, 1000);
+    put_i16(0x3c, 0x28, -2000);
+    sensor_engine_init(&engine, &hi2c2, callback);
+    delivered_count = 0;
+    stub_i2c_reset_stats();
+}
+
+static bool bus_busy(void) { return HAL_I2C_GetState(&hi2c2) != HAL_I2C_STATE_READY; }
+
+static void test_back_to_back(void) {
+    setup(on_sample);
+    CHECK(sensor_engine_is_idle(&engine));
+    CHECK(sensor_engine_request(&engine, lps22hb_sensor(&lps)));
+    CHECK(sensor_engine_request(&engine, lsm6dsl_sensor(&lsm)));
+    CHECK(sensor_engine_request(&engine, lis3mdl_sensor(&lis)));
+    // the requests return at once, with interrupts enabled again
+    CHECK_EQ(__get_PRIMASK(), 0);
+    CHECK_EQ(stub_i2c_stats().transactions, 0);
+    CHECK(bus_busy());
+
+    // every completion starts the next transfer, without the main loop
+    CHECK(stub_i2c_complete(false));
+    CHECK(bus_busy());
+    CHECK(stub_i2c_complete(false));
+    CHECK(bus_busy());
+    CHECK(stub_i2c_complete(false));
+    CHECK(!bus_busy());
+    CHECK(!stub_i2c_complete(false));
+    CHECK(sensor_engine_is_idle(&engine));
+    CHECK_EQ(stub_i2c_stats().transactions, 3);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 5 + 14 + 6);
+
+    SensorSample s;
+    CHECK(sensor_engine_pop(&engine, &s));
+    CHECK_EQ(s.kind, SENSOR_LPS22HB);
+    CHECK_NEAR(s.data.lps22hb.press, 1000, 1e-3);
+    CHECK_NEAR(s.data.lps22hb.temp, 25, 1e-4);
+    CHECK(sensor_engine_pop(&engine, &s));
+    CHECK_EQ(s.kind, SENSOR_LSM6DSL);
+    CHECK_NEAR(s.data.lsm6dsl.accel.x, 1000 * 0.061 * 9.81 / 1000, 1e-4);
+    CHECK(sensor_engine_pop(&engine, &s));
+    CHECK_EQ(s.kind, SENSOR_LIS3MDL);
+    CHECK_NEAR(s.data.lis3mdl.x, -2000 * 0.14, 1e-3);
+    CHECK(!sensor_engine_pop(&engine, &s));
+
+    // the callback sees the same samples, in order
+    CHECK_EQ(delivered_count, 3);
+    CHECK_EQ(delivered[0].kind, SENSOR_LPS22HB);
+    CHECK_EQ(delivered[1].kind, SENSOR_LSM6DSL);
+    CHECK_EQ(delivered[2].kind, SENSOR_LIS3MDL);
+}
+
+static void test_queue_limits(void) {
+    setup(NULL);
+    LPS22HBDevice other = lps22hb_get_default_device(&hi2c1);
+    CHECK(!sensor_engine_request(&engine, lps22hb_sensor(&other)));
+    for (int i = 0; i < SENSOR_ENGINE_QUEUE_LEN; i++) {
+        CHECK(sensor_engine_request(&engine, lsm6dsl_sensor(&lsm)));
+    }
+    CHECK(!sensor_engine_request(&engine, lsm6dsl_sensor(&lsm)));
+    CHECK(stub_i2c_complete(false));
+    CHECK(sensor_engine_request(&engine, lsm6dsl_sensor(&lsm)));
+    while (stub_i2c_complete(false)) {
+    }
+    CHECK_EQ(stub_i2c_stats().transactions, SENSOR_ENGINE_QUEUE_LEN + 1);
+    CHECK(sensor_engine_is_idle(&engine));
+}
+
+static void test_ring_overflow(void) {
+    setup(on_sample);
+    for (int i = 0; i < 40; i++) {
+        CHECK(sensor_engine_request(&engine, lis3mdl_sensor(&lis)));
+        CHECK(stub_i2c_complete(false));
+    }
+    // one slot of the ring tells full from empty
+    CHECK_EQ(engine.dropped_samples, 40 - (SENSOR_ENGINE_RING_LEN - 1));
+    CHECK_EQ(delivered_count, 40);
+    SensorSample s;
+    size_t popped = 0;
+    while (sensor_engine_pop(&engine, &s)) {
+        popped++;
+    }
+    CHECK_EQ(popped, SENSOR_ENGINE_RING_LEN - 1);
+}
+
+static void test_bus_errors(void) {
+    setup(on_sample);
+    CHECK(sensor_engine_request(&engine, lps22hb_sensor(&lps)));
+    CHECK(sensor_engine_request(&engine, lis3mdl_sensor(&lis)));
+    // the failed transfer is dropped and the next one starts
+    CHECK(stub_i2c_complete(true));
+    CHECK_EQ(engine.bus_errors, 1);
+    CHECK(bus_busy());
+    CHECK(stub_i2c_complete(false));
+    CHECK_EQ(delivered_count, 1);
+    CHECK_EQ(delivered[0].kind, SENSOR_LIS3MDL);
+
+    // a transfer that can't start is dropped too, instead of being retried forever
+    stub_i2c_fail_next(1);
+    CHECK(sensor_engine_request(&engine, lps22hb_sensor(&lps)));
+    CHECK_EQ(engine.bus_errors, 2);
+    CHECK(sensor_engine_is_idle(&engine));
+    CHECK(!bus_busy());
+}
+
+int main(void) {
+    RUN(test_back_to_back);
+    RUN(test_queue_limits);
+    RUN(test_ring_overflow);
+    RUN(test_bus_errors);
+    TEST_END();
+}
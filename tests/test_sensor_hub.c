@@ -0,0 +1,149 @@
+#include "hal_stub.h"
+#include "sensor_hub.h"
+#include "sensors.h"
+#include "test.h"
+
+// the hub runs on a fake microsecond clock set by the test, the status registers tell whether an output is new
+
+static I2C_HandleTypeDef hi2c2 = {.Instance = 2};
+
+static uint32_t now_us;
+static uint32_t fake_clock(void) { return now_us; }
+
+static SensorHub hub;
+static LSM6DSLDevice lsm;
+static LIS3MDLDevice lis;
+static LPS22HBDevice lps;
+
+// every output is new
+static void set_status(bool lsm_new, bool lis_new, bool lps_new) {
+    stub_i2c_regs(0xd4)[0x1e] = lsm_new ? 0x03 : 0x00;
+    stub_i2c_regs(0x3c)[0x27] = lis_new ? 0x08 : 0x00;
+    stub_i2c_regs(0xba)[0x27] = lps_new ? 0x03 : 0x00;
+}
+
+static void setup(uint32_t start_us) {
+    stub_reset();
+    now_us = start_us;
+    lsm = lsm6dsl_get_default_device(&hi2c2);
+    lsm6dsl_init(&lsm, XL_104_HZ, XL_2_G, G_104_HZ, G_250_DPS);
+    lis = lis3mdl_get_default_device(&hi2c2);
+    lis3mdl_init(&lis, LIS_80_HZ, LIS_4_GAUSS);
+    lps = lps22hb_get_default_device(&hi2c2);
+    lps22hb_init(&lps, LPS_HZ_25);
+    set_status(true, true, true);
+    sensor_hub_init(&hub, fake_clock, 400000);
+}
+
+static SensorKind pop_kind(void) {
+    SensorSample s;
+    CHECK(sensor_hub_pop(&hub, &s));
+    return s.kind;
+}
+
+static void test_edf_order(void) {
+    setup(0);
+    // added with the longest period first, read with the earliest deadline first
+    CHECK(sensor_hub_add(&hub, lps22hb_sensor(&lps)));
+    CHECK(sensor_hub_add(&hub, lis3mdl_sensor(&lis)));
+    CHECK(sensor_hub_add(&hub, lsm6dsl_sensor(&lsm)));
+    CHECK_EQ(sensor_hub_poll(&hub), 3);
+    CHECK_EQ(pop_kind(), SENSOR_LSM6DSL); // 9615 us
+    CHECK_EQ(pop_kind(), SENSOR_LIS3MDL); // 12500 us
+    CHECK_EQ(pop_kind(), SENSOR_LPS22HB); // 40000 us
+    SensorSample s;
+    CHECK(!sensor_hub_pop(&hub, &s));
+
+    // nothing is due before the next release
+    now_us = 9000;
+    CHECK_EQ(sensor_hub_poll(&hub), 0);
+    now_us = 9615;
+    CHECK_EQ(sensor_hub_poll(&hub), 1);
+    CHECK_EQ(pop_kind(), SENSOR_LSM6DSL);
+
+    // LIS3MDL released at 12500 has the deadline 25000, before the LSM6DSL one (19230 + 9615)
+    now_us = 19300;
+    CHECK_EQ(sensor_hub_poll(&hub), 2);
+    CHECK_EQ(pop_kind(), SENSOR_LIS3MDL);
+    CHECK_EQ(pop_kind(), SENSOR_LSM6DSL);
+    CHECK_EQ(sensor_hub_missed_deadlines(&hub), 0);
+    CHECK_EQ(hub.tasks[2].samples, 3);
+}
+
+static void test_missed_deadlines(void) {
+    setup(1000);
+    CHECK(sensor_hub_add(&hub, lsm6dsl_sensor(&lsm)));
+    CHECK_EQ(sensor_hub_poll(&hub), 1);
+
+    // 4 more output updates happened, only the last one can be read
+    now_us = 1000 + 4 * 9615 + 100;
+    CHECK_EQ(sensor_hub_poll(&hub), 1);
+    CHECK_EQ(sensor_hub_missed_deadlines(&hub), 3);
+    CHECK_EQ(hub.tasks[0].release_us, 1000 + 5 * 9615);
+    CHECK_EQ(hub.tasks[0].samples, 2);
+}
+
+static void test_no_new_data(void) {
+    setup(0);
+    CHECK(sensor_hub_add(&hub, lsm6dsl_sensor(&lsm)));
+    CHECK(sensor_hub_add(&hub, lis3mdl_sensor(&lis)));
+    CHECK_EQ(sensor_hub_poll(&hub), 2);
+
+    // the LSM6DSL clock is a little slow, its output isn't updated when the hub expects it
+    now_us = 12500;
+    set_status(false, true, true);
+    stub_i2c_reset_stats();
+    CHECK_EQ(sensor_hub_poll(&hub), 1);
+    CHECK_EQ(pop_kind(), SENSOR_LSM6DSL);
+    CHECK_EQ(pop_kind(), SENSOR_LIS3MDL);
+    CHECK_EQ(pop_kind(), SENSOR_LIS3MDL);
+    // one status read each, one sample read
+    CHECK_EQ(stub_i2c_stats().transactions, 3);
+    CHECK_EQ(lsm.drdy.stale_reads, 1);
+    CHECK_EQ(hub.tasks[0].release_us, 9615);
+
+    // read as soon as it's there, without counting a miss
+    now_us = 12600;
+    set_status(true, false, false);
+    CHECK_EQ(sensor_hub_poll(&hub), 1);
+    CHECK_EQ(pop_kind(), SENSOR_LSM6DSL);
+    CHECK_EQ(sensor_hub_missed_deadlines(&hub), 0);
+
+    // a failed read is tried again at the next poll
+    now_us = 19300;
+    set_status(true, true, true);
+    stub_i2c_fail_next(1);
+    CHECK_EQ(sensor_hub_poll(&hub), 0);
+    CHECK_EQ(hub.tasks[0].bus_errors, 1);
+    CHECK_EQ(sensor_hub_poll(&hub), 1);
+}
+
+static void test_clock_wrap(void) {
+    // 20 ms before the 32 bits clock wraps
+    setup(0xffffffffu - 20000);
+    CHECK(sensor_hub_add(&hub, lsm6dsl_sensor(&lsm)));
+    uint32_t start = now_us;
+    uint32_t reads = 0;
+    // 100 ms in 1 ms steps
+    for (int i = 0; i <= 100; i++) {
+        now_us = start + (uint32_t) i * 1000;
+        reads += sensor_hub_poll(&hub);
+    }
+    // one read per period across the wrap, nothing missed or read twice
+    CHECK_EQ(reads, 100000 / 9615 + 1);
+    CHECK_EQ(sensor_hub_missed_deadlines(&hub), 0);
+    CHECK_EQ(hub.elapsed_us, 100000);
+    // every read is the status and the 14 bytes burst
+    CHECK_EQ(hub.busy_us, (uint64_t) reads * hub.tasks[0].transfer_us);
+    CHECK_NEAR(sensor_hub_bus_utilisation(&hub), (double) reads * hub.tasks[0].transfer_us / 100000, 1e-6);
+    CHECK(sensor_hub_bus_utilisation(&hub) < 1);
+    CHECK_NEAR(sensor_hub_estimated_load(&hub), (double) hub.tasks[0].transfer_us / 9615, 1e-6);
+}
+
+int main(void) {
+    RUN(test_edf_order);
+    RUN(test_missed_deadlines);
+    RUN(test_no_new_data);
+    RUN(test_clock_wrap);
+    TEST_END();
+}
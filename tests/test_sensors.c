@@ -0,0 +1,216 @@
+#include "hal_stub.h"
+#include "sensors.h"
+#include "test.h"
+
+// register bursts: every sample must be a single I2C transaction, without reading the CTRL registers
+
+static I2C_HandleTypeDef hi2c2 = {.Instance = 2};
+
+static void put_i16(uint16_t addr, uint8_t reg, int16_t v) {
+    uint8_t *regs = stub_i2c_regs(addr);
+    regs[reg] = (uint16_t) v & 0xff;
+    regs[reg + 1] = (uint16_t) v >> 8;
+}
+
+static void put_hts221_calibration(void) {
+    uint8_t *regs = stub_i2c_regs(0xbe);
+    regs[0x30] = 60; // H0_rH_x2, 30 %rH
+    regs[0x31] = 140; // H1_rH_x2, 70 %rH
+    regs[0x32] = 80; // T0_degC_x8, 10 degrees
+    regs[0x33] = 240; // T1_degC_x8, 30 degrees
+    regs[0x35] = 0;
+    put_i16(0xbe, 0x36, 1000); // H0_T0_OUT
+    put_i16(0xbe, 0x3a, 5000); // H1_T0_OUT
+    put_i16(0xbe, 0x3c, 300); // T0_OUT
+    put_i16(0xbe, 0x3e, 700); // T1_OUT
+}
+
+static void test_accel_gyro_single_burst(void) {
+    stub_reset();
+    LSM6DSLDevice dev = lsm6dsl_get_default_device(&hi2c2);
+    lsm6dsl_init(&dev, XL_833_HZ, XL_2_G, G_833_HZ, G_250_DPS);
+    put_i16(0xd4, 0x22, 100);
+    put_i16(0xd4, 0x24, -200);
+    put_i16(0xd4, 0x26, 300);
+    put_i16(0xd4, 0x28, 1000);
+    put_i16(0xd4, 0x2a, -1000);
+    put_i16(0xd4, 0x2c, 16384);
+
+    stub_i2c_reset_stats();
+    Vec3 accel, gyro;
+    lsm6dsl_read_accel_gyro(&dev, &accel, &gyro);
+    CHECK_EQ(stub_i2c_stats().transactions, 1);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 12);
+    CHECK_NEAR(gyro.x, 0.875, 1e-4);
+    CHECK_NEAR(gyro.y, -1.75, 1e-4);
+    CHECK_NEAR(gyro.z, 2.625, 1e-4);
+    CHECK_NEAR(accel.x, 1000 * 0.061 * 9.81 / 1000, 1e-4);
+    CHECK_NEAR(accel.y, -1000 * 0.061 * 9.81 / 1000, 1e-4);
+    CHECK_NEAR(accel.z, 16384 * 0.061 * 9.81 / 1000, 1e-3);
+
+    stub_i2c_reset_stats();
+    Vec3 a = lsm6dsl_read_accel(&dev);
+    CHECK_EQ(stub_i2c_stats().transactions, 1);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 6);
+    CHECK_NEAR(a.x, accel.x, 1e-6);
+}
+
+static void test_imu_sample_single_burst(void) {
+    stub_reset();
+    LSM6DSLDevice dev = lsm6dsl_get_default_device(&hi2c2);
+    lsm6dsl_init(&dev, XL_104_HZ, XL_4_G, G_104_HZ, G_500_DPS);
+    put_i16(0xd4, 0x20, 512); // OUT_TEMP, 25 + 512 / 256 degrees
+    put_i16(0xd4, 0x22, 10);
+    put_i16(0xd4, 0x28, -20);
+
+    stub_i2c_reset_stats();
+    LSM6DSLSample s = lsm6dsl_read_imu(&dev);
+    CHECK_EQ(stub_i2c_stats().transactions, 1);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 14);
+    CHECK_NEAR(s.temp, 27.0, 1e-4);
+    CHECK_NEAR(s.gyro.x, 10 * 17.5 / 1000, 1e-5);
+    CHECK_NEAR(s.accel.x, -20 * 0.122 * 9.81 / 1000, 1e-5);
+    CHECK_EQ(s.timestamp, 0);
+}
+
+static uint32_t fifo_out_reads;
+
+static uint8_t count_fifo_out(uint16_t addr, uint8_t start, uint16_t offset) {
+    uint8_t reg = (uint8_t) (start + offset);
+    if (reg == 0x3e || reg == 0x3f) {
+        fifo_out_reads++;
+    }
+    return stub_i2c_regs(addr)[reg];
+}
+
+static void test_imu_sample_with_timestamp(void) {
+    stub_reset();
+    LSM6DSLDevice dev = lsm6dsl_get_default_device(&hi2c2);
+    lsm6dsl_init(&dev, XL_104_HZ, XL_4_G, G_104_HZ, G_500_DPS);
+    lsm6dsl_enable_timestamp(&dev);
+    put_i16(0xd4, 0x22, 10);
+    put_i16(0xd4, 0x28, -20);
+    uint8_t *regs = stub_i2c_regs(0xd4);
+    regs[0x40] = 0x56; // TIMESTAMP0..2
+    regs[0x41] = 0x34;
+    regs[0x42] = 0x12;
+    stub_i2c_set_read_hook(0xd4, count_fifo_out);
+
+    // the timestamp comes from the same burst as the data, FIFO_DATA_OUT is crossed while the FIFO is empty
+    stub_i2c_reset_stats();
+    LSM6DSLSample s = lsm6dsl_read_imu(&dev);
+    CHECK_EQ(stub_i2c_stats().transactions, 1);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 0x43 - 0x20);
+    CHECK_EQ(s.timestamp, 0x123456);
+    CHECK_NEAR(s.gyro.x, 10 * 17.5 / 1000, 1e-5);
+    CHECK_NEAR(s.accel.x, -20 * 0.122 * 9.81 / 1000, 1e-5);
+
+    // with the FIFO enabled the burst would take data from it, the timestamp is read on its own
+    LSM6DSLFifoConfig conf = {.mode = FIFO_CONTINUOUS, .update_rate = XL_104_HZ, .decimation = FIFO_DEC_NONE,
+                              .watermark = 10};
+    lsm6dsl_fifo_init(&dev, &conf);
+    fifo_out_reads = 0;
+    stub_i2c_reset_stats();
+    s = lsm6dsl_read_imu(&dev);
+    CHECK_EQ(stub_i2c_stats().transactions, 2);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 14 + 3);
+    CHECK_EQ(s.timestamp, 0x123456);
+    CHECK_EQ(fifo_out_reads, 0);
+
+    conf.mode = FIFO_BYPASS;
+    lsm6dsl_fifo_init(&dev, &conf);
+    stub_i2c_reset_stats();
+    lsm6dsl_read_imu(&dev);
+    CHECK_EQ(stub_i2c_stats().transactions, 1);
+    stub_i2c_set_read_hook(0xd4, NULL);
+}
+
+static void test_mag_single_burst(void) {
+    stub_reset();
+    LIS3MDLDevice dev = lis3mdl_get_default_device(&hi2c2);
+    lis3mdl_init(&dev, LIS_80_HZ, LIS_8_GAUSS);
+    put_i16(0x3c, 0x28, 1000);
+    put_i16(0x3c, 0x2a, -500);
+    put_i16(0x3c, 0x2c, 7);
+
+    stub_i2c_reset_stats();
+    Vec3 mag = lis3mdl_read_mag(&dev);
+    CHECK_EQ(stub_i2c_stats().transactions, 1);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 6);
+    CHECK_NEAR(mag.x, 290, 1e-3);
+    CHECK_NEAR(mag.y, -145, 1e-3);
+    CHECK_NEAR(mag.z, 2.03, 1e-4);
+}
+
+static void test_pressure_and_temperature(void) {
+    stub_reset();
+    LPS22HBDevice dev = lps22hb_get_default_device(&hi2c2);
+    lps22hb_init(&dev, LPS_HZ_25);
+    uint8_t *regs = stub_i2c_regs(0xba);
+    int32_t press = 1013 * 4096 + 2048; // 1013.5 hPa
+    regs[0x28] = press & 0xff;
+    regs[0x29] = (press >> 8) & 0xff;
+    regs[0x2a] = (press >> 16) & 0xff;
+    put_i16(0xba, 0x2b, 2345);
+
+    stub_i2c_reset_stats();
+    CHECK_NEAR(lps22hb_read_press(&dev), 1013.5, 1e-3);
+    CHECK_EQ(stub_i2c_stats().transactions, 1);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 3);
+    CHECK_NEAR(lps22hb_read_temp(&dev), 23.45, 1e-4);
+    CHECK_EQ(stub_i2c_stats().transactions, 2);
+}
+
+static void test_humidity_and_temperature(void) {
+    stub_reset();
+    put_hts221_calibration();
+    HTS221Device dev = hts221_get_default_device(&hi2c2);
+    stub_i2c_reset_stats();
+    hts221_init(&dev, HTS_HZ_7);
+    // CTRL1 and the whole calibration block
+    CHECK_EQ(stub_i2c_stats().transactions, 2);
+    put_i16(0xbe, 0x28, 3000); // H_OUT
+    put_i16(0xbe, 0x2a, 500); // T_OUT
+
+    stub_i2c_reset_stats();
+    float hum, temp;
+    hts221_read_hum_temp(&dev, &hum, &temp);
+    CHECK_EQ(stub_i2c_stats().transactions, 1);
+    CHECK_EQ(stub_i2c_stats().bytes_read, 4);
+    CHECK_NEAR(hum, 50.0, 1e-3);
+    CHECK_NEAR(temp, 20.0, 1e-3);
+}
+
+static void test_generic_samples_are_one_burst(void) {
+    stub_reset();
+    put_hts221_calibration();
+    LPS22HBDevice lps = lps22hb_get_default_device(&hi2c2);
+    HTS221Device hts = hts221_get_default_device(&hi2c2);
+    LSM6DSLDevice lsm = lsm6dsl_get_default_device(&hi2c2);
+    LIS3MDLDevice lis = lis3mdl_get_default_device(&hi2c2);
+    lps22hb_init(&lps, LPS_HZ_1);
+    hts221_init(&hts, HTS_HZ_1);
+    lsm6dsl_init(&lsm, XL_104_HZ, XL_2_G, G_104_HZ, G_250_DPS);
+    lis3mdl_init(&lis, LIS_10_HZ, LIS_4_GAUSS);
+
+    const Sensor sensors[] = {lps22hb_sensor(&lps), hts221_sensor(&hts), lsm6dsl_sensor(&lsm), lis3mdl_sensor(&lis)};
+    const uint32_t lens[] = {5, 4, 14, 6};
+    for (size_t i = 0; i < 4; i++) {
+        stub_i2c_reset_stats();
+        SensorSample s = sensor_read_sample(sensors[i]);
+        CHECK_EQ(s.kind, sensors[i].kind);
+        CHECK_EQ(stub_i2c_stats().transactions, 1);
+        CHECK_EQ(stub_i2c_stats().bytes_read, lens[i]);
+    }
+}
+
+int main(void) {
+    RUN(test_accel_gyro_single_burst);
+    RUN(test_imu_sample_single_burst);
+    RUN(test_imu_sample_with_timestamp);
+    RUN(test_mag_single_burst);
+    RUN(test_pressure_and_temperature);
+    RUN(test_humidity_and_temperature);
+    RUN(test_generic_samples_are_one_burst);
+    TEST_END();
+}
@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "ism43362_pool.h"
+#include "module_sim.h"
+#include "test.h"
+
+// R0 data goes straight into the caller's buffer, what doesn't fit is stashed in a pool buffer for the next read
+
+static uint8_t pattern[ISM43362_MAX_PAYLOAD];
+
+static void setup(Socket s) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = s;
+    CHECK_EQ(ism43362_start_wifi_client(&client), Ok);
+    ism43362_pool_reset_usage();
+    for (size_t i = 0; i < sizeof(pattern); i++) {
+        pattern[i] = (uint8_t) (i * 7 + 3);
+    }
+}
+
+static void test_into_caller_buffer(void) {
+    setup(SOCKET_1);
+    // odd and even lengths, up to a full packet
+    const size_t lens[] = {1, 2, 31, 600, ISM43362_MAX_PAYLOAD};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        static uint8_t buff[ISM43362_MAX_PAYLOAD + 16];
+        memset(buff, 0, sizeof(buff));
+        sim_push_rx(1, pattern, lens[i]);
+        size_t len = 0;
+        CHECK_EQ(ism43362_read(buff, sizeof(buff), &len), Ok);
+        CHECK_EQ(len, lens[i]);
+        CHECK(memcmp(buff, pattern, lens[i]) == 0);
+    }
+    // a buffer that holds the whole response needs no stash
+    CHECK_EQ(ism43362_pool_get_usage(ISM_POOL_PAYLOAD).high_water, 0);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+}
+
+static void test_stash(void) {
+    setup(SOCKET_2);
+    sim_push_rx(2, pattern, 101);
+    uint8_t buff[30];
+    size_t len = 0, total = 0;
+    uint8_t received[101];
+    // the first bytes, PacketBufferTooSmall tells there's more
+    CHECK_EQ(ism43362_read(buff, sizeof(buff), &len), PacketBufferTooSmall);
+    CHECK_EQ(len, sizeof(buff));
+    memcpy(received, buff, len);
+    total += len;
+    CHECK_EQ(ism43362_pool_get_usage(ISM_POOL_PAYLOAD).in_use, 1);
+
+    // the rest comes from the stash, without asking the module
+    for (int i = 0; i < 2; i++) {
+        CHECK_EQ(ism43362_read(buff, sizeof(buff), &len), PacketBufferTooSmall);
+        CHECK_EQ(len, sizeof(buff));
+        memcpy(received + total, buff, len);
+        total += len;
+    }
+    CHECK_EQ(ism43362_read(buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(len, 11);
+    memcpy(received + total, buff, len);
+    total += len;
+    CHECK_EQ(total, 101);
+    CHECK(memcmp(received, pattern, sizeof(received)) == 0);
+    CHECK_EQ(sim_count("R0"), 1);
+    // given back once empty
+    CHECK_EQ(ism43362_pool_get_usage(ISM_POOL_PAYLOAD).in_use, 0);
+
+    // the stash belongs to its socket, another socket reads from the module
+    sim_push_rx(2, pattern, 50);
+    CHECK_EQ(ism43362_socket_read(SOCKET_2, buff, sizeof(buff), &len), PacketBufferTooSmall);
+    sim_push_rx(0, "other", 5);
+    CHECK_EQ(ism43362_socket_read(SOCKET_0, buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(len, 5);
+    CHECK(memcmp(buff, "other", 5) == 0);
+    CHECK_EQ(ism43362_socket_read(SOCKET_2, buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(len, 20);
+    CHECK(memcmp(buff, pattern + 30, 20) == 0);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+}
+
+static void test_no_buffer(void) {
+    setup(SOCKET_3);
+    uint8_t *buffs[ISM43362_POOL_PAYLOAD_COUNT];
+    for (size_t i = 0; i < ISM43362_POOL_PAYLOAD_COUNT; i++) {
+        buffs[i] = ism43362_pool_borrow(ISM_POOL_PAYLOAD);
+    }
+    sim_push_rx(3, pattern, 80);
+    uint8_t buff[30];
+    size_t len = 1;
+    // no stash for what wouldn't fit, the data stays in the module
+    CHECK_EQ(ism43362_read(buff, sizeof(buff), &len), NoBuffer);
+    CHECK_EQ(len, 0);
+    CHECK_EQ(sim_count("R0"), 0);
+
+    // a buffer large enough for any response doesn't need one
+    static uint8_t big[ISM43362_MAX_PAYLOAD + 16];
+    CHECK_EQ(ism43362_read(big, sizeof(big), &len), Ok);
+    CHECK_EQ(len, 80);
+    CHECK(memcmp(big, pattern, 80) == 0);
+    for (size_t i = 0; i < ISM43362_POOL_PAYLOAD_COUNT; i++) {
+        ism43362_pool_return(ISM_POOL_PAYLOAD, buffs[i]);
+    }
+}
+
+static void test_reset_drops_stash(void) {
+    setup(SOCKET_1);
+    sim_push_rx(1, pattern, 200);
+    uint8_t buff[30];
+    size_t len;
+    CHECK_EQ(ism43362_read(buff, sizeof(buff), &len), PacketBufferTooSmall);
+    CHECK_EQ(ism43362_pool_get_usage(ISM_POOL_PAYLOAD).in_use, 1);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    CHECK_EQ(ism43362_pool_get_usage(ISM_POOL_PAYLOAD).in_use, 0);
+
+    // the next read asks the module again
+    sim_push_rx(1, "new", 3);
+    CHECK_EQ(ism43362_socket_read(SOCKET_1, buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(len, 3);
+    CHECK(memcmp(buff, "new", 3) == 0);
+}
+
+int main(void) {
+    RUN(test_into_caller_buffer);
+    RUN(test_stash);
+    RUN(test_no_buffer);
+    RUN(test_reset_drops_stash);
+    TEST_END();
+}
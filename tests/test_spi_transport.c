@@ -0,0 +1,133 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "module_sim.h"
+#include "test.h"
+
+// 1460 bytes sends and reads through the simulated module, built with and without ISM43362_SPI_DMA: the data must
+// arrive intact, and the throughput in simulated time and the HAL SPI calls per command are reported. The module
+// answers at once, so the numbers are the cost of the transport alone.
+
+#ifdef ISM43362_SPI_DMA
+#define TRANSPORT "dma"
+#else
+#define TRANSPORT "blocking"
+#endif
+
+#define PAYLOAD 1460
+#define ROUNDS 20
+
+static uint8_t data[PAYLOAD + 1];
+static uint8_t buff[PAYLOAD + 64];
+
+static void setup(void) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    for (size_t i = 0; i < sizeof(data); i++) {
+        // no 0x15, trailing pad bytes are trimmed from the responses
+        data[i] = (uint8_t) (i * 7 + 1) == 0x15 ? 0x16 : (uint8_t) (i * 7 + 1);
+    }
+    // the socket selection isn't part of the measure
+    CHECK_EQ(ism43362_set_socket(SOCKET_1), Ok);
+    stub_spi_reset_stats();
+    ism43362_reset_stats();
+}
+
+static void report(const char *what, uint64_t ns, StubSpiStats st) {
+    double seconds = ns / 1e9;
+    printf("%s %s: %.0f B/s, %.1f HAL SPI calls per command, %.1f us per %d bytes\n", TRANSPORT, what,
+           ROUNDS * PAYLOAD / seconds, (double) st.calls / ROUNDS, ns / 1e3 / ROUNDS, PAYLOAD);
+}
+
+static void test_send(void) {
+    setup();
+    uint64_t start = stub_time_ns();
+    for (int i = 0; i < ROUNDS; i++) {
+        CHECK_EQ(ism43362_socket_send(SOCKET_1, data, PAYLOAD), Ok);
+        uint8_t out[PAYLOAD];
+        CHECK_EQ(sim_take_tx(1, out, sizeof(out)), PAYLOAD);
+        CHECK(memcmp(out, data, PAYLOAD) == 0);
+    }
+    uint64_t ns = stub_time_ns() - start;
+    StubSpiStats st = stub_spi_stats();
+    report("send", ns, st);
+    CHECK_EQ(st.protocol_errors, 0);
+    CHECK_EQ(sim_count("S3"), ROUNDS);
+    CHECK_EQ(sim_count("P0"), 1);
+    CHECK_EQ(ism43362_get_stats().spi_calls, st.calls);
+#ifdef ISM43362_SPI_DMA
+    // the header, the payload in a single transfer, the trailer and the response in one chunk
+    CHECK(st.calls <= ROUNDS * 4);
+#else
+    // the response is read a word at a time
+    CHECK(st.calls <= ROUNDS * (3 + sizeof("\r\n1460\r\nOK\r\n> ") / 2));
+#endif
+}
+
+static void test_read(void) {
+    setup();
+    uint64_t start = stub_time_ns();
+    for (int i = 0; i < ROUNDS; i++) {
+        sim_push_rx(1, data, PAYLOAD);
+        size_t len = 0;
+        CHECK_EQ(ism43362_socket_read(SOCKET_1, buff, sizeof(buff), &len), Ok);
+        CHECK_EQ(len, PAYLOAD);
+        CHECK(memcmp(buff, data, PAYLOAD) == 0);
+    }
+    uint64_t ns = stub_time_ns() - start;
+    StubSpiStats st = stub_spi_stats();
+    report("read", ns, st);
+    CHECK_EQ(st.protocol_errors, 0);
+    CHECK_EQ(sim_count("R0"), ROUNDS);
+    CHECK_EQ(ism43362_get_stats().spi_calls, st.calls);
+#ifdef ISM43362_SPI_DMA
+    // the command, then the response in chunks of ISM43362_SPI_RX_CHUNK_WORDS
+    CHECK(st.calls <= ROUNDS * (4 + (PAYLOAD + 16) / 128 + 2));
+#endif
+}
+
+static void test_odd_and_unaligned(void) {
+    setup();
+    // an odd length from an odd address, the DMA transport falls back to the blocking functions for it
+    CHECK_EQ(ism43362_socket_send(SOCKET_1, data + 1, PAYLOAD - 1), Ok);
+    uint8_t out[PAYLOAD];
+    CHECK_EQ(sim_take_tx(1, out, sizeof(out)), PAYLOAD - 1);
+    CHECK(memcmp(out, data + 1, PAYLOAD - 1) == 0);
+
+    sim_push_rx(1, data, PAYLOAD - 1);
+    size_t len = 0;
+    CHECK_EQ(ism43362_socket_read(SOCKET_1, buff + 1, sizeof(buff) - 1, &len), Ok);
+    CHECK_EQ(len, PAYLOAD - 1);
+    CHECK(memcmp(buff + 1, data, PAYLOAD - 1) == 0);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+}
+
+#ifdef ISM43362_SPI_DMA
+static void test_dma_stall(void) {
+    setup();
+    // a DMA transfer that never completes fails the command instead of hanging
+    stub_spi_stall_dma(1);
+    uint64_t start = stub_time_ns();
+    CHECK_EQ(ism43362_socket_send(SOCKET_1, data, PAYLOAD), Timeout);
+    CHECK(stub_time_ns() - start < 10 * 1000000ull);
+    CHECK_EQ(ism43362_get_selected_socket(), -1);
+
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    CHECK_EQ(ism43362_socket_send(SOCKET_1, data, PAYLOAD), Ok);
+    uint8_t out[PAYLOAD];
+    CHECK_EQ(sim_take_tx(1, out, sizeof(out)), PAYLOAD);
+    CHECK(memcmp(out, data, PAYLOAD) == 0);
+}
+#endif
+
+int main(void) {
+    RUN(test_send);
+    RUN(test_read);
+    RUN(test_odd_and_unaligned);
+#ifdef ISM43362_SPI_DMA
+    RUN(test_dma_stall);
+#endif
+    TEST_END();
+}
@@ -0,0 +1,157 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "ism43362_server.h"
+#include "module_sim.h"
+#include "test.h"
+
+// the connections are served one at a time in accept order, the events report every accept and close
+
+#define MS 1000000ULL
+
+static TcpServerEvent events[16];
+static size_t event_count;
+
+static void on_event(const TcpServerEvent *ev, void *ctx) {
+    (void) ctx;
+    if (event_count < 16) {
+        events[event_count] = *ev;
+    }
+    event_count++;
+}
+
+static void accept_from(int port) {
+    char line[64];
+    snprintf(line, sizeof(line), "[SOMA][TCP SVR] Accepted 10.0.0.9:%d", port);
+    sim_push_message(line);
+}
+
+static void setup(ISM43362TcpServer *srv, uint8_t backlogs) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    event_count = 0;
+    WifiTcpServerConfig conf = ism43362_get_default_tcp_server_config();
+    conf.base_conf.s = SOCKET_1;
+    conf.listen_backlogs = backlogs;
+    CHECK_EQ(ism43362_tcp_server_init(srv, &conf, on_event, NULL), Ok);
+    CHECK_EQ(sim_socket_param(1, "P8"), backlogs);
+}
+
+static void test_accept_and_close(void) {
+    static ISM43362TcpServer srv;
+    setup(&srv, 2);
+    accept_from(40000);
+    accept_from(40001);
+    accept_from(40002);
+    CHECK_EQ(ism43362_tcp_server_process(&srv), Ok);
+    CHECK_EQ(event_count, 2);
+    CHECK_EQ(events[0].type, TCP_SERVER_ACCEPTED);
+    CHECK_EQ(events[0].remote.port, 40000);
+    CHECK_EQ(events[1].remote.port, 40001);
+    // beyond listen_backlogs
+    CHECK_EQ(srv.dropped_accepts, 1);
+    uint8_t first = events[0].id, second = events[1].id;
+    CHECK_EQ(ism43362_tcp_server_get(&srv, first)->state, TCP_CONN_ACTIVE);
+    CHECK_EQ(ism43362_tcp_server_get(&srv, second)->state, TCP_CONN_PENDING);
+
+    // only the active connection is served
+    CHECK_EQ(ism43362_tcp_server_write(&srv, second, (const uint8_t *) "x", 1), NotConnected);
+    CHECK_EQ(ism43362_tcp_server_close(&srv, second), Error);
+    CHECK_EQ(ism43362_tcp_server_write(&srv, first, (const uint8_t *) "reply", 5), Ok);
+    CHECK_EQ(sim_tx_len(1), 5);
+    sim_push_rx(1, "request", 7);
+    uint8_t buff[32];
+    size_t len;
+    CHECK_EQ(ism43362_tcp_server_read(&srv, first, buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(len, 7);
+
+    CHECK_EQ(ism43362_tcp_server_close(&srv, first), Ok);
+    CHECK_EQ(sim_count("P5"), 2);
+    CHECK_EQ(event_count, 3);
+    CHECK_EQ(events[2].type, TCP_SERVER_CLOSED);
+    CHECK_EQ(events[2].id, first);
+    CHECK(ism43362_tcp_server_get(&srv, first) == NULL);
+    CHECK_EQ(ism43362_tcp_server_get(&srv, second)->state, TCP_CONN_ACTIVE);
+
+    // a failed transfer means the peer has gone
+    sim_fail("R0", 1, false);
+    CHECK_EQ(ism43362_tcp_server_read(&srv, second, buff, sizeof(buff), &len), BadResponse);
+    CHECK_EQ(event_count, 4);
+    CHECK_EQ(events[3].type, TCP_SERVER_CLOSED);
+    CHECK_EQ(srv.count, 0);
+    CHECK_EQ(stub_spi_stats().protocol_errors, 0);
+}
+
+static void test_idle_probe(void) {
+    static ISM43362TcpServer srv;
+    setup(&srv, 1);
+    accept_from(40000);
+    CHECK_EQ(ism43362_tcp_server_process(&srv), Ok);
+    CHECK_EQ(event_count, 1);
+
+    // nothing is read before the connection has been idle for ISM43362_SERVER_PROBE_MS
+    uint32_t r0 = sim_count("R0");
+    stub_advance_ns((ISM43362_SERVER_PROBE_MS - 10) * MS);
+    CHECK_EQ(ism43362_tcp_server_process(&srv), Ok);
+    CHECK_EQ(sim_count("R0"), r0);
+    CHECK_EQ(sim_count("MR"), 2);
+
+    // the probe keeps the data it finds for the next read
+    sim_push_rx(1, "late", 4);
+    stub_advance_ns(20 * MS);
+    CHECK_EQ(ism43362_tcp_server_process(&srv), Ok);
+    CHECK_EQ(sim_count("R0"), r0 + 1);
+    CHECK_EQ(event_count, 1);
+    uint8_t buff[16];
+    size_t len;
+    CHECK_EQ(ism43362_tcp_server_read(&srv, events[0].id, buff, sizeof(buff), &len), Ok);
+    CHECK_EQ(len, 4);
+    CHECK_EQ(sim_count("R0"), r0 + 1);
+
+    // a closed peer is noticed by the probe
+    stub_advance_ns(ISM43362_SERVER_PROBE_MS * MS);
+    sim_fail("R0", 1, false);
+    CHECK_EQ(ism43362_tcp_server_process(&srv), BadResponse);
+    CHECK_EQ(event_count, 2);
+    CHECK_EQ(events[1].type, TCP_SERVER_CLOSED);
+    CHECK_EQ(srv.count, 0);
+}
+
+static void test_message_rate(void) {
+    static ISM43362TcpServer srv;
+    setup(&srv, 2);
+    // called in a tight loop, the messages are read every ISM43362_SERVER_MESSAGES_MS
+    for (int i = 0; i < 50; i++) {
+        CHECK_EQ(ism43362_tcp_server_process(&srv), Ok);
+        stub_advance_ns(ISM43362_SERVER_MESSAGES_MS / 10 * MS);
+    }
+    CHECK_EQ(sim_count("MR"), 5);
+
+    // an accept queued by another function is reported at once
+    accept_from(40000);
+    CHECK_EQ(ism43362_read_messages(), Ok);
+    uint32_t mr = sim_count("MR");
+    CHECK_EQ(ism43362_tcp_server_process(&srv), Ok);
+    CHECK_EQ(event_count, 1);
+    CHECK_EQ(sim_count("MR"), mr);
+
+    // the probe polls the socket with a single R0 and reads the messages itself
+    stub_advance_ns(ISM43362_SERVER_PROBE_MS * MS);
+    uint32_t commands = sim_total_commands();
+    CHECK_EQ(ism43362_tcp_server_process(&srv), Ok);
+    CHECK_EQ(sim_count("MR"), mr + 1);
+    stub_advance_ns(ISM43362_SERVER_PROBE_MS * MS);
+    CHECK_EQ(ism43362_tcp_server_process(&srv), Ok);
+    CHECK_EQ(sim_count("MR"), mr + 2);
+    // the timeout is lowered once, then R0 and MR
+    CHECK_EQ(sim_total_commands() - commands, 5);
+}
+
+int main(void) {
+    RUN(test_accept_and_close);
+    RUN(test_idle_probe);
+    RUN(test_message_rate);
+    TEST_END();
+}
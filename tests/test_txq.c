@@ -0,0 +1,135 @@
+#include <string.h>
+
+#include "hal_stub.h"
+#include "ism43362.h"
+#include "ism43362_txq.h"
+#include "module_sim.h"
+#include "test.h"
+
+// small records are packed in one S3, sent at the threshold, after the latency or on a flush, and nothing is lost
+// when the module accepts only part of a frame or the send fails
+
+#define MS 1000000ULL
+
+static ISM43362TxQueue q;
+
+static void setup(uint16_t threshold) {
+    stub_reset();
+    sim_init(ism43362_drdy_exti_callback);
+    CHECK_EQ(ism43362_reset_module(), Ok);
+    WifiClientConfig client = ism43362_get_default_client_config();
+    client.s = SOCKET_2;
+    CHECK_EQ(ism43362_start_wifi_client(&client), Ok);
+    ISM43362TxQueueConfig conf = ism43362_txq_get_default_config();
+    conf.threshold = threshold;
+    conf.max_latency_ms = 20;
+    ism43362_txq_init(&q, SOCKET_2, &conf);
+}
+
+static void check_tx(const char *expected) {
+    uint8_t out[2048];
+    size_t len = sim_take_tx(2, out, sizeof(out));
+    CHECK_EQ(len, strlen(expected));
+    CHECK(memcmp(out, expected, len) == 0);
+}
+
+static void write_str(const char *record) {
+    CHECK_EQ(ism43362_txq_write(&q, (const uint8_t *) record, strlen(record)), Ok);
+}
+
+static void test_latency(void) {
+    setup(1000);
+    uint32_t s3 = sim_count("S3");
+    write_str("a=1;");
+    stub_advance_ns(5 * MS);
+    write_str("b=22;");
+    write_str("c=333;");
+    stub_advance_ns(14 * MS);
+    CHECK_EQ(ism43362_txq_poll(&q), Ok);
+    CHECK_EQ(sim_count("S3"), s3);
+
+    // the oldest record has waited 20 ms
+    stub_advance_ns(1 * MS);
+    CHECK_EQ(ism43362_txq_poll(&q), Ok);
+    CHECK_EQ(sim_count("S3"), s3 + 1);
+    check_tx("a=1;b=22;c=333;");
+    CHECK_EQ(q.stats.frames, 1);
+    CHECK_EQ(q.stats.records, 3);
+    CHECK_EQ(q.stats.bytes, 15);
+    CHECK_EQ(q.stats.latency_ms, 20);
+
+    // an empty queue isn't sent
+    stub_advance_ns(100 * MS);
+    CHECK_EQ(ism43362_txq_poll(&q), Ok);
+    CHECK_EQ(ism43362_txq_flush(&q), Ok);
+    CHECK_EQ(sim_count("S3"), s3 + 1);
+}
+
+static void test_threshold(void) {
+    setup(10);
+    uint32_t s3 = sim_count("S3");
+    write_str("12345");
+    CHECK_EQ(sim_count("S3"), s3);
+    write_str("67890");
+    CHECK_EQ(sim_count("S3"), s3 + 1);
+    check_tx("1234567890");
+
+    // a record that doesn't fit the frame flushes the queue first
+    setup(ISM43362_MAX_PAYLOAD);
+    static uint8_t big[ISM43362_MAX_PAYLOAD - 2];
+    memset(big, 'x', sizeof(big));
+    write_str("abc");
+    s3 = sim_count("S3");
+    CHECK_EQ(ism43362_txq_write(&q, big, sizeof(big)), Ok);
+    CHECK_EQ(sim_count("S3"), s3 + 1);
+    check_tx("abc");
+    CHECK_EQ(q.len, sizeof(big));
+    CHECK_EQ(ism43362_txq_flush(&q), Ok);
+    CHECK_EQ(q.stats.frames, 2);
+    CHECK_EQ(q.stats.records, 2);
+    CHECK_EQ(q.stats.bytes, 3 + sizeof(big));
+
+    CHECK_EQ(ism43362_txq_write(&q, big, ISM43362_MAX_PAYLOAD + 1), Error);
+}
+
+static void test_partial_accept(void) {
+    setup(1000);
+    write_str("first;");
+    write_str("second;");
+    write_str("third;");
+    // the module takes 8 bytes per S3, the rest follows in order
+    sim_set_s3_accept(8);
+    uint32_t s3 = sim_count("S3");
+    CHECK_EQ(ism43362_txq_flush(&q), Ok);
+    CHECK_EQ(sim_count("S3"), s3 + 3);
+    check_tx("first;second;third;");
+    CHECK_EQ(q.len, 0);
+    CHECK_EQ(q.stats.frames, 1);
+    CHECK_EQ(q.stats.records, 3);
+    CHECK_EQ(q.stats.bytes, 19);
+}
+
+static void test_send_error(void) {
+    setup(1000);
+    write_str("kept;");
+    sim_fail("S3", 1, false);
+    CHECK(ism43362_txq_flush(&q) != Ok);
+    CHECK_EQ(q.stats.send_errors, 1);
+    CHECK_EQ(q.stats.frames, 0);
+    CHECK_EQ(q.len, 5);
+
+    write_str("next;");
+    CHECK_EQ(ism43362_txq_flush(&q), Ok);
+    check_tx("kept;next;");
+    CHECK_EQ(q.stats.frames, 1);
+    CHECK_EQ(q.stats.records, 2);
+    CHECK_EQ(q.stats.bytes, 10);
+}
+
+int main(void) {
+    RUN(test_latency);
+    RUN(test_threshold);
+    RUN(test_partial_accept);
+    RUN(test_send_error);
+    TEST_END();
+}